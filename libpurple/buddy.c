@@ -22,6 +22,7 @@
 
 #include "internal.h"
 #include "purplebuddypresence.h"
+#include "purpleprivate.h"
 #include "purpleprotocolclient.h"
 #include "util.h"
 
@@ -574,7 +575,6 @@ purple_buddy_get_presence(PurpleBuddy *buddy) {
 
 void
 purple_buddy_update_status(PurpleBuddy *buddy, PurpleStatus *old_status) {
-	PurpleBuddyList *blist = NULL;
 	PurpleBuddyPrivate *priv = NULL;
 	PurpleStatus *status = NULL;
 	gpointer handle = NULL;
@@ -585,7 +585,6 @@ purple_buddy_update_status(PurpleBuddy *buddy, PurpleStatus *old_status) {
 
 	priv = purple_buddy_get_instance_private(buddy);
 	status = purple_presence_get_active_status(priv->presence);
-	blist = purple_blist_get_default();
 	handle = purple_blist_get_handle();
 
 	purple_debug_info("blistnodetypes", "Updating buddy status for %s (%s)\n",
@@ -641,7 +640,7 @@ purple_buddy_update_status(PurpleBuddy *buddy, PurpleStatus *old_status) {
 	 */
 	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
 
-	purple_blist_update_node(blist, PURPLE_BLIST_NODE(buddy));
+	_purple_blist_update_node_deferred(PURPLE_BLIST_NODE(buddy));
 }
 
 PurpleMediaCaps
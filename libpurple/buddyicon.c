@@ -94,6 +94,24 @@ static GHashTable *icon_file_cache = NULL;
  */
 static GHashTable *pointer_icon_cache = NULL;
 
+/*
+ * Writes to and deletions from the on-disk cache are done by a single worker
+ * thread, so they never block the main loop but still happen in the order
+ * they were requested in.
+ */
+static GThreadPool *icon_io_pool = NULL;
+
+/*
+ * Icons handed to icon_io_pool which haven't hit the disk yet, so that we
+ * never try to read a file that is still being written.  Protected by
+ * pending_writes_lock as the worker removes entries when it is done.
+ *
+ * Key is the filename, as for icon_file_cache.
+ * Value is a GBytes of the icon data.
+ */
+static GHashTable *pending_writes = NULL;
+static GMutex pending_writes_lock;
+
 static char       *cache_dir     = NULL;
 
 /* "Should icons be cached to disk?" */
@@ -145,71 +163,187 @@ image_get_filename(PurpleImage *img)
 	return g_object_get_data(G_OBJECT(img), "purple-buddyicon-filename");
 }
 
+typedef struct {
+	gchar *dirname;
+	gchar *filename;
+	GBytes *contents;          /* NULL to delete the file.             */
+
+	/* What happened, logged from the main thread since the debug UI
+	 * isn't thread-safe. */
+	PurpleDebugLevel level;
+	gchar *message;
+} PurpleBuddyIconIoJob;
+
 static void
-purple_buddy_icon_data_cache(PurpleImage *img)
+icon_io_job_free(PurpleBuddyIconIoJob *job)
 {
-	const gchar *dirname, *filename;
-	gchar *path;
+	g_free(job->dirname);
+	g_free(job->filename);
+	if (job->contents != NULL)
+		g_bytes_unref(job->contents);
+	g_free(job->message);
+	g_free(job);
+}
 
-	g_return_if_fail(PURPLE_IS_IMAGE(img));
+static void G_GNUC_PRINTF(3, 4)
+icon_io_job_set_message(PurpleBuddyIconIoJob *job, PurpleDebugLevel level,
+                        const gchar *format, ...)
+{
+	va_list args;
 
-	if (!purple_buddy_icons_is_caching())
-		return;
+	g_free(job->message);
 
-	dirname = purple_buddy_icons_get_cache_dir();
-	filename = image_get_filename(img);
-	g_return_if_fail(filename != NULL);
+	va_start(args, format);
+	job->message = g_strdup_vprintf(format, args);
+	va_end(args);
+	job->level = level;
+}
 
-	if (!g_file_test(dirname, G_FILE_TEST_IS_DIR))
-	{
-		purple_debug_info("buddyicon", "creating icon cache directory");
+static gboolean
+icon_io_job_report(gpointer data)
+{
+	PurpleBuddyIconIoJob *job = data;
+
+	purple_debug(job->level, "buddyicon", "%s\n", job->message);
+	icon_io_job_free(job);
+
+	return G_SOURCE_REMOVE;
+}
 
-		if (g_mkdir(dirname, S_IRUSR | S_IWUSR | S_IXUSR) < 0)
+static void
+icon_io_write(PurpleBuddyIconIoJob *job, const gchar *path)
+{
+	GError *error = NULL;
+
+	/* The cache is content-addressed, so an existing file already has
+	 * exactly this data. */
+	if (g_file_test(path, G_FILE_TEST_EXISTS))
+		return;
+
+	if (!g_file_test(job->dirname, G_FILE_TEST_IS_DIR))
+	{
+		if (g_mkdir_with_parents(job->dirname, S_IRUSR | S_IWUSR | S_IXUSR) < 0)
 		{
-			purple_debug_error("buddyicon",
+			icon_io_job_set_message(job, PURPLE_DEBUG_ERROR,
 				"unable to create directory %s: %s",
-				dirname, g_strerror(errno));
+				job->dirname, g_strerror(errno));
 			return;
 		}
-	}
 
-	path = g_build_filename(dirname, filename, NULL);
-	if (!purple_image_save(img, path))
-		purple_debug_error("buddyicon", "failed to save icon %s", path);
+		icon_io_job_set_message(job, PURPLE_DEBUG_INFO,
+			"created icon cache directory %s", job->dirname);
+	}
 
-	g_free(path);
+	if (!g_file_set_contents(path, g_bytes_get_data(job->contents, NULL),
+			g_bytes_get_size(job->contents), &error))
+	{
+		icon_io_job_set_message(job, PURPLE_DEBUG_ERROR,
+			"failed to save icon %s: %s", path, error->message);
+		g_error_free(error);
+	}
 }
 
 static void
-purple_buddy_icon_data_uncache_file(const char *filename)
+icon_io_delete(PurpleBuddyIconIoJob *job, const gchar *path)
 {
-	const char *dirname;
-	char *path;
-
-	g_return_if_fail(filename != NULL);
-
-	/* It's possible that there are other references to this icon
-	 * cache file that are not currently loaded into memory. */
-	if (GPOINTER_TO_INT(g_hash_table_lookup(icon_file_cache, filename)))
-		return;
-
-	dirname = purple_buddy_icons_get_cache_dir();
-	path = g_build_filename(dirname, filename, NULL);
-
 	if (g_file_test(path, G_FILE_TEST_EXISTS))
 	{
 		if (g_unlink(path))
 		{
-			purple_debug_error("buddyicon", "Failed to delete %s: %s\n",
-			                   path, g_strerror(errno));
+			icon_io_job_set_message(job, PURPLE_DEBUG_ERROR,
+				"Failed to delete %s: %s", path, g_strerror(errno));
 		}
 		else
 		{
-			purple_debug_info("buddyicon", "Deleted cache file: %s\n", path);
+			icon_io_job_set_message(job, PURPLE_DEBUG_INFO,
+				"Deleted cache file: %s", path);
 		}
 	}
+}
+
+/* Runs in the icon_io_pool thread. */
+static void
+icon_io_thread(gpointer data, gpointer user_data)
+{
+	PurpleBuddyIconIoJob *job = data;
+	gchar *path = g_build_filename(job->dirname, job->filename, NULL);
+
+	if (job->contents != NULL)
+	{
+		icon_io_write(job, path);
+
+		g_mutex_lock(&pending_writes_lock);
+		/* A later write of the same file replaces the entry, that one
+		 * will remove it instead. */
+		if (g_hash_table_lookup(pending_writes, job->filename) == job->contents)
+			g_hash_table_remove(pending_writes, job->filename);
+		g_mutex_unlock(&pending_writes_lock);
+	}
+	else
+		icon_io_delete(job, path);
 
 	g_free(path);
+
+	if (job->message != NULL)
+		g_main_context_invoke(NULL, icon_io_job_report, job);
+	else
+		icon_io_job_free(job);
+}
+
+static void
+icon_io_push(const gchar *filename, GBytes *contents)
+{
+	PurpleBuddyIconIoJob *job;
+
+	g_return_if_fail(icon_io_pool != NULL);
+
+	job = g_new0(PurpleBuddyIconIoJob, 1);
+	job->dirname = g_strdup(purple_buddy_icons_get_cache_dir());
+	job->filename = g_strdup(filename);
+
+	if (contents != NULL)
+	{
+		job->contents = g_bytes_ref(contents);
+
+		g_mutex_lock(&pending_writes_lock);
+		g_hash_table_insert(pending_writes, g_strdup(filename),
+		                    g_bytes_ref(contents));
+		g_mutex_unlock(&pending_writes_lock);
+	}
+
+	g_thread_pool_push(icon_io_pool, job, NULL);
+}
+
+static void
+purple_buddy_icon_data_cache(PurpleImage *img)
+{
+	const gchar *filename;
+	GBytes *contents;
+
+	g_return_if_fail(PURPLE_IS_IMAGE(img));
+
+	if (!purple_buddy_icons_is_caching())
+		return;
+
+	filename = image_get_filename(img);
+	g_return_if_fail(filename != NULL);
+
+	contents = purple_image_get_contents(img);
+	icon_io_push(filename, contents);
+	g_bytes_unref(contents);
+}
+
+static void
+purple_buddy_icon_data_uncache_file(const char *filename)
+{
+	g_return_if_fail(filename != NULL);
+
+	/* It's possible that there are other references to this icon
+	 * cache file that are not currently loaded into memory. */
+	if (GPOINTER_TO_INT(g_hash_table_lookup(icon_file_cache, filename)))
+		return;
+
+	icon_io_push(filename, NULL);
 }
 
 /*
@@ -517,6 +651,14 @@ purple_buddy_icon_get_data(const PurpleBuddyIcon *icon, size_t *len)
 	return NULL;
 }
 
+PurpleImage *
+purple_buddy_icon_get_image(const PurpleBuddyIcon *icon)
+{
+	g_return_val_if_fail(icon != NULL, NULL);
+
+	return icon->img;
+}
+
 const char *
 purple_buddy_icon_get_extension(const PurpleBuddyIcon *icon)
 {
@@ -603,19 +745,52 @@ purple_buddy_icons_get_checksum_for_user(PurpleBuddy *buddy)
 }
 
 static gboolean
-read_icon_file(const char *path, guchar **data, size_t *len)
+read_icon_file(const char *filename, guchar **data, size_t *len)
 {
+	PurpleImage *img;
+	GBytes *contents = NULL;
 	GError *err = NULL;
+	gchar *path;
+
+	/* Don't go to the disk for something we already have, it might not
+	 * even have been written out yet. */
+	img = g_hash_table_lookup(icon_data_cache, filename);
+	if (img != NULL)
+	{
+		contents = purple_image_get_contents(img);
+	}
+	else
+	{
+		g_mutex_lock(&pending_writes_lock);
+		contents = g_hash_table_lookup(pending_writes, filename);
+		if (contents != NULL)
+			g_bytes_ref(contents);
+		g_mutex_unlock(&pending_writes_lock);
+	}
+
+	if (contents != NULL)
+	{
+		*len = g_bytes_get_size(contents);
+		*data = g_memdup2(g_bytes_get_data(contents, NULL), *len);
+		g_bytes_unref(contents);
+
+		return TRUE;
+	}
+
+	path = g_build_filename(purple_buddy_icons_get_cache_dir(), filename, NULL);
 
 	if (!g_file_get_contents(path, (gchar **)data, len, &err))
 	{
 		purple_debug_error("buddyicon", "Error reading %s: %s\n",
 		                   path, err->message);
 		g_error_free(err);
+		g_free(path);
 
 		return FALSE;
 	}
 
+	g_free(path);
+
 	return TRUE;
 }
 
@@ -635,9 +810,7 @@ purple_buddy_icons_find(PurpleAccount *account, const char *username)
 		/* The icon is not currently cached in memory--try reading from disk */
 		PurpleBuddy *b = purple_blist_find_buddy(account, username);
 		const char *protocol_icon_file;
-		const char *dirname;
 		gboolean caching;
-		gchar *path;
 		guchar *data;
 		size_t len;
 
@@ -649,16 +822,13 @@ purple_buddy_icons_find(PurpleAccount *account, const char *username)
 		if (protocol_icon_file == NULL)
 			return NULL;
 
-		dirname = purple_buddy_icons_get_cache_dir();
-
 		caching = purple_buddy_icons_is_caching();
 		/* By disabling caching temporarily, we avoid a loop
 		 * and don't have to add special code through several
 		 * functions. */
 		purple_buddy_icons_set_caching(FALSE);
 
-		path = g_build_filename(dirname, protocol_icon_file, NULL);
-		if (read_icon_file(path, &data, &len)) {
+		if (read_icon_file(protocol_icon_file, &data, &len)) {
 			const char *checksum;
 
 			icon = purple_buddy_icon_create(account, username);
@@ -670,8 +840,6 @@ purple_buddy_icons_find(PurpleAccount *account, const char *username)
 			delete_buddy_icon_settings((PurpleBlistNode *)b, "buddy_icon");
 		}
 
-		g_free(path);
-
 		purple_buddy_icons_set_caching(caching);
 	}
 
@@ -683,8 +851,6 @@ purple_buddy_icons_find_account_icon(PurpleAccount *account)
 {
 	PurpleImage *img;
 	const char *account_icon_file;
-	const char *dirname;
-	char *path;
 	guchar *data;
 	size_t len;
 
@@ -701,16 +867,11 @@ purple_buddy_icons_find_account_icon(PurpleAccount *account)
 	if (account_icon_file == NULL)
 		return NULL;
 
-	dirname = purple_buddy_icons_get_cache_dir();
-	path = g_build_filename(dirname, account_icon_file, NULL);
-
-	if (read_icon_file(path, &data, &len)) {
-		g_free(path);
+	if (read_icon_file(account_icon_file, &data, &len)) {
 		img = purple_buddy_icons_set_account_icon(account, data, len);
 		g_object_ref(img);
 		return img;
 	}
-	g_free(path);
 
 	return NULL;
 }
@@ -808,11 +969,10 @@ purple_buddy_icons_node_has_custom_icon(PurpleBlistNode *node)
 PurpleImage *
 purple_buddy_icons_node_find_custom_icon(PurpleBlistNode *node)
 {
-	char *path;
 	size_t len;
 	guchar *data;
 	PurpleImage *img;
-	const char *custom_icon_file, *dirname;
+	const char *custom_icon_file;
 
 	g_return_val_if_fail(node != NULL, NULL);
 
@@ -828,16 +988,11 @@ purple_buddy_icons_node_find_custom_icon(PurpleBlistNode *node)
 	if (custom_icon_file == NULL)
 		return NULL;
 
-	dirname = purple_buddy_icons_get_cache_dir();
-	path = g_build_filename(dirname, custom_icon_file, NULL);
-
-	if (read_icon_file(path, &data, &len)) {
-		g_free(path);
+	if (read_icon_file(custom_icon_file, &data, &len)) {
 		img = purple_buddy_icons_node_set_custom_icon(node, data, len);
 		g_object_ref(img);
 		return img;
 	}
-	g_free(path);
 
 	return NULL;
 }
@@ -1091,6 +1246,10 @@ purple_buddy_icons_init()
 	                                        g_free, NULL);
 	pointer_icon_cache = g_hash_table_new(g_direct_hash, g_direct_equal);
 
+	pending_writes = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                       g_free, (GDestroyNotify)g_bytes_unref);
+	icon_io_pool = g_thread_pool_new(icon_io_thread, NULL, 1, FALSE, NULL);
+
 	if (!cache_dir)
 		cache_dir = g_build_filename(purple_cache_dir(), "icons", NULL);
 }
@@ -1100,10 +1259,15 @@ purple_buddy_icons_uninit()
 {
 	purple_signals_disconnect_by_handle(purple_buddy_icons_get_handle());
 
+	/* Let any queued writes finish before we go. */
+	g_thread_pool_free(icon_io_pool, FALSE, TRUE);
+	icon_io_pool = NULL;
+
 	g_hash_table_destroy(account_cache);
 	g_hash_table_destroy(icon_data_cache);
 	g_hash_table_destroy(icon_file_cache);
 	g_hash_table_destroy(pointer_icon_cache);
+	g_hash_table_destroy(pending_writes);
 	g_free(cache_dir);
 
 	cache_dir = NULL;
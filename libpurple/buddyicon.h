@@ -212,6 +212,18 @@ const char *purple_buddy_icon_get_checksum(const PurpleBuddyIcon *icon);
  */
 gconstpointer purple_buddy_icon_get_data(const PurpleBuddyIcon *icon, size_t *len);
 
+/**
+ * purple_buddy_icon_get_image:
+ * @icon: The buddy icon.
+ *
+ * Returns the image holding the buddy icon's data.  Icons with the same data
+ * share a single image, whose generated filename is the SHA-1 of that data, so
+ * it is suitable as a key for caching anything derived from the icon.
+ *
+ * Returns: (transfer none): The image, or %NULL if the icon has no data.
+ */
+PurpleImage *purple_buddy_icon_get_image(const PurpleBuddyIcon *icon);
+
 /**
  * purple_buddy_icon_get_extension:
  * @icon: The buddy icon.
@@ -25,6 +25,7 @@
 
 #include "internal.h"
 #include "buddylist.h"
+#include "core.h"
 #include "conversation.h"
 #include "debug.h"
 #include "notify.h"
@@ -64,6 +65,17 @@ static GHashTable *groups_cache = NULL;
 
 static guint          save_timer = 0;
 static gboolean       blist_loaded = FALSE;
+
+/*
+ * Nodes whose presence changed while the UI was in the background.  The UI
+ * is told about them in one batch, either when it comes back or every
+ * DEFERRED_UPDATE_INTERVAL seconds.
+ * PurpleBlistNode* (ref'd) set.
+ */
+#define DEFERRED_UPDATE_INTERVAL 10
+static GHashTable *deferred_updates = NULL;
+static guint deferred_update_timer = 0;
+
 static gchar *localized_default_group_name = NULL;
 
 /*********************************************************************
@@ -1495,6 +1507,10 @@ void purple_blist_remove_buddy(PurpleBuddy *buddy)
 		klass->remove_node(purplebuddylist, node);
 	}
 
+	/* Don't let a pending presence update resurrect it in the UI */
+	if (deferred_updates != NULL)
+		g_hash_table_remove(deferred_updates, node);
+
 	/* Signal that the buddy has been removed before freeing the memory for it */
 	purple_signal_emit(purple_blist_get_handle(), "blist-node-removed",
 			PURPLE_BLIST_NODE(buddy));
@@ -2063,6 +2079,67 @@ purple_blist_update_node(PurpleBuddyList *list, PurpleBlistNode *node)
 	}
 }
 
+static void
+purple_blist_flush_deferred_updates(void)
+{
+	GHashTable *pending;
+	GHashTableIter iter;
+	gpointer node;
+
+	if (deferred_update_timer != 0) {
+		g_source_remove(deferred_update_timer);
+		deferred_update_timer = 0;
+	}
+
+	if (deferred_updates == NULL || g_hash_table_size(deferred_updates) == 0)
+		return;
+
+	/* Swap in a fresh set in case an update defers something else. */
+	pending = deferred_updates;
+	deferred_updates = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                         g_object_unref, NULL);
+
+	g_hash_table_iter_init(&iter, pending);
+	while (g_hash_table_iter_next(&iter, &node, NULL))
+		purple_blist_update_node(purplebuddylist, node);
+
+	g_hash_table_destroy(pending);
+}
+
+static gboolean
+deferred_update_cb(gpointer data)
+{
+	deferred_update_timer = 0;
+	purple_blist_flush_deferred_updates();
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+foreground_changed_cb(gboolean foreground, gpointer data)
+{
+	if (foreground)
+		purple_blist_flush_deferred_updates();
+}
+
+void
+_purple_blist_update_node_deferred(PurpleBlistNode *node)
+{
+	g_return_if_fail(PURPLE_IS_BLIST_NODE(node));
+
+	if (purple_core_is_foreground() || deferred_updates == NULL) {
+		purple_blist_update_node(purplebuddylist, node);
+		return;
+	}
+
+	g_hash_table_add(deferred_updates, g_object_ref(node));
+
+	if (deferred_update_timer == 0) {
+		deferred_update_timer = g_timeout_add_seconds(
+		        DEFERRED_UPDATE_INTERVAL, deferred_update_cb, NULL);
+	}
+}
+
 void
 purple_blist_save_node(PurpleBuddyList *list, PurpleBlistNode *node)
 {
@@ -2185,6 +2262,11 @@ purple_blist_init(void)
 			handle,
 			PURPLE_CALLBACK(purple_blist_buddies_cache_remove_account),
 			NULL);
+
+	deferred_updates = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                         g_object_unref, NULL);
+	purple_signal_connect(purple_get_core(), "foreground-changed", handle,
+			PURPLE_CALLBACK(foreground_changed_cb), NULL);
 }
 
 static void
@@ -2227,6 +2309,12 @@ purple_blist_uninit(void)
 
 	purple_debug_info("buddylist", "Destroying");
 
+	if (deferred_update_timer != 0) {
+		g_source_remove(deferred_update_timer);
+		deferred_update_timer = 0;
+	}
+	g_clear_pointer(&deferred_updates, g_hash_table_destroy);
+
 	g_hash_table_destroy(buddies_cache);
 	g_hash_table_destroy(groups_cache);
 
@@ -53,6 +53,8 @@ struct PurpleCore
 {
 	char *ui;
 
+	gboolean foreground;
+
 	void *reserved;
 };
 
@@ -109,6 +111,7 @@ purple_core_init(const char *ui)
 
 	_core = core = g_new0(PurpleCore, 1);
 	core->ui = g_strdup(ui);
+	core->foreground = TRUE;
 	core->reserved = NULL;
 
 	ops = purple_core_get_ui_ops();
@@ -129,6 +132,8 @@ purple_core_init(const char *ui)
 		0);
 	purple_signal_register(core, "core-initialized", purple_marshal_VOID,
 		G_TYPE_NONE, 0);
+	purple_signal_register(core, "foreground-changed",
+		purple_marshal_VOID__INT, G_TYPE_NONE, 1, G_TYPE_BOOLEAN);
 
 	purple_core_print_version();
 
@@ -304,6 +309,35 @@ purple_get_core(void)
 	return _core;
 }
 
+void
+purple_core_set_foreground(gboolean foreground)
+{
+	PurpleCore *core = purple_get_core();
+
+	/* UIs may still be tearing down windows after the core is gone. */
+	if (core == NULL)
+		return;
+
+	foreground = !!foreground;
+	if (core->foreground == foreground)
+		return;
+
+	core->foreground = foreground;
+	purple_signal_emit(core, "foreground-changed", foreground);
+}
+
+gboolean
+purple_core_is_foreground(void)
+{
+	PurpleCore *core = purple_get_core();
+
+	/* Without a core there's nobody to defer anything for. */
+	if (core == NULL)
+		return TRUE;
+
+	return core->foreground;
+}
+
 static PurpleCoreUiOps *
 purple_core_ui_ops_copy(PurpleCoreUiOps *ops)
 {
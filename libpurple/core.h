@@ -158,6 +158,32 @@ const char *purple_core_get_ui(void);
  */
 PurpleCore *purple_get_core(void);
 
+/**
+ * purple_core_set_foreground:
+ * @foreground: Whether the user can currently see the UI.
+ *
+ * Tells the core whether the UI is in the foreground.  UIs should set this to
+ * %FALSE when they are minimized or hidden, so that non-urgent work can be
+ * deferred and protocols can tell their servers the client is inactive.
+ *
+ * The core starts out in the foreground.
+ *
+ * Since: 3.0.0
+ */
+void purple_core_set_foreground(gboolean foreground);
+
+/**
+ * purple_core_is_foreground:
+ *
+ * Returns whether the UI is in the foreground, as last set with
+ * purple_core_set_foreground().
+ *
+ * Returns: %TRUE if the UI is in the foreground.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_core_is_foreground(void);
+
 /**
  * purple_core_set_ui_ops:
  * @ops: A UI ops structure for the core.
@@ -47,30 +47,45 @@ static gboolean debug_unsafe = FALSE;
 
 static gboolean debug_colored = FALSE;
 
-static void
-purple_debug_vargs(PurpleDebugLevel level, const char *category,
-				 const char *format, va_list args)
+gboolean
+purple_debug_is_printing(PurpleDebugLevel level, const char *category)
 {
 	PurpleDebugUi *ops;
 	PurpleDebugUiInterface *iface;
-	char *arg_s = NULL;
-
-	g_return_if_fail(level != PURPLE_DEBUG_ALL);
-	g_return_if_fail(format != NULL);
 
 	ops = purple_debug_get_ui();
 	if (!ops)
-		return;
+		return FALSE;
 	iface = PURPLE_DEBUG_UI_GET_IFACE(ops);
 	if (!iface)
-		return;
+		return FALSE;
 
 	if (!debug_enabled &&
 	    ((iface->print == NULL) ||
 	     (iface->is_enabled && !iface->is_enabled(ops, level, category)))) {
-		return;
+		return FALSE;
 	}
 
+	return TRUE;
+}
+
+static void
+purple_debug_vargs(PurpleDebugLevel level, const char *category,
+				 const char *format, va_list args)
+{
+	PurpleDebugUi *ops;
+	PurpleDebugUiInterface *iface;
+	char *arg_s = NULL;
+
+	g_return_if_fail(level != PURPLE_DEBUG_ALL);
+	g_return_if_fail(format != NULL);
+
+	if (!purple_debug_is_printing(level, category))
+		return;
+
+	ops = purple_debug_get_ui();
+	iface = PURPLE_DEBUG_UI_GET_IFACE(ops);
+
 	arg_s = g_strdup_vprintf(format, args);
 	g_strchomp(arg_s); /* strip trailing linefeeds */
 
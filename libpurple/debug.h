@@ -246,6 +246,22 @@ void purple_debug_set_unsafe(gboolean unsafe);
  */
 gboolean purple_debug_is_unsafe(void);
 
+/**
+ * purple_debug_is_printing:
+ * @level:    The debug level.
+ * @category: The category (or %NULL).
+ *
+ * Check if a message at @level in @category would be printed anywhere.
+ * Callers can use this to skip building expensive debug messages that
+ * nobody would see.
+ *
+ * Returns: TRUE if the message would be printed, FALSE if it would be
+ *          dropped.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_debug_is_printing(PurpleDebugLevel level, const char *category);
+
 /**
  * purple_debug_set_colored:
  * @colored: TRUE to enable colored output, FALSE to disable it.
@@ -54,6 +54,7 @@ typedef struct
 	SoupSession *cons;
 	PurpleConnection *gc;
 	gboolean retrying;
+	GZlibDecompressor *inflater;
 
 	FbId uid;
 	gint64 sid;
@@ -181,6 +182,7 @@ fb_api_dispose(GObject *obj)
 	}
 
 	g_object_unref(priv->cons);
+	g_object_unref(priv->inflater);
 	g_queue_free_full(priv->msgs, (GDestroyNotify) fb_api_message_free);
 
 	g_free(priv->cid);
@@ -509,6 +511,7 @@ fb_api_init(FbApi *api)
 	api->priv = priv;
 
 	priv->msgs = g_queue_new();
+	priv->inflater = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
 }
 
 GQuark
@@ -1846,6 +1849,7 @@ fb_api_cb_mqtt_publish(FbMqtt *mqtt, const gchar *topic, GByteArray *pload,
                        gpointer data)
 {
 	FbApi *api = data;
+	FbApiPrivate *priv = api->priv;
 	gboolean comp;
 	GByteArray *bytes;
 	GError *err = NULL;
@@ -1866,7 +1870,7 @@ fb_api_cb_mqtt_publish(FbMqtt *mqtt, const gchar *topic, GByteArray *pload,
 	comp = fb_util_zlib_test(pload);
 
 	if (G_LIKELY(comp)) {
-		bytes = fb_util_zlib_inflate(pload, &err);
+		bytes = fb_util_zlib_inflate_conv(priv->inflater, pload, &err);
 		FB_API_ERROR_EMIT(api, err, return);
 	} else {
 		bytes = (GByteArray *) pload;
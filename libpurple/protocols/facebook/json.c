@@ -27,11 +27,23 @@
 #include "json.h"
 #include "util.h"
 
+typedef struct _FbJsonStep FbJsonStep;
 typedef struct _FbJsonValue FbJsonValue;
 
+/*
+ * One step of a compiled expression: a member name, or an array index
+ * when the name is NULL.
+ */
+struct _FbJsonStep
+{
+	gchar *name;
+	guint index;
+};
+
 struct _FbJsonValue
 {
 	const gchar *expr;
+	GArray *steps;
 	FbJsonType type;
 	gboolean required;
 	GValue value;
@@ -76,6 +88,10 @@ fb_json_values_dispose(GObject *obj)
 			g_value_unset(&value->value);
 		}
 
+		if (value->steps != NULL) {
+			g_array_free(value->steps, TRUE);
+		}
+
 		g_free(value);
 	}
 
@@ -294,18 +310,138 @@ fb_json_node_new(const gchar *data, gssize size, GError **error)
 	return root;
 }
 
+static void
+fb_json_step_clear(gpointer data)
+{
+	FbJsonStep *step = data;
+
+	g_free(step->name);
+}
+
+static gboolean
+fb_json_name_char(gchar c)
+{
+	return g_ascii_isalnum(c) || (c == '_') || (c == '-');
+}
+
+/*
+ * Compiles the plain member and index expressions, such as "$.a.b[0]",
+ * that make up nearly everything we query. Anything else returns NULL
+ * and is left to #JsonPath.
+ */
+static GArray *
+fb_json_expr_compile(const gchar *expr)
+{
+	const gchar *end;
+	FbJsonStep step;
+	GArray *steps;
+	guint64 index;
+
+	if (expr[0] != '$') {
+		return NULL;
+	}
+
+	steps = g_array_new(FALSE, FALSE, sizeof(FbJsonStep));
+	g_array_set_clear_func(steps, fb_json_step_clear);
+
+	for (expr++; *expr != '\0'; expr = end) {
+		if (expr[0] == '.') {
+			for (end = expr + 1; fb_json_name_char(*end); end++);
+
+			/* Leave expr on the dot, so "$.a." is not taken for "$.a" */
+			if (end == expr + 1) {
+				break;
+			}
+
+			step.name = g_strndup(expr + 1, end - expr - 1);
+			step.index = 0;
+		} else if (expr[0] == '[' && g_ascii_isdigit(expr[1])) {
+			index = g_ascii_strtoull(expr + 1, (gchar **) &end, 10);
+
+			if ((*end != ']') || (index > G_MAXUINT)) {
+				break;
+			}
+
+			end++;
+			step.name = NULL;
+			step.index = index;
+		} else {
+			break;
+		}
+
+		g_array_append_val(steps, step);
+	}
+
+	if (*expr != '\0') {
+		g_array_free(steps, TRUE);
+		return NULL;
+	}
+
+	return steps;
+}
+
+/*
+ * Walks a compiled expression from the root. The returned #JsonNode
+ * belongs to the root, nothing is copied along the way.
+ */
+static JsonNode *
+fb_json_expr_eval(JsonNode *root, GArray *steps, const gchar *expr,
+                  GError **error)
+{
+	FbJsonStep *step;
+	JsonArray *arr;
+	JsonNode *node = root;
+	guint i;
+
+	for (i = 0; (node != NULL) && (i < steps->len); i++) {
+		step = &g_array_index(steps, FbJsonStep, i);
+
+		if (step->name != NULL) {
+			node = JSON_NODE_HOLDS_OBJECT(node) ?
+				json_object_get_member(json_node_get_object(node),
+				                       step->name) :
+				NULL;
+		} else if (JSON_NODE_HOLDS_ARRAY(node)) {
+			arr = json_node_get_array(node);
+			node = (step->index < json_array_get_length(arr)) ?
+				json_array_get_element(arr, step->index) :
+				NULL;
+		} else {
+			node = NULL;
+		}
+	}
+
+	if (node == NULL) {
+		g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NOMATCH,
+		            _("No matches for %s"), expr);
+		return NULL;
+	}
+
+	if (JSON_NODE_HOLDS_NULL(node)) {
+		g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NULL,
+		            _("Null value for %s"), expr);
+		return NULL;
+	}
+
+	return node;
+}
+
 JsonNode *
 fb_json_node_get(JsonNode *root, const gchar *expr, GError **error)
 {
+	GArray *steps;
 	GError *err = NULL;
 	guint size;
 	JsonArray *rslt;
 	JsonNode *node;
 	JsonNode *ret;
 
-	/* Special case for json-glib < 0.99.2 */
-	if (purple_strequal(expr, "$")) {
-		return json_node_copy(root);
+	steps = fb_json_expr_compile(expr);
+
+	if (steps != NULL) {
+		node = fb_json_expr_eval(root, steps, expr, error);
+		g_array_free(steps, TRUE);
+		return (node != NULL) ? json_node_copy(node) : NULL;
 	}
 
 	node = json_path_query(expr, root, &err);
@@ -473,6 +609,7 @@ fb_json_values_add(FbJsonValues *values, FbJsonType type, gboolean required,
 
 	value = g_new0(FbJsonValue, 1);
 	value->expr = expr;
+	value->steps = fb_json_expr_compile(expr);
 	value->type = type;
 	value->required = required;
 
@@ -555,7 +692,13 @@ fb_json_values_update(FbJsonValues *values, GError **error)
 
 	for (l = priv->queue->head; l != NULL; l = l->next) {
 		value = l->data;
-		node = fb_json_node_get(root, value->expr, &err);
+
+		if (value->steps != NULL) {
+			node = fb_json_expr_eval(root, value->steps, value->expr,
+			                         &err);
+		} else {
+			node = fb_json_node_get(root, value->expr, &err);
+		}
 
 		if (G_IS_VALUE(&value->value)) {
 			g_value_unset(&value->value);
@@ -581,12 +724,19 @@ fb_json_values_update(FbJsonValues *values, GError **error)
 			            g_type_name(value->type),
 			            g_type_name(type),
 				    value->expr);
-			json_node_free(node);
+
+			if (value->steps == NULL) {
+				json_node_free(node);
+			}
+
 			return FALSE;
 		}
 
 		json_node_get_value(node, &value->value);
-		json_node_free(node);
+
+		if (value->steps == NULL) {
+			json_node_free(node);
+		}
 	}
 
 	priv->next = priv->queue->head;
@@ -361,7 +361,9 @@ fb_json_values_new(JsonNode *root);
  * @required: #TRUE if the node is required, otherwise #FALSE.
  * @expr: The #JsonPath expression.
  *
- * Adds a new #FbJsonValue to the #FbJsonValues.
+ * Adds a new #FbJsonValue to the #FbJsonValues. Expressions made up of
+ * only member names and array indexes are compiled here, once, and are
+ * then evaluated by walking the nodes directly on every update.
  */
 void
 fb_json_values_add(FbJsonValues *values, FbJsonType type, gboolean required,
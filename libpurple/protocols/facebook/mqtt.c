@@ -41,7 +41,8 @@ typedef struct
 	guint16 mid;
 
 	GByteArray *rbuf;
-	gsize remz;
+	GByteArray *pload;
+	FbMqttMessage *rmsg;
 
 	gint tev;
 } FbMqttPrivate;
@@ -93,7 +94,17 @@ fb_mqtt_dispose(GObject *obj)
 	FbMqttPrivate *priv = mqtt->priv;
 
 	fb_mqtt_close(mqtt);
-	g_byte_array_free(priv->rbuf, TRUE);
+	g_clear_object(&priv->rmsg);
+
+	if (priv->rbuf != NULL) {
+		g_byte_array_free(priv->rbuf, TRUE);
+		priv->rbuf = NULL;
+	}
+
+	if (priv->pload != NULL) {
+		g_byte_array_unref(priv->pload);
+		priv->pload = NULL;
+	}
 }
 
 static void
@@ -155,7 +166,8 @@ fb_mqtt_class_init(FbMqttClass *klass)
 	 * @topic: The topic.
 	 * @pload: The payload.
 	 *
-	 * Emitted upon an incoming message from the steam.
+	 * Emitted upon an incoming message from the steam. The payload
+	 * is only valid for the duration of the emission.
 	 */
 	g_signal_new("publish",
 	             G_TYPE_FROM_CLASS(klass),
@@ -174,6 +186,7 @@ fb_mqtt_init(FbMqtt *mqtt)
 	mqtt->priv = priv;
 
 	priv->rbuf = g_byte_array_new();
+	priv->pload = g_byte_array_new();
 }
 
 static void
@@ -392,55 +405,31 @@ fb_mqtt_cb_fill(GObject *source, GAsyncResult *res, gpointer data)
 	fb_mqtt_read_packet(mqtt);
 }
 
-static void
-fb_mqtt_cb_read_packet(GObject *source, GAsyncResult *res, gpointer data)
+/*
+ * How much of a buffered packet is read into rbuf. For a PUBLISH, that
+ * is everything up to the payload, which is read into pload on its own,
+ * so that it can be handed out as is. A header that does not fit leaves
+ * the whole packet in rbuf, for fb_mqtt_read() to reject.
+ */
+static gsize
+fb_mqtt_packet_header_size(const guint8 *buf, gsize pos, gsize size)
 {
-	FbMqtt *mqtt = data;
-	FbMqttPrivate *priv;
-	gssize ret;
-	FbMqttMessage *msg;
-	GError *err = NULL;
-
-	ret = g_input_stream_read_finish(G_INPUT_STREAM(source), res, &err);
-
-	if (ret < 1) {
-		if (ret == 0) {
-			err = g_error_new_literal(G_IO_ERROR,
-					G_IO_ERROR_CONNECTION_CLOSED,
-					_("Connection closed"));
-		}
+	gsize hsize;
 
-		fb_mqtt_take_error(mqtt, err, _("Failed to read packet data"));
-		return;
+	if ((((buf[0] & 0xF0) >> 4) != FB_MQTT_MESSAGE_TYPE_PUBLISH) ||
+	    ((pos + 2) > size))
+	{
+		return size;
 	}
 
-	priv = mqtt->priv;
-	priv->remz -= ret;
-
-	if (priv->remz > 0) {
-		g_input_stream_read_async(G_INPUT_STREAM(source),
-				priv->rbuf->data +
-				priv->rbuf->len - priv->remz, priv->remz,
-				G_PRIORITY_DEFAULT, priv->cancellable,
-				fb_mqtt_cb_read_packet, mqtt);
-		return;
-	}
+	/* The topic, then a message identifier above QoS 0 */
+	hsize = pos + 2 + ((buf[pos] << 8) | buf[pos + 1]);
 
-	msg = fb_mqtt_message_new_bytes(priv->rbuf);
-
-	if (G_UNLIKELY(msg == NULL)) {
-		fb_mqtt_error_literal(mqtt, FB_MQTT_ERROR_GENERAL,
-		                      _("Failed to parse message"));
-		return;
+	if (buf[0] & (FB_MQTT_MESSAGE_FLAG_QOS1 | FB_MQTT_MESSAGE_FLAG_QOS2)) {
+		hsize += 2;
 	}
 
-	fb_mqtt_read(mqtt, msg);
-	g_object_unref(msg);
-
-	/* Read another packet if connection wasn't reset in fb_mqtt_read() */
-	if (fb_mqtt_connected(mqtt, FALSE)) {
-		fb_mqtt_read_packet(mqtt);
-	}
+	return MIN(hsize, size);
 }
 
 static void
@@ -448,48 +437,90 @@ fb_mqtt_read_packet(FbMqtt *mqtt)
 {
 	FbMqttPrivate *priv = mqtt->priv;
 	const guint8 *buf;
-	gsize count = 0;
+	gsize count;
+	gsize hsize;
 	gsize pos;
-	guint mult = 1;
+	guint mult;
 	guint8 byte;
-	gsize size = 0;
+	gsize size;
+	GError *err = NULL;
 
-	buf = g_buffered_input_stream_peek_buffer(priv->input, &count);
+	/* Handle every packet that is already buffered before going back
+	 * to the main loop for more. */
+	do {
+		buf = g_buffered_input_stream_peek_buffer(priv->input, &count);
+		size = 0;
+		mult = 1;
 
-	/* Start at 1 to skip the first byte */
-	pos = 1;
+		/* Start at 1 to skip the first byte */
+		pos = 1;
 
-	do {
-		if (pos >= count) {
-			/* Not enough data yet, try again later */
-			g_buffered_input_stream_fill_async(priv->input, -1,
-					G_PRIORITY_DEFAULT, priv->cancellable,
-					fb_mqtt_cb_fill, mqtt);
+		do {
+			if (pos >= count) {
+				goto fill;
+			}
+
+			byte = *(buf + pos++);
+
+			size += (byte & 127) * mult;
+			mult *= 128;
+		} while ((byte & 128) != 0);
+
+		/* Add header to size */
+		size += pos;
+
+		if (count < size) {
+			goto fill;
+		}
+
+		/* The whole packet is buffered, so this never blocks */
+		hsize = fb_mqtt_packet_header_size(buf, pos, size);
+		g_byte_array_set_size(priv->rbuf, hsize);
+		g_byte_array_set_size(priv->pload, size - hsize);
+
+		if (g_input_stream_read_all(G_INPUT_STREAM(priv->input),
+				priv->rbuf->data, hsize, NULL,
+				priv->cancellable, &err))
+		{
+			g_input_stream_read_all(G_INPUT_STREAM(priv->input),
+					priv->pload->data, size - hsize, NULL,
+					priv->cancellable, &err);
+		}
+
+		if (G_UNLIKELY(err != NULL)) {
+			fb_mqtt_take_error(mqtt, err,
+			                   _("Failed to read packet data"));
+			return;
+		}
+
+		if (priv->rmsg == NULL) {
+			priv->rmsg = fb_mqtt_message_new_bytes(priv->rbuf);
+		} else {
+			fb_mqtt_message_set_bytes(priv->rmsg, priv->rbuf);
+		}
+
+		if (G_UNLIKELY(priv->rmsg == NULL)) {
+			fb_mqtt_error_literal(mqtt, FB_MQTT_ERROR_GENERAL,
+			                      _("Failed to parse message"));
 			return;
 		}
 
-		byte = *(buf + pos++);
+		fb_mqtt_read(mqtt, priv->rmsg);
 
-		size += (byte & 127) * mult;
-		mult *= 128;
-	} while ((byte & 128) != 0);
+	/* Read another packet if connection wasn't reset in fb_mqtt_read() */
+	} while (fb_mqtt_connected(mqtt, FALSE));
 
-	/* Add header to size */
-	size += pos;
+	return;
 
-	g_byte_array_set_size(priv->rbuf, size);
-	priv->remz = size;
+fill:
+	/* Not enough data yet, try again later */
+	if (size > g_buffered_input_stream_get_buffer_size(priv->input)) {
+		g_buffered_input_stream_set_buffer_size(priv->input, size);
+	}
 
-	/* TODO: Use g_input_stream_read_all_async() when available. */
-	/* TODO: Alternately, it would be nice to let the
-	 * FbMqttMessage directly use the GBufferedInputStream
-	 * buffer instead of copying it, provided it's consumed
-	 * before the next read.
-	 */
-	g_input_stream_read_async(G_INPUT_STREAM(priv->input),
-			priv->rbuf->data, priv->rbuf->len,
+	g_buffered_input_stream_fill_async(priv->input, -1,
 			G_PRIORITY_DEFAULT, priv->cancellable,
-			fb_mqtt_cb_read_packet, mqtt);
+			fb_mqtt_cb_fill, mqtt);
 }
 
 void
@@ -498,7 +529,7 @@ fb_mqtt_read(FbMqtt *mqtt, FbMqttMessage *msg)
 	FbMqttMessage *nsg;
 	FbMqttPrivate *priv;
 	FbMqttMessagePrivate *mriv;
-	GByteArray *wytes;
+	GByteArray *pload;
 	gchar *str;
 	guint8 chr;
 	guint16 mid;
@@ -556,10 +587,18 @@ fb_mqtt_read(FbMqtt *mqtt, FbMqttMessage *msg)
 			g_object_unref(nsg);
 		}
 
-		wytes = g_byte_array_new();
-		fb_mqtt_message_read_r(msg, wytes);
-		g_signal_emit_by_name(mqtt, "publish", str, wytes);
-		g_byte_array_free(wytes, TRUE);
+		/* A packet off the stream had its payload read apart from
+		 * the rest, see fb_mqtt_read_packet(). The reference keeps it
+		 * alive through a handler closing or dropping the #FbMqtt. */
+		if (msg == priv->rmsg) {
+			pload = g_byte_array_ref(priv->pload);
+		} else {
+			pload = g_byte_array_new();
+			fb_mqtt_message_read_r(msg, pload);
+		}
+
+		g_signal_emit_by_name(mqtt, "publish", str, pload);
+		g_byte_array_unref(pload);
 		g_free(str);
 		return;
 
@@ -871,15 +910,31 @@ FbMqttMessage *
 fb_mqtt_message_new_bytes(GByteArray *bytes)
 {
 	FbMqttMessage *msg;
-	FbMqttMessagePrivate *priv;
-	guint8 *byte;
 
 	g_return_val_if_fail(bytes != NULL, NULL);
 	g_return_val_if_fail(bytes->len >= 2, NULL);
 
 	msg = g_object_new(FB_TYPE_MQTT_MESSAGE, NULL);
+	fb_mqtt_message_set_bytes(msg, bytes);
+
+	return msg;
+}
+
+void
+fb_mqtt_message_set_bytes(FbMqttMessage *msg, GByteArray *bytes)
+{
+	FbMqttMessagePrivate *priv;
+	guint8 *byte;
+
+	g_return_if_fail(FB_IS_MQTT_MESSAGE(msg));
+	g_return_if_fail(bytes != NULL);
+	g_return_if_fail(bytes->len >= 2);
 	priv = msg->priv;
 
+	if ((priv->bytes != NULL) && priv->local) {
+		g_byte_array_free(priv->bytes, TRUE);
+	}
+
 	priv->bytes = bytes;
 	priv->local = FALSE;
 	priv->type = (*bytes->data & 0xF0) >> 4;
@@ -889,8 +944,6 @@ fb_mqtt_message_new_bytes(GByteArray *bytes)
 	for (byte = priv->bytes->data + 1; (*(byte++) & 128) != 0; );
 	priv->offset = byte - bytes->data;
 	priv->pos = priv->offset;
-
-	return msg;
 }
 
 void
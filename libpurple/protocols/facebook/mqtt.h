@@ -382,6 +382,19 @@ fb_mqtt_message_new(FbMqttMessageType type, FbMqttMessageFlags flags);
 FbMqttMessage *
 fb_mqtt_message_new_bytes(GByteArray *bytes);
 
+/**
+ * fb_mqtt_message_set_bytes:
+ * @msg: The #FbMqttMessage.
+ * @bytes: The #GByteArray.
+ *
+ * Points an #FbMqttMessage at a new #GByteArray, as with
+ * #fb_mqtt_message_new_bytes(). This lets one #FbMqttMessage be used
+ * for every packet read. The #GByteArray is not copied, and must
+ * outlive its use by the #FbMqttMessage.
+ */
+void
+fb_mqtt_message_set_bytes(FbMqttMessage *msg, GByteArray *bytes);
+
 /**
  * fb_mqtt_message_reset:
  * @msg: The #FbMqttMessage.
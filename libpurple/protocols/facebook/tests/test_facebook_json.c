@@ -0,0 +1,346 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+#include "protocols/facebook/json.h"
+
+/*
+ * Plain member and index expressions are walked directly by
+ * fb_json_node_get(), everything else goes to #JsonPath.  Either way the
+ * answer has to be the one #JsonPath gives, which these tests check by
+ * asking it too.
+ */
+static const gchar *test_fb_json_fixture =
+	"{"
+		"\"viewer\": {"
+			"\"message_threads\": {"
+				"\"sync_sequence_id\": \"1234\","
+				"\"unread_count\": 3,"
+				"\"nodes\": ["
+					"{\"thread_key\": {\"thread_fbid\": \"11\"},"
+					" \"name\": \"first\", \"is_group\": true,"
+					" \"all_participants\": {\"nodes\": ["
+						"{\"messaging_actor\": {\"id\": \"1\"}},"
+						"{\"messaging_actor\": {\"id\": \"2\"}}"
+					"]}},"
+					"{\"thread_key\": {\"other_user_id\": \"22\"},"
+					" \"name\": null, \"is_group\": false,"
+					" \"all_participants\": {\"nodes\": []}}"
+				"]"
+			"}"
+		"},"
+		"\"matrix\": [[1, 2], [3, [4, 5]]],"
+		"\"with-dash\": {\"under_score\": 1.5},"
+		"\"nothing\": null,"
+		"\"string\": \"text\","
+		"\"empty\": {}"
+	"}";
+
+static const gchar *test_fb_json_exprs[] = {
+	/* nested members */
+	"$",
+	"$.viewer",
+	"$.viewer.message_threads.sync_sequence_id",
+	"$.viewer.message_threads.unread_count",
+	"$.with-dash.under_score",
+	/* indexes */
+	"$.viewer.message_threads.nodes[0].name",
+	"$.viewer.message_threads.nodes[1].thread_key.other_user_id",
+	"$.viewer.message_threads.nodes[0].all_participants.nodes[1]"
+		".messaging_actor.id",
+	"$.matrix[1][1][0]",
+	"$.matrix[0]",
+	/* out of range indexes */
+	"$.matrix[2]",
+	"$.matrix[1][1][2]",
+	"$.viewer.message_threads.nodes[1].all_participants.nodes[0]",
+	/* null */
+	"$.nothing",
+	"$.nothing.below",
+	"$.viewer.message_threads.nodes[1].name",
+	/* missing members and steps into the wrong kind of node */
+	"$.missing",
+	"$.empty.missing",
+	"$.string.length",
+	"$.string[0]",
+	"$.viewer[0]",
+	"$.matrix.0",
+	"$.viewer.message_threads.unread_count.value",
+	/* left to JsonPath */
+	"$['viewer']['message_threads']['unread_count']",
+	"$.matrix[4294967296]",
+	"$.matrix[*]",
+	"$..thread_fbid",
+	"$..id",
+	"$.viewer.message_threads.nodes[*].name",
+	"$.matrix[0][-1]",
+	"$.viewer.",
+};
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static JsonNode *
+test_fb_json_root(void) {
+	GError *error = NULL;
+	JsonNode *root;
+
+	root = fb_json_node_new(test_fb_json_fixture, -1, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(root);
+
+	return root;
+}
+
+static gchar *
+test_fb_json_to_string(JsonNode *node) {
+	JsonGenerator *gen = json_generator_new();
+	gchar *str;
+
+	json_generator_set_root(gen, node);
+	str = json_generator_to_data(gen, NULL);
+	g_object_unref(gen);
+
+	return str;
+}
+
+/*
+ * What fb_json_node_get() has to return for expr, worked out from a plain
+ * #JsonPath query.  Returns the match, or NULL with the error code set.
+ */
+static JsonNode *
+test_fb_json_path_get(JsonNode *root, const gchar *expr, gint *code) {
+	GError *error = NULL;
+	JsonArray *matches;
+	JsonNode *result, *ret = NULL;
+
+	result = json_path_query(expr, root, &error);
+
+	if (error != NULL) {
+		*code = -1;
+		g_error_free(error);
+		json_node_free(result);
+		return NULL;
+	}
+
+	matches = json_node_get_array(result);
+
+	if (json_array_get_length(matches) < 1) {
+		*code = FB_JSON_ERROR_NOMATCH;
+	} else if (json_array_get_length(matches) > 1) {
+		*code = FB_JSON_ERROR_AMBIGUOUS;
+	} else if (json_array_get_null_element(matches, 0)) {
+		*code = FB_JSON_ERROR_NULL;
+	} else {
+		*code = FB_JSON_ERROR_SUCCESS;
+		ret = json_array_dup_element(matches, 0);
+	}
+
+	json_node_free(result);
+	return ret;
+}
+
+static void
+test_fb_json_assert_same(JsonNode *root, const gchar *expr) {
+	GError *error = NULL;
+	JsonNode *expected, *node;
+	gint code;
+
+	expected = test_fb_json_path_get(root, expr, &code);
+	node = fb_json_node_get(root, expr, &error);
+
+	if (code == FB_JSON_ERROR_SUCCESS) {
+		gchar *want = test_fb_json_to_string(expected);
+		gchar *got;
+
+		g_assert_no_error(error);
+		g_assert_nonnull(node);
+
+		got = test_fb_json_to_string(node);
+		g_assert_cmpstr(want, ==, got);
+
+		g_free(want);
+		g_free(got);
+		json_node_free(expected);
+		json_node_free(node);
+	} else if (code < 0) {
+		/* an expression neither of them understands */
+		g_assert_nonnull(error);
+		g_assert_null(node);
+		g_error_free(error);
+	} else {
+		g_assert_error(error, FB_JSON_ERROR, code);
+		g_assert_null(node);
+		g_error_free(error);
+	}
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_fb_json_node_get(void) {
+	JsonNode *root = test_fb_json_root();
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(test_fb_json_exprs); i++) {
+		g_test_message("%s", test_fb_json_exprs[i]);
+		test_fb_json_assert_same(root, test_fb_json_exprs[i]);
+	}
+
+	json_node_free(root);
+}
+
+/* fb_json_values_update() walks its compiled expressions from each element. */
+static void
+test_fb_json_values(void) {
+	JsonNode *root = test_fb_json_root();
+	FbJsonValues *values;
+	GError *error = NULL;
+	guint count = 0;
+
+	values = fb_json_values_new(root);
+	fb_json_values_add(values, FB_JSON_TYPE_STR, FALSE,
+	                   "$.thread_key.thread_fbid");
+	fb_json_values_add(values, FB_JSON_TYPE_STR, FALSE, "$.name");
+	fb_json_values_add(values, FB_JSON_TYPE_BOOL, TRUE, "$.is_group");
+	fb_json_values_add(values, FB_JSON_TYPE_STR, FALSE,
+	                   "$.all_participants.nodes[0].messaging_actor.id");
+	fb_json_values_add(values, FB_JSON_TYPE_STR, FALSE, "$..other_user_id");
+	fb_json_values_set_array(values, TRUE, "$.viewer.message_threads.nodes");
+
+	while (fb_json_values_update(values, &error)) {
+		const gchar *fbid = fb_json_values_next_str(values, NULL);
+		const gchar *name = fb_json_values_next_str(values, NULL);
+		gboolean group = fb_json_values_next_bool(values, FALSE);
+		const gchar *first = fb_json_values_next_str(values, NULL);
+		const gchar *other = fb_json_values_next_str(values, NULL);
+
+		if (count++ == 0) {
+			g_assert_cmpstr("11", ==, fbid);
+			g_assert_cmpstr("first", ==, name);
+			g_assert_true(group);
+			g_assert_cmpstr("1", ==, first);
+			g_assert_null(other);
+		} else {
+			g_assert_null(fbid);
+			g_assert_null(name);
+			g_assert_false(group);
+			g_assert_null(first);
+			g_assert_cmpstr("22", ==, other);
+		}
+	}
+
+	g_assert_no_error(error);
+	g_assert_cmpuint(2, ==, count);
+	g_object_unref(values);
+
+	/* a required value of the wrong type */
+	values = fb_json_values_new(root);
+	fb_json_values_add(values, FB_JSON_TYPE_INT, TRUE,
+	                   "$.viewer.message_threads.sync_sequence_id");
+	g_assert_false(fb_json_values_update(values, &error));
+	g_assert_error(error, FB_JSON_ERROR, FB_JSON_ERROR_TYPE);
+	g_clear_error(&error);
+	g_object_unref(values);
+
+	/* and a required one that is null */
+	values = fb_json_values_new(root);
+	fb_json_values_add(values, FB_JSON_TYPE_STR, TRUE, "$.nothing");
+	g_assert_false(fb_json_values_update(values, &error));
+	g_assert_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NULL);
+	g_clear_error(&error);
+	g_object_unref(values);
+
+	json_node_free(root);
+}
+
+/*
+ * The lookups a sync response is made of, walked directly and through
+ * #JsonPath.  Run with -m perf for numbers that mean something.
+ */
+static void
+test_fb_json_node_get_timing(void) {
+	static const gchar *exprs[] = {
+		"$.viewer.message_threads.sync_sequence_id",
+		"$.viewer.message_threads.unread_count",
+		"$.viewer.message_threads.nodes",
+		"$.viewer.message_threads.nodes[0].thread_key.thread_fbid",
+		"$.viewer.message_threads.nodes[1].name",
+		"$.missing",
+	};
+	JsonNode *root = test_fb_json_root();
+	guint count = g_test_perf() ? 100000 : 100;
+	gdouble compiled, path;
+	guint i, j;
+	gint code;
+
+	g_test_timer_start();
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < G_N_ELEMENTS(exprs); j++) {
+			JsonNode *node = fb_json_node_get(root, exprs[j], NULL);
+
+			if (node != NULL) {
+				json_node_free(node);
+			}
+		}
+	}
+	compiled = g_test_timer_elapsed();
+
+	g_test_timer_start();
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < G_N_ELEMENTS(exprs); j++) {
+			JsonNode *node = test_fb_json_path_get(root, exprs[j], &code);
+
+			if (node != NULL) {
+				json_node_free(node);
+			}
+		}
+	}
+	path = g_test_timer_elapsed();
+
+	count *= G_N_ELEMENTS(exprs);
+	g_test_message("%.3f us per lookup through JsonPath",
+	               path * 1000000 / count);
+	g_test_minimized_result(compiled * 1000000 / count,
+	                        "%.3f us per compiled lookup over %u lookups",
+	                        compiled * 1000000 / count, count);
+
+	json_node_free(root);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/facebook/json/node-get", test_fb_json_node_get);
+	g_test_add_func("/facebook/json/values", test_fb_json_values);
+	g_test_add_func("/facebook/json/node-get/timing",
+	                test_fb_json_node_get_timing);
+
+	return g_test_run();
+}
@@ -545,25 +545,32 @@ fb_util_zlib_conv(GConverter *conv, const GByteArray *bytes, GError **error)
 	GConverterResult res;
 	gsize cize = 0;
 	gsize rize;
+	gsize size = 0;
 	gsize wize;
-	guint8 data[1024];
 
+	/* Convert straight into the result, growing it as needed */
 	ret = g_byte_array_new();
+	g_byte_array_set_size(ret, MAX(bytes->len * 2, 1024));
 
 	while (TRUE) {
+		if ((ret->len - size) < 1024) {
+			g_byte_array_set_size(ret, ret->len * 2);
+		}
+
 		rize = 0;
 		wize = 0;
 
 		res = g_converter_convert(conv,
 		                          bytes->data + cize,
 		                          bytes->len - cize,
-		                          data, sizeof data,
+		                          ret->data + size,
+		                          ret->len - size,
 		                          G_CONVERTER_INPUT_AT_END,
 		                          &rize, &wize, error);
 
 		switch (res) {
 		case G_CONVERTER_CONVERTED:
-			g_byte_array_append(ret, data, wize);
+			size += wize;
 			cize += rize;
 			break;
 
@@ -572,7 +579,8 @@ fb_util_zlib_conv(GConverter *conv, const GByteArray *bytes, GError **error)
 			return NULL;
 
 		case G_CONVERTER_FINISHED:
-			g_byte_array_append(ret, data, wize);
+			size += wize;
+			g_byte_array_set_size(ret, size);
 			return ret;
 
 		default:
@@ -604,3 +612,13 @@ fb_util_zlib_inflate(const GByteArray *bytes, GError **error)
 	g_object_unref(conv);
 	return ret;
 }
+
+GByteArray *
+fb_util_zlib_inflate_conv(GZlibDecompressor *conv, const GByteArray *bytes,
+                          GError **error)
+{
+	g_return_val_if_fail(G_IS_ZLIB_DECOMPRESSOR(conv), NULL);
+
+	g_converter_reset(G_CONVERTER(conv));
+	return fb_util_zlib_conv(G_CONVERTER(conv), bytes, error);
+}
@@ -341,4 +341,22 @@ fb_util_zlib_deflate(const GByteArray *bytes, GError **error);
 GByteArray *
 fb_util_zlib_inflate(const GByteArray *bytes, GError **error);
 
+/**
+ * fb_util_zlib_inflate_conv:
+ * @conv: The #GZlibDecompressor.
+ * @bytes: The #GByteArray.
+ * @error: The return location for the #GError or #NULL.
+ *
+ * Inflates a #GByteArray with zlib like #fb_util_zlib_inflate(), but
+ * with an existing #GZlibDecompressor. The decompressor is reset first,
+ * so one can be kept around for every message rather than created for
+ * each. The returned #GByteArray should be freed with
+ * #g_byte_array_free() when no longer needed.
+ *
+ * Returns: The inflated #GByteArray or #NULL on error.
+ */
+GByteArray *
+fb_util_zlib_inflate_conv(GZlibDecompressor *conv, const GByteArray *bytes,
+                          GError **error);
+
 #endif /* PURPLE_FACEBOOK_UTIL_H */
@@ -0,0 +1,298 @@
+/**
+ * purple
+ *
+ * IRCv3 capability negotiation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include <purple.h>
+
+#include "irc.h"
+
+/* Keep CAP REQ lines well inside the 512 byte limit. */
+#define IRC_CAP_REQ_MAX 400
+
+#ifdef HAVE_CYRUS_SASL
+static gboolean irc_cap_want_sasl(struct irc_conn *irc);
+static void irc_cap_sasl(struct irc_conn *irc, const char *cap, gboolean enabled);
+#endif
+
+/*
+ * Every capability we know how to use.  Feature code that needs one adds
+ * it here; want decides per connection whether to ask for it (NULL means
+ * always), and cb, if set, is told when the server enables or drops it.
+ * Everything else just checks irc_cap_enabled() where it matters.
+ */
+static struct _irc_cap {
+	const char *name;
+	gboolean (*want)(struct irc_conn *irc);
+	void (*cb)(struct irc_conn *irc, const char *cap, gboolean enabled);
+} _irc_caps[] = {
+	{ "away-notify", NULL, NULL },		/* AWAY from channel members	*/
+	{ "batch", NULL, NULL },		/* BATCH grouping		*/
+	{ "cap-notify", NULL, NULL },		/* CAP NEW and CAP DEL		*/
+	{ "draft/chathistory", NULL, NULL },	/* Backlog on join		*/
+	{ "extended-join", NULL, NULL },	/* Account and realname on JOIN	*/
+	{ "message-tags", NULL, NULL },		/* Tags on any message		*/
+	{ "multi-prefix", NULL, NULL },		/* Every prefix in NAMES	*/
+#ifdef HAVE_CYRUS_SASL
+	{ "sasl", irc_cap_want_sasl, irc_cap_sasl },	/* SASL authentication	*/
+#endif
+	{ "server-time", NULL, NULL },		/* time tag on messages		*/
+	{ "userhost-in-names", NULL, NULL },	/* nick!user@host in NAMES	*/
+	{ NULL, NULL, NULL }
+};
+
+static struct _irc_cap *
+irc_cap_find(const char *name)
+{
+	int i;
+
+	for (i = 0; _irc_caps[i].name; i++) {
+		if (purple_strequal(_irc_caps[i].name, name))
+			return &_irc_caps[i];
+	}
+
+	return NULL;
+}
+
+static void
+irc_cap_send(struct irc_conn *irc, const char *subcmd, const char *arg)
+{
+	char *buf;
+
+	if (arg)
+		buf = irc_format(irc, "vv:", "CAP", subcmd, arg);
+	else
+		buf = irc_format(irc, "vv", "CAP", subcmd);
+	irc_send(irc, buf);
+	g_free(buf);
+}
+
+void irc_cap_start(struct irc_conn *irc)
+{
+	irc->caps_offered = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                          g_free, g_free);
+	irc->caps_enabled = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                          g_free, NULL);
+	irc->caps_negotiating = TRUE;
+
+	/* 302 gets us capability values and implicit cap-notify. */
+	irc_cap_send(irc, "LS", "302");
+}
+
+void irc_cap_free(struct irc_conn *irc)
+{
+	g_clear_pointer(&irc->caps_offered, g_hash_table_destroy);
+	g_clear_pointer(&irc->caps_enabled, g_hash_table_destroy);
+}
+
+void irc_cap_end(struct irc_conn *irc)
+{
+	if (!irc->caps_negotiating)
+		return;
+
+	irc->caps_negotiating = FALSE;
+	irc_cap_send(irc, "END", NULL);
+}
+
+gboolean irc_cap_enabled(struct irc_conn *irc, const char *cap)
+{
+	return irc->caps_enabled != NULL &&
+	       g_hash_table_contains(irc->caps_enabled, cap);
+}
+
+const char *irc_cap_get_value(struct irc_conn *irc, const char *cap)
+{
+	if (irc->caps_offered == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(irc->caps_offered, cap);
+}
+
+/* Finish registration once nothing is waiting on the server. */
+static void
+irc_cap_maybe_end(struct irc_conn *irc)
+{
+	if (irc->caps_pending > 0)
+		return;
+
+#ifdef HAVE_CYRUS_SASL
+	/* Authentication sends CAP END itself when it is done. */
+	if (irc->sasl_conn)
+		return;
+#endif
+
+	irc_cap_end(irc);
+}
+
+/* Ask for everything we want out of what is offered but not yet on. */
+static void
+irc_cap_request(struct irc_conn *irc)
+{
+	GString *req = g_string_new(NULL);
+	int i;
+
+	for (i = 0; _irc_caps[i].name; i++) {
+		struct _irc_cap *cap = &_irc_caps[i];
+
+		if (!g_hash_table_contains(irc->caps_offered, cap->name) ||
+		    g_hash_table_contains(irc->caps_enabled, cap->name) ||
+		    (cap->want && !cap->want(irc)))
+			continue;
+
+		if (req->len + strlen(cap->name) + 1 > IRC_CAP_REQ_MAX) {
+			irc_cap_send(irc, "REQ", req->str);
+			irc->caps_pending++;
+			g_string_truncate(req, 0);
+		}
+
+		if (req->len)
+			g_string_append_c(req, ' ');
+		g_string_append(req, cap->name);
+	}
+
+	if (req->len) {
+		irc_cap_send(irc, "REQ", req->str);
+		irc->caps_pending++;
+	}
+
+	g_string_free(req, TRUE);
+}
+
+static void
+irc_cap_set_enabled(struct irc_conn *irc, const char *name, gboolean enabled)
+{
+	struct _irc_cap *cap = irc_cap_find(name);
+
+	if (enabled)
+		g_hash_table_add(irc->caps_enabled, g_strdup(name));
+	else if (!g_hash_table_remove(irc->caps_enabled, name))
+		return;
+
+	purple_debug_info("irc", "Capability %s %s\n", name,
+	                  enabled ? "enabled" : "disabled");
+
+	if (cap && cap->cb)
+		cap->cb(irc, name, enabled);
+}
+
+static void
+irc_cap_add_offered(struct irc_conn *irc, char **caps)
+{
+	int i;
+
+	for (i = 0; caps[i]; i++) {
+		char *value;
+
+		if (*caps[i] == '\0')
+			continue;
+
+		if ((value = strchr(caps[i], '=')) != NULL)
+			*value++ = '\0';
+
+		g_hash_table_replace(irc->caps_offered, g_strdup(caps[i]),
+		                     g_strdup(value ? value : ""));
+	}
+}
+
+void irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	const char *subcmd = args[1];
+	char *list = g_strstrip(args[2]);
+	gboolean more = FALSE;
+	char **caps;
+	int i;
+
+	if (irc->caps_offered == NULL)
+		return;
+
+	/* Multi-line replies mark every line but the last with a '*'. */
+	if (list[0] == '*' && list[1] == ' ') {
+		more = TRUE;
+		list += 2;
+		if (*list == ':')
+			list++;
+	}
+
+	caps = g_strsplit(list, " ", -1);
+
+	if (purple_strequal(subcmd, "LS")) {
+		irc_cap_add_offered(irc, caps);
+		if (!more) {
+#ifdef HAVE_CYRUS_SASL
+			if (irc_cap_want_sasl(irc) &&
+			    !g_hash_table_contains(irc->caps_offered, "sasl")) {
+				irc_sasl_unavailable(irc);
+				g_strfreev(caps);
+				return;
+			}
+#endif
+			irc_cap_request(irc);
+			irc_cap_maybe_end(irc);
+		}
+	} else if (purple_strequal(subcmd, "NEW")) {
+		irc_cap_add_offered(irc, caps);
+		irc_cap_request(irc);
+	} else if (purple_strequal(subcmd, "DEL")) {
+		for (i = 0; caps[i]; i++) {
+			irc_cap_set_enabled(irc, caps[i], FALSE);
+			g_hash_table_remove(irc->caps_offered, caps[i]);
+		}
+	} else if (purple_strequal(subcmd, "ACK")) {
+		for (i = 0; caps[i]; i++) {
+			if (*caps[i] == '-')
+				irc_cap_set_enabled(irc, caps[i] + 1, FALSE);
+			else if (*caps[i])
+				irc_cap_set_enabled(irc, caps[i], TRUE);
+		}
+		if (irc->caps_pending > 0)
+			irc->caps_pending--;
+		irc_cap_maybe_end(irc);
+	} else if (purple_strequal(subcmd, "NAK")) {
+		for (i = 0; caps[i]; i++) {
+			purple_debug_info("irc", "Capability %s refused\n", caps[i]);
+#ifdef HAVE_CYRUS_SASL
+			if (purple_strequal(caps[i], "sasl"))
+				irc_sasl_unavailable(irc);
+#endif
+		}
+		if (irc->caps_pending > 0)
+			irc->caps_pending--;
+		irc_cap_maybe_end(irc);
+	}
+
+	g_strfreev(caps);
+}
+
+#ifdef HAVE_CYRUS_SASL
+static gboolean
+irc_cap_want_sasl(struct irc_conn *irc)
+{
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+	const char *pass = purple_connection_get_password(gc);
+
+	return pass && *pass &&
+	       purple_account_get_bool(irc->account, "sasl", FALSE);
+}
+
+static void
+irc_cap_sasl(struct irc_conn *irc, const char *cap, gboolean enabled)
+{
+	if (enabled && irc->caps_negotiating)
+		irc_sasl_start(irc);
+}
+#endif
@@ -22,6 +22,7 @@
 #include <errno.h>
 
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 
 #ifndef _WIN32
 # include <arpa/inet.h>
@@ -32,19 +33,27 @@
 
 #include "irc.h"
 
+/* How long to wait for an ACCEPT before receiving the whole file instead. */
+#define IRC_DCC_RESUME_TIMEOUT 30
+
 struct _IrcXfer {
 	PurpleXfer parent;
 
+	/* "Turbo" (TSEND) transfers are never acknowledged. */
+	gboolean turbo;
+
 	/* receive properties */
 	gchar *ip;
 	guint remote_port;
+	gboolean resuming;	/* sent DCC RESUME, waiting for ACCEPT */
+	guint resume_timer;
 
 	/* send properties */
 	GSocketService *service;
 	GSocketConnection *conn;
 	gint inpa;
-	guchar *rxqueue;
-	guint rxlen;
+	guchar ack[4];		/* a partly read acknowledgement */
+	guint acklen;
 };
 
 G_DEFINE_DYNAMIC_TYPE(IrcXfer, irc_xfer, PURPLE_TYPE_XFER);
@@ -62,7 +71,8 @@ static void irc_dccsend_recv_ack(PurpleXfer *xfer, const guchar *data, size_t si
 	guint32 l;
 	gssize result;
 
-	if(purple_xfer_get_xfer_type(xfer) != PURPLE_XFER_TYPE_RECEIVE) {
+	if(purple_xfer_get_xfer_type(xfer) != PURPLE_XFER_TYPE_RECEIVE ||
+	   IRC_XFER(xfer)->turbo) {
 		return;
 	}
 
@@ -74,14 +84,142 @@ static void irc_dccsend_recv_ack(PurpleXfer *xfer, const guchar *data, size_t si
 	}
 }
 
+/* Send a CTCP DCC request to the other end of the transfer. */
+static void irc_dccsend_ctcp(PurpleXfer *xfer, const char *request)
+{
+	PurpleConnection *gc =
+	        purple_account_get_connection(purple_xfer_get_account(xfer));
+	const char *arg[2];
+
+	arg[0] = purple_xfer_get_remote_user(xfer);
+	arg[1] = request;
+	irc_cmd_privmsg(purple_connection_get_protocol_data(gc), "msg", NULL, arg);
+}
+
+/* The sender never answered our RESUME; take the whole file instead. */
+static gboolean irc_dccsend_resume_timeout(gpointer data)
+{
+	PurpleXfer *xfer = data;
+	IrcXfer *xd = IRC_XFER(xfer);
+
+	xd->resume_timer = 0;
+	xd->resuming = FALSE;
+
+	if (purple_xfer_is_cancelled(xfer))
+		return G_SOURCE_REMOVE;
+
+	purple_debug_info("irc", "No reply to DCC RESUME for %s, receiving "
+	                  "it from the start", purple_xfer_get_filename(xfer));
+	purple_xfer_start(xfer, -1, xd->ip, xd->remote_port);
+
+	return G_SOURCE_REMOVE;
+}
+
 static void irc_dccsend_recv_init(PurpleXfer *xfer) {
 	IrcXfer *xd = IRC_XFER(xfer);
+	PurpleAccount *account = purple_xfer_get_account(xfer);
+	GStatBuf st;
+
+	/* If an earlier attempt left part of the file behind, ask the sender
+	 * to carry on from there (mIRC's DCC RESUME).  This appends to
+	 * whatever is at the chosen path, so it is only done when the user
+	 * asked for it. */
+	if (purple_account_get_bool(account, "dcc_resume", FALSE) &&
+	    g_stat(purple_xfer_get_local_filename(xfer), &st) == 0 &&
+	    st.st_size > 0 && st.st_size < purple_xfer_get_size(xfer)) {
+		char *request = g_strdup_printf(
+		        "\001DCC RESUME \"%s\" %u %" G_GOFFSET_FORMAT "\001",
+		        purple_xfer_get_filename(xfer), xd->remote_port,
+		        (goffset)st.st_size);
+
+		purple_debug_info("irc", "Asking to resume %s at %" G_GOFFSET_FORMAT,
+		                  purple_xfer_get_filename(xfer), (goffset)st.st_size);
+		xd->resuming = TRUE;
+		xd->resume_timer = g_timeout_add_seconds(IRC_DCC_RESUME_TIMEOUT,
+		                                         irc_dccsend_resume_timeout,
+		                                         xfer);
+		irc_dccsend_ctcp(xfer, request);
+		g_free(request);
+		return;
+	}
 
 	purple_xfer_start(xfer, -1, xd->ip, xd->remote_port);
 }
 
+/*
+ * Find our side of the transfer a DCC RESUME or ACCEPT refers to.  Only the
+ * port identifies it reliably; clients disagree on quoting the filename.
+ */
+static IrcXfer *irc_dccsend_find(struct irc_conn *irc, const char *from,
+                                 PurpleXferType type, guint port)
+{
+	GList *l;
+
+	for (l = purple_xfers_get_all(); l; l = l->next) {
+		PurpleXfer *xfer = l->data;
+		guint xfer_port;
+
+		if (!IRC_IS_XFER(xfer) ||
+		    purple_xfer_get_account(xfer) != irc->account ||
+		    purple_xfer_get_xfer_type(xfer) != type ||
+		    purple_utf8_strcasecmp(purple_xfer_get_remote_user(xfer), from))
+			continue;
+
+		if (type == PURPLE_XFER_TYPE_SEND)
+			xfer_port = purple_xfer_get_local_port(xfer);
+		else
+			xfer_port = IRC_XFER(xfer)->remote_port;
+
+		if (xfer_port == port)
+			return IRC_XFER(xfer);
+	}
+
+	return NULL;
+}
+
+/* Split "filename port position" off the end of a RESUME or ACCEPT. */
+static gboolean irc_dccsend_parse_resume(const char *msg, guint *port, goffset *pos)
+{
+	gchar **token = g_strsplit(msg, " ", 0);
+	guint n = g_strv_length(token);
+	gboolean ok = FALSE;
+
+	if (n >= 3) {
+		*port = strtoul(token[n - 2], NULL, 10);
+		*pos = g_ascii_strtoll(token[n - 1], NULL, 10);
+		ok = *port > 0 && *port <= G_MAXUINT16 && *pos > 0;
+	}
+
+	g_strfreev(token);
+	return ok;
+}
+
+/* The sender agreed to resume; connect and carry on from there. */
+void irc_dccsend_accept(struct irc_conn *irc, const char *from, const char *msg) {
+	IrcXfer *xd;
+	guint port;
+	goffset pos;
+
+	if (!irc_dccsend_parse_resume(msg, &port, &pos))
+		return;
+
+	xd = irc_dccsend_find(irc, from, PURPLE_XFER_TYPE_RECEIVE, port);
+	if (xd == NULL || !xd->resuming ||
+	    pos > purple_xfer_get_size(PURPLE_XFER(xd)))
+		return;
+
+	xd->resuming = FALSE;
+	if (xd->resume_timer > 0) {
+		g_source_remove(xd->resume_timer);
+		xd->resume_timer = 0;
+	}
+	purple_xfer_seek(PURPLE_XFER(xd), pos);
+	purple_xfer_start(PURPLE_XFER(xd), -1, xd->ip, xd->remote_port);
+}
+
 /* This function makes the necessary arrangements for receiving files */
-void irc_dccsend_recv(struct irc_conn *irc, const char *from, const char *msg) {
+void irc_dccsend_recv(struct irc_conn *irc, const char *from, const char *msg,
+                      gboolean turbo) {
 	IrcXfer *xfer;
 	gchar **token;
 	GString *filename;
@@ -129,9 +267,12 @@ void irc_dccsend_recv(struct irc_conn *irc, const char *from, const char *msg) {
 
 	purple_xfer_set_filename(PURPLE_XFER(xfer), filename->str);
 
+	xfer->turbo = turbo;
 	xfer->remote_port = atoi(token[i+1]);
 
-	nip = strtoul(token[i], NULL, 10);
+	/* The address is a number in host order; the bytes go in network
+	 * order. */
+	nip = g_htonl(strtoul(token[i], NULL, 10));
 	if (nip) {
 		GInetAddress *addr = g_inet_address_new_from_bytes(
 		        (const guchar *)&nip, G_SOCKET_FAMILY_IPV4);
@@ -142,7 +283,8 @@ void irc_dccsend_recv(struct irc_conn *irc, const char *from, const char *msg) {
 	}
 
 	purple_debug_info("irc", "Receiving file (%s) from %s", filename->str, xfer->ip);
-	purple_xfer_set_size(PURPLE_XFER(xfer), token[i+2] ? atoi(token[i+2]) : 0);
+	purple_xfer_set_size(PURPLE_XFER(xfer),
+	                     token[i+2] ? g_ascii_strtoll(token[i+2], NULL, 10) : 0);
 
 	purple_xfer_request(PURPLE_XFER(xfer));
 
@@ -154,13 +296,21 @@ void irc_dccsend_recv(struct irc_conn *irc, const char *from, const char *msg) {
  * Functions related to sending files via DCC SEND
  *******************************************************************/
 
-/* just in case you were wondering, this is why DCC is crappy */
+/*
+ * just in case you were wondering, this is why DCC is crappy
+ *
+ * The receiver acknowledges the running total (modulo 2^32) after every
+ * read.  The totals are cumulative, so only the newest one matters; the
+ * rest are drained without being kept.
+ */
 static void irc_dccsend_send_read(gpointer data, int source, PurpleInputCondition cond)
 {
 	PurpleXfer *xfer = PURPLE_XFER(data);
 	IrcXfer *xd = IRC_XFER(xfer);
-	char buffer[64];
-	int len;
+	guchar buffer[1024];
+	gboolean have_ack = FALSE;
+	guint32 acked = 0;
+	int len, i;
 
 	len = read(source, buffer, sizeof(buffer));
 
@@ -173,37 +323,24 @@ static void irc_dccsend_send_read(gpointer data, int source, PurpleInputConditio
 		return;
 	}
 
-	xd->rxqueue = g_realloc(xd->rxqueue, len + xd->rxlen);
-	memcpy(xd->rxqueue + xd->rxlen, buffer, len);
-	xd->rxlen += len;
-
-	while (1) {
-		gint32 val;
-		size_t acked;
-
-		if (xd->rxlen < 4)
-			break;
+	for (i = 0; i < len; i++) {
+		xd->ack[xd->acklen++] = buffer[i];
+		if (xd->acklen == sizeof(xd->ack)) {
+			guint32 val;
 
-		memcpy(&val, xd->rxqueue, sizeof(val));
-		acked = g_ntohl(val);
-
-		xd->rxlen -= 4;
-		if (xd->rxlen) {
-			unsigned char *tmp = g_memdup2(xd->rxqueue + 4, xd->rxlen);
-			g_free(xd->rxqueue);
-			xd->rxqueue = tmp;
-		} else {
-			g_free(xd->rxqueue);
-			xd->rxqueue = NULL;
+			memcpy(&val, xd->ack, sizeof(val));
+			acked = g_ntohl(val);
+			have_ack = TRUE;
+			xd->acklen = 0;
 		}
+	}
 
-		if ((goffset)acked >= purple_xfer_get_size(xfer)) {
-			purple_input_remove(xd->inpa);
-			xd->inpa = 0;
-			purple_xfer_set_completed(xfer, TRUE);
-			purple_xfer_end(xfer);
-			return;
-		}
+	if (have_ack && purple_xfer_get_bytes_remaining(xfer) == 0 &&
+	    acked == (guint32)purple_xfer_get_size(xfer)) {
+		purple_input_remove(xd->inpa);
+		xd->inpa = 0;
+		purple_xfer_set_completed(xfer, TRUE);
+		purple_xfer_end(xfer);
 	}
 }
 
@@ -244,8 +381,11 @@ irc_dccsend_send_connected(GSocketService *service,
 	fd = g_socket_get_fd(sock);
 	_purple_network_set_common_socket_flags(fd);
 
-	xd->inpa = purple_input_add(fd, PURPLE_INPUT_READ, irc_dccsend_send_read,
-	                            xfer);
+	/* Turbo receivers never acknowledge anything. */
+	if (!xd->turbo) {
+		xd->inpa = purple_input_add(fd, PURPLE_INPUT_READ,
+		                            irc_dccsend_send_read, xfer);
+	}
 	/* Start the transfer */
 	purple_xfer_start(xfer, fd, NULL, 0);
 }
@@ -257,10 +397,9 @@ static void
 irc_dccsend_send_init(PurpleXfer *xfer)
 {
 	IrcXfer *xd = IRC_XFER(xfer);
-	PurpleConnection *gc =
-	        purple_account_get_connection(purple_xfer_get_account(xfer));
+	PurpleAccount *account = purple_xfer_get_account(xfer);
+	PurpleConnection *gc = purple_account_get_connection(account);
 	struct irc_conn *irc;
-	const char *arg[2];
 	char *tmp;
 	GInetAddress *addr = NULL;
 	const guint8 *bytes = NULL;
@@ -304,19 +443,50 @@ irc_dccsend_send_init(PurpleXfer *xfer)
 	purple_debug_misc("irc", "port is %hu\n", port);
 
 	/* Send the intended recipient the DCC request */
-	arg[0] = purple_xfer_get_remote_user(xfer);
+	xd->turbo = purple_account_get_bool(account, "dcc_turbo", FALSE);
 	tmp = purple_network_get_my_ip_from_gio(irc->conn);
 	addr = g_inet_address_new_from_string(tmp);
 	bytes = g_inet_address_to_bytes(addr);
 	ip = (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
 	g_object_unref(addr);
 	g_free(tmp);
-	arg[1] = tmp = g_strdup_printf(
-	        "\001DCC SEND \"%s\" %u %hu %" G_GOFFSET_FORMAT "\001",
+	tmp = g_strdup_printf(
+	        "\001DCC %s \"%s\" %u %hu %" G_GOFFSET_FORMAT "\001",
+	        xd->turbo ? "TSEND" : "SEND",
 	        purple_xfer_get_filename(xfer), ip, port,
 	        purple_xfer_get_size(xfer));
 
-	irc_cmd_privmsg(purple_connection_get_protocol_data(gc), "msg", NULL, arg);
+	irc_dccsend_ctcp(xfer, tmp);
+	g_free(tmp);
+}
+
+/* The receiver has part of the file already and wants the rest. */
+void irc_dccsend_resume(struct irc_conn *irc, const char *from, const char *msg) {
+	IrcXfer *xd;
+	PurpleXfer *xfer;
+	guint port;
+	goffset pos;
+	char *tmp;
+
+	if (!irc_dccsend_parse_resume(msg, &port, &pos))
+		return;
+
+	/* Only before they connect; the file is opened at that point. */
+	xd = irc_dccsend_find(irc, from, PURPLE_XFER_TYPE_SEND, port);
+	if (xd == NULL || xd->service == NULL)
+		return;
+
+	xfer = PURPLE_XFER(xd);
+	if (pos >= purple_xfer_get_size(xfer))
+		return;
+
+	purple_debug_info("irc", "Resuming %s at %" G_GOFFSET_FORMAT,
+	                  purple_xfer_get_filename(xfer), pos);
+	purple_xfer_seek(xfer, pos);
+
+	tmp = g_strdup_printf("\001DCC ACCEPT \"%s\" %u %" G_GOFFSET_FORMAT "\001",
+	                      purple_xfer_get_filename(xfer), port, pos);
+	irc_dccsend_ctcp(xfer, tmp);
 	g_free(tmp);
 }
 
@@ -373,7 +543,9 @@ irc_xfer_finalize(GObject *obj) {
 
 	/* clean up the receiving proprties */
 	g_free(xfer->ip);
-	g_free(xfer->rxqueue);
+	if (xfer->resume_timer > 0) {
+		g_source_remove(xfer->resume_timer);
+	}
 
 	/* clean up the sending properties */
 	if (xfer->service) {
@@ -253,6 +253,175 @@ irc_push_bytes_cb(GObject *source, GAsyncResult *res, gpointer data)
 	}
 }
 
+static void
+irc_send_write(struct irc_conn *irc, GString *line)
+{
+	GBytes *data = g_string_free_to_bytes(line);
+
+	purple_queued_output_stream_push_bytes_async(irc->output, data,
+			G_PRIORITY_DEFAULT, irc->cancellable, irc_push_bytes_cb,
+			purple_account_get_connection(irc->account));
+	g_bytes_unref(data);
+}
+
+static gboolean
+irc_send_has_command(const char *line, const char *cmd)
+{
+	gsize len = strlen(cmd);
+
+	return g_ascii_strncasecmp(line, cmd, len) == 0 &&
+	       (line[len] == ' ' || line[len] == '\r' || line[len] == '\0');
+}
+
+static enum irc_send_priority
+irc_send_get_priority(const char *line)
+{
+	/* Registration waits on CAP and AUTHENTICATE, so never hold them. */
+	if (irc_send_has_command(line, "PONG") ||
+	    irc_send_has_command(line, "QUIT") ||
+	    irc_send_has_command(line, "CAP") ||
+	    irc_send_has_command(line, "AUTHENTICATE"))
+		return IRC_SEND_URGENT;
+
+	if (irc_send_has_command(line, "ISON") ||
+	    irc_send_has_command(line, "WHO"))
+		return IRC_SEND_BACKGROUND;
+
+	return IRC_SEND_NORMAL;
+}
+
+/*
+ * If line is a JOIN without keys, return where its channel list starts.
+ * "JOIN 0" parts every channel, so it is never merged.
+ */
+static const char *
+irc_send_get_join_channels(const char *line, gsize len)
+{
+	const char *chans;
+
+	if (len < 7 || !irc_send_has_command(line, "JOIN") ||
+	    line[4] != ' ' || strncmp(line + len - 2, "\r\n", 2) != 0)
+		return NULL;
+
+	chans = line + 5;
+	if (memchr(chans, ' ', line + len - 2 - chans) != NULL ||
+	    strncmp(chans, "0\r\n", 3) == 0)
+		return NULL;
+
+	return chans;
+}
+
+/* Fold a keyless JOIN into one already waiting at the end of the queue. */
+static gboolean
+irc_send_coalesce(GQueue *queue, const char *line, gsize len)
+{
+	GString *tail = g_queue_peek_tail(queue);
+	const char *chans;
+
+	if (tail == NULL ||
+	    (chans = irc_send_get_join_channels(line, len)) == NULL ||
+	    irc_send_get_join_channels(tail->str, tail->len) == NULL)
+		return FALSE;
+
+	if (tail->len + (line + len - chans) + 1 > IRC_MAX_MSG_SIZE)
+		return FALSE;
+
+	g_string_truncate(tail, tail->len - 2);
+	g_string_append_c(tail, ',');
+	g_string_append_len(tail, chans, line + len - chans);
+
+	return TRUE;
+}
+
+static void
+irc_send_refill(struct irc_conn *irc)
+{
+	PurpleAccount *account = irc->account;
+	gint64 interval, now, gained;
+	guint burst;
+
+	burst = purple_account_get_int(account, "send_burst",
+	                               IRC_DEFAULT_SEND_BURST);
+	interval = purple_account_get_int(account, "send_interval",
+	                                  IRC_DEFAULT_SEND_INTERVAL);
+	interval *= G_TIME_SPAN_MILLISECOND;
+	now = g_get_monotonic_time();
+
+	if (interval <= 0) {
+		irc->send_tokens = G_MAXUINT;
+		irc->send_refill = now;
+		return;
+	}
+
+	burst = MAX(burst, 1);
+	gained = (now - irc->send_refill) / interval;
+	if (irc->send_tokens + gained >= burst) {
+		irc->send_tokens = burst;
+		irc->send_refill = now;
+	} else if (gained > 0) {
+		irc->send_tokens += gained;
+		irc->send_refill += gained * interval;
+	}
+}
+
+static gboolean irc_send_timeout(gpointer data);
+
+/* Write out as many queued lines as the bucket allows. */
+static void
+irc_send_flush(struct irc_conn *irc)
+{
+	guint before = irc_send_queue_get_length(irc);
+	guint after;
+	int i;
+
+	irc_send_refill(irc);
+
+	for (i = IRC_SEND_NORMAL; i < IRC_SEND_PRIORITIES; i++) {
+		while (irc->send_tokens > 0 && !g_queue_is_empty(&irc->send_queue[i])) {
+			irc_send_write(irc, g_queue_pop_head(&irc->send_queue[i]));
+			irc->send_tokens--;
+		}
+	}
+
+	after = irc_send_queue_get_length(irc);
+	if (after > 0 && irc->send_timer == 0) {
+		gint64 interval = purple_account_get_int(irc->account,
+				"send_interval", IRC_DEFAULT_SEND_INTERVAL);
+		gint64 wait = irc->send_refill / G_TIME_SPAN_MILLISECOND +
+				interval - g_get_monotonic_time() / G_TIME_SPAN_MILLISECOND;
+
+		irc->send_timer = g_timeout_add(CLAMP(wait, 1, interval),
+				irc_send_timeout, irc);
+	}
+
+	if (after != before) {
+		purple_signal_emit(_irc_protocol, "irc-send-queue-changed",
+				purple_account_get_connection(irc->account), after);
+	}
+}
+
+static gboolean
+irc_send_timeout(gpointer data)
+{
+	struct irc_conn *irc = data;
+
+	irc->send_timer = 0;
+	irc_send_flush(irc);
+
+	return G_SOURCE_REMOVE;
+}
+
+guint irc_send_queue_get_length(struct irc_conn *irc)
+{
+	guint len = 0;
+	int i;
+
+	for (i = IRC_SEND_NORMAL; i < IRC_SEND_PRIORITIES; i++)
+		len += g_queue_get_length(&irc->send_queue[i]);
+
+	return len;
+}
+
 int irc_send(struct irc_conn *irc, const char *buf)
 {
     return irc_send_len(irc, buf, strlen(buf));
@@ -262,7 +431,8 @@ int irc_send_len(struct irc_conn *irc, const char *buf, int buflen)
 {
  	char *tosend = g_strdup(buf);
 	int len;
-	GBytes *data;
+	enum irc_send_priority priority;
+	GQueue *queue;
 
 	purple_signal_emit(_irc_protocol, "irc-sending-text", purple_account_get_connection(irc->account), &tosend);
 
@@ -277,11 +447,24 @@ int irc_send_len(struct irc_conn *irc, const char *buf, int buflen)
 	}
 
 	len = strlen(tosend);
-	data = g_bytes_new_take(tosend, len);
-	purple_queued_output_stream_push_bytes_async(irc->output, data,
-			G_PRIORITY_DEFAULT, irc->cancellable, irc_push_bytes_cb,
-			purple_account_get_connection(irc->account));
-	g_bytes_unref(data);
+	priority = irc_send_get_priority(tosend);
+
+	if (priority == IRC_SEND_URGENT) {
+		/* Still counts against the server's limit, but never waits. */
+		irc_send_refill(irc);
+		if (irc->send_tokens > 0)
+			irc->send_tokens--;
+		irc_send_write(irc, g_string_new_len(tosend, len));
+		g_free(tosend);
+		return len;
+	}
+
+	queue = &irc->send_queue[priority];
+	if (!irc_send_coalesce(queue, tosend, len))
+		g_queue_push_tail(queue, g_string_new_len(tosend, len));
+	g_free(tosend);
+
+	irc_send_flush(irc);
 
 	return len;
 }
@@ -332,7 +515,90 @@ void irc_buddy_query(struct irc_conn *irc)
 
 static void irc_ison_buddy_init(char *name, struct irc_buddy *ib, GList **list)
 {
-	*list = g_list_append(*list, ib);
+	if (!ib->monitored)
+		*list = g_list_append(*list, ib);
+}
+
+static void irc_buddy_monitor_send(struct irc_conn *irc, GString *string)
+{
+	char *buf;
+
+	if (string->len == 0)
+		return;
+
+	if (irc->presence == IRC_PRESENCE_MONITOR)
+		buf = irc_format(irc, "vvn", "MONITOR", "+", string->str);
+	else
+		buf = irc_format(irc, "vn", "WATCH", string->str);
+	irc_send(irc, buf);
+	g_free(buf);
+
+	g_string_truncate(string, 0);
+}
+
+/*
+ * Ask the server to tell us when these buddies come and go, as far as
+ * its limit allows.  Anyone left over keeps being polled with ISON.
+ */
+void irc_buddy_monitor(struct irc_conn *irc, GList *buddies)
+{
+	GString *string;
+	GList *lp;
+
+	if (irc->presence == IRC_PRESENCE_ISON)
+		return;
+
+	string = g_string_sized_new(512);
+
+	for (lp = buddies; lp; lp = lp->next) {
+		struct irc_buddy *ib = lp->data;
+
+		if (ib->monitored)
+			continue;
+		if (irc->presence_limit &&
+		    irc->presence_count >= irc->presence_limit)
+			break;
+
+		if (string->len + strlen(ib->name) + 2 > 450)
+			irc_buddy_monitor_send(irc, string);
+
+		if (irc->presence == IRC_PRESENCE_MONITOR) {
+			if (string->len)
+				g_string_append_c(string, ',');
+			g_string_append(string, ib->name);
+		} else {
+			if (string->len)
+				g_string_append_c(string, ' ');
+			g_string_append_printf(string, "+%s", ib->name);
+		}
+
+		ib->monitored = TRUE;
+		irc->presence_count++;
+	}
+
+	irc_buddy_monitor_send(irc, string);
+	g_string_free(string, TRUE);
+}
+
+static void irc_buddy_unmonitor(struct irc_conn *irc, struct irc_buddy *ib)
+{
+	char *buf, *tmp;
+
+	if (!ib->monitored)
+		return;
+
+	if (irc->presence == IRC_PRESENCE_MONITOR) {
+		buf = irc_format(irc, "vvn", "MONITOR", "-", ib->name);
+	} else {
+		tmp = g_strdup_printf("-%s", ib->name);
+		buf = irc_format(irc, "vn", "WATCH", tmp);
+		g_free(tmp);
+	}
+	irc_send(irc, buf);
+	g_free(buf);
+
+	ib->monitored = FALSE;
+	irc->presence_count--;
 }
 
 
@@ -447,6 +713,9 @@ static void irc_login(PurpleAccount *account)
 	purple_connection_set_protocol_data(gc, irc);
 	irc->account = account;
 	irc->cancellable = g_cancellable_new();
+	irc->send_tokens = purple_account_get_int(account, "send_burst",
+	                                          IRC_DEFAULT_SEND_BURST);
+	irc->send_refill = g_get_monotonic_time();
 
 	userparts = g_strsplit(username, "@", 2);
 	purple_connection_set_display_name(gc, userparts[0]);
@@ -457,8 +726,6 @@ static void irc_login(PurpleAccount *account)
 					     NULL, (GDestroyNotify)irc_buddy_free);
 	irc->cmds = g_hash_table_new(g_str_hash, g_str_equal);
 	irc_cmd_table_build(irc);
-	irc->msgs = g_hash_table_new(g_str_hash, g_str_equal);
-	irc_msg_table_build(irc);
 
 	purple_connection_update_progress(gc, _("Connecting"), 1, 2);
 
@@ -492,18 +759,23 @@ static gboolean do_login(PurpleConnection *gc) {
 	const gboolean use_sasl = purple_account_get_bool(irc->account, "sasl", FALSE);
 #endif
 
+	/* Registration waits for CAP END from here on; servers that don't
+	 * know CAP just ignore it. */
+	irc_cap_start(irc);
+
 	if (pass && *pass) {
 #ifdef HAVE_CYRUS_SASL
-		if (use_sasl)
-			buf = irc_format(irc, "vv:", "CAP", "REQ", "sasl");
-		else /* intended to fall through */
+		/* The password goes through SASL once the server ACKs it. */
+		if (!use_sasl)
 #endif
+		{
 			buf = irc_format(irc, "v:", "PASS", pass);
-		if (irc_send(irc, buf) < 0) {
+			if (irc_send(irc, buf) < 0) {
+				g_free(buf);
+				return FALSE;
+			}
 			g_free(buf);
-			return FALSE;
 		}
-		g_free(buf);
 	}
 
 	nickname = purple_connection_get_display_name(gc);
@@ -581,6 +853,7 @@ irc_login_cb(GObject *source, GAsyncResult *res, gpointer user_data)
 static void irc_close(PurpleConnection *gc)
 {
 	struct irc_conn *irc = purple_connection_get_protocol_data(gc);
+	int i;
 
 	if (irc == NULL)
 		return;
@@ -605,9 +878,17 @@ static void irc_close(PurpleConnection *gc)
 
 	if (irc->timer)
 		g_source_remove(irc->timer);
+	if (irc->send_timer)
+		g_source_remove(irc->send_timer);
+	for (i = 0; i < IRC_SEND_PRIORITIES; i++) {
+		while (!g_queue_is_empty(&irc->send_queue[i]))
+			g_string_free(g_queue_pop_head(&irc->send_queue[i]), TRUE);
+	}
 	g_hash_table_destroy(irc->cmds);
-	g_hash_table_destroy(irc->msgs);
 	g_hash_table_destroy(irc->buddies);
+	irc_cap_free(irc);
+	if (irc->batches)
+		g_hash_table_destroy(irc->batches);
 	if (irc->motd)
 		g_string_free(irc->motd, TRUE);
 	g_free(irc->server);
@@ -707,8 +988,15 @@ irc_add_buddy(PurpleProtocolServer *protocol_server, PurpleConnection *gc,
 	/* if the timer isn't set, this is during signon, so we don't want to flood
 	 * ourself off with ISON's, so we don't, but after that we want to know when
 	 * someone's online asap */
-	if (irc->timer)
-		irc_ison_one(irc, ib);
+	if (irc->timer) {
+		GList *one = g_list_prepend(NULL, ib);
+
+		irc_buddy_monitor(irc, one);
+		g_list_free(one);
+
+		if (!ib->monitored)
+			irc_ison_one(irc, ib);
+	}
 }
 
 static void
@@ -720,6 +1008,7 @@ irc_remove_buddy(PurpleProtocolServer *protocol_server, PurpleConnection *gc,
 
 	ib = g_hash_table_lookup(irc->buddies, purple_buddy_get_name(buddy));
 	if (ib && --ib->ref == 0) {
+		irc_buddy_unmonitor(irc, ib);
 		g_hash_table_remove(irc->buddies, purple_buddy_get_name(buddy));
 	}
 }
@@ -1004,6 +1293,24 @@ irc_protocol_init(IRCProtocol *self)
 	protocol->account_options = g_list_append(protocol->account_options, option);
 	*/
 
+	option = purple_account_option_int_new(_("Lines sent before throttling"),
+			"send_burst", IRC_DEFAULT_SEND_BURST);
+	protocol->account_options = g_list_append(protocol->account_options, option);
+
+	option = purple_account_option_int_new(
+			_("Milliseconds between throttled lines (0 to disable)"),
+			"send_interval", IRC_DEFAULT_SEND_INTERVAL);
+	protocol->account_options = g_list_append(protocol->account_options, option);
+
+	option = purple_account_option_bool_new(
+			_("Resume partially received DCC files"), "dcc_resume", FALSE);
+	protocol->account_options = g_list_append(protocol->account_options, option);
+
+	option = purple_account_option_bool_new(
+			_("Send files without acknowledgements (DCC TSEND)"),
+			"dcc_turbo", FALSE);
+	protocol->account_options = g_list_append(protocol->account_options, option);
+
 	option = purple_account_option_bool_new(_("Use SSL"), "ssl", FALSE);
 	protocol->account_options = g_list_append(protocol->account_options, option);
 
@@ -1140,6 +1447,7 @@ plugin_load(PurplePlugin *plugin, GError **error)
 	purple_prefs_remove("/plugins/prpl/irc");
 
 	irc_register_commands();
+	irc_msg_table_build();
 
 	purple_signal_register(_irc_protocol, "irc-sending-text",
 			     purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
@@ -1149,6 +1457,10 @@ plugin_load(PurplePlugin *plugin, GError **error)
 			     purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
 			     PURPLE_TYPE_CONNECTION,
 			     G_TYPE_POINTER); /* pointer to a string */
+	purple_signal_register(_irc_protocol, "irc-send-queue-changed",
+			     purple_marshal_VOID__POINTER_UINT, G_TYPE_NONE, 2,
+			     PURPLE_TYPE_CONNECTION,
+			     G_TYPE_UINT); /* lines waiting to be sent */
 
 	purple_signal_connect(purple_get_core(), "uri-handler", plugin,
 			PURPLE_CALLBACK(irc_uri_handler), NULL);
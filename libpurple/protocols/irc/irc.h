@@ -49,16 +49,41 @@
 
 #define IRC_DEFAULT_QUIT "Leaving."
 
+/* The classic ircd flood limit (RFC 1459, section 8.10): a burst of five
+ * lines, then one every two seconds. */
+#define IRC_DEFAULT_SEND_BURST 5
+#define IRC_DEFAULT_SEND_INTERVAL 2000
+
 #define IRC_BUFSIZE_INCREMENT 1024
 #define IRC_MAX_BUFSIZE 16384
 
 #define IRC_MAX_MSG_SIZE 512
 
 #define IRC_NAMES_FLAG "irc-namelist"
+/* server-time of the newest message seen in a chat, for CHATHISTORY */
+#define IRC_HISTORY_TIME "irc-history-time"
+
+/* Messages to ask for when rejoining, unless ISUPPORT says fewer. */
+#define IRC_CHATHISTORY_LIMIT 50
 
 enum { IRC_USEROPT_SERVER, IRC_USEROPT_PORT, IRC_USEROPT_CHARSET };
 enum irc_state { IRC_STATE_NEW, IRC_STATE_ESTABLISHED };
 
+/* How buddy presence is tracked, from the server's ISUPPORT tokens. */
+enum irc_presence {
+	IRC_PRESENCE_ISON,	/* poll with ISON */
+	IRC_PRESENCE_MONITOR,	/* IRCv3 MONITOR */
+	IRC_PRESENCE_WATCH	/* legacy WATCH */
+};
+
+/* Outgoing lines are paced by priority; urgent ones are never held. */
+enum irc_send_priority {
+	IRC_SEND_URGENT,	/* PONG, QUIT and registration */
+	IRC_SEND_NORMAL,
+	IRC_SEND_BACKGROUND,	/* ISON and WHO polling */
+	IRC_SEND_PRIORITIES
+};
+
 typedef struct
 {
 	PurpleProtocol parent;
@@ -71,7 +96,6 @@ typedef struct
 
 struct irc_conn {
 	PurpleAccount *account;
-	GHashTable *msgs;
 	GHashTable *cmds;
 	char *server;
 	GSocketConnection *conn;
@@ -82,9 +106,20 @@ struct irc_conn {
 	gboolean ison_outstanding;
 	GList *buddies_outstanding;
 
+	enum irc_presence presence;
+	guint presence_limit;	/* 0 for no limit */
+	guint presence_count;	/* buddies the server is watching for us */
+
 	GDataInputStream *input;
 	PurpleQueuedOutputStream *output;
 
+	/* Lines held back by the token bucket, one queue of GStrings per
+	 * priority below IRC_SEND_URGENT. */
+	GQueue send_queue[IRC_SEND_PRIORITIES];
+	guint send_tokens;
+	gint64 send_refill;
+	guint send_timer;
+
 	GString *motd;
 	GString *names;
 	struct _whois {
@@ -108,6 +143,17 @@ struct irc_conn {
 
 	time_t recv_time;
 
+	/* IRCv3 capabilities, see cap.c */
+	GHashTable *caps_offered;	/* name -> value, "" if none */
+	GHashTable *caps_enabled;
+	guint caps_pending;		/* CAP REQs not answered yet */
+	gboolean caps_negotiating;	/* until CAP END is sent */
+
+	/* Tags of the message being dispatched, still escaped, or NULL */
+	const char *tags;
+	GHashTable *batches;		/* open BATCH reference -> type */
+	guint chathistory_limit;
+
 	char *mode_chars;
 	char *reqnick;
 	gboolean nickused;
@@ -125,6 +171,7 @@ struct irc_buddy {
 	gboolean online;
 	gboolean flag;
  	gboolean new_online_status;
+	gboolean monitored;	/* pushed by MONITOR/WATCH rather than polled */
 	int ref;
 };
 
@@ -134,9 +181,11 @@ G_MODULE_EXPORT GType irc_protocol_get_type(void);
 
 int irc_send(struct irc_conn *irc, const char *buf);
 int irc_send_len(struct irc_conn *irc, const char *buf, int len);
+guint irc_send_queue_get_length(struct irc_conn *irc);
 gboolean irc_blist_timeout(struct irc_conn *irc);
 gboolean irc_who_channel_timeout(struct irc_conn *irc);
 void irc_buddy_query(struct irc_conn *irc);
+void irc_buddy_monitor(struct irc_conn *irc, GList *buddies);
 
 char *irc_escape_privmsg(const char *text, gssize length);
 
@@ -149,7 +198,7 @@ gboolean irc_ischannel(const char *string);
 
 void irc_register_commands(void);
 void irc_unregister_commands(void);
-void irc_msg_table_build(struct irc_conn *irc);
+void irc_msg_table_build(void);
 void irc_parse_msg(struct irc_conn *irc, char *input);
 char *irc_parse_ctcp(struct irc_conn *irc, const char *from, const char *to, const char *msg, int notice);
 char *irc_format(struct irc_conn *irc, const char *format, ...);
@@ -172,6 +221,8 @@ void irc_msg_kick(struct irc_conn *irc, const char *name, const char *from, char
 void irc_msg_list(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_luser(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_mode(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_monitor(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_monlistfull(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_motd(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_names(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_nick(struct irc_conn *irc, const char *name, const char *from, char **args);
@@ -195,10 +246,26 @@ void irc_msg_topicinfo(struct irc_conn *irc, const char *name, const char *from,
 void irc_msg_unavailable(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_unknown(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_wallops(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_watch(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_whois(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_who(struct irc_conn *irc, const char *name, const char *from, char **args);
-#ifdef HAVE_CYRUS_SASL
+void irc_msg_away_notify(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_batch(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args);
+
+void irc_cap_start(struct irc_conn *irc);
+void irc_cap_end(struct irc_conn *irc);
+void irc_cap_free(struct irc_conn *irc);
+gboolean irc_cap_enabled(struct irc_conn *irc, const char *cap);
+const char *irc_cap_get_value(struct irc_conn *irc, const char *cap);
+
+char *irc_tag_get(struct irc_conn *irc, const char *key);
+time_t irc_msg_get_time(struct irc_conn *irc);
+gboolean irc_msg_is_replay(struct irc_conn *irc);
+
+#ifdef HAVE_CYRUS_SASL
+void irc_sasl_start(struct irc_conn *irc);
+void irc_sasl_unavailable(struct irc_conn *irc);
 void irc_msg_auth(struct irc_conn *irc, char *arg);
 void irc_msg_authenticate(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_authok(struct irc_conn *irc, const char *name, const char *from, char **args);
@@ -242,6 +309,8 @@ void irc_xfer_register(GTypeModule *module);
 
 PurpleXfer *irc_dccsend_new_xfer(PurpleProtocolXfer *prplxfer, PurpleConnection *gc, const char *who);
 void irc_dccsend_send_file(PurpleProtocolXfer *prplxfer, PurpleConnection *gc, const char *who, const char *file);
-void irc_dccsend_recv(struct irc_conn *irc, const char *from, const char *msg);
+void irc_dccsend_recv(struct irc_conn *irc, const char *from, const char *msg, gboolean turbo);
+void irc_dccsend_resume(struct irc_conn *irc, const char *from, const char *msg);
+void irc_dccsend_accept(struct irc_conn *irc, const char *from, const char *msg);
 
 #endif /* PURPLE_IRC_IRC_H */
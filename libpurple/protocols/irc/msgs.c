@@ -43,7 +43,9 @@ static char *irc_mask_nick(const char *mask);
 static char *irc_mask_userhost(const char *mask);
 static void irc_chat_remove_buddy(PurpleChatConversation *chat, char *data[2]);
 static void irc_buddy_status(char *name, struct irc_buddy *ib, struct irc_conn *irc);
+static void irc_buddy_ison_status(char *name, struct irc_buddy *ib, struct irc_conn *irc);
 static void irc_connected(struct irc_conn *irc, const char *nick);
+static void irc_chathistory_request(struct irc_conn *irc, PurpleChatConversation *chat);
 
 static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name,
                                    const char *from, const char *to,
@@ -118,6 +120,14 @@ static void irc_connected(struct irc_conn *irc, const char *nick)
 		g_hash_table_replace(irc->buddies, ib->name, ib);
 	}
 
+	/* With MONITOR or WATCH the server tells us about presence changes
+	 * as they happen, and polling only covers whoever didn't fit. */
+	if (irc->presence != IRC_PRESENCE_ISON) {
+		GList *list = g_hash_table_get_values(irc->buddies);
+		irc_buddy_monitor(irc, list);
+		g_list_free(list);
+	}
+
 	irc_blist_timeout(irc);
 	if (!irc->timer)
 		irc->timer = g_timeout_add_seconds(45, (GSourceFunc)irc_blist_timeout, (gpointer)irc);
@@ -209,6 +219,20 @@ void irc_msg_features(struct irc_conn *irc, const char *name, const char *from,
 		if (!strncmp(features[i], "PREFIX=", 7)) {
 			if ((val = strchr(features[i] + 7, ')')) != NULL)
 				irc->mode_chars = g_strdup(val + 1);
+		} else if (!strncmp(features[i], "MONITOR", 7) &&
+		           (features[i][7] == '\0' || features[i][7] == '=')) {
+			/* Preferred over WATCH when a server offers both. */
+			irc->presence = IRC_PRESENCE_MONITOR;
+			irc->presence_limit = features[i][7] ?
+				strtoul(features[i] + 8, NULL, 10) : 0;
+		} else if (!strncmp(features[i], "WATCH", 5) &&
+		           (features[i][5] == '\0' || features[i][5] == '=') &&
+		           irc->presence != IRC_PRESENCE_MONITOR) {
+			irc->presence = IRC_PRESENCE_WATCH;
+			irc->presence_limit = features[i][5] ?
+				strtoul(features[i] + 6, NULL, 10) : 0;
+		} else if (!strncmp(features[i], "CHATHISTORY=", 12)) {
+			irc->chathistory_limit = strtoul(features[i] + 12, NULL, 10);
 		}
 	}
 
@@ -246,6 +270,63 @@ void irc_msg_away(struct irc_conn *irc, const char *name, const char *from, char
 	}
 }
 
+/* away-notify: a channel member or buddy went away or came back. */
+void irc_msg_away_notify(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+	gboolean away = args[0] && *args[0];
+	struct irc_buddy *ib;
+	GSList *chats;
+	char *nick;
+
+	g_return_if_fail(gc);
+
+	nick = irc_mask_nick(from);
+
+	for (chats = purple_connection_get_active_chats(gc); chats; chats = chats->next) {
+		PurpleChatUser *cb;
+		PurpleChatUserFlags flags;
+
+		cb = purple_chat_conversation_find_user(chats->data, nick);
+		if (!cb)
+			continue;
+
+		flags = purple_chat_user_get_flags(cb);
+		if (away)
+			flags |= PURPLE_CHAT_USER_AWAY;
+		else
+			flags &= ~PURPLE_CHAT_USER_AWAY;
+		purple_chat_user_set_flags(cb, flags);
+	}
+
+	if ((ib = g_hash_table_lookup(irc->buddies, nick)) != NULL && ib->online) {
+		if (away)
+			purple_protocol_got_user_status(irc->account, ib->name,
+				"away", "message", args[0], NULL);
+		else
+			purple_protocol_got_user_status(irc->account, ib->name,
+				"available", NULL);
+	}
+
+	g_free(nick);
+}
+
+/* BATCH +ref type [params] opens a batch, BATCH -ref closes it. */
+void irc_msg_batch(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	const char *ref = args[0];
+
+	if (*ref == '+' && args[1]) {
+		if (!irc->batches)
+			irc->batches = g_hash_table_new_full(g_str_hash, g_str_equal,
+			                                     g_free, g_free);
+		g_hash_table_replace(irc->batches, g_strdup(ref + 1),
+		                     g_strndup(args[1], strcspn(args[1], " ")));
+	} else if (*ref == '-' && irc->batches) {
+		g_hash_table_remove(irc->batches, ref + 1);
+	}
+}
+
 void irc_msg_badmode(struct irc_conn *irc, const char *name, const char *from, char **args)
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
@@ -649,6 +730,12 @@ void irc_msg_unknown(struct irc_conn *irc, const char *name, const char *from, c
 
 	g_return_if_fail(gc);
 
+	/* A server that predates IRCv3 rejecting our CAP LS. */
+	if (!g_ascii_strcasecmp(args[1], "CAP")) {
+		irc->caps_negotiating = FALSE;
+		return;
+	}
+
 	buf = g_strdup_printf(_("Unknown message '%s'"), args[1]);
 	purple_notify_error(gc, _("Unknown message"), buf, _("The IRC server "
 		"received a message it did not understand."),
@@ -679,39 +766,63 @@ void irc_msg_names(struct irc_conn *irc, const char *name, const char *from, cha
 		} else if (cur != NULL) {
 			GList *users = NULL;
 			GList *flags = NULL;
+			GList *userhosts = NULL;
 
 			while (*cur) {
 				PurpleChatUserFlags f = PURPLE_CHAT_USER_NONE;
+				char *bang;
 				end = strchr(cur, ' ');
 				if (!end)
 					end = cur + strlen(cur);
-				if (*cur == '@') {
-					f = PURPLE_CHAT_USER_OP;
-					cur++;
-				} else if (*cur == '%') {
-					f = PURPLE_CHAT_USER_HALFOP;
-					cur++;
-				} else if(*cur == '+') {
-					f = PURPLE_CHAT_USER_VOICE;
-					cur++;
-				} else if(irc->mode_chars
-					  && strchr(irc->mode_chars, *cur)) {
-					if (*cur == '~')
-						f = PURPLE_CHAT_USER_FOUNDER;
-					cur++;
+				/* With multi-prefix, every prefix is listed. */
+				for (; cur < end; cur++) {
+					if (*cur == '@') {
+						f |= PURPLE_CHAT_USER_OP;
+					} else if (*cur == '%') {
+						f |= PURPLE_CHAT_USER_HALFOP;
+					} else if(*cur == '+') {
+						f |= PURPLE_CHAT_USER_VOICE;
+					} else if(irc->mode_chars
+						  && strchr(irc->mode_chars, *cur)) {
+						if (*cur == '~')
+							f |= PURPLE_CHAT_USER_FOUNDER;
+					} else {
+						break;
+					}
 				}
-				tmp = g_strndup(cur, end - cur);
+				/* With userhost-in-names, nick!user@host. */
+				bang = memchr(cur, '!', end - cur);
+				tmp = g_strndup(cur, (bang ? bang : end) - cur);
 				users = g_list_prepend(users, tmp);
 				flags = g_list_prepend(flags, GINT_TO_POINTER(f));
+				userhosts = g_list_prepend(userhosts,
+					bang ? g_strndup(bang + 1, end - bang - 1) : NULL);
 				cur = end;
 				if (*cur)
 					cur++;
 			}
 
 			if (users != NULL) {
+				GList *u, *h;
+
 				purple_chat_conversation_add_users(PURPLE_CHAT_CONVERSATION(convo), users, NULL, flags, FALSE);
 
+				for (u = users, h = userhosts; u; u = u->next, h = h->next) {
+					PurpleChatUser *cb;
+
+					if (h->data == NULL)
+						continue;
+					cb = purple_chat_conversation_find_user(
+						PURPLE_CHAT_CONVERSATION(convo), u->data);
+					if (cb) {
+						g_object_set_data_full(G_OBJECT(cb), "userhost",
+							h->data, g_free);
+						h->data = NULL;
+					}
+				}
+
 				g_list_free_full(users, g_free);
+				g_list_free_full(userhosts, g_free);
 				g_list_free(flags);
 			}
 
@@ -908,7 +1019,70 @@ void irc_msg_ison(struct irc_conn *irc, const char *name, const char *from, char
 		irc_buddy_query(irc);
 
 	if (!irc->ison_outstanding)
-		g_hash_table_foreach(irc->buddies, (GHFunc)irc_buddy_status, (gpointer)irc);
+		g_hash_table_foreach(irc->buddies, (GHFunc)irc_buddy_ison_status, (gpointer)irc);
+}
+
+static void irc_buddy_ison_status(char *name, struct irc_buddy *ib, struct irc_conn *irc)
+{
+	/* The server keeps us up to date on these; ISON didn't ask. */
+	if (!ib->monitored)
+		irc_buddy_status(name, ib, irc);
+}
+
+static void irc_buddy_set_online(struct irc_conn *irc, const char *nick, gboolean online)
+{
+	struct irc_buddy *ib;
+
+	if ((ib = g_hash_table_lookup(irc->buddies, nick)) == NULL)
+		return;
+
+	ib->new_online_status = online;
+	irc_buddy_status(ib->name, ib, irc);
+}
+
+void irc_msg_monitor(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	gboolean online = purple_strequal(name, "730");
+	char **targets;
+	int i;
+
+	/* Each target is a nick, or nick!user@host when they are online. */
+	targets = g_strsplit(args[1], ",", -1);
+	for (i = 0; targets[i]; i++) {
+		char *bang = strchr(targets[i], '!');
+
+		if (bang)
+			*bang = '\0';
+		irc_buddy_set_online(irc, targets[i], online);
+	}
+	g_strfreev(targets);
+}
+
+void irc_msg_monlistfull(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	char **targets;
+	struct irc_buddy *ib;
+	int i;
+
+	/* Our count was off; fall back to polling for whoever was refused. */
+	targets = g_strsplit(args[2], ",", -1);
+	for (i = 0; targets[i]; i++) {
+		if ((ib = g_hash_table_lookup(irc->buddies, targets[i])) == NULL ||
+		    !ib->monitored)
+			continue;
+		ib->monitored = FALSE;
+		irc->presence_count--;
+	}
+	g_strfreev(targets);
+
+	irc->presence_limit = irc->presence_count;
+}
+
+void irc_msg_watch(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	/* 600 logged on, 601 logged off, 604 is online, 605 is offline */
+	irc_buddy_set_online(irc, args[1],
+		purple_strequal(name, "600") || purple_strequal(name, "604"));
 }
 
 static void irc_buddy_status(char *name, struct irc_buddy *ib, struct irc_conn *irc)
@@ -928,18 +1102,61 @@ static void irc_buddy_status(char *name, struct irc_buddy *ib, struct irc_conn *
 	}
 }
 
+/*
+ * Ask for what was said in the channel while we were away: everything since
+ * the newest message we saw, or just the latest few on a first join.  The
+ * replay arrives as a chathistory batch.
+ */
+static void irc_chathistory_request(struct irc_conn *irc, PurpleChatConversation *chat)
+{
+	const char *since;
+	char *buf, *bound, *limit;
+	guint n = IRC_CHATHISTORY_LIMIT;
+
+	if (!irc_cap_enabled(irc, "draft/chathistory") ||
+	    !irc_cap_enabled(irc, "batch"))
+		return;
+
+	if (irc->chathistory_limit)
+		n = MIN(n, irc->chathistory_limit);
+
+	since = g_object_get_data(G_OBJECT(chat), IRC_HISTORY_TIME);
+	if (since)
+		bound = g_strdup_printf("timestamp=%s", since);
+	else
+		bound = g_strdup("*");
+	limit = g_strdup_printf("%u", n);
+
+	buf = irc_format(irc, "vvcvv", "CHATHISTORY", "LATEST",
+		purple_conversation_get_name(PURPLE_CONVERSATION(chat)), bound, limit);
+	irc_send(irc, buf);
+	g_free(buf);
+	g_free(bound);
+	g_free(limit);
+}
+
 void irc_msg_join(struct irc_conn *irc, const char *name, const char *from, char **args)
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
 	PurpleChatConversation *chat;
 	PurpleChatUser *cb;
 
-	char *nick, *userhost, *buf;
+	char *nick, *userhost, *buf, *realname = NULL;
 	struct irc_buddy *ib;
 	static int id = 1;
 
 	g_return_if_fail(gc);
 
+	/* With extended-join this is "channel account :realname". */
+	if ((buf = strchr(args[0], ' ')) != NULL) {
+		*buf++ = '\0';
+		if ((realname = strchr(buf, ' ')) != NULL) {
+			realname++;
+			if (*realname == ':')
+				realname++;
+		}
+	}
+
 	nick = irc_mask_nick(from);
 
 	if (!purple_utf8_strcasecmp(nick, purple_connection_get_display_name(gc))) {
@@ -955,10 +1172,15 @@ void irc_msg_join(struct irc_conn *irc, const char *name, const char *from, char
 		g_object_set_data(G_OBJECT(chat), IRC_NAMES_FLAG,
 					   GINT_TO_POINTER(FALSE));
 
-		// Get the real name and user host for all participants.
-		buf = irc_format(irc, "vc", "WHO", args[0]);
-		irc_send(irc, buf);
-		g_free(buf);
+		// Get the real name and user host for all participants, unless
+		// NAMES is going to tell us the user hosts anyway.
+		if (!irc_cap_enabled(irc, "userhost-in-names")) {
+			buf = irc_format(irc, "vc", "WHO", args[0]);
+			irc_send(irc, buf);
+			g_free(buf);
+		}
+
+		irc_chathistory_request(irc, chat);
 
 		/* Until purple_conversation_present does something that
 		 * one would expect in Pidgin, this call produces buggy
@@ -982,6 +1204,9 @@ void irc_msg_join(struct irc_conn *irc, const char *name, const char *from, char
 
 	if (cb) {
 		g_object_set_data_full(G_OBJECT(cb), "userhost", userhost, g_free);
+		if (realname)
+			g_object_set_data_full(G_OBJECT(cb), "realname",
+			                       g_strdup(realname), g_free);
 	}
 
 	if ((ib = g_hash_table_lookup(irc->buddies, nick)) != NULL) {
@@ -1290,6 +1515,8 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name, const
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
 	PurpleChatConversation *chat;
+	PurpleMessageFlags flags = 0;
+	time_t mtime;
 	char *tmp;
 	char *msg;
 	char *nick;
@@ -1297,6 +1524,14 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name, const
 	if (!gc)
 		return;
 
+	if (irc_msg_is_replay(irc)) {
+		/* Don't answer CTCP requests from the backlog. */
+		if (rawmsg[0] == '\001' && strncmp(rawmsg + 1, "ACTION ", 7))
+			return;
+		flags |= PURPLE_MESSAGE_DELAYED;
+	}
+	mtime = irc_msg_get_time(irc);
+
 	nick = irc_mask_nick(from);
 	tmp = irc_parse_ctcp(irc, nick, to, rawmsg, notice);
 	if (!tmp) {
@@ -1317,12 +1552,19 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name, const
 	}
 
 	if (!purple_utf8_strcasecmp(to, purple_connection_get_display_name(gc))) {
-		purple_serv_got_im(gc, nick, msg, 0, time(NULL));
+		purple_serv_got_im(gc, nick, msg, flags, mtime);
 	} else {
 		chat = purple_conversations_find_chat_with_account(irc_nick_skip_mode(irc, to), irc->account);
 		if (chat) {
+			char *stamp = irc_tag_get(irc, "time");
+
 			purple_serv_got_chat_in(gc, purple_chat_conversation_get_id(chat),
-				nick, PURPLE_MESSAGE_RECV, msg, time(NULL));
+				nick, PURPLE_MESSAGE_RECV | flags, msg, mtime);
+
+			/* Where to pick the backlog up after a reconnect. */
+			if (stamp)
+				g_object_set_data_full(G_OBJECT(chat),
+					IRC_HISTORY_TIME, stamp, g_free);
 		} else
 			purple_debug_error("irc", "Got a %s on %s, which does not exist\n",
 			                   notice ? "NOTICE" : "PRIVMSG", to);
@@ -1558,9 +1800,23 @@ irc_auth_start_cyrus(struct irc_conn *irc)
 	g_free(buf);
 }
 
-/* SASL authentication */
+/* The server did not offer or refused the sasl capability. */
 void
-irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args)
+irc_sasl_unavailable(struct irc_conn *irc)
+{
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+
+	purple_connection_take_error(gc, g_error_new_literal(
+		PURPLE_CONNECTION_ERROR,
+		PURPLE_CONNECTION_ERROR_AUTHENTICATION_IMPOSSIBLE,
+		_("SASL authentication failed: Server does not support SASL authentication.")));
+
+	irc_sasl_finish(irc);
+}
+
+/* SASL authentication, once the server has acknowledged the capability */
+void
+irc_sasl_start(struct irc_conn *irc)
 {
 	int ret = 0;
 	int id = 0;
@@ -1569,18 +1825,6 @@ irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **arg
 	char *pos;
 	size_t index;
 
-	if (strncmp(g_strstrip(args[2]), "sasl", 5))
-		return;
-	if (strncmp(args[1], "ACK", 4)) {
-		purple_connection_take_error(gc, g_error_new_literal(
-			PURPLE_CONNECTION_ERROR,
-			PURPLE_CONNECTION_ERROR_AUTHENTICATION_IMPOSSIBLE,
-			_("SASL authentication failed: Server does not support SASL authentication.")));
-
-		irc_sasl_finish(irc);
-		return;
-	}
-
 	if ((ret = sasl_client_init(NULL)) != SASL_OK) {
 		purple_connection_take_error(gc, g_error_new_literal(
 			PURPLE_CONNECTION_ERROR,
@@ -1700,16 +1944,12 @@ irc_msg_authenticate(struct irc_conn *irc, const char *name, const char *from, c
 void
 irc_msg_authok(struct irc_conn *irc, const char *name, const char *from, char **args)
 {
-	char *buf;
-
 	sasl_dispose(&irc->sasl_conn);
 	irc->sasl_conn = NULL;
 	purple_debug_info("irc", "Successfully authenticated using SASL.\n");
 
 	/* Finish auth session */
-	buf = irc_format(irc, "vv", "CAP", "END");
-	irc_send(irc, buf);
-	g_free(buf);
+	irc_cap_end(irc);
 }
 
 void
@@ -1782,8 +2022,6 @@ irc_msg_authfail(struct irc_conn *irc, const char *name, const char *from, char
 static void
 irc_sasl_finish(struct irc_conn *irc)
 {
-	char *buf;
-
 	sasl_dispose(&irc->sasl_conn);
 	irc->sasl_conn = NULL;
 
@@ -1791,8 +2029,6 @@ irc_sasl_finish(struct irc_conn *irc)
 	irc->sasl_cb = NULL;
 
 	/* Auth failed, abort */
-	buf = irc_format(irc, "vv", "CAP", "END");
-	irc_send(irc, buf);
-	g_free(buf);
+	irc_cap_end(irc);
 }
 #endif
@@ -104,15 +104,24 @@ static struct _irc_msg {
 	{ "501", "n:", 2, irc_msg_badmode },		/* Unknown mode flag		*/
 	{ "506", "nc:", 3, irc_msg_nosend },		/* Must identify to send	*/
 	{ "515", "nc:", 3, irc_msg_regonly },		/* Registration required	*/
+	{ "600", "nn", 2, irc_msg_watch },		/* WATCH: logged on		*/
+	{ "601", "nn", 2, irc_msg_watch },		/* WATCH: logged off		*/
+	{ "604", "nn", 2, irc_msg_watch },		/* WATCH: is online		*/
+	{ "605", "nn", 2, irc_msg_watch },		/* WATCH: is offline		*/
+	{ "730", "n:", 2, irc_msg_monitor },		/* MONITOR: online		*/
+	{ "731", "n:", 2, irc_msg_monitor },		/* MONITOR: offline		*/
+	{ "734", "nvv:", 3, irc_msg_monlistfull },	/* MONITOR list is full		*/
 #ifdef HAVE_CYRUS_SASL
 	{ "903", "*", 0, irc_msg_authok},		/* SASL auth successful		*/
 	{ "904", "*", 0, irc_msg_authtryagain },	/* SASL auth failed, can recover*/
 	{ "905", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
 	{ "906", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
 	{ "907", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
-	{ "cap", "vv:", 3, irc_msg_cap },		/* SASL capable			*/
 	{ "authenticate", ":", 1, irc_msg_authenticate }, /* SASL authenticate		*/
 #endif
+	{ "away", ":", 0, irc_msg_away_notify },	/* Member went or came back	*/
+	{ "batch", "v*", 1, irc_msg_batch },		/* Start or end of a BATCH	*/
+	{ "cap", "vv:", 3, irc_msg_cap },		/* Capability negotiation	*/
 	{ "invite", "n:", 2, irc_msg_invite },		/* Invited			*/
 	{ "join", ":", 1, irc_msg_join },		/* Joined a channel		*/
 	{ "kick", "cn:", 3, irc_msg_kick },		/* KICK				*/
@@ -129,6 +138,20 @@ static struct _irc_msg {
 	{ NULL, NULL, 0, NULL }
 };
 
+/* No format in _irc_msgs is longer than this. */
+#define IRC_MSG_MAX_ARGS 16
+
+/* Named commands are looked up in a small open-addressed table; must be a
+ * power of two comfortably larger than the number of names. */
+#define IRC_MSG_NAMED_SLOTS 128
+
+/*
+ * Both tables are filled in once from _irc_msgs when the plugin loads.
+ * Numerics index straight into the first, so they never collide.
+ */
+static struct _irc_msg *irc_msg_numerics[1000];
+static struct _irc_msg *irc_msg_named[IRC_MSG_NAMED_SLOTS];
+
 static struct _irc_user_cmd {
 	char *name;
 	char *format;
@@ -594,7 +617,16 @@ char *irc_parse_ctcp(struct irc_conn *irc, const char *from, const char *to, con
 		irc_send(irc, buf);
 		g_free(buf);
 	} else if (!strncmp(cur, "DCC SEND ", 9)) {
-		irc_dccsend_recv(irc, from, msg + 10);
+		irc_dccsend_recv(irc, from, msg + 10, FALSE);
+		return NULL;
+	} else if (!strncmp(cur, "DCC TSEND ", 10)) {
+		irc_dccsend_recv(irc, from, msg + 11, TRUE);
+		return NULL;
+	} else if (!strncmp(cur, "DCC RESUME ", 11)) {
+		irc_dccsend_resume(irc, from, msg + 12);
+		return NULL;
+	} else if (!strncmp(cur, "DCC ACCEPT ", 11)) {
+		irc_dccsend_accept(irc, from, msg + 12);
 		return NULL;
 	}
 
@@ -605,18 +637,117 @@ char *irc_parse_ctcp(struct irc_conn *irc, const char *from, const char *to, con
 	return buf;
 }
 
-void irc_msg_table_build(struct irc_conn *irc)
+static gboolean
+irc_msg_is_numeric(const char *name, gsize len)
+{
+	return len == 3 && g_ascii_isdigit(name[0]) && g_ascii_isdigit(name[1]) &&
+	       g_ascii_isdigit(name[2]);
+}
+
+static guint
+irc_msg_named_hash(const char *name, gsize len)
+{
+	return (len * 31 + g_ascii_tolower(name[0]) * 7 +
+	        g_ascii_tolower(name[len - 1])) & (IRC_MSG_NAMED_SLOTS - 1);
+}
+
+void irc_msg_table_build(void)
 {
 	int i;
 
-	if (!irc || !irc->msgs) {
-		purple_debug_error("irc", "Attempt to build a message table on a bogus structure");
-		return;
-	}
+	memset(irc_msg_numerics, 0, sizeof(irc_msg_numerics));
+	memset(irc_msg_named, 0, sizeof(irc_msg_named));
 
 	for (i = 0; _irc_msgs[i].name; i++) {
-		g_hash_table_insert(irc->msgs, (gpointer)_irc_msgs[i].name, (gpointer)&_irc_msgs[i]);
+		struct _irc_msg *msgent = &_irc_msgs[i];
+		gsize len = strlen(msgent->name);
+		guint slot;
+
+		if (strlen(msgent->format) > IRC_MSG_MAX_ARGS) {
+			g_warning("IRC message %s has too many arguments", msgent->name);
+			continue;
+		}
+
+		if (irc_msg_is_numeric(msgent->name, len)) {
+			irc_msg_numerics[g_ascii_strtoull(msgent->name, NULL, 10)] = msgent;
+			continue;
+		}
+
+		slot = irc_msg_named_hash(msgent->name, len);
+		while (irc_msg_named[slot] != NULL)
+			slot = (slot + 1) & (IRC_MSG_NAMED_SLOTS - 1);
+		irc_msg_named[slot] = msgent;
+	}
+}
+
+/* Look up the command in input[0, len) without copying it. */
+static struct _irc_msg *
+irc_msg_lookup(const char *name, gsize len)
+{
+	guint slot;
+
+	if (len == 0)
+		return NULL;
+
+	if (irc_msg_is_numeric(name, len)) {
+		return irc_msg_numerics[(name[0] - '0') * 100 +
+		                        (name[1] - '0') * 10 + (name[2] - '0')];
 	}
+
+	slot = irc_msg_named_hash(name, len);
+	while (irc_msg_named[slot] != NULL) {
+		struct _irc_msg *msgent = irc_msg_named[slot];
+
+		if (g_ascii_strncasecmp(msgent->name, name, len) == 0 &&
+		    msgent->name[len] == '\0')
+			return msgent;
+
+		slot = (slot + 1) & (IRC_MSG_NAMED_SLOTS - 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * Whether irc_recv_convert() would hand back valid UTF-8 input unchanged,
+ * so the parser can skip it and use the text in place.
+ */
+static gboolean
+irc_recv_is_utf8(struct irc_conn *irc)
+{
+	const gchar *enclist;
+
+	if (purple_account_get_bool(irc->account, "autodetect_utf8",
+	                            IRC_DEFAULT_AUTODETECT))
+		return TRUE;
+
+	enclist = purple_account_get_string(irc->account, "encoding",
+	                                    IRC_DEFAULT_CHARSET);
+	while (*enclist == ' ')
+		enclist++;
+
+	return g_ascii_strncasecmp(enclist, "UTF-8", 5) == 0 &&
+	       (enclist[5] == '\0' || enclist[5] == ',');
+}
+
+/* Returns text itself when it can be used as is, or a new string. */
+static char *
+irc_recv_text(struct irc_conn *irc, char *text, gboolean utf8)
+{
+	if (utf8 && g_utf8_validate(text, -1, NULL))
+		return text;
+
+	return irc_recv_convert(irc, text);
+}
+
+/* Like irc_recv_text() for text that is never transcoded, only salvaged. */
+static char *
+irc_recv_verbatim(char *text)
+{
+	if (g_utf8_validate(text, -1, NULL))
+		return text;
+
+	return g_utf8_make_valid(text, -1);
 }
 
 void irc_cmd_table_build(struct irc_conn *irc)
@@ -670,14 +801,88 @@ char *irc_format(struct irc_conn *irc, const char *format, ...)
 	return (g_string_free(string, FALSE));
 }
 
+/*
+ * Message tags (IRCv3 message-tags) are only looked at by the few handlers
+ * that care, so they are kept as the raw "key=value;key" string for the
+ * duration of the dispatch and searched on demand.
+ */
+char *irc_tag_get(struct irc_conn *irc, const char *key)
+{
+	const char *cur = irc->tags;
+	gsize keylen = strlen(key);
+
+	while (cur != NULL && *cur) {
+		const char *end = strchr(cur, ';');
+		const char *value;
+		GString *unescaped;
+
+		if (end == NULL)
+			end = cur + strlen(cur);
+
+		if (strncmp(cur, key, keylen) != 0 ||
+		    (cur[keylen] != '=' && cur + keylen != end)) {
+			cur = *end ? end + 1 : end;
+			continue;
+		}
+
+		unescaped = g_string_sized_new(end - cur);
+		for (value = cur + keylen + 1; value < end; value++) {
+			if (*value != '\\') {
+				g_string_append_c(unescaped, *value);
+				continue;
+			}
+			if (++value == end)
+				break;
+			switch (*value) {
+			case ':': g_string_append_c(unescaped, ';'); break;
+			case 's': g_string_append_c(unescaped, ' '); break;
+			case 'r': g_string_append_c(unescaped, '\r'); break;
+			case 'n': g_string_append_c(unescaped, '\n'); break;
+			default: g_string_append_c(unescaped, *value); break;
+			}
+		}
+
+		return g_string_free(unescaped, FALSE);
+	}
+
+	return NULL;
+}
+
+/* When the message being dispatched was sent, by server-time if given. */
+time_t irc_msg_get_time(struct irc_conn *irc)
+{
+	char *stamp = irc_tag_get(irc, "time");
+	time_t mtime = 0;
+
+	if (stamp != NULL) {
+		mtime = purple_str_to_time(stamp, TRUE, NULL, NULL, NULL);
+		g_free(stamp);
+	}
+
+	return mtime ? mtime : time(NULL);
+}
+
+/* Whether the message being dispatched is part of a history replay. */
+gboolean irc_msg_is_replay(struct irc_conn *irc)
+{
+	char *ref;
+	const char *type = NULL;
+
+	if (irc->batches == NULL || (ref = irc_tag_get(irc, "batch")) == NULL)
+		return FALSE;
+
+	type = g_hash_table_lookup(irc->batches, ref);
+	g_free(ref);
+
+	return purple_strequal(type, "chathistory") ||
+	       purple_strequal(type, "draft/chathistory");
+}
+
+static void irc_parse_line(struct irc_conn *irc, char *input);
+
 void irc_parse_msg(struct irc_conn *irc, char *input)
 {
-	struct _irc_msg *msgent;
-	char *cur, *end, *tmp, *from, *msgname, *fmt, **args, *msg;
-	guint i;
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
-	gboolean fmt_valid;
-	int args_cnt;
 
 	irc->recv_time = time(NULL);
 
@@ -695,6 +900,36 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 		g_free(clean);
 	}
 
+	if (*input == '@') {
+		char *space = strchr(input, ' ');
+
+		if (space == NULL) {
+			irc_parse_error_cb(irc, input);
+			return;
+		}
+
+		*space = '\0';
+		irc->tags = input + 1;
+		input = space + 1;
+		while (*input == ' ')
+			input++;
+	}
+
+	irc_parse_line(irc, input);
+	irc->tags = NULL;
+}
+
+static void irc_parse_line(struct irc_conn *irc, char *input)
+{
+	struct _irc_msg *msgent;
+	char *cur, *end, *from, *fmt, *msg;
+	char *args[IRC_MSG_MAX_ARGS];
+	guint32 owned = 0;
+	guint i, fmt_len;
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+	gboolean fmt_valid, more, utf8;
+	int args_cnt;
+
 	if (!strncmp(input, "PING ", 5)) {
 		msg = irc_format(irc, "vv", "PONG", input + 5);
 		irc_send(irc, msg);
@@ -727,85 +962,89 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 		return;
 	}
 
-	from = g_strndup(&input[1], cur - &input[1]);
-	cur++;
-	end = strchr(cur, ' ');
-	if (!end)
-		end = cur + strlen(cur);
-
-	tmp = g_strndup(cur, end - cur);
-	msgname = g_ascii_strdown(tmp, -1);
-	g_free(tmp);
+	/* The prefix ends at cur, the command at end. */
+	from = &input[1];
+	end = cur + 1 + strcspn(cur + 1, " ");
 
-	if ((msgent = g_hash_table_lookup(irc->msgs, msgname)) == NULL) {
+	if ((msgent = irc_msg_lookup(cur + 1, end - (cur + 1))) == NULL) {
+		/* irc_msg_default() shows the whole line, so leave it intact. */
+		from = g_strndup(&input[1], cur - &input[1]);
 		irc_msg_default(irc, "", from, &input);
-		g_free(msgname);
 		g_free(from);
 		return;
 	}
-	g_free(msgname);
+
+	/*
+	 * From here on the line is split in place: each separator becomes a
+	 * terminator and args point into input, unless the text needed
+	 * converting, in which case the bit in owned says to free it.
+	 */
+	*cur = '\0';
+	utf8 = irc_recv_is_utf8(irc);
+	fmt = msgent->format;
+	fmt_len = strlen(fmt);
+	memset(args, 0, fmt_len * sizeof(char *));
 
 	fmt_valid = TRUE;
-	args = g_new0(char *, strlen(msgent->format));
 	args_cnt = 0;
-	for (cur = end, fmt = msgent->format, i = 0; fmt[i] && *cur++; i++) {
+	more = (*end == ' ');
+	for (i = 0; fmt[i] && more; i++) {
+		cur = end + 1;
 		switch (fmt[i]) {
 		case 'v':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			/* This is a string of unknown encoding which we do not
+		case 't':
+		case 'n':
+		case 'c':
+			end = cur + strcspn(cur, " ");
+			more = (*end == ' ');
+			*end = '\0';
+			/* A 'v' field is of unknown encoding, which we do not
 			 * want to transcode, but it may or may not be valid
 			 * UTF-8, so we'll salvage it.  If a nick/channel/target
 			 * field has inadvertently been marked verbatim, this
 			 * could cause weirdness. */
-			tmp = g_strndup(cur, end - cur);
-			args[i] = g_utf8_make_valid(tmp, -1);
-			g_free(tmp);
-			cur += end - cur;
-			break;
-		case 't':
-		case 'n':
-		case 'c':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			tmp = g_strndup(cur, end - cur);
-			args[i] = irc_recv_convert(irc, tmp);
-			g_free(tmp);
-			cur += end - cur;
+			if (fmt[i] == 'v')
+				args[i] = irc_recv_verbatim(cur);
+			else
+				args[i] = irc_recv_text(irc, cur, utf8);
 			break;
 		case ':':
 			if (*cur == ':') cur++;
-			args[i] = irc_recv_convert(irc, cur);
-			cur = cur + strlen(cur);
+			args[i] = irc_recv_text(irc, cur, utf8);
+			more = FALSE;
 			break;
 		case '*':
 			/* Ditto 'v' above; we're going to salvage this in case
 			 * it leaks past the IRC protocol */
-			args[i] = g_utf8_make_valid(cur, -1);
-			cur = cur + strlen(cur);
+			args[i] = irc_recv_verbatim(cur);
+			more = FALSE;
 			break;
 		default:
 			purple_debug_error("irc", "invalid message format character '%c'", fmt[i]);
 			fmt_valid = FALSE;
 			break;
 		}
+		if (args[i] != NULL && args[i] != cur)
+			owned |= 1u << i;
 		if (fmt_valid)
 			args_cnt = i + 1;
 	}
 	if (G_UNLIKELY(!fmt_valid)) {
 		purple_debug_error("irc", "message format was invalid");
 	} else if (G_LIKELY(args_cnt >= msgent->req_cnt)) {
-		tmp = irc_recv_convert(irc, from);
+		char *tmp = irc_recv_text(irc, from, utf8);
 		(msgent->cb)(irc, msgent->name, tmp, args);
-		g_free(tmp);
+		if (tmp != from)
+			g_free(tmp);
 	} else {
 		purple_debug_error("irc", "args count (%d) doesn't reach "
 			"expected value of %d for the '%s' command",
 			args_cnt, msgent->req_cnt, msgent->name);
 	}
-	for (i = 0; i < strlen(msgent->format); i++) {
-		g_free(args[i]);
+	for (i = 0; i < fmt_len; i++) {
+		if (owned & (1u << i))
+			g_free(args[i]);
 	}
-	g_free(args);
-	g_free(from);
 }
 
 static void irc_parse_error_cb(struct irc_conn *irc, char *input)
@@ -0,0 +1,382 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "protocols/irc/irc.h"
+#include "tests/test_ui.h"
+
+/*
+ * Two IRC connections, alice and bob, that never talk to a server.  What one
+ * of them sends is caught on irc-sending-text and handed to the other's CTCP
+ * parser by the test, while the DCC connection itself runs over loopback.
+ */
+#define TEST_IRC_FILE_SIZE (256 * 1024)
+
+/* Set by the plugin when it loads; the tests put their own protocol there. */
+extern PurpleProtocol *_irc_protocol;
+
+typedef struct {
+	PurpleConnection *gc;
+	struct irc_conn *irc;
+	/* lines sent to the server, oldest first */
+	GPtrArray *sent;
+	/* where a file offered to this side is saved */
+	gchar *path;
+	PurpleXfer *xfer;
+} TestIrcSide;
+
+/******************************************************************************
+ * Stand-ins for the plugin
+ *****************************************************************************/
+typedef struct {
+	PurpleProtocol parent;
+} TestIrcProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestIrcProtocolClass;
+
+static GType test_irc_protocol_get_type(void);
+
+G_DEFINE_TYPE(TestIrcProtocol, test_irc_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_irc_protocol_init(TestIrcProtocol *protocol) {
+	PURPLE_PROTOCOL(protocol)->id = "prpl-irc-dcc-test";
+}
+
+static void
+test_irc_protocol_class_init(TestIrcProtocolClass *klass) {
+}
+
+/* IrcXfer is registered with the plugin's type module. */
+typedef struct {
+	GTypeModule parent;
+} TestIrcModule;
+
+typedef struct {
+	GTypeModuleClass parent;
+} TestIrcModuleClass;
+
+static GType test_irc_module_get_type(void);
+
+G_DEFINE_TYPE(TestIrcModule, test_irc_module, G_TYPE_TYPE_MODULE);
+
+static gboolean
+test_irc_module_load(GTypeModule *module) {
+	return TRUE;
+}
+
+static void
+test_irc_module_unload(GTypeModule *module) {
+}
+
+static void
+test_irc_module_init(TestIrcModule *module) {
+}
+
+static void
+test_irc_module_class_init(TestIrcModuleClass *klass) {
+	GTypeModuleClass *module_class = G_TYPE_MODULE_CLASS(klass);
+
+	module_class->load = test_irc_module_load;
+	module_class->unload = test_irc_module_unload;
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static guchar
+test_irc_pattern(goffset offset) {
+	return (guchar)(offset % 251);
+}
+
+static gchar *
+test_irc_create_file(gsize size) {
+	GError *error = NULL;
+	gchar *path = NULL;
+	guchar *data;
+	gsize i;
+	gint fd;
+
+	fd = g_file_open_tmp("purple-dcc-XXXXXX", &path, &error);
+	g_assert_no_error(error);
+	g_close(fd, NULL);
+
+	data = g_malloc(size);
+	for (i = 0; i < size; i++) {
+		data[i] = test_irc_pattern(i);
+	}
+
+	g_file_set_contents(path, (const gchar *)data, size, &error);
+	g_assert_no_error(error);
+	g_free(data);
+
+	return path;
+}
+
+static void
+test_irc_assert_file(const gchar *path, gsize size) {
+	GError *error = NULL;
+	gchar *data = NULL;
+	gsize len = 0, i;
+
+	g_file_get_contents(path, &data, &len, &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(len, ==, size);
+
+	for (i = 0; i < len; i++) {
+		g_assert_cmpuint((guchar)data[i], ==, test_irc_pattern(i));
+	}
+
+	g_free(data);
+}
+
+static void
+test_irc_sending_text_cb(PurpleConnection *gc, gchar **text, gpointer data) {
+	GPtrArray *sent = g_object_get_data(G_OBJECT(gc), "test-sent");
+
+	/* Take the line; nothing is connected to write it to. */
+	g_ptr_array_add(sent, *text);
+	*text = NULL;
+}
+
+static void
+test_irc_file_recv_request_cb(PurpleXfer *xfer, gpointer data) {
+	PurpleConnection *gc =
+	        purple_account_get_connection(purple_xfer_get_account(xfer));
+	TestIrcSide *side = g_object_get_data(G_OBJECT(gc), "test-side");
+
+	side->xfer = g_object_ref(xfer);
+	purple_xfer_request_accepted(xfer, side->path);
+}
+
+static void
+test_irc_side_init(TestIrcSide *side, const gchar *nick) {
+	PurpleAccount *account = purple_account_new(nick, "prpl-irc-dcc-test");
+	PurpleProxyInfo *info = purple_proxy_info_new();
+
+	purple_proxy_info_set_proxy_type(info, PURPLE_PROXY_NONE);
+	purple_account_set_proxy_info(account, info);
+
+	side->gc = g_object_new(PURPLE_TYPE_CONNECTION, "account", account,
+	                        "protocol", _irc_protocol, NULL);
+	side->sent = g_ptr_array_new_with_free_func(g_free);
+	g_object_set_data(G_OBJECT(side->gc), "test-sent", side->sent);
+	g_object_set_data(G_OBJECT(side->gc), "test-side", side);
+
+	side->irc = g_new0(struct irc_conn, 1);
+	side->irc->account = account;
+	purple_connection_set_protocol_data(side->gc, side->irc);
+
+	side->path = NULL;
+	side->xfer = NULL;
+}
+
+static void
+test_irc_side_clear(TestIrcSide *side) {
+	g_clear_object(&side->xfer);
+
+	purple_connection_set_protocol_data(side->gc, NULL);
+	g_free(side->irc);
+	g_object_set_data(G_OBJECT(side->gc), "test-side", NULL);
+	g_object_set_data(G_OBJECT(side->gc), "test-sent", NULL);
+	g_ptr_array_free(side->sent, TRUE);
+
+	if (side->path != NULL) {
+		g_remove(side->path);
+		g_free(side->path);
+	}
+}
+
+/*
+ * Hand the oldest line sent by one side to the other's CTCP parser, as if
+ * the server had passed it on, and check it was a DCC request of that kind.
+ */
+static void
+test_irc_deliver(TestIrcSide *from, TestIrcSide *to, const gchar *kind) {
+	PurpleAccount *sender = purple_connection_get_account(from->gc);
+	PurpleAccount *receiver = purple_connection_get_account(to->gc);
+	gchar *line, *msg, *expected;
+
+	g_assert_cmpuint(from->sent->len, >, 0);
+	line = g_ptr_array_index(from->sent, 0);
+
+	expected = g_strdup_printf("PRIVMSG %s :\001DCC %s ",
+	                           purple_account_get_username(receiver), kind);
+	g_assert_true(g_str_has_prefix(line, expected));
+	g_free(expected);
+
+	msg = g_strdup(strchr(line, ':'));
+	g_strchomp(msg);
+	memmove(msg, msg + 1, strlen(msg));
+
+	g_assert_null(irc_parse_ctcp(to->irc, purple_account_get_username(sender),
+	                             purple_account_get_username(receiver), msg,
+	                             FALSE));
+
+	g_free(msg);
+	g_ptr_array_remove_index(from->sent, 0);
+}
+
+static void
+test_irc_wait_done(PurpleXfer *sender, PurpleXfer *receiver) {
+	while (!purple_xfer_is_completed(sender) ||
+	       !purple_xfer_is_completed(receiver)) {
+		g_assert_false(purple_xfer_is_cancelled(sender));
+		g_assert_false(purple_xfer_is_cancelled(receiver));
+		g_main_context_iteration(NULL, TRUE);
+	}
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_irc_dcc_send(void) {
+	TestIrcSide alice, bob;
+	gchar *source = test_irc_create_file(TEST_IRC_FILE_SIZE);
+	gchar *path = NULL;
+	PurpleXfer *xfer;
+	gint fd;
+
+	test_irc_side_init(&alice, "alice");
+	test_irc_side_init(&bob, "bob");
+
+	fd = g_file_open_tmp("purple-dcc-XXXXXX", &path, NULL);
+	g_assert_cmpint(fd, >=, 0);
+	g_close(fd, NULL);
+	g_remove(path);
+	bob.path = path;
+
+	xfer = irc_dccsend_new_xfer(NULL, alice.gc, "bob");
+	alice.xfer = g_object_ref(xfer);
+	purple_xfer_request_accepted(xfer, source);
+	g_assert_cmpint(purple_xfer_get_size(xfer), ==, TEST_IRC_FILE_SIZE);
+
+	/* bob accepts the offer right away and connects */
+	test_irc_deliver(&alice, &bob, "SEND");
+	g_assert_nonnull(bob.xfer);
+	g_assert_cmpint(purple_xfer_get_size(bob.xfer), ==, TEST_IRC_FILE_SIZE);
+
+	test_irc_wait_done(alice.xfer, bob.xfer);
+
+	g_assert_cmpint(purple_xfer_get_bytes_sent(alice.xfer), ==,
+	                TEST_IRC_FILE_SIZE);
+	g_assert_cmpint(purple_xfer_get_bytes_sent(bob.xfer), ==,
+	                TEST_IRC_FILE_SIZE);
+	test_irc_assert_file(bob.path, TEST_IRC_FILE_SIZE);
+	g_assert_cmpuint(0, ==, alice.sent->len);
+	g_assert_cmpuint(0, ==, bob.sent->len);
+
+	test_irc_side_clear(&alice);
+	test_irc_side_clear(&bob);
+
+	g_remove(source);
+	g_free(source);
+}
+
+/* bob already has the start of the file and only fetches the rest. */
+static void
+test_irc_dcc_send_resume(void) {
+	const gsize partial = 100 * 1000 + 7;
+	TestIrcSide alice, bob;
+	gchar *source = test_irc_create_file(TEST_IRC_FILE_SIZE);
+	PurpleXfer *xfer;
+
+	test_irc_side_init(&alice, "alice");
+	test_irc_side_init(&bob, "bob");
+
+	bob.path = test_irc_create_file(partial);
+	purple_account_set_bool(purple_connection_get_account(bob.gc),
+	                        "dcc_resume", TRUE);
+
+	xfer = irc_dccsend_new_xfer(NULL, alice.gc, "bob");
+	alice.xfer = g_object_ref(xfer);
+	purple_xfer_request_accepted(xfer, source);
+
+	/* bob asks to carry on where the file stops, alice agrees */
+	test_irc_deliver(&alice, &bob, "SEND");
+	g_assert_nonnull(bob.xfer);
+	g_assert_cmpuint(0, ==, alice.sent->len);
+
+	test_irc_deliver(&bob, &alice, "RESUME");
+	g_assert_cmpint(purple_xfer_get_bytes_sent(alice.xfer), ==, partial);
+
+	test_irc_deliver(&alice, &bob, "ACCEPT");
+	g_assert_cmpint(purple_xfer_get_bytes_sent(bob.xfer), ==, partial);
+
+	test_irc_wait_done(alice.xfer, bob.xfer);
+
+	g_assert_cmpint(purple_xfer_get_bytes_sent(alice.xfer), ==,
+	                TEST_IRC_FILE_SIZE);
+	g_assert_cmpint(purple_xfer_get_bytes_sent(bob.xfer), ==,
+	                TEST_IRC_FILE_SIZE);
+	test_irc_assert_file(bob.path, TEST_IRC_FILE_SIZE);
+
+	test_irc_side_clear(&alice);
+	test_irc_side_clear(&bob);
+
+	g_remove(source);
+	g_free(source);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	GTypeModule *module;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	module = g_object_new(test_irc_module_get_type(), NULL);
+	g_type_module_use(module);
+	irc_xfer_register(module);
+
+	_irc_protocol = g_object_new(test_irc_protocol_get_type(), NULL);
+	purple_signal_register(_irc_protocol, "irc-sending-text",
+	                       purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE,
+	                       2, PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+	purple_signal_connect(_irc_protocol, "irc-sending-text", _irc_protocol,
+	                      PURPLE_CALLBACK(test_irc_sending_text_cb), NULL);
+	purple_signal_connect(purple_xfers_get_handle(), "file-recv-request",
+	                      _irc_protocol,
+	                      PURPLE_CALLBACK(test_irc_file_recv_request_cb),
+	                      NULL);
+
+	/* The address offered in DCC SEND. */
+	purple_prefs_set_bool("/purple/network/auto_ip", FALSE);
+	purple_network_set_public_ip("127.0.0.1");
+
+	g_test_add_func("/irc/dcc/send", test_irc_dcc_send);
+	g_test_add_func("/irc/dcc/send/resume", test_irc_dcc_send_resume);
+
+	return g_test_run();
+}
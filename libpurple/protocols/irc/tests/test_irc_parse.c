@@ -0,0 +1,411 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "protocols/irc/irc.h"
+#include "tests/test_ui.h"
+
+/*
+ * An IRC connection with the nick "me" that never talks to a server.  Lines
+ * are handed straight to irc_parse_msg() and whatever the handlers send back
+ * is caught on irc-sending-text.
+ */
+
+/* Set by the plugin when it loads; the tests put their own protocol there. */
+extern PurpleProtocol *_irc_protocol;
+
+typedef struct {
+	PurpleConnection *gc;
+	struct irc_conn *irc;
+	/* lines sent to the server, oldest first */
+	GPtrArray *sent;
+} TestIrcConn;
+
+/******************************************************************************
+ * Stand-ins for the plugin
+ *****************************************************************************/
+typedef struct {
+	PurpleProtocol parent;
+} TestIrcProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestIrcProtocolClass;
+
+static GType test_irc_protocol_get_type(void);
+
+G_DEFINE_TYPE(TestIrcProtocol, test_irc_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_irc_protocol_init(TestIrcProtocol *protocol) {
+	PURPLE_PROTOCOL(protocol)->id = "prpl-irc-parse-test";
+}
+
+static void
+test_irc_protocol_class_init(TestIrcProtocolClass *klass) {
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+test_irc_sending_text_cb(PurpleConnection *gc, gchar **text, gpointer data) {
+	GPtrArray *sent = g_object_get_data(G_OBJECT(gc), "test-sent");
+
+	/* Take the line; nothing is connected to write it to. */
+	g_ptr_array_add(sent, *text);
+	*text = NULL;
+}
+
+static void
+test_irc_conn_init(TestIrcConn *conn) {
+	PurpleAccount *account = purple_account_new("me", "prpl-irc-parse-test");
+
+	conn->gc = g_object_new(PURPLE_TYPE_CONNECTION, "account", account,
+	                        "protocol", _irc_protocol, NULL);
+	purple_connection_set_display_name(conn->gc, "me");
+	conn->sent = g_ptr_array_new_with_free_func(g_free);
+	g_object_set_data(G_OBJECT(conn->gc), "test-sent", conn->sent);
+
+	conn->irc = g_new0(struct irc_conn, 1);
+	conn->irc->account = account;
+	conn->irc->reqnick = g_strdup("me");
+	conn->irc->buddies = g_hash_table_new(g_str_hash, g_str_equal);
+	purple_connection_set_protocol_data(conn->gc, conn->irc);
+}
+
+static void
+test_irc_conn_clear(TestIrcConn *conn) {
+	purple_connection_set_protocol_data(conn->gc, NULL);
+	if (conn->irc->batches)
+		g_hash_table_destroy(conn->irc->batches);
+	g_hash_table_destroy(conn->irc->buddies);
+	g_free(conn->irc->reqnick);
+	g_free(conn->irc);
+	g_object_set_data(G_OBJECT(conn->gc), "test-sent", NULL);
+	g_ptr_array_free(conn->sent, TRUE);
+}
+
+/* irc_parse_msg() splits its input in place, so give it a copy. */
+static void
+test_irc_feed(TestIrcConn *conn, const gchar *line) {
+	gchar *input = g_strdup(line);
+
+	irc_parse_msg(conn->irc, input);
+	g_assert_null(conn->irc->tags);
+
+	g_free(input);
+}
+
+/* Check line was the only thing sent since the last check. */
+static void
+test_irc_assert_sent(TestIrcConn *conn, const gchar *line) {
+	g_assert_cmpuint(1, ==, conn->sent->len);
+	g_assert_cmpstr(line, ==, g_ptr_array_index(conn->sent, 0));
+	g_ptr_array_set_size(conn->sent, 0);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_irc_parse_ping(void) {
+	TestIrcConn conn;
+
+	test_irc_conn_init(&conn);
+
+	/* without a prefix the rest of the line is echoed as is */
+	test_irc_feed(&conn, "PING :irc.example.net");
+	test_irc_assert_sent(&conn, "PONG :irc.example.net\r\n");
+
+	/* the trailing parameter keeps its spaces and loses its colon */
+	test_irc_feed(&conn, ":irc.example.net PING :some token");
+	test_irc_assert_sent(&conn, "PONG :some token\r\n");
+
+	/* and may come without the colon */
+	test_irc_feed(&conn, ":irc.example.net PING token");
+	test_irc_assert_sent(&conn, "PONG :token\r\n");
+
+	/* tags are skipped, however many spaces follow them */
+	test_irc_feed(&conn,
+	              "@time=2010-08-27T20:42:02.000Z;msgid=a\\sb  "
+	              ":irc.example.net PING :tagged");
+	test_irc_assert_sent(&conn, "PONG :tagged\r\n");
+
+	test_irc_conn_clear(&conn);
+}
+
+static void
+test_irc_parse_params(void) {
+	TestIrcConn conn;
+
+	test_irc_conn_init(&conn);
+
+	/* middle parameters: "433 * me :Nickname is already in use" */
+	test_irc_feed(&conn,
+	              ":irc.example.net 433 * me :Nickname is already in use");
+	test_irc_assert_sent(&conn, "NICK me1\r\n");
+	g_assert_cmpstr("me1", ==, purple_connection_get_display_name(conn.gc));
+
+	/* too few parameters for the handler */
+	test_irc_feed(&conn, ":irc.example.net 433 *");
+	test_irc_feed(&conn, ":irc.example.net PING");
+	g_assert_cmpuint(0, ==, conn.sent->len);
+
+	/* text in another encoding is converted on the way in and out */
+	purple_account_set_bool(conn.irc->account, "autodetect_utf8", FALSE);
+	purple_account_set_string(conn.irc->account, "encoding", "ISO-8859-1");
+	test_irc_feed(&conn, ":irc.example.net PING :caf\xe9");
+	test_irc_assert_sent(&conn, "PONG :caf\xe9\r\n");
+
+	test_irc_conn_clear(&conn);
+}
+
+static void
+test_irc_parse_malformed(void) {
+	TestIrcConn conn;
+
+	test_irc_conn_init(&conn);
+
+	test_irc_feed(&conn, "garbage");
+	test_irc_feed(&conn, "@tags-without-a-message");
+	test_irc_feed(&conn, ":prefix-without-a-command");
+	test_irc_feed(&conn, ":irc.example.net FROBNICATE #chan :what");
+	test_irc_feed(&conn, ":irc.example.net 999 me #chan :unknown numeric");
+	test_irc_feed(&conn, "");
+	g_assert_cmpuint(0, ==, conn.sent->len);
+
+	test_irc_conn_clear(&conn);
+}
+
+static void
+test_irc_parse_tags(void) {
+	TestIrcConn conn;
+	gchar *value;
+
+	test_irc_conn_init(&conn);
+
+	conn.irc->tags = "time=2010-08-27T20:42:02.000Z;+draft/label=a\\sb\\:c"
+	                 "\\\\d\\r\\n;flag;empty=;batch=ref;tail=ab\\";
+
+	value = irc_tag_get(conn.irc, "+draft/label");
+	g_assert_cmpstr("a b;c\\d\r\n", ==, value);
+	g_free(value);
+
+	/* a tag without a value, with or without the = */
+	value = irc_tag_get(conn.irc, "flag");
+	g_assert_cmpstr("", ==, value);
+	g_free(value);
+	value = irc_tag_get(conn.irc, "empty");
+	g_assert_cmpstr("", ==, value);
+	g_free(value);
+
+	/* a lone backslash at the end is dropped */
+	value = irc_tag_get(conn.irc, "tail");
+	g_assert_cmpstr("ab", ==, value);
+	g_free(value);
+
+	/* keys only match whole */
+	g_assert_null(irc_tag_get(conn.irc, "bat"));
+	g_assert_null(irc_tag_get(conn.irc, "label"));
+	g_assert_null(irc_tag_get(conn.irc, "missing"));
+
+	g_assert_cmpint(1282941722, ==, irc_msg_get_time(conn.irc));
+
+	conn.irc->tags = NULL;
+	g_assert_null(irc_tag_get(conn.irc, "time"));
+
+	test_irc_conn_clear(&conn);
+}
+
+/* Tags reach the handlers: CTCPs replayed from a chathistory batch are not
+ * answered, live ones are. */
+static void
+test_irc_parse_batch(void) {
+	TestIrcConn conn;
+
+	test_irc_conn_init(&conn);
+
+	test_irc_feed(&conn, ":irc.example.net BATCH +hist chathistory #chan");
+	g_assert_true(g_hash_table_contains(conn.irc->batches, "hist"));
+
+	test_irc_feed(&conn, "@batch=hist;time=2010-08-27T20:42:02.000Z "
+	                     ":alice!alice@example.com PRIVMSG #chan :\001VERSION\001");
+	g_assert_cmpuint(0, ==, conn.sent->len);
+
+	test_irc_feed(&conn, ":irc.example.net BATCH -hist");
+	g_assert_false(g_hash_table_contains(conn.irc->batches, "hist"));
+
+	test_irc_feed(&conn, "@batch=hist "
+	                     ":alice!alice@example.com PRIVMSG #chan :\001VERSION\001");
+	test_irc_assert_sent(&conn,
+	                     "NOTICE alice :\001VERSION Purple IRC\001\r\n");
+
+	/* a bare nick for a prefix */
+	test_irc_feed(&conn, ":bob PRIVMSG #chan :\001VERSION\001");
+	test_irc_assert_sent(&conn, "NOTICE bob :\001VERSION Purple IRC\001\r\n");
+
+	test_irc_conn_clear(&conn);
+}
+
+static void
+test_irc_parse_ctcp(void) {
+	TestIrcConn conn;
+	gchar *text;
+
+	test_irc_conn_init(&conn);
+
+	/* not a CTCP, or not a whole one */
+	text = irc_parse_ctcp(conn.irc, "alice", "me", "hello", FALSE);
+	g_assert_cmpstr("hello", ==, text);
+	g_free(text);
+	text = irc_parse_ctcp(conn.irc, "alice", "me", "\001", FALSE);
+	g_assert_cmpstr("\001", ==, text);
+	g_free(text);
+	text = irc_parse_ctcp(conn.irc, "alice", "me", "\001ACTION waves",
+	                      FALSE);
+	g_assert_cmpstr("\001ACTION waves", ==, text);
+	g_free(text);
+
+	text = irc_parse_ctcp(conn.irc, "alice", "me", "\001ACTION waves\001",
+	                      FALSE);
+	g_assert_cmpstr("/me waves", ==, text);
+	g_free(text);
+
+	text = irc_parse_ctcp(conn.irc, "alice", "me", "\001FINGER\001", FALSE);
+	g_assert_cmpstr("Received CTCP 'FINGER' (to me) from alice", ==, text);
+	g_free(text);
+	g_assert_cmpuint(0, ==, conn.sent->len);
+
+	/* requests are answered with a NOTICE, replies are not */
+	text = irc_parse_ctcp(conn.irc, "alice", "me", "\001PING 123\001",
+	                      FALSE);
+	g_assert_cmpstr("Received CTCP 'PING 123' (to me) from alice", ==, text);
+	g_free(text);
+	test_irc_assert_sent(&conn, "NOTICE alice :\001PING 123\001\r\n");
+
+	text = irc_parse_ctcp(conn.irc, "alice", "me", "\001VERSION\001", FALSE);
+	g_free(text);
+	test_irc_assert_sent(&conn,
+	                     "NOTICE alice :\001VERSION Purple IRC\001\r\n");
+
+	text = irc_parse_ctcp(conn.irc, "alice", "me",
+	                      "\001VERSION Some Client\001", TRUE);
+	g_assert_cmpstr("Received CTCP 'VERSION Some Client' (to me) from alice",
+	                ==, text);
+	g_free(text);
+	g_assert_cmpuint(0, ==, conn.sent->len);
+
+	test_irc_conn_clear(&conn);
+}
+
+/*
+ * What a client sees on a busy network: mostly channel traffic, much of it
+ * tagged.  The channels are not joined, so the handlers stop at the lookup
+ * and this times the parser and dispatch rather than the conversation UI.
+ * Run with -m perf for a number that means something.
+ */
+static const gchar *test_irc_trace[] = {
+	"@time=2010-08-27T20:42:02.000Z;account=someone;msgid=Zk%uq "
+	":nick%u!~user@host-%u.example.com PRIVMSG #busy :so what do you "
+	"think about the release %u?",
+	":nick%u!~user@host-%u.example.com PRIVMSG #busy :\001ACTION "
+	"shrugs %u\001",
+	"@time=2010-08-27T20:42:03.000Z "
+	":nick%u!~user@host-%u.example.com JOIN #busy nick%u :Real Name %u",
+	":nick%u!~user@host-%u.example.com PART #busy :leaving %u",
+	"@time=2010-08-27T20:42:04.000Z "
+	":nick%u!~user@host-%u.example.com QUIT :Quit: ping timeout %u",
+	":ChanServ!ChanServ@services. MODE #busy +o nick%u",
+	":nick%u!~user@host-%u.example.com NICK nick%u_",
+	":nick%u!~user@host-%u.example.com NOTICE #busy :notice %u",
+	"PING :irc.example.net",
+};
+
+static void
+test_irc_parse_trace(void) {
+	TestIrcConn conn;
+	GPtrArray *lines = g_ptr_array_new_with_free_func(g_free);
+	guint count = g_test_perf() ? 200000 : 2000;
+	gdouble elapsed;
+	guint i, pongs = 0;
+
+	test_irc_conn_init(&conn);
+
+	for (i = 0; i < count; i++) {
+		const gchar *format = test_irc_trace[i % G_N_ELEMENTS(test_irc_trace)];
+
+		g_ptr_array_add(lines, g_strdup_printf(format, i, i, i, i));
+		if (g_str_has_prefix(format, "PING "))
+			pongs++;
+	}
+
+	g_test_timer_start();
+	for (i = 0; i < count; i++)
+		irc_parse_msg(conn.irc, g_ptr_array_index(lines, i));
+	elapsed = g_test_timer_elapsed();
+
+	/* the only thing in there that wants an answer */
+	g_assert_cmpuint(pongs, ==, conn.sent->len);
+	g_test_minimized_result(elapsed * 1000000 / count,
+	                        "%.3f us per line over %u lines",
+	                        elapsed * 1000000 / count, count);
+
+	g_ptr_array_free(lines, TRUE);
+	test_irc_conn_clear(&conn);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	irc_msg_table_build();
+
+	_irc_protocol = g_object_new(test_irc_protocol_get_type(), NULL);
+	purple_signal_register(_irc_protocol, "irc-receiving-text",
+	                       purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE,
+	                       2, PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+	purple_signal_register(_irc_protocol, "irc-sending-text",
+	                       purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE,
+	                       2, PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+	purple_signal_connect(_irc_protocol, "irc-sending-text", _irc_protocol,
+	                      PURPLE_CALLBACK(test_irc_sending_text_cb), NULL);
+
+	g_test_add_func("/irc/parse/ping", test_irc_parse_ping);
+	g_test_add_func("/irc/parse/params", test_irc_parse_params);
+	g_test_add_func("/irc/parse/malformed", test_irc_parse_malformed);
+	g_test_add_func("/irc/parse/tags", test_irc_parse_tags);
+	g_test_add_func("/irc/parse/batch", test_irc_parse_batch);
+	g_test_add_func("/irc/parse/ctcp", test_irc_parse_ctcp);
+	g_test_add_func("/irc/parse/trace", test_irc_parse_trace);
+
+	return g_test_run();
+}
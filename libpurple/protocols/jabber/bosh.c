@@ -33,10 +33,12 @@ TODO: test, what happens, if the http server (BOSH server) doesn't support
 keep-alive (sends connection: close).
 */
 
-#define JABBER_BOSH_SEND_DELAY 250
-
 #define JABBER_BOSH_TIMEOUT 10
 
+/* Upper bound on the connection manager's 'requests' attribute; also the
+ * number of keep-alive HTTP connections the session may open. */
+#define JABBER_BOSH_MAX_REQUESTS 8
+
 static gchar *jabber_bosh_useragent = NULL;
 
 struct _PurpleJabberBOSHConnection {
@@ -50,16 +52,40 @@ struct _PurpleJabberBOSHConnection {
 	gchar *sid;
 	guint64 rid; /* Must be big enough to hold 2^53 - 1 */
 
+	/*
+	 * Requests may be answered out of order, but their payloads have to be
+	 * processed in rid order.  Every rid up to processed_rid has been
+	 * handled; early responses wait in the pending queue, sorted by rid.
+	 */
+	guint64 processed_rid;
+	GQueue pending;
+
+	/* From the session creation response */
+	guint requests;
+	guint hold;
+
 	GString *send_buff;
 	guint send_timer;
 };
 
+typedef struct {
+	PurpleJabberBOSHConnection *conn;
+	guint64 rid;
+} JabberBOSHRequest;
+
+typedef struct {
+	guint64 rid;
+	PurpleXmlNode *node;
+} JabberBOSHResponse;
+
 static SoupMessage *jabber_bosh_connection_http_request_new(
         PurpleJabberBOSHConnection *conn, const GString *data);
 static void
 jabber_bosh_connection_session_create(PurpleJabberBOSHConnection *conn);
 static void
 jabber_bosh_connection_send_now(PurpleJabberBOSHConnection *conn);
+static void
+jabber_bosh_connection_schedule(PurpleJabberBOSHConnection *conn);
 
 void
 jabber_bosh_init(void)
@@ -123,11 +149,15 @@ jabber_bosh_connection_new(JabberStream *js, const gchar *url)
 	conn->payload_reqs = soup_session_new_with_options(
 	        SOUP_SESSION_PROXY_RESOLVER, resolver, SOUP_SESSION_TIMEOUT,
 	        JABBER_BOSH_TIMEOUT + 2, SOUP_SESSION_USER_AGENT,
-	        jabber_bosh_useragent, NULL);
+	        jabber_bosh_useragent, SOUP_SESSION_MAX_CONNS_PER_HOST,
+	        JABBER_BOSH_MAX_REQUESTS, NULL);
 	conn->url = g_strdup(url);
 	conn->js = js;
 	conn->is_ssl = (url_p->scheme == SOUP_URI_SCHEME_HTTPS);
 	conn->send_buff = g_string_new(NULL);
+	g_queue_init(&conn->pending);
+	conn->requests = 1;
+	conn->hold = 1;
 
 	/*
 	 * Random 64-bit integer masked off by 2^52 - 1.
@@ -162,10 +192,16 @@ jabber_bosh_connection_destroy(PurpleJabberBOSHConnection *conn)
 
 	if (conn->send_timer)
 		g_source_remove(conn->send_timer);
+	conn->send_timer = 0;
 
 	soup_session_abort(conn->payload_reqs);
 
 	g_clear_object(&conn->payload_reqs);
+	while (!g_queue_is_empty(&conn->pending)) {
+		JabberBOSHResponse *response = g_queue_pop_head(&conn->pending);
+		purple_xmlnode_free(response->node);
+		g_free(response);
+	}
 	g_string_free(conn->send_buff, TRUE);
 	conn->send_buff = NULL;
 
@@ -210,6 +246,14 @@ jabber_bosh_connection_parse(PurpleJabberBOSHConnection *conn,
 
 	root = purple_xmlnode_from_str(response->response_body->data,
 	                               response->response_body->length);
+	if (root == NULL) {
+		/* Dropping it would leave a hole in the rid sequence that
+		 * nothing after it could get past. */
+		purple_connection_error(conn->js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Invalid response from server"));
+		return NULL;
+	}
 
 	type = purple_xmlnode_get_attrib(root, "type");
 	if (purple_strequal(type, "terminate")) {
@@ -224,20 +268,10 @@ jabber_bosh_connection_parse(PurpleJabberBOSHConnection *conn,
 }
 
 static void
-jabber_bosh_connection_recv(SoupSession *session, SoupMessage *msg,
-                            gpointer user_data)
+jabber_bosh_connection_process(PurpleJabberBOSHConnection *bosh_conn,
+                               PurpleXmlNode *node)
 {
-	PurpleJabberBOSHConnection *bosh_conn = user_data;
-	PurpleXmlNode *node, *child;
-
-	if (purple_debug_is_verbose() && purple_debug_is_unsafe()) {
-		purple_debug_misc("jabber-bosh", "received: %s\n",
-		                  msg->response_body->data);
-	}
-
-	node = jabber_bosh_connection_parse(bosh_conn, msg);
-	if (node == NULL)
-		return;
+	PurpleXmlNode *child;
 
 	child = node->child;
 	while (child != NULL) {
@@ -266,13 +300,63 @@ jabber_bosh_connection_recv(SoupSession *session, SoupMessage *msg,
 
 		child = next;
 	}
+}
+
+static gint
+jabber_bosh_response_compare(gconstpointer a, gconstpointer b,
+                             gpointer user_data)
+{
+	const JabberBOSHResponse *ra = a, *rb = b;
+
+	return (ra->rid > rb->rid) - (ra->rid < rb->rid);
+}
+
+static void
+jabber_bosh_connection_recv(SoupSession *session, SoupMessage *msg,
+                            gpointer user_data)
+{
+	JabberBOSHRequest *request = user_data;
+	PurpleJabberBOSHConnection *bosh_conn = request->conn;
+	JabberBOSHResponse *response;
+	PurpleXmlNode *node;
+
+	if (purple_debug_is_verbose() && purple_debug_is_unsafe()) {
+		purple_debug_misc("jabber-bosh", "received (rid %" G_GUINT64_FORMAT
+		                  "): %s\n", request->rid, msg->response_body->data);
+	}
 
-	jabber_bosh_connection_send(bosh_conn, NULL);
+	node = jabber_bosh_connection_parse(bosh_conn, msg);
+	if (node == NULL) {
+		g_free(request);
+		return;
+	}
+
+	response = g_new(JabberBOSHResponse, 1);
+	response->rid = request->rid;
+	response->node = node;
+	g_free(request);
+	g_queue_insert_sorted(&bosh_conn->pending, response,
+	                      jabber_bosh_response_compare, NULL);
+
+	/* Hand over everything that is now in sequence. */
+	while ((response = g_queue_peek_head(&bosh_conn->pending)) != NULL &&
+	       response->rid == bosh_conn->processed_rid + 1) {
+		g_queue_pop_head(&bosh_conn->pending);
+		bosh_conn->processed_rid = response->rid;
+
+		jabber_bosh_connection_process(bosh_conn, response->node);
+
+		purple_xmlnode_free(response->node);
+		g_free(response);
+	}
+
+	jabber_bosh_connection_schedule(bosh_conn);
 }
 
 static void
 jabber_bosh_connection_send_now(PurpleJabberBOSHConnection *conn)
 {
+	JabberBOSHRequest *request;
 	SoupMessage *req;
 	GString *data;
 
@@ -320,22 +404,58 @@ jabber_bosh_connection_send_now(PurpleJabberBOSHConnection *conn)
 		g_free(conn->sid);
 		conn->sid = NULL;
 	} else {
+		request = g_new(JabberBOSHRequest, 1);
+		request->conn = conn;
+		request->rid = conn->rid;
 		soup_session_queue_message(conn->payload_reqs, req,
-		                           jabber_bosh_connection_recv, conn);
+		                           jabber_bosh_connection_recv, request);
 	}
 }
 
+/* Requests sent whose responses haven't been processed yet. */
+static guint
+jabber_bosh_connection_outstanding(const PurpleJabberBOSHConnection *conn)
+{
+	return conn->rid - conn->processed_rid;
+}
+
 static gboolean
-jabber_bosh_connection_send_delayed(gpointer _conn)
+jabber_bosh_connection_flush(gpointer _conn)
 {
 	PurpleJabberBOSHConnection *conn = _conn;
+	guint outstanding = jabber_bosh_connection_outstanding(conn);
 
 	conn->send_timer = 0;
-	jabber_bosh_connection_send_now(conn);
+
+	/*
+	 * Never go past the window the connection manager allowed; whatever
+	 * is queued meanwhile goes out together once a response frees a slot.
+	 * With nothing to send, only keep enough requests open for the
+	 * manager to hold on to.
+	 */
+	if (outstanding >= conn->requests)
+		return FALSE;
+
+	if (conn->send_buff->len > 0 || conn->js->reinit ||
+	    outstanding < conn->hold)
+		jabber_bosh_connection_send_now(conn);
 
 	return FALSE;
 }
 
+/*
+ * Flush on the next main loop iteration, so stanzas sent back to back
+ * share one request without adding any fixed delay.
+ */
+static void
+jabber_bosh_connection_schedule(PurpleJabberBOSHConnection *conn)
+{
+	if (conn->sid == NULL || conn->send_timer != 0)
+		return;
+
+	conn->send_timer = g_idle_add(jabber_bosh_connection_flush, conn);
+}
+
 void
 jabber_bosh_connection_send(PurpleJabberBOSHConnection *conn,
 	const gchar *data)
@@ -345,11 +465,7 @@ jabber_bosh_connection_send(PurpleJabberBOSHConnection *conn,
 	if (data)
 		g_string_append(conn->send_buff, data);
 
-	if (conn->send_timer == 0) {
-		conn->send_timer = g_timeout_add(
-			JABBER_BOSH_SEND_DELAY,
-			jabber_bosh_connection_send_delayed, conn);
-	}
+	jabber_bosh_connection_schedule(conn);
 }
 
 void
@@ -357,7 +473,9 @@ jabber_bosh_connection_send_keepalive(PurpleJabberBOSHConnection *conn)
 {
 	g_return_if_fail(conn != NULL);
 
-	jabber_bosh_connection_send_now(conn);
+	/* A request the manager is holding keeps the session alive already. */
+	if (jabber_bosh_connection_outstanding(conn) < conn->requests)
+		jabber_bosh_connection_send_now(conn);
 }
 
 static gboolean
@@ -387,7 +505,7 @@ jabber_bosh_connection_session_created(SoupSession *session, SoupMessage *msg,
 {
 	PurpleJabberBOSHConnection *bosh_conn = user_data;
 	PurpleXmlNode *node, *features;
-	const gchar *sid, *ver, *inactivity_str;
+	const gchar *sid, *ver, *inactivity_str, *requests_str, *hold_str;
 	int inactivity = 0;
 
 	if (purple_debug_is_verbose() && purple_debug_is_unsafe()) {
@@ -402,7 +520,8 @@ jabber_bosh_connection_session_created(SoupSession *session, SoupMessage *msg,
 	sid = purple_xmlnode_get_attrib(node, "sid");
 	ver = purple_xmlnode_get_attrib(node, "ver");
 	inactivity_str = purple_xmlnode_get_attrib(node, "inactivity");
-	/* requests = purple_xmlnode_get_attrib(node, "requests"); */
+	requests_str = purple_xmlnode_get_attrib(node, "requests");
+	hold_str = purple_xmlnode_get_attrib(node, "hold");
 
 	if (!sid) {
 		purple_connection_error(bosh_conn->js->gc,
@@ -427,6 +546,21 @@ jabber_bosh_connection_session_created(SoupSession *session, SoupMessage *msg,
 	purple_debug_misc("jabber-bosh", "Session created for %p\n", bosh_conn);
 
 	bosh_conn->sid = g_strdup(sid);
+	bosh_conn->processed_rid = bosh_conn->rid;
+
+	/* The manager echoes the hold it settled on, and allows one request
+	 * more than that if it doesn't say otherwise. */
+	if (hold_str)
+		bosh_conn->hold = CLAMP(atoi(hold_str), 1,
+		                        JABBER_BOSH_MAX_REQUESTS - 1);
+	if (requests_str)
+		bosh_conn->requests = atoi(requests_str);
+	else
+		bosh_conn->requests = bosh_conn->hold + 1;
+	bosh_conn->requests = CLAMP(bosh_conn->requests, bosh_conn->hold,
+	                            JABBER_BOSH_MAX_REQUESTS);
+	purple_debug_misc("jabber-bosh", "Using up to %u concurrent requests, "
+	                  "%u held\n", bosh_conn->requests, bosh_conn->hold);
 
 	if (inactivity_str)
 		inactivity = atoi(inactivity_str);
@@ -456,7 +590,7 @@ jabber_bosh_connection_session_created(SoupSession *session, SoupMessage *msg,
 
 	purple_xmlnode_free(node);
 
-	jabber_bosh_connection_send(bosh_conn, NULL);
+	jabber_bosh_connection_schedule(bosh_conn);
 }
 
 static void
@@ -2240,8 +2240,10 @@ jabber_resource_has_capability(const JabberBuddyResource *jbr, const gchar *cap)
 		return FALSE;
 	}
 
-	node = g_list_find_custom(jbr->caps.info->features, cap, (GCompareFunc)strcmp);
-	if (!node && jbr->caps.exts && jbr->caps.info->exts) {
+	if (jabber_caps_client_info_has_feature(jbr->caps.info, cap))
+		return TRUE;
+
+	if (jbr->caps.exts && jbr->caps.info->exts) {
 		const GList *ext;
 		exts = jbr->caps.info->exts;
 		/* Walk through all the enabled caps, checking each list for the cap.
@@ -41,11 +41,40 @@ static GHashTable *capstable = NULL; /* JabberCapsTuple -> JabberCapsClientInfo
 static GHashTable *nodetable = NULL; /* char *node -> JabberCapsNodeExts */
 static guint       save_timer = 0;
 
-/* Free a GList of allocated char* */
+/*
+ * Feature namespaces are interned: the same few dozen of them are advertised
+ * by nearly every client, so there is no point in keeping a copy for each.
+ * That also means lists of features are freed with g_list_free().
+ */
+static const char *
+jabber_caps_intern_feature(const char *var)
+{
+	return g_intern_string(var);
+}
+
+/* Build the set of features used for lookups once info->features is final */
 static void
-free_string_glist(GList *list)
+jabber_caps_client_info_index_features(JabberCapsClientInfo *info)
 {
-	g_list_free_full(list, g_free);
+	GList *node;
+
+	info->feature_set = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (node = info->features; node; node = node->next)
+		g_hash_table_add(info->feature_set, node->data);
+}
+
+gboolean
+jabber_caps_client_info_has_feature(const JabberCapsClientInfo *info,
+                                    const char *feature)
+{
+	g_return_val_if_fail(info != NULL, FALSE);
+
+	if (info->feature_set == NULL)
+		return g_list_find_custom(info->features, feature,
+		                          (GCompareFunc)strcmp) != NULL;
+
+	return g_hash_table_contains(info->feature_set, feature);
 }
 
 static JabberCapsNodeExts*
@@ -94,7 +123,7 @@ static gboolean jabber_caps_compare(gconstpointer v1, gconstpointer v2) {
 	       purple_strequal(name1->hash, name2->hash);
 }
 
-static void
+void
 jabber_caps_client_info_destroy(JabberCapsClientInfo *info)
 {
 	if (info == NULL)
@@ -102,7 +131,9 @@ jabber_caps_client_info_destroy(JabberCapsClientInfo *info)
 
 	g_list_free_full(info->identities, (GDestroyNotify)jabber_identity_free);
 
-	free_string_glist(info->features);
+	g_list_free(info->features);
+	if (info->feature_set != NULL)
+		g_hash_table_destroy(info->feature_set);
 
 	g_list_free_full(info->forms, (GDestroyNotify)purple_xmlnode_free);
 
@@ -124,7 +155,7 @@ jabber_caps_find_exts_by_node(const char *node)
 	if (NULL == (exts = g_hash_table_lookup(nodetable, node))) {
 		exts = g_new0(JabberCapsNodeExts, 1);
 		exts->exts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-		                                   (GDestroyNotify)free_string_glist);
+		                                   (GDestroyNotify)g_list_free);
 		g_hash_table_insert(nodetable, g_strdup(node), jabber_caps_node_exts_ref(exts));
 	}
 
@@ -247,7 +278,8 @@ jabber_caps_load(void)
 					const char *var = purple_xmlnode_get_attrib(child, "var");
 					if(!var)
 						continue;
-					value->features = g_list_append(value->features,g_strdup(var));
+					value->features = g_list_append(value->features,
+						(gpointer)jabber_caps_intern_feature(var));
 				} else if (purple_strequal(child->name, "identity")) {
 					const char *category = purple_xmlnode_get_attrib(child, "category");
 					const char *type = purple_xmlnode_get_attrib(child, "type");
@@ -285,7 +317,8 @@ jabber_caps_load(void)
 								const char *var = purple_xmlnode_get_attrib(node, "var");
 								if (!var)
 									continue;
-								features = g_list_prepend(features, g_strdup(var));
+								features = g_list_prepend(features,
+									(gpointer)jabber_caps_intern_feature(var));
 							}
 						}
 
@@ -300,6 +333,7 @@ jabber_caps_load(void)
 			}
 
 			value->exts = exts;
+			jabber_caps_client_info_index_features(value);
 			g_hash_table_replace(capstable, key, value);
 
 		}
@@ -389,7 +423,7 @@ cbplususerdata_unref(jabber_caps_cbplususerdata *data)
 
 	/* If we have info here, it's already in the capstable, so don't free it */
 	if (data->exts)
-		free_string_glist(data->exts);
+		g_list_free_full(data->exts, g_free);
 	if (data->node_exts)
 		jabber_caps_node_exts_unref(data->node_exts);
 	g_free(data);
@@ -563,7 +597,8 @@ jabber_caps_ext_iqcb(JabberStream *js, const char *from, JabberIqType type,
 	        child = purple_xmlnode_get_next_twin(child)) {
 		const char *var = purple_xmlnode_get_attrib(child, "var");
 		if (var)
-			features = g_list_prepend(features, g_strdup(var));
+			features = g_list_prepend(features,
+				(gpointer)jabber_caps_intern_feature(var));
 	}
 
 	g_hash_table_insert(node_exts->exts, g_strdup(userdata->name), features);
@@ -742,7 +777,8 @@ JabberCapsClientInfo *jabber_caps_parse_client_info(PurpleXmlNode *query)
 			/* parse feature */
 			const char *var = purple_xmlnode_get_attrib(child, "var");
 			if (var)
-				info->features = g_list_prepend(info->features, g_strdup(var));
+				info->features = g_list_prepend(info->features,
+					(gpointer)jabber_caps_intern_feature(var));
 		} else if (purple_strequal(child->name, "x")) {
 			if (purple_strequal(child->xmlns, "jabber:x:data")) {
 				/* x-data form */
@@ -751,6 +787,9 @@ JabberCapsClientInfo *jabber_caps_parse_client_info(PurpleXmlNode *query)
 			}
 		}
 	}
+
+	jabber_caps_client_info_index_features(info);
+
 	return info;
 }
 
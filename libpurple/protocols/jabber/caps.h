@@ -40,7 +40,10 @@ typedef struct {
 
 struct _JabberCapsClientInfo {
 	GList *identities; /* JabberIdentity */
-	GList *features; /* char * */
+	GList *features; /* interned char * */
+	/* the same features, for lookups.  Like the rest of the info, this is
+	 * shared by every resource advertising the same caps. */
+	GHashTable *feature_set;
 	GList *forms; /* PurpleXmlNode * */
 	JabberCapsNodeExts *exts;
 
@@ -62,7 +65,7 @@ struct _JabberCapsClientInfo {
  */
 struct _JabberCapsNodeExts {
 	guint ref;
-	GHashTable *exts; /* char *ext_name -> GList *features */
+	GHashTable *exts; /* char *ext_name -> GList *features (interned) */
 };
 
 typedef void (*jabber_caps_get_info_cb)(JabberCapsClientInfo *info, GList *exts, gpointer user_data);
@@ -70,6 +73,13 @@ typedef void (*jabber_caps_get_info_cb)(JabberCapsClientInfo *info, GList *exts,
 void jabber_caps_init(void);
 void jabber_caps_uninit(void);
 
+/**
+ * Check whether the given info advertises a feature.  This does not look at
+ * any exts.
+ */
+gboolean jabber_caps_client_info_has_feature(const JabberCapsClientInfo *info,
+                                             const char *feature);
+
 /**
  * Check whether all of the exts in a char* array are known to the given info.
  */
@@ -127,4 +137,10 @@ void jabber_caps_broadcast_change(void);
  */
 JabberCapsClientInfo *jabber_caps_parse_client_info(PurpleXmlNode *query);
 
+/**
+ * Free a JabberCapsClientInfo, such as one from
+ * jabber_caps_parse_client_info().  NULL is ignored.
+ */
+void jabber_caps_client_info_destroy(JabberCapsClientInfo *info);
+
 #endif /* PURPLE_JABBER_CAPS_H */
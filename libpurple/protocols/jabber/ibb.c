@@ -29,6 +29,13 @@
 
 #define JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE 4096
 
+/* the block size we offer when opening a session, we fall back towards the
+ default if the other side (or its server) finds this too large */
+#define JABBER_IBB_SESSION_PREFERRED_BLOCK_SIZE 32768
+
+/* XEP-0047 doesn't allow anything larger */
+#define JABBER_IBB_SESSION_MAX_BLOCK_SIZE 65535
+
 static GHashTable *jabber_ibb_sessions = NULL;
 static GList *open_handlers = NULL;
 
@@ -44,9 +51,11 @@ jabber_ibb_session_create(JabberStream *js, const gchar *sid, const gchar *who,
 		sess->sid = jabber_get_next_id(js);
 	}
 	sess->who = g_strdup(who);
-	sess->block_size = JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE;
+	sess->block_size = JABBER_IBB_SESSION_PREFERRED_BLOCK_SIZE;
+	sess->window = JABBER_IBB_SESSION_DEFAULT_WINDOW;
 	sess->state = JABBER_IBB_SESSION_NOT_OPENED;
 	sess->user_data = user_data;
+	sess->pending_iqs = g_queue_new();
 
 	g_hash_table_insert(jabber_ibb_sessions, sess->sid, sess);
 
@@ -91,16 +100,19 @@ jabber_ibb_session_destroy(JabberIBBSession *sess)
 		jabber_ibb_session_close(sess);
 	}
 
-	if (sess->last_iq_id) {
+	while (!g_queue_is_empty(sess->pending_iqs)) {
+		gchar *iq_id = g_queue_pop_head(sess->pending_iqs);
+
 		purple_debug_info("jabber", "IBB: removing callback for <iq/> %s\n",
-			sess->last_iq_id);
+			iq_id);
 		jabber_iq_remove_callback_by_id(jabber_ibb_session_get_js(sess),
-			sess->last_iq_id);
-		g_free(sess->last_iq_id);
-		sess->last_iq_id = NULL;
+			iq_id);
+		g_free(iq_id);
 	}
+	g_queue_free(sess->pending_iqs);
 
 	g_hash_table_remove(jabber_ibb_sessions, sess->sid);
+	g_free(sess->encode_buffer);
 	g_free(sess->id);
 	g_free(sess->sid);
 	g_free(sess->who);
@@ -160,6 +172,51 @@ jabber_ibb_session_set_block_size(JabberIBBSession *sess, gsize size)
 	}
 }
 
+guint
+jabber_ibb_session_get_window(const JabberIBBSession *sess)
+{
+	return sess->window;
+}
+
+void
+jabber_ibb_session_set_window(JabberIBBSession *sess, guint window)
+{
+	sess->window = MAX(window, 1);
+}
+
+guint
+jabber_ibb_session_get_pending(const JabberIBBSession *sess)
+{
+	return g_queue_get_length(sess->pending_iqs);
+}
+
+gboolean
+jabber_ibb_session_can_send(const JabberIBBSession *sess)
+{
+	return jabber_ibb_session_get_state(sess) == JABBER_IBB_SESSION_OPENED &&
+		jabber_ibb_session_get_pending(sess) < sess->window;
+}
+
+/* track a sent IQ, so its callback can be removed if the session goes away */
+static void
+jabber_ibb_session_add_pending(JabberIBBSession *sess, JabberIq *iq)
+{
+	g_queue_push_tail(sess->pending_iqs,
+		g_strdup(purple_xmlnode_get_attrib(iq->node, "id")));
+}
+
+static void
+jabber_ibb_session_remove_pending(JabberIBBSession *sess, const char *id)
+{
+	GList *link = g_queue_find_custom(sess->pending_iqs, id,
+		(GCompareFunc)g_strcmp0);
+
+	if (link) {
+		g_free(link->data);
+		g_queue_delete_link(sess->pending_iqs, link);
+	}
+}
+
 gsize
 jabber_ibb_session_get_max_data_size(const JabberIBBSession *sess)
 {
@@ -214,7 +271,25 @@ jabber_ibb_session_opened_cb(JabberStream *js, const char *from,
 {
 	JabberIBBSession *sess = (JabberIBBSession *) data;
 
+	jabber_ibb_session_remove_pending(sess, id);
+
 	if (type == JABBER_IQ_ERROR) {
+		PurpleXmlNode *error = purple_xmlnode_get_child(packet, "error");
+
+		/* the other side is free to reject the block size we offered, in
+		  which case we try again with smaller blocks */
+		if (error && sess->block_size > JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE &&
+				purple_xmlnode_get_child_with_namespace(error,
+					"resource-constraint", NS_XMPP_STANZAS)) {
+			sess->block_size = MAX(sess->block_size / 2,
+				JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE);
+			purple_debug_info("jabber",
+				"IBB: block size rejected, retrying with %" G_GSIZE_FORMAT "\n",
+				sess->block_size);
+			jabber_ibb_session_open(sess);
+			return;
+		}
+
 		sess->state = JABBER_IBB_SESSION_ERROR;
 	} else {
 		sess->state = JABBER_IBB_SESSION_OPENED;
@@ -245,6 +320,7 @@ jabber_ibb_session_open(JabberIBBSession *sess)
 		purple_xmlnode_insert_child(set->node, open);
 
 		jabber_iq_set_callback(set, jabber_ibb_session_opened_cb, sess);
+		jabber_ibb_session_add_pending(sess, set);
 
 		jabber_iq_send(set);
 	}
@@ -293,18 +369,22 @@ jabber_ibb_session_send_acknowledge_cb(JabberStream *js, const char *from,
 	JabberIBBSession *sess = (JabberIBBSession *) data;
 
 	if (sess) {
-		/* reset callback */
-		g_free(sess->last_iq_id);
-		sess->last_iq_id = NULL;
+		/* this packet no longer takes up room in the window */
+		jabber_ibb_session_remove_pending(sess, id);
 
 		if (type == JABBER_IQ_ERROR) {
+			if (jabber_ibb_session_get_state(sess) != JABBER_IBB_SESSION_OPENED) {
+				/* another packet in the window already failed */
+				return;
+			}
+
 			jabber_ibb_session_close(sess);
 			sess->state = JABBER_IBB_SESSION_ERROR;
 
 			if (sess->error_cb) {
 				sess->error_cb(sess);
 			}
-		} else {
+		} else if (jabber_ibb_session_get_state(sess) == JABBER_IBB_SESSION_OPENED) {
 			if (sess->data_sent_cb) {
 				sess->data_sent_cb(sess);
 			}
@@ -331,36 +411,71 @@ jabber_ibb_session_send_data(JabberIBBSession *sess, gconstpointer data,
 	} else if (size > jabber_ibb_session_get_max_data_size(sess)) {
 		purple_debug_error("jabber",
 			"trying to send a too large packet in the IBB session\n");
+	} else if (!jabber_ibb_session_can_send(sess)) {
+		purple_debug_error("jabber",
+			"trying to send data on an IBB session with a full window\n");
 	} else {
 		JabberIq *set = jabber_iq_new(jabber_ibb_session_get_js(sess),
 			JABBER_IQ_SET);
 		PurpleXmlNode *data_element = purple_xmlnode_new("data");
-		char *base64 = g_base64_encode(data, size);
+		/* the space g_base64_encode_step() needs, without line breaks */
+		gsize encoded_size = (size / 3 + 1) * 4 + 4;
+		gsize encoded_len;
+		gint state = 0, save = 0;
 		char seq[10];
 		g_snprintf(seq, sizeof(seq), "%u", jabber_ibb_session_get_send_seq(sess));
 
+		/* encode straight into a buffer kept for the life of the session,
+		  rather than allocating a new string for every block */
+		if (sess->encode_buffer_size < encoded_size) {
+			g_free(sess->encode_buffer);
+			sess->encode_buffer = g_malloc(encoded_size);
+			sess->encode_buffer_size = encoded_size;
+		}
+		encoded_len = g_base64_encode_step(data, size, FALSE,
+			sess->encode_buffer, &state, &save);
+		encoded_len += g_base64_encode_close(FALSE,
+			sess->encode_buffer + encoded_len, &state, &save);
+
 		purple_xmlnode_set_attrib(set->node, "to", jabber_ibb_session_get_who(sess));
 		purple_xmlnode_set_namespace(data_element, NS_IBB);
 		purple_xmlnode_set_attrib(data_element, "sid", jabber_ibb_session_get_sid(sess));
 		purple_xmlnode_set_attrib(data_element, "seq", seq);
-		purple_xmlnode_insert_data(data_element, base64, -1);
+		purple_xmlnode_insert_data(data_element, sess->encode_buffer,
+			encoded_len);
 
 		purple_xmlnode_insert_child(set->node, data_element);
 
-		purple_debug_info("jabber",
-			"IBB: setting send <iq/> callback for session %p %s\n", sess,
-			sess->sid);
 		jabber_iq_set_callback(set, jabber_ibb_session_send_acknowledge_cb, sess);
-		sess->last_iq_id = g_strdup(purple_xmlnode_get_attrib(set->node, "id"));
-		purple_debug_info("jabber", "IBB: set sess->last_iq_id: %s\n",
-			sess->last_iq_id);
+		jabber_ibb_session_add_pending(sess, set);
+		purple_debug_info("jabber",
+			"IBB: sent <iq/> %s for session %p %s, %u awaiting response\n",
+			purple_xmlnode_get_attrib(set->node, "id"), sess, sess->sid,
+			jabber_ibb_session_get_pending(sess));
 		jabber_iq_send(set);
 
-		g_free(base64);
 		(sess->send_seq)++;
 	}
 }
 
+static void
+jabber_ibb_send_resource_constraint(JabberStream *js, const char *to,
+                                    const char *id)
+{
+	JabberIq *result = jabber_iq_new(js, JABBER_IQ_ERROR);
+	PurpleXmlNode *error = purple_xmlnode_new("error");
+	PurpleXmlNode *constraint = purple_xmlnode_new("resource-constraint");
+
+	purple_xmlnode_set_namespace(constraint, NS_XMPP_STANZAS);
+	purple_xmlnode_set_attrib(error, "type", "modify");
+	jabber_iq_set_id(result, id);
+	purple_xmlnode_set_attrib(result->node, "to", to);
+	purple_xmlnode_insert_child(error, constraint);
+	purple_xmlnode_insert_child(result->node, error);
+
+	jabber_iq_send(result);
+}
+
 static void
 jabber_ibb_send_error_response(JabberStream *js, const char *to, const char *id)
 {
@@ -474,6 +589,15 @@ jabber_ibb_parse(JabberStream *js, const char *who, JabberIqType type,
 	} else if (open) {
 		JabberIq *result;
 		const GList *iterator;
+		const gchar *block_size = purple_xmlnode_get_attrib(child, "block-size");
+
+		/* ask for smaller blocks if these are more than we allow, the
+		 initiator will retry */
+		if (block_size && g_ascii_strtoull(block_size, NULL, 10) >
+				JABBER_IBB_SESSION_MAX_BLOCK_SIZE) {
+			jabber_ibb_send_resource_constraint(js, who, id);
+			return;
+		}
 
 		/* run all open handlers registered until one returns true */
 		for (iterator = open_handlers ; iterator ;
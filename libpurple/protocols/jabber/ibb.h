@@ -27,6 +27,9 @@
 #include "jabber.h"
 #include "iq.h"
 
+/* how many <data/> packets may be awaiting acknowledgement by default */
+#define JABBER_IBB_SESSION_DEFAULT_WINDOW 8
+
 typedef struct _JabberIBBSession JabberIBBSession;
 
 typedef void
@@ -56,6 +59,9 @@ struct _JabberIBBSession {
 	guint16 recv_seq;
 	gsize block_size;
 
+	/* the maximum number of <data/> packets awaiting acknowledgement */
+	guint window;
+
 	/* session state */
 	JabberIBBSessionState state;
 
@@ -70,8 +76,13 @@ struct _JabberIBBSession {
 	JabberIBBDataCallback *data_received_cb;
 	JabberIBBErrorCallback *error_cb;
 
-	/* store the last sent IQ (to permit cancel of callback) */
-	gchar *last_iq_id;
+	/* ids of the sent IQs still awaiting a response, oldest first (to
+	   permit cancel of callbacks) */
+	GQueue *pending_iqs;
+
+	/* reused for base64-encoding each outgoing block */
+	gchar *encode_buffer;
+	gsize encode_buffer_size;
 };
 
 JabberIBBSession *jabber_ibb_session_create(JabberStream *js, const gchar *sid,
@@ -110,6 +121,16 @@ JabberIBBSessionState jabber_ibb_session_get_state(const JabberIBBSession *sess)
 gsize jabber_ibb_session_get_block_size(const JabberIBBSession *sess);
 void jabber_ibb_session_set_block_size(JabberIBBSession *sess, gsize size);
 
+guint jabber_ibb_session_get_window(const JabberIBBSession *sess);
+void jabber_ibb_session_set_window(JabberIBBSession *sess, guint window);
+
+/* number of sent <data/> packets not acknowledged yet */
+guint jabber_ibb_session_get_pending(const JabberIBBSession *sess);
+
+/* whether another data block may be sent right now, that is, the session is
+ open and the window is not full */
+gboolean jabber_ibb_session_can_send(const JabberIBBSession *sess);
+
 /* get maximum size data block to send (in bytes)
  (before encoded to BASE64) */
 gsize jabber_ibb_session_get_max_data_size(const JabberIBBSession *sess);
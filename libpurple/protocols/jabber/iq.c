@@ -39,18 +39,269 @@
 static GHashTable *iq_handlers = NULL;
 static GHashTable *signal_iq_handlers = NULL;
 
+/* Must be a power of two. */
+#define JABBER_IQ_WHEEL_SLOTS 64
+
+/*
+ * Outstanding requests are keyed by the serial number behind their id, and
+ * those with a deadline also sit on a timing wheel of one-second slots.  A
+ * single timer turns the wheel, and stops itself once the wheel is empty.
+ */
+struct _JabberIqTracker {
+	JabberStream *js;
+
+	GHashTable *callbacks; /* serial => JabberIqCallbackData */
+
+	GQueue wheel[JABBER_IQ_WHEEL_SLOTS];
+	guint scheduled;
+	gint64 tick;
+	guint timer;
+
+	guint64 timed_out;
+};
+
 struct _JabberIqCallbackData {
 	JabberIqCallback *callback;
 	gpointer data;
 	JabberID *to;
+
+	JabberIqTracker *tracker;
+	guint32 serial;
+	gint64 deadline;
+	GList *link;
 };
 
+static gint64
+jabber_iq_tracker_now(void)
+{
+	return g_get_monotonic_time() / G_USEC_PER_SEC;
+}
+
+static GQueue *
+jabber_iq_tracker_slot(JabberIqTracker *tracker, gint64 tick)
+{
+	return &tracker->wheel[tick & (JABBER_IQ_WHEEL_SLOTS - 1)];
+}
+
+static void
+jabber_iq_tracker_unschedule(JabberIqCallbackData *jcd)
+{
+	JabberIqTracker *tracker = jcd->tracker;
+
+	if (jcd->link == NULL)
+		return;
+
+	g_queue_delete_link(jabber_iq_tracker_slot(tracker, jcd->deadline),
+	                    jcd->link);
+	jcd->link = NULL;
+	tracker->scheduled--;
+}
+
 void jabber_iq_callbackdata_free(JabberIqCallbackData *jcd)
 {
+	jabber_iq_tracker_unschedule(jcd);
 	jabber_id_free(jcd->to);
 	g_free(jcd);
 }
 
+/*
+ * Hand a callback an error reply made up locally, as if from had sent it.
+ */
+static void
+jabber_iq_fail(JabberStream *js, JabberIqCallback *callback, gpointer data,
+               const char *from, const char *id, const char *type,
+               const char *condition)
+{
+	PurpleXmlNode *packet, *error, *child;
+
+	packet = purple_xmlnode_new("iq");
+	purple_xmlnode_set_attrib(packet, "type", "error");
+	purple_xmlnode_set_attrib(packet, "id", id);
+	if (from)
+		purple_xmlnode_set_attrib(packet, "from", from);
+	error = purple_xmlnode_new_child(packet, "error");
+	purple_xmlnode_set_attrib(error, "type", type);
+	child = purple_xmlnode_new_child(error, condition);
+	purple_xmlnode_set_namespace(child, NS_XMPP_STANZAS);
+
+	callback(js, from, JABBER_IQ_ERROR, id, packet, data);
+
+	purple_xmlnode_free(packet);
+}
+
+static void
+jabber_iq_timeout(JabberIqCallbackData *jcd)
+{
+	char *id, *from = NULL;
+
+	id = g_strdup_printf("purple%x", jcd->serial);
+	if (jcd->to)
+		from = jabber_id_get_full_jid(jcd->to);
+
+	purple_debug_warning("jabber", "IQ %s to %s timed out\n", id,
+	                     from ? from : "(server)");
+
+	/* The error the server would have sent if it had given up on the
+	 * request itself. */
+	jabber_iq_fail(jcd->tracker->js, jcd->callback, jcd->data, from, id,
+	               "wait", "remote-server-timeout");
+
+	g_free(from);
+	g_free(id);
+}
+
+static gboolean
+jabber_iq_tracker_tick_cb(gpointer data)
+{
+	JabberIqTracker *tracker = data;
+	gint64 now = jabber_iq_tracker_now();
+	GList *expired = NULL, *l;
+	guint turned = 0;
+
+	/* Everything is pulled off the wheel before any callback runs, since a
+	 * callback is free to send or cancel other requests. */
+	while (tracker->tick < now && turned++ < JABBER_IQ_WHEEL_SLOTS) {
+		GQueue *slot;
+
+		tracker->tick++;
+		slot = jabber_iq_tracker_slot(tracker, tracker->tick);
+
+		l = slot->head;
+		while (l != NULL) {
+			JabberIqCallbackData *jcd = l->data;
+
+			l = l->next;
+			if (jcd->deadline > now)
+				continue;
+
+			g_hash_table_steal(tracker->callbacks,
+			                   GUINT_TO_POINTER(jcd->serial));
+			jabber_iq_tracker_unschedule(jcd);
+			expired = g_list_prepend(expired, jcd);
+		}
+	}
+	tracker->tick = now;
+
+	for (l = g_list_reverse(expired); l != NULL; l = l->next) {
+		JabberIqCallbackData *jcd = l->data;
+
+		tracker->timed_out++;
+		jabber_iq_timeout(jcd);
+		jabber_iq_callbackdata_free(jcd);
+	}
+	g_list_free(expired);
+
+	if (tracker->scheduled == 0) {
+		tracker->timer = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+jabber_iq_tracker_schedule(JabberIqTracker *tracker, JabberIqCallbackData *jcd,
+                           guint timeout)
+{
+	GQueue *slot;
+
+	if (tracker->timer == 0) {
+		tracker->tick = jabber_iq_tracker_now();
+		tracker->timer = g_timeout_add_seconds(1,
+				jabber_iq_tracker_tick_cb, tracker);
+	}
+
+	jcd->deadline = tracker->tick + timeout;
+	slot = jabber_iq_tracker_slot(tracker, jcd->deadline);
+	g_queue_push_tail(slot, jcd);
+	jcd->link = slot->tail;
+	tracker->scheduled++;
+}
+
+JabberIqTracker *
+jabber_iq_tracker_new(JabberStream *js)
+{
+	JabberIqTracker *tracker = g_new0(JabberIqTracker, 1);
+
+	tracker->js = js;
+	tracker->callbacks = g_hash_table_new_full(g_direct_hash,
+			g_direct_equal, NULL,
+			(GDestroyNotify)jabber_iq_callbackdata_free);
+
+	return tracker;
+}
+
+void
+jabber_iq_tracker_free(JabberIqTracker *tracker)
+{
+	if (tracker == NULL)
+		return;
+
+	g_hash_table_destroy(tracker->callbacks);
+	if (tracker->timer != 0)
+		g_source_remove(tracker->timer);
+	g_free(tracker);
+}
+
+guint
+jabber_iq_get_outstanding_count(JabberStream *js)
+{
+	g_return_val_if_fail(js != NULL, 0);
+
+	return g_hash_table_size(js->iq_tracker->callbacks);
+}
+
+guint64
+jabber_iq_get_timed_out_count(JabberStream *js)
+{
+	g_return_val_if_fail(js != NULL, 0);
+
+	return js->iq_tracker->timed_out;
+}
+
+gboolean
+jabber_iq_id_parse(const char *id, guint32 *serial)
+{
+	guint32 value = 0;
+	const char *p;
+
+	if (id == NULL || !g_str_has_prefix(id, "purple"))
+		return FALSE;
+
+	p = id + strlen("purple");
+
+	/* Only accept exactly what jabber_get_next_id() would have produced,
+	 * so that two different ids can never share a serial. */
+	if (*p == '\0' || (*p == '0' && p[1] != '\0') || strlen(p) > 8)
+		return FALSE;
+
+	for (; *p != '\0'; p++) {
+		if (*p >= '0' && *p <= '9')
+			value = (value << 4) | (guint32)(*p - '0');
+		else if (*p >= 'a' && *p <= 'f')
+			value = (value << 4) | (guint32)(*p - 'a' + 10);
+		else
+			return FALSE;
+	}
+
+	if (serial)
+		*serial = value;
+
+	return TRUE;
+}
+
+static JabberIqCallbackData *
+jabber_iq_lookup_callback(JabberStream *js, const char *id)
+{
+	guint32 serial;
+
+	if (!jabber_iq_id_parse(id, &serial))
+		return NULL;
+
+	return g_hash_table_lookup(js->iq_tracker->callbacks,
+	                           GUINT_TO_POINTER(serial));
+}
+
 JabberIq *jabber_iq_new(JabberStream *js, JabberIqType type)
 {
 	JabberIq *iq;
@@ -79,6 +330,7 @@ JabberIq *jabber_iq_new(JabberStream *js, JabberIqType type)
 	}
 
 	iq->js = js;
+	iq->timeout = JABBER_IQ_TIMEOUT;
 
 	if(type == JABBER_IQ_GET || type == JABBER_IQ_SET) {
 		iq->id = jabber_get_next_id(js);
@@ -107,6 +359,12 @@ jabber_iq_set_callback(JabberIq *iq, JabberIqCallback *callback, gpointer data)
 	iq->callback_data = data;
 }
 
+void
+jabber_iq_set_timeout(JabberIq *iq, guint seconds)
+{
+	iq->timeout = seconds;
+}
+
 void jabber_iq_set_id(JabberIq *iq, const char *id)
 {
 	g_free(iq->id);
@@ -122,18 +380,39 @@ void jabber_iq_set_id(JabberIq *iq, const char *id)
 
 void jabber_iq_send(JabberIq *iq)
 {
+	JabberIqTracker *tracker;
 	JabberIqCallbackData *jcd;
+	guint32 serial;
 	g_return_if_fail(iq != NULL);
 
+	/* A reply to an id we did not make could never be matched to the
+	 * callback, so fail the request now instead of leaving it hanging. */
+	if (iq->id && iq->callback && !jabber_iq_id_parse(iq->id, &serial)) {
+		purple_debug_error("jabber", "Not sending IQ with foreign id %s, "
+		                   "its reply could not be tracked\n", iq->id);
+		jabber_iq_fail(iq->js, iq->callback, iq->callback_data,
+		               purple_xmlnode_get_attrib(iq->node, "to"), iq->id,
+		               "modify", "bad-request");
+		jabber_iq_free(iq);
+		return;
+	}
+
 	jabber_send(iq->js, iq->node);
 
 	if(iq->id && iq->callback) {
+		tracker = iq->js->iq_tracker;
+
 		jcd = g_new0(JabberIqCallbackData, 1);
 		jcd->callback = iq->callback;
 		jcd->data = iq->callback_data;
 		jcd->to = jabber_id_new(purple_xmlnode_get_attrib(iq->node, "to"));
+		jcd->tracker = tracker;
+		jcd->serial = serial;
 
-		g_hash_table_insert(iq->js->iq_callbacks, g_strdup(iq->id), jcd);
+		g_hash_table_replace(tracker->callbacks, GUINT_TO_POINTER(serial),
+		                     jcd);
+		if (iq->timeout > 0)
+			jabber_iq_tracker_schedule(tracker, jcd, iq->timeout);
 	}
 
 	jabber_iq_free(iq);
@@ -261,7 +540,11 @@ static void jabber_iq_version_parse(JabberStream *js, const char *from,
 
 void jabber_iq_remove_callback_by_id(JabberStream *js, const char *id)
 {
-	g_hash_table_remove(js->iq_callbacks, id);
+	guint32 serial;
+
+	if (jabber_iq_id_parse(id, &serial))
+		g_hash_table_remove(js->iq_tracker->callbacks,
+		                    GUINT_TO_POINTER(serial));
 }
 
 /**
@@ -412,7 +695,7 @@ void jabber_iq_parse(JabberStream *js, PurpleXmlNode *packet)
 
 	/* First, lets see if a special callback got registered */
 	if(type == JABBER_IQ_RESULT || type == JABBER_IQ_ERROR) {
-		jcd = g_hash_table_lookup(js->iq_callbacks, id);
+		jcd = jabber_iq_lookup_callback(js, id);
 		if (jcd) {
 			if (does_reply_from_match_request_to(js, jcd->to, from_id)) {
 				jcd->callback(js, from, type, id, packet, jcd->data);
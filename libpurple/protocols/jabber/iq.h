@@ -35,11 +35,16 @@ typedef enum {
 	JABBER_IQ_NONE
 } JabberIqType;
 
+typedef struct _JabberIqTracker JabberIqTracker;
+
 #include "jabber.h"
 
 typedef struct _JabberIq JabberIq;
 typedef struct _JabberIqCallbackData  JabberIqCallbackData;
 
+/* Seconds to wait for the reply to a GET or SET before giving up on it. */
+#define JABBER_IQ_TIMEOUT 120
+
 /**
  * A JabberIqHandler is called to process an incoming IQ stanza.
  * Handlers typically process unsolicited incoming GETs or SETs for their
@@ -71,7 +76,9 @@ typedef void (JabberIqHandler)(JabberStream *js, const char *from,
  * @param js     The JabberStream object.
  * @param from   The remote entity (the from attribute on the <iq/> stanza)
  * @param type   The IQ type. The only possible values are JABBER_IQ_RESULT
- *               and JABBER_IQ_ERROR.
+ *               and JABBER_IQ_ERROR.  If no reply arrives in time, the
+ *               callback gets a locally generated error carrying a
+ *               <remote-server-timeout/> condition.
  * @param id     The IQ id (the id attribute on the <iq/> stanza)
  * @param packet The <iq/> stanza
  * @param data   The callback data passed to jabber_iq_set_callback()
@@ -89,6 +96,7 @@ struct _JabberIq {
 
 	JabberIqCallback *callback;
 	gpointer callback_data;
+	guint timeout;
 
 	JabberStream *js;
 };
@@ -104,9 +112,37 @@ void jabber_iq_remove_callback_by_id(JabberStream *js, const char *id);
 void jabber_iq_set_callback(JabberIq *iq, JabberIqCallback *cb, gpointer data);
 void jabber_iq_set_id(JabberIq *iq, const char *id);
 
+/**
+ * Override how long to wait for the reply, in seconds.  0 waits for as long
+ * as the stream lasts, which is only right for requests that wait on a
+ * person at the other end.
+ */
+void jabber_iq_set_timeout(JabberIq *iq, guint seconds);
+
+/**
+ * Send @a iq and free it.  If it has a callback, the callback gets the
+ * reply, or an error made up locally if none comes in time.  A request with
+ * a callback and an id set by jabber_iq_set_id() that this client did not
+ * make is not sent at all; its callback gets a <bad-request/> error before
+ * this returns.
+ */
 void jabber_iq_send(JabberIq *iq);
 void jabber_iq_free(JabberIq *iq);
 
+JabberIqTracker *jabber_iq_tracker_new(JabberStream *js);
+void jabber_iq_tracker_free(JabberIqTracker *tracker);
+
+/* Requests still waiting for a reply, and how many were given up on. */
+guint jabber_iq_get_outstanding_count(JabberStream *js);
+guint64 jabber_iq_get_timed_out_count(JabberStream *js);
+
+/**
+ * Recover the serial number behind an id made by jabber_get_next_id().
+ *
+ * @return FALSE if @a id did not come from this client.
+ */
+gboolean jabber_iq_id_parse(const char *id, guint32 *serial);
+
 void jabber_iq_init(void);
 void jabber_iq_uninit(void);
 
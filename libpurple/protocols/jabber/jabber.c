@@ -63,6 +63,10 @@
  * anything in the last 120 seconds
  */
 #define DEFAULT_INACTIVITY_TIME 120
+/* Outgoing stanzas are serialized into a buffer kept on the stream, which
+ * is dropped rather than kept around once it grows past the maximum. */
+#define JABBER_SEND_BUFFER_SIZE 1024
+#define JABBER_SEND_BUFFER_MAX (64 * 1024)
 
 GList *jabber_features = NULL;
 GList *jabber_identities = NULL;
@@ -75,13 +79,21 @@ static gint plugin_ref = 0;
 
 static void jabber_unregister_account_cb(JabberStream *js);
 
-static void jabber_stream_init(JabberStream *js)
+void jabber_stream_init(JabberStream *js)
 {
 	char *open_stream;
 
 	g_free(js->stream_id);
 	js->stream_id = NULL;
 
+	/* Each WebSocket message is parsed on its own, so there's no parser to
+	 * reset, just an <open/> to send. */
+	if (js->websocket) {
+		js->reinit = FALSE;
+		jabber_websocket_connection_open(js->websocket);
+		return;
+	}
+
 	open_stream = g_strdup_printf("<stream:stream to='%s' "
 				          "xmlns='" NS_XMPP_CLIENT "' "
 						  "xmlns:stream='" NS_XMPP_STREAMS "' "
@@ -136,7 +148,7 @@ static void jabber_bind_result_cb(JabberStream *js, const char *from,
 		if((jid = purple_xmlnode_get_child(bind, "jid")) && (full_jid = purple_xmlnode_get_data(jid))) {
 			jabber_id_free(js->user);
 
-			js->user = jabber_id_new(full_jid);
+			js->user = jabber_id_new_private(full_jid);
 			if (js->user == NULL) {
 				purple_connection_error(js->gc,
 					PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
@@ -161,6 +173,7 @@ static void jabber_bind_result_cb(JabberStream *js, const char *from,
 		return;
 	}
 
+	jabber_sm_enable(js);
 	jabber_session_init(js);
 }
 
@@ -215,21 +228,30 @@ jabber_process_starttls(JabberStream *js, PurpleXmlNode *packet)
 		return FALSE;
 	}
 
-	/* Otherwise, it's a standard XMPP connection, or a HTTP (insecure) BOSH connection.
-	 * We request STARTTLS for standard XMPP connections, but we do nothing for insecure
-	 * BOSH connections, per XEP-0206. */
-	if(!js->bosh) {
+	/* Same for WebSocket (RFC 7395 section 3.6), where TLS belongs to the
+	 * wss:// connection. */
+	if (js->websocket && jabber_websocket_connection_is_ssl(js->websocket)) {
+		return FALSE;
+	}
+
+	/* Otherwise, it's a standard XMPP connection, or an insecure HTTP BOSH or
+	 * ws:// WebSocket connection. We request STARTTLS for standard XMPP
+	 * connections, but we do nothing for insecure BOSH (XEP-0206) or WebSocket
+	 * (RFC 7395) connections. */
+	if(!js->bosh && !js->websocket) {
 		jabber_send_raw(NULL, js,
 				"<starttls xmlns='urn:ietf:params:xml:ns:xmpp-tls'/>", -1);
 		return TRUE;
 	}
 
-	/* It's an insecure standard XMPP connection, or an insecure BOSH connection, let's
-	 * ignore STARTTLS even it's required by the server to prevent disabling HTTP BOSH
-	 * entirely (sysadmin is responsible to provide HTTPS-only BOSH if security is required),
+	/* It's an insecure standard XMPP connection, or an insecure BOSH or WebSocket
+	 * connection, let's ignore STARTTLS even it's required by the server to prevent
+	 * disabling HTTP BOSH and ws:// WebSocket entirely (sysadmin is responsible to
+	 * provide HTTPS-only BOSH or wss://-only WebSocket if security is required),
 	 * and emit errors if encryption is required by the user. */
 	starttls = purple_xmlnode_get_child(packet, "starttls");
-	if(!js->bosh && purple_xmlnode_get_child(starttls, "required")) {
+	if(!js->bosh && !js->websocket &&
+			purple_xmlnode_get_child(starttls, "required")) {
 		purple_connection_error(js->gc,
 				PURPLE_CONNECTION_ERROR_NO_SSL_SUPPORT,
 				_("Server requires TLS/SSL, but no TLS/SSL support was found."));
@@ -265,11 +287,26 @@ void jabber_stream_features_parse(JabberStream *js, PurpleXmlNode *packet)
 		return;
 	}
 
+	/* These ride along with other features, so note them before deciding
+	 * what to do next. */
+	if (purple_xmlnode_get_child_with_namespace(packet, "ver", NS_ROSTER_VERSIONING))
+		js->server_caps |= JABBER_CAP_ROSTER_VERSIONING;
+	if (purple_xmlnode_get_child_with_namespace(packet, "sm", NS_STREAM_MANAGEMENT))
+		js->server_caps |= JABBER_CAP_STREAM_MANAGEMENT;
+	if (purple_xmlnode_get_child_with_namespace(packet, "csi", NS_CSI))
+		js->server_caps |= JABBER_CAP_CSI;
+
 	if(js->registration) {
 		jabber_register_start(js);
 	} else if(purple_xmlnode_get_child(packet, "mechanisms")) {
 		jabber_stream_set_state(js, JABBER_STREAM_AUTHENTICATING);
 		jabber_auth_start(js, packet);
+	} else if (jabber_sm_is_resuming(js)) {
+		if (js->server_caps & JABBER_CAP_STREAM_MANAGEMENT) {
+			jabber_sm_resume(js);
+		} else {
+			jabber_sm_resume_failed(js);
+		}
 	} else if(purple_xmlnode_get_child(packet, "bind")) {
 		PurpleXmlNode *bind, *resource;
 		char *requested_resource;
@@ -287,8 +324,6 @@ void jabber_stream_features_parse(JabberStream *js, PurpleXmlNode *packet)
 		jabber_iq_set_callback(iq, jabber_bind_result_cb, NULL);
 
 		jabber_iq_send(iq);
-	} else if (purple_xmlnode_get_child_with_namespace(packet, "ver", NS_ROSTER_VERSIONING)) {
-		js->server_caps |= JABBER_CAP_ROSTER_VERSIONING;
 	} else /* if(purple_xmlnode_get_child_with_namespace(packet, "auth")) */ {
 		/* If we get an empty stream:features packet, or we explicitly get
 		 * an auth feature with namespace http://jabber.org/features/iq-auth
@@ -325,6 +360,8 @@ void jabber_process_packet(JabberStream *js, PurpleXmlNode **packet)
 	name = (*packet)->name;
 	xmlns = purple_xmlnode_get_namespace(*packet);
 
+	jabber_sm_stanza_received(js, *packet);
+
 	if (purple_strequal(name, "iq")) {
 		jabber_iq_parse(js, *packet);
 	} else if (purple_strequal(name, "presence")) {
@@ -356,11 +393,105 @@ void jabber_process_packet(JabberStream *js, PurpleXmlNode **packet)
 				tls_init(js);
 			/* TODO: Handle <failure/>, I guess? */
 		}
+	} else if (purple_strequal(xmlns, NS_STREAM_MANAGEMENT)) {
+		jabber_sm_process_packet(js, *packet);
 	} else {
 		purple_debug_warning("jabber", "Unknown packet: %s\n", name);
 	}
 }
 
+static void jabber_stream_connect(JabberStream *js);
+
+/*
+ * Throw away the transport but keep everything else, then connect again so
+ * the session can be resumed on the new stream.
+ */
+static void
+jabber_stream_reconnect(JabberStream *js)
+{
+	if (js->inpa) {
+		g_source_remove(js->inpa);
+		js->inpa = 0;
+	}
+	if (js->inactivity_timer != 0) {
+		g_source_remove(js->inactivity_timer);
+		js->inactivity_timer = 0;
+	}
+	/* The ping went out on the old stream; its answer never will. */
+	if (js->keepalive_timeout != 0) {
+		g_source_remove(js->keepalive_timeout);
+		js->keepalive_timeout = 0;
+	}
+
+	/* The new stream announces its own features, which need not match
+	 * the old one's. */
+	js->server_caps &= ~(JABBER_CAP_ROSTER_VERSIONING |
+	                     JABBER_CAP_STREAM_MANAGEMENT | JABBER_CAP_CSI);
+
+	/* Abort whatever is still queued for the old socket. */
+	g_cancellable_cancel(js->cancellable);
+	g_object_unref(js->cancellable);
+	js->cancellable = g_cancellable_new();
+
+	if (js->stream != NULL) {
+		purple_gio_graceful_close(js->stream, js->input,
+		                          js->output ? G_OUTPUT_STREAM(js->output) : NULL);
+	}
+	js->input = NULL;
+	g_clear_object(&js->output);
+	g_clear_object(&js->stream);
+	g_clear_object(&js->client);
+
+	if (js->current) {
+		PurpleXmlNode *root = js->current;
+
+		while (root->parent)
+			root = root->parent;
+		purple_xmlnode_free(root);
+		js->current = NULL;
+	}
+	jabber_parser_free(js);
+	js->reinit = FALSE;
+
+	if (js->auth_mech && js->auth_mech->dispose)
+		js->auth_mech->dispose(js);
+	js->auth_mech = NULL;
+#ifdef HAVE_CYRUS_SASL
+	if (js->sasl)
+		sasl_dispose(&js->sasl);
+	if (js->sasl_mechs) {
+		g_string_free(js->sasl_mechs, TRUE);
+		js->sasl_mechs = NULL;
+	}
+	js->sasl_maxbuf = 0;
+	/* Note: _not_ g_free.  See auth_cyrus.c:jabber_sasl_cb_secret */
+	free(js->sasl_secret);
+	js->sasl_secret = NULL;
+#endif
+
+	g_free(js->serverFQDN);
+	js->serverFQDN = NULL;
+	g_free(js->certificate_CN);
+	js->certificate_CN = NULL;
+
+	jabber_stream_connect(js);
+}
+
+static void
+jabber_stream_lost(JabberStream *js, GError *error)
+{
+	if (jabber_sm_start_resume(js)) {
+		purple_debug_info("jabber", "Lost connection (%s), trying to resume "
+		                  "the session\n", error->message);
+		g_error_free(error);
+		jabber_stream_reconnect(js);
+		return;
+	}
+
+	g_prefix_error(&error, "%s", _("Lost connection with server: "));
+	purple_connection_take_error(js->gc, error);
+}
+
 static void
 jabber_push_bytes_cb(GObject *source, GAsyncResult *res, gpointer data)
 {
@@ -374,9 +505,8 @@ jabber_push_bytes_cb(GObject *source, GAsyncResult *res, gpointer data)
 	if (!result) {
 		purple_queued_output_stream_clear_queue(stream);
 
-		if (error->code != G_IO_ERROR_CANCELLED) {
-			g_prefix_error(&error, "%s", _("Lost connection with server: "));
-			purple_connection_take_error(js->gc, error);
+		if (error->code != G_IO_ERROR_CANCELLED && stream == js->output) {
+			jabber_stream_lost(js, error);
 		} else {
 			g_error_free(error);
 		}
@@ -390,6 +520,10 @@ static gboolean do_jabber_send_raw(JabberStream *js, const char *data, int len)
 
 	g_return_val_if_fail(len > 0, FALSE);
 
+	/* Between transports while a session is being resumed. */
+	if (js->output == NULL)
+		return FALSE;
+
 	if (js->state == JABBER_STREAM_CONNECTED)
 		jabber_stream_restart_inactivity_timer(js);
 
@@ -414,8 +548,10 @@ jabber_send_raw(PurpleProtocolServer *protocol_server, JabberStream *js,
 
 	g_return_if_fail(data != NULL);
 
-	/* because printing a tab to debug every minute gets old */
-	if (!purple_strequal(data, "\t")) {
+	/* because printing a tab to debug every minute gets old, and there's
+	 * no point in scrubbing passwords from a message nobody will see */
+	if (!purple_strequal(data, "\t") &&
+	    purple_debug_is_printing(PURPLE_DEBUG_MISC, "jabber")) {
 		const char *username;
 		char *text = NULL, *last_part = NULL, *tag_start = NULL;
 
@@ -506,6 +642,8 @@ jabber_send_raw(PurpleProtocolServer *protocol_server, JabberStream *js,
 
 	if (js->bosh)
 		jabber_bosh_connection_send(js->bosh, data);
+	else if (js->websocket)
+		jabber_websocket_connection_send(js->websocket, data, len);
 	else
 		do_jabber_send_raw(js, data, len);
 }
@@ -530,8 +668,7 @@ void jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
                            gpointer unused)
 {
 	JabberStream *js;
-	char *txt;
-	int len;
+	GString *buf;
 
 	if (NULL == packet)
 		return;
@@ -543,14 +680,31 @@ void jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
 	if (NULL == js)
 		return;
 
-	if (js->bosh)
+	/* Over HTTP transports every stanza stands alone, so it needs its
+	 * namespace spelled out. */
+	if (js->bosh || js->websocket)
 		if (purple_strequal((*packet)->name, "message") ||
 				purple_strequal((*packet)->name, "iq") ||
 				purple_strequal((*packet)->name, "presence"))
 			purple_xmlnode_set_namespace(*packet, NS_XMPP_CLIENT);
-	txt = purple_xmlnode_to_str(*packet, &len);
-	jabber_send_raw(NULL, js, txt, len);
-	g_free(txt);
+
+	/* Serialize into the stream's buffer.  It is taken while in use, since
+	 * a jabber-sending-text handler could send another stanza. */
+	buf = js->send_buffer;
+	js->send_buffer = NULL;
+	if (buf == NULL)
+		buf = g_string_sized_new(JABBER_SEND_BUFFER_SIZE);
+	g_string_truncate(buf, 0);
+
+	purple_xmlnode_append_str(*packet, buf);
+	if (jabber_sm_stanza_sent(js, *packet, buf->str, buf->len))
+		jabber_send_raw(NULL, js, buf->str, buf->len);
+
+	/* Don't hold on to the memory of the odd huge stanza, like an avatar. */
+	if (js->send_buffer == NULL && buf->allocated_len <= JABBER_SEND_BUFFER_MAX)
+		js->send_buffer = buf;
+	else
+		g_string_free(buf, TRUE);
 }
 
 void jabber_send(JabberStream *js, PurpleXmlNode *packet)
@@ -561,9 +715,18 @@ void jabber_send(JabberStream *js, PurpleXmlNode *packet)
 static gboolean jabber_keepalive_timeout(PurpleConnection *gc)
 {
 	JabberStream *js = purple_connection_get_protocol_data(gc);
-	purple_connection_error(gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-					_("Ping timed out"));
+
 	js->keepalive_timeout = 0;
+
+	if (jabber_sm_start_resume(js)) {
+		purple_debug_info("jabber", "Ping timed out, resuming the "
+		                  "session on a new connection\n");
+		jabber_stream_reconnect(js);
+	} else {
+		purple_connection_error(gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+						_("Ping timed out"));
+	}
+
 	return FALSE;
 }
 
@@ -599,9 +762,15 @@ jabber_recv_cb(GObject *stream, gpointer data)
 		        G_POLLABLE_INPUT_STREAM(stream), buf, sizeof(buf) - 1,
 		        js->cancellable, &error);
 		if (len == 0) {
-			purple_connection_error(js->gc,
-			                        PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-			                        _("Server closed the connection"));
+			if (jabber_sm_start_resume(js)) {
+				purple_debug_info("jabber", "Server closed the connection, "
+				                  "trying to resume the session\n");
+				jabber_stream_reconnect(js);
+			} else {
+				purple_connection_error(js->gc,
+				                        PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				                        _("Server closed the connection"));
+			}
 			return G_SOURCE_REMOVE;
 		} else if (len < 0) {
 			if (error->code == G_IO_ERROR_WOULD_BLOCK) {
@@ -610,9 +779,7 @@ jabber_recv_cb(GObject *stream, gpointer data)
 			} else if (error->code == G_IO_ERROR_CANCELLED) {
 				g_error_free(error);
 			} else {
-				g_prefix_error(&error, "%s",
-				               _("Lost connection with server: "));
-				purple_connection_take_error(js->gc, error);
+				jabber_stream_lost(js, error);
 			}
 			return G_SOURCE_REMOVE;
 		}
@@ -934,7 +1101,8 @@ jabber_stream_new(PurpleAccount *account)
 	slash = strchr(user, '/');
 	if (slash && *(slash + 1) == '\0')
 		*slash = '\0';
-	js->user = jabber_id_new(user);
+	/* we change this one as we go along, so it can't be a shared one */
+	js->user = jabber_id_new_private(user);
 
 	if (!js->user) {
 		purple_connection_error(gc,
@@ -984,8 +1152,7 @@ jabber_stream_new(PurpleAccount *account)
 
 	js->user_jb->subscription |= JABBER_SUB_BOTH;
 
-	js->iq_callbacks = g_hash_table_new_full(g_str_hash, g_str_equal,
-			g_free, (GDestroyNotify)jabber_iq_callbackdata_free);
+	js->iq_tracker = jabber_iq_tracker_new(js);
 	js->chats = g_hash_table_new_full(g_str_hash, g_str_equal,
 			g_free, (GDestroyNotify)jabber_chat_free);
 	js->next_id = g_random_int();
@@ -1022,6 +1189,18 @@ jabber_stream_connect(JabberStream *js)
 
 	jabber_stream_set_state(js, JABBER_STREAM_CONNECTING);
 
+	/* The same setting takes a ws:// or wss:// URL for RFC 7395. */
+	if (jabber_websocket_is_url(bosh_url)) {
+		js->websocket = jabber_websocket_connection_new(js, bosh_url);
+		if (!js->websocket) {
+			purple_connection_error(gc,
+				PURPLE_CONNECTION_ERROR_INVALID_SETTINGS,
+				_("Malformed WebSocket URL"));
+		}
+
+		return;
+	}
+
 	/* If both BOSH and a Connect Server are specified, we prefer BOSH. I'm not
 	 * attached to that choice, though.
 	 */
@@ -1611,6 +1790,9 @@ void jabber_close(PurpleConnection *gc)
 	if (js->bosh) {
 		jabber_bosh_connection_destroy(js->bosh);
 		js->bosh = NULL;
+	} else if (js->websocket) {
+		jabber_websocket_connection_destroy(js->websocket);
+		js->websocket = NULL;
 	} else if (js->output != NULL) {
 		/* We should emit the stream termination message here
 		 * normally, but since we destroy the jabber stream just
@@ -1640,8 +1822,9 @@ void jabber_close(PurpleConnection *gc)
 
 	jabber_parser_free(js);
 
-	if(js->iq_callbacks)
-		g_hash_table_destroy(js->iq_callbacks);
+	jabber_iq_tracker_free(js->iq_tracker);
+	if (js->send_buffer)
+		g_string_free(js->send_buffer, TRUE);
 	if(js->buddies)
 		g_hash_table_destroy(js->buddies);
 	if(js->chats)
@@ -1688,6 +1871,8 @@ void jabber_close(PurpleConnection *gc)
 	g_free(js->old_uri);
 	g_free(js->old_track);
 
+	jabber_sm_close(js);
+
 	if (js->keepalive_timeout != 0)
 		g_source_remove(js->keepalive_timeout);
 	if (js->inactivity_timer != 0)
@@ -1714,6 +1899,15 @@ void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 	         : 5)
 
 	js->state = state;
+
+	/* The account never went offline, so don't report connection progress
+	 * while the transport is replaced underneath a resumable session. */
+	if (jabber_sm_is_resuming(js)) {
+		if (state == JABBER_STREAM_INITIALIZING)
+			jabber_stream_init(js);
+		return;
+	}
+
 	switch(state) {
 		case JABBER_STREAM_OFFLINE:
 			break;
@@ -1748,6 +1942,9 @@ void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 		case JABBER_STREAM_CONNECTED:
 			/* Send initial presence */
 			jabber_presence_send(js, TRUE);
+			/* A new stream starts out active */
+			js->csi_inactive = FALSE;
+			jabber_csi_update(js, FALSE);
 			/* Start up the inactivity timer */
 			jabber_stream_restart_inactivity_timer(js);
 
@@ -1758,6 +1955,45 @@ void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 #undef JABBER_CONNECT_STEPS
 }
 
+void
+jabber_csi_update(JabberStream *js, gboolean force)
+{
+	gboolean inactive;
+
+	if (!(js->server_caps & JABBER_CAP_CSI) ||
+	    js->state != JABBER_STREAM_CONNECTED)
+		return;
+
+	inactive = !purple_core_is_foreground() || js->idle != 0;
+	if (inactive == js->csi_inactive && !force)
+		return;
+
+	js->csi_inactive = inactive;
+	if (inactive)
+		jabber_send_raw(NULL, js, "<inactive xmlns='" NS_CSI "'/>", -1);
+	else
+		jabber_send_raw(NULL, js, "<active xmlns='" NS_CSI "'/>", -1);
+}
+
+static void
+jabber_foreground_changed_cb(gboolean foreground, gpointer data)
+{
+	GList *l;
+
+	for (l = purple_connections_get_all(); l != NULL; l = l->next) {
+		PurpleConnection *gc = l->data;
+		JabberStream *js;
+
+		if (purple_connection_get_protocol(gc) != xmpp_protocol)
+			continue;
+
+		js = purple_connection_get_protocol_data(gc);
+		if (js != NULL)
+			jabber_csi_update(js, FALSE);
+	}
+}
+
+/* jabber_iq_id_parse() relies on this exact format. */
 char *jabber_get_next_id(JabberStream *js)
 {
 	return g_strdup_printf("purple%x", js->next_id++);
@@ -1775,6 +2011,8 @@ jabber_idle_set(PurpleProtocolServer *protocol_server, PurpleConnection *gc,
 	/* send out an updated prescence */
 	purple_debug_info("jabber", "sending updated presence for idle\n");
 	jabber_presence_send(js, FALSE);
+
+	jabber_csi_update(js, FALSE);
 }
 
 void jabber_blocklist_parse_push(JabberStream *js, const char *from,
@@ -2067,8 +2305,12 @@ void jabber_bytestreams_streamhost_free(JabberBytestreamsStreamhost *sh)
 
 gboolean jabber_stream_is_ssl(JabberStream *js)
 {
-	return (js->bosh && jabber_bosh_connection_is_ssl(js->bosh)) ||
-	       (!js->bosh && G_IS_TLS_CONNECTION(js->stream));
+	if (js->bosh)
+		return jabber_bosh_connection_is_ssl(js->bosh);
+	if (js->websocket)
+		return jabber_websocket_connection_is_ssl(js->websocket);
+
+	return G_IS_TLS_CONNECTION(js->stream);
 }
 
 static gboolean
@@ -2083,7 +2325,9 @@ inactivity_cb(gpointer data)
 
 	if (js->bosh) {
 		jabber_bosh_connection_send_keepalive(js->bosh);
-	} else {
+	} else if (!js->websocket) {
+		/* WebSocket doesn't allow whitespace between messages, and the
+		 * connection sends its own pings instead. */
 		jabber_send_raw(NULL, js, "\t", 1);
 	}
 
@@ -3980,6 +4224,7 @@ jabber_do_uninit(void)
 	jabber_auth_uninit();
 	g_list_free_full(jabber_features, (GDestroyNotify)jabber_feature_free);
 	g_list_free_full(jabber_identities, (GDestroyNotify)jabber_identity_free);
+	jabber_id_cache_clear();
 
 	g_hash_table_destroy(jabber_cmds);
 	jabber_cmds = NULL;
@@ -4311,6 +4556,8 @@ plugin_load(PurplePlugin *plugin, GError **error)
 
 	purple_signal_connect(purple_get_core(), "uri-handler", xmpp_protocol,
 		PURPLE_CALLBACK(xmpp_uri_handler), xmpp_protocol);
+	purple_signal_connect(purple_get_core(), "foreground-changed",
+		xmpp_protocol, PURPLE_CALLBACK(jabber_foreground_changed_cb), NULL);
 
 	jabber_init_protocol(xmpp_protocol);
 
@@ -4322,6 +4569,8 @@ plugin_unload(PurplePlugin *plugin, GError **error)
 {
 	purple_signal_disconnect(purple_get_core(), "uri-handler",
 			xmpp_protocol, PURPLE_CALLBACK(xmpp_uri_handler));
+	purple_signal_disconnect(purple_get_core(), "foreground-changed",
+			xmpp_protocol, PURPLE_CALLBACK(jabber_foreground_changed_cb));
 
 	jabber_uninit_protocol(xmpp_protocol);
 
@@ -43,6 +43,8 @@ typedef enum {
 
 	JABBER_CAP_ITEMS          = 1 << 14,
 	JABBER_CAP_ROSTER_VERSIONING = 1 << 15,
+	JABBER_CAP_STREAM_MANAGEMENT = 1 << 16,
+	JABBER_CAP_CSI            = 1 << 17,
 
 	JABBER_CAP_MESSAGE_CARBONS = 1 << 19,
 
@@ -68,6 +70,8 @@ typedef struct _JabberStream JabberStream;
 #include "jutil.h"
 #include "buddy.h"
 #include "bosh.h"
+#include "sm.h"
+#include "websocket.h"
 
 #ifdef HAVE_CYRUS_SASL
 #include <sasl/sasl.h>
@@ -171,8 +175,8 @@ struct _JabberStream
 	PurpleRoomlist *roomlist;
 	GList *user_directories;
 
-	GHashTable *iq_callbacks;
-	int next_id;
+	JabberIqTracker *iq_tracker;
+	guint32 next_id;
 
 	GList *bs_proxies;
 	GList *oob_file_transfers;
@@ -189,6 +193,7 @@ struct _JabberStream
 	GIOStream *stream;
 	GInputStream *input;
 	PurpleQueuedOutputStream *output;
+	GString *send_buffer;
 
 	gboolean registration;
 
@@ -260,6 +265,13 @@ struct _JabberStream
 	guint conn_close_timeout;
 
 	PurpleJabberBOSHConnection *bosh;
+	PurpleJabberWebSocketConnection *websocket;
+
+	/* XEP-0198 state, NULL until <enable/> has been sent */
+	JabberStreamManagement *sm;
+
+	/* Whether we last told the server we're <inactive/> (XEP-0352) */
+	gboolean csi_inactive;
 
 	SoupSession *http_conns;
 
@@ -307,6 +319,7 @@ extern GList *jabber_identities;
 G_MODULE_EXPORT GType jabber_protocol_get_type(void);
 
 void jabber_stream_features_parse(JabberStream *js, PurpleXmlNode *packet);
+void jabber_stream_init(JabberStream *js);
 void jabber_process_packet(JabberStream *js, PurpleXmlNode **packet);
 void jabber_send(JabberStream *js, PurpleXmlNode *data);
 void jabber_send_raw(PurpleProtocolServer *protocol_server, JabberStream *js, const char *data, int len);
@@ -315,6 +328,13 @@ void jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
 
 void jabber_stream_set_state(JabberStream *js, JabberStreamState state);
 
+/**
+ * Tell the server whether we're active or inactive (XEP-0352), based on
+ * whether the UI is in the foreground and whether we're idle.  Nothing is
+ * sent if the state hasn't changed, unless @a force is set.
+ */
+void jabber_csi_update(JabberStream *js, gboolean force);
+
 void jabber_register_parse(JabberStream *js, const char *from,
                            JabberIqType type, const char *id, PurpleXmlNode *query);
 void jabber_register_start(JabberStream *js);
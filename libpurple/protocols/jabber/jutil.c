@@ -31,7 +31,40 @@
 
 #include <idna.h>
 #include <stringprep.h>
-static char idn_buffer[1024];
+
+/* the maximum length, in bytes, of each of the parts of a JID */
+#define JABBER_ID_PART_MAX 1023
+
+/* how many parsed JIDs jabber_id_new() keeps around */
+#define JABBER_ID_CACHE_SIZE 1024
+
+typedef struct {
+	gchar *str;
+	JabberID *jid;
+} JabberIDCacheEntry;
+
+/*
+ * Parsed JIDs, keyed on the string they were parsed from.  The same few
+ * hundred JIDs show up in nearly every stanza, so this saves both the
+ * parsing and the allocations.  The least recently used entries are dropped
+ * once there are more than JABBER_ID_CACHE_SIZE.
+ *
+ * jid_cache maps the string to a link in jid_cache_lru, which holds the
+ * JabberIDCacheEntry's, most recently used first.
+ */
+static GHashTable *jid_cache = NULL;
+static GQueue jid_cache_lru = G_QUEUE_INIT;
+static GMutex jid_cache_lock;
+
+static JabberID *
+jabber_id_alloc(void)
+{
+	JabberID *jid = g_new0(JabberID, 1);
+
+	jid->ref_count = 1;
+
+	return jid;
+}
 
 static gboolean jabber_nodeprep(char *str, size_t buflen)
 {
@@ -53,6 +86,7 @@ jabber_idn_validate(const char *str, const char *at, const char *slash,
 	int node_len = 0;
 	int domain_len = 0;
 	int resource_len = 0;
+	char idn_buffer[JABBER_ID_PART_MAX + 1];
 	char *out;
 	JabberID *jid;
 
@@ -81,14 +115,14 @@ jabber_idn_validate(const char *str, const char *at, const char *slash,
 		}
 	}
 
-	if (node && node_len > 1023)
+	if (node && node_len > JABBER_ID_PART_MAX)
 		return NULL;
-	if (domain_len > 1023)
+	if (domain_len > JABBER_ID_PART_MAX)
 		return NULL;
-	if (resource && resource_len > 1023)
+	if (resource && resource_len > JABBER_ID_PART_MAX)
 		return NULL;
 
-	jid = g_new0(JabberID, 1);
+	jid = jabber_id_alloc();
 
 	if (node) {
 		strncpy(idn_buffer, node, node_len);
@@ -165,12 +199,13 @@ out:
 
 gboolean jabber_nodeprep_validate(const char *str)
 {
+	char idn_buffer[JABBER_ID_PART_MAX + 1];
 	gboolean result;
 
 	if(!str)
 		return TRUE;
 
-	if(strlen(str) > 1023)
+	if(strlen(str) > JABBER_ID_PART_MAX)
 		return FALSE;
 
 	strncpy(idn_buffer, str, sizeof(idn_buffer) - 1);
@@ -188,7 +223,7 @@ gboolean jabber_domain_validate(const char *str)
 		return TRUE;
 
 	len = strlen(str);
-	if (len > 1023)
+	if (len > JABBER_ID_PART_MAX)
 		return FALSE;
 
 	c = str;
@@ -232,12 +267,13 @@ gboolean jabber_domain_validate(const char *str)
 
 gboolean jabber_resourceprep_validate(const char *str)
 {
+	char idn_buffer[JABBER_ID_PART_MAX + 1];
 	gboolean result;
 
 	if(!str)
 		return TRUE;
 
-	if(strlen(str) > 1023)
+	if(strlen(str) > JABBER_ID_PART_MAX)
 		return FALSE;
 
 	strncpy(idn_buffer, str, sizeof(idn_buffer) - 1);
@@ -248,6 +284,7 @@ gboolean jabber_resourceprep_validate(const char *str)
 
 char *jabber_saslprep(const char *in)
 {
+	char idn_buffer[JABBER_ID_PART_MAX + 1];
 	char *out;
 
 	g_return_val_if_fail(in != NULL, NULL);
@@ -267,8 +304,35 @@ char *jabber_saslprep(const char *in)
 	return out;
 }
 
+/*
+ * Characters which nodeprep leaves alone, apart from lowercasing them.  That
+ * is printable ASCII, minus space and the characters it prohibits.
+ */
+static gboolean
+jabber_node_char_is_simple(char c)
+{
+	return c > 0x20 && c < 0x7F &&
+		c != '"' && c != '&' && c != '\'' && c != ':' &&
+		c != '<' && c != '>';
+}
+
+/* resourceprep doesn't touch printable ASCII at all */
+static gboolean
+jabber_resource_char_is_simple(char c)
+{
+	return c >= 0x20 && c < 0x7F;
+}
+
+/* nameprep and ToASCII only lowercase LDH names */
+static gboolean
+jabber_domain_char_is_simple(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+		(c >= 'A' && c <= 'Z') || c == '.' || c == '-';
+}
+
 static JabberID*
-jabber_id_new_internal(const char *str, gboolean allow_terminating_slash)
+jabber_id_parse(const char *str, gboolean allow_terminating_slash)
 {
 	const char *at = NULL;
 	const char *slash = NULL;
@@ -315,27 +379,42 @@ jabber_id_new_internal(const char *str, gboolean allow_terminating_slash)
 				break;
 
 			default:
-				/* characters allowed everywhere */
-				if ((*c >= 'a' && *c <= 'z')
-						|| (*c >= '0' && *c <= '9')
-						|| (*c >= 'A' && *c <= 'Z')
-						|| *c == '.' || *c == '-')
-					/* We're good */
-					break;
-
 				/*
-				 * Hmm, this character is a bit more exotic.  Better fall
-				 * back to using the more expensive UTF-8 compliant
-				 * stringprep functions.
+				 * Only characters which stringprep provably leaves alone
+				 * (other than case) can take the quick path; anything a bit
+				 * more exotic falls back to the more expensive UTF-8
+				 * compliant stringprep functions.  We don't know which part
+				 * of the JID we're in until we've seen all of it, so for now
+				 * anything that's simple in a resource will do, the other
+				 * parts get a closer look below.
 				 */
-				needs_validation = TRUE;
+				if (!jabber_resource_char_is_simple(*c))
+					needs_validation = TRUE;
 				break;
 		}
 	}
 
+	if (!needs_validation) {
+		const char *domain = at ? at + 1 : str;
+		const char *domain_end = slash ? slash : c;
+		const char *p;
+
+		if (at && at - str > JABBER_ID_PART_MAX)
+			return NULL;
+		if (domain_end - domain > JABBER_ID_PART_MAX)
+			return NULL;
+		if (slash && c - (slash + 1) > JABBER_ID_PART_MAX)
+			return NULL;
+
+		for (p = str; at && p < at && !needs_validation; p++)
+			needs_validation = !jabber_node_char_is_simple(*p);
+		for (p = domain; p < domain_end && !needs_validation; p++)
+			needs_validation = !jabber_domain_char_is_simple(*p);
+	}
+
 	if (!needs_validation) {
 		/* JID is made of only ASCII characters--just lowercase and return */
-		jid = g_new0(JabberID, 1);
+		jid = jabber_id_alloc();
 
 		if (at) {
 			jid->node = g_ascii_strdown(str, at - str);
@@ -370,10 +449,103 @@ jabber_id_new_internal(const char *str, gboolean allow_terminating_slash)
 	return jabber_idn_validate(str, at, slash, c /* points to the null */);
 }
 
+static void
+jabber_id_cache_entry_free(JabberIDCacheEntry *entry)
+{
+	g_free(entry->str);
+	jabber_id_free(entry->jid);
+	g_free(entry);
+}
+
+static JabberID*
+jabber_id_new_internal(const char *str, gboolean allow_terminating_slash)
+{
+	JabberIDCacheEntry *entry;
+	JabberID *jid;
+	GList *link;
+
+	if (!str)
+		return NULL;
+
+	/* "user@domain/" is only a JID when it's allowed, keep those out of the
+	  cache so a lookup never depends on how it was made */
+	if (allow_terminating_slash && *str && str[strlen(str) - 1] == '/')
+		return jabber_id_parse(str, TRUE);
+
+	g_mutex_lock(&jid_cache_lock);
+
+	if (jid_cache == NULL)
+		jid_cache = g_hash_table_new(g_str_hash, g_str_equal);
+
+	link = g_hash_table_lookup(jid_cache, str);
+	if (link != NULL) {
+		g_queue_unlink(&jid_cache_lru, link);
+		g_queue_push_head_link(&jid_cache_lru, link);
+		jid = jabber_id_ref(((JabberIDCacheEntry *)link->data)->jid);
+		g_mutex_unlock(&jid_cache_lock);
+
+		return jid;
+	}
+
+	g_mutex_unlock(&jid_cache_lock);
+
+	jid = jabber_id_parse(str, FALSE);
+	if (jid == NULL)
+		return NULL;
+
+	g_mutex_lock(&jid_cache_lock);
+
+	/* someone else may have got here first */
+	if (g_hash_table_lookup(jid_cache, str) == NULL) {
+		entry = g_new(JabberIDCacheEntry, 1);
+		entry->str = g_strdup(str);
+		entry->jid = jabber_id_ref(jid);
+
+		g_queue_push_head(&jid_cache_lru, entry);
+		g_hash_table_insert(jid_cache, entry->str, jid_cache_lru.head);
+
+		if (g_queue_get_length(&jid_cache_lru) > JABBER_ID_CACHE_SIZE) {
+			entry = g_queue_pop_tail(&jid_cache_lru);
+			g_hash_table_remove(jid_cache, entry->str);
+			jabber_id_cache_entry_free(entry);
+		}
+	}
+
+	g_mutex_unlock(&jid_cache_lock);
+
+	return jid;
+}
+
+void
+jabber_id_cache_clear(void)
+{
+	g_mutex_lock(&jid_cache_lock);
+
+	if (jid_cache != NULL) {
+		g_hash_table_destroy(jid_cache);
+		jid_cache = NULL;
+	}
+
+	while (!g_queue_is_empty(&jid_cache_lru))
+		jabber_id_cache_entry_free(g_queue_pop_head(&jid_cache_lru));
+
+	g_mutex_unlock(&jid_cache_lock);
+}
+
+JabberID *
+jabber_id_ref(JabberID *jid)
+{
+	g_return_val_if_fail(jid != NULL, NULL);
+
+	g_atomic_int_inc(&jid->ref_count);
+
+	return jid;
+}
+
 void
 jabber_id_free(JabberID *jid)
 {
-	if(jid) {
+	if(jid && g_atomic_int_dec_and_test(&jid->ref_count)) {
 		g_free(jid->node);
 		g_free(jid->domain);
 		g_free(jid->resource);
@@ -431,7 +603,7 @@ char *jabber_get_resource(const char *in)
 JabberID *
 jabber_id_to_bare_jid(const JabberID *jid)
 {
-	JabberID *result = g_new0(JabberID, 1);
+	JabberID *result = jabber_id_alloc();
 
 	result->node = g_strdup(jid->node);
 	result->domain = g_strdup(jid->domain);
@@ -497,6 +669,12 @@ jabber_id_new(const char *str)
 	return jabber_id_new_internal(str, FALSE);
 }
 
+JabberID *
+jabber_id_new_private(const char *str)
+{
+	return jabber_id_parse(str, FALSE);
+}
+
 const char *jabber_normalize(const PurpleAccount *account, const char *in)
 {
 	PurpleConnection *gc = NULL;
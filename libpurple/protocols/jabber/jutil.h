@@ -29,6 +29,9 @@ typedef struct {
 	char *node;
 	char *domain;
 	char *resource;
+
+	/*< private >*/
+	gint ref_count;
 } JabberID;
 
 typedef enum {
@@ -44,16 +47,32 @@ typedef enum {
 
 #include "jabber.h"
 
+/**
+ * Parse a JID.  The result may be shared with other callers (parsed JIDs are
+ * cached), so it must not be modified.  Release it with jabber_id_free().
+ */
 JabberID* jabber_id_new(const char *str);
 
+/**
+ * Like jabber_id_new(), but always parses a fresh JID which the caller may
+ * modify.
+ */
+JabberID* jabber_id_new_private(const char *str);
+
+JabberID *jabber_id_ref(JabberID *jid);
+
 /**
  * Compare two JIDs for equality. In addition to the node and domain,
  * the resources of the two JIDs must also be equal (or both absent).
  */
 gboolean jabber_id_equal(const JabberID *jid1, const JabberID *jid2);
 
+/* Releases a reference, the JID is freed along with the last one. */
 void jabber_id_free(JabberID *jid);
 
+/* Drops all the JIDs cached by jabber_id_new(). */
+void jabber_id_cache_clear(void);
+
 char *jabber_get_domain(const char *jid);
 char *jabber_get_resource(const char *jid);
 char *jabber_get_bare_jid(const char *jid);
@@ -32,6 +32,9 @@
 #define NS_XMPP_STREAMS "http://etherx.jabber.org/streams"
 #define NS_XMPP_TLS "urn:ietf:params:xml:ns:xmpp-tls"
 
+/* RFC 7395 XMPP over WebSocket */
+#define NS_XMPP_FRAMING "urn:ietf:params:xml:ns:xmpp-framing"
+
 /* XEP-0012 Last Activity (and XEP-0256 Last Activity in Presence) */
 #define NS_LAST_ACTIVITY "jabber:iq:last"
 
@@ -89,6 +92,9 @@
 /* XEP-0231 BoB (Bits of Binary) */
 #define NS_BOB "urn:xmpp:bob"
 
+/* XEP-0198 Stream Management */
+#define NS_STREAM_MANAGEMENT "urn:xmpp:sm:3"
+
 /* XEP-0233 XMPP Server Registration for use with Kerberos V5 */
 #define NS_XMPP_SERVER_REGISTRATION "urn:xmpp:domain-based-name:1"
 
@@ -104,6 +110,9 @@
 /* XEP-0297 Stanza Forwarding */
 #define NS_FORWARD "urn:xmpp:forward:0"
 
+/* XEP-0352 Client State Indication */
+#define NS_CSI "urn:xmpp:csi:0"
+
 /* Apple extension(s) */
 #define NS_APPLE_IDLE "http://www.apple.com/xmpp/idle"
 
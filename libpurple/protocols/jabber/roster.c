@@ -43,10 +43,88 @@ static gchar *roster_groups_join(GSList *list)
 	return g_string_free(out, FALSE);
 }
 
+/*
+ * Roster versioning (XEP-0237, now part of RFC 6121).  The roster items are
+ * already kept in the buddy list across sessions; the subscription of each is
+ * stored along with them, and the version of the roster they correspond to is
+ * stored in the account.  When the server knows that version, it only sends
+ * us the pushes for what changed since.
+ */
+#define JABBER_ROSTER_VERSION_SETTING "roster_version"
+#define JABBER_ROSTER_SUBSCRIPTION_SETTING "subscription"
+
+/* Returns the version of the roster we have cached, or NULL if we don't have
+ * one we can use. */
+static const char *
+roster_get_cached_version(JabberStream *js)
+{
+	PurpleAccount *account = purple_connection_get_account(js->gc);
+	const char *ver;
+	GSList *buddies;
+
+	ver = purple_account_get_string(account, JABBER_ROSTER_VERSION_SETTING,
+	                                NULL);
+	if (ver == NULL || *ver == '\0')
+		return NULL;
+
+	/* No buddies means the buddy list was lost, whatever the version says */
+	buddies = purple_blist_find_buddies(account, NULL);
+	if (buddies == NULL)
+		return NULL;
+	g_slist_free(buddies);
+
+	return ver;
+}
+
+static void
+roster_cache_subscription(JabberStream *js, const char *jid, JabberBuddy *jb)
+{
+	GSList *buddies;
+
+	buddies = purple_blist_find_buddies(purple_connection_get_account(js->gc), jid);
+
+	while (buddies) {
+		purple_blist_node_set_int(PURPLE_BLIST_NODE(buddies->data),
+		                          JABBER_ROSTER_SUBSCRIPTION_SETTING,
+		                          jb->subscription);
+		buddies = g_slist_delete_link(buddies, buddies);
+	}
+}
+
+/* The server knows our roster version, so take what we know about each buddy
+ * from the cache; any changes arrive as roster pushes. */
+static void
+roster_restore_cached(JabberStream *js)
+{
+	GSList *buddies;
+	gboolean self = FALSE;
+
+	buddies = purple_blist_find_buddies(purple_connection_get_account(js->gc), NULL);
+
+	while (buddies) {
+		PurpleBuddy *b = buddies->data;
+		JabberBuddy *jb = jabber_buddy_find(js, purple_buddy_get_name(b), TRUE);
+
+		if (jb == js->user_jb) {
+			jb->subscription = JABBER_SUB_BOTH;
+			self = TRUE;
+		} else if (jb) {
+			jb->subscription = purple_blist_node_get_int(PURPLE_BLIST_NODE(b),
+			                                             JABBER_ROSTER_SUBSCRIPTION_SETTING);
+		}
+
+		buddies = g_slist_delete_link(buddies, buddies);
+	}
+
+	if (self)
+		jabber_presence_fake_to_self(js, NULL);
+}
+
 static void roster_request_cb(JabberStream *js, const char *from,
                               JabberIqType type, const char *id,
                               PurpleXmlNode *packet, gpointer data)
 {
+	gboolean versioned = GPOINTER_TO_INT(data);
 	PurpleXmlNode *query;
 
 	if (type == JABBER_IQ_ERROR) {
@@ -60,8 +138,14 @@ static void roster_request_cb(JabberStream *js, const char *from,
 		return;
 	}
 
+	if (versioned)
+		roster_restore_cached(js);
+
 	query = purple_xmlnode_get_child(packet, "query");
 	if (query == NULL) {
+		/* With versioning, this means nothing changed since last time */
+		if (versioned)
+			purple_debug_info("jabber", "Roster unchanged, using cached copy\n");
 		jabber_stream_set_state(js, JABBER_STREAM_CONNECTED);
 		return;
 	}
@@ -73,10 +157,19 @@ static void roster_request_cb(JabberStream *js, const char *from,
 void jabber_roster_request(JabberStream *js)
 {
 	JabberIq *iq;
+	const char *ver = NULL;
 
 	iq = jabber_iq_new_query(js, JABBER_IQ_GET, "jabber:iq:roster");
 
-	jabber_iq_set_callback(iq, roster_request_cb, NULL);
+	if (js->server_caps & JABBER_CAP_ROSTER_VERSIONING) {
+		PurpleXmlNode *query = purple_xmlnode_get_child(iq->node, "query");
+
+		/* An empty version asks for the whole roster, versioned */
+		ver = roster_get_cached_version(js);
+		purple_xmlnode_set_attrib(query, "ver", ver ? ver : "");
+	}
+
+	jabber_iq_set_callback(iq, roster_request_cb, GINT_TO_POINTER(ver != NULL));
 	jabber_iq_send(iq);
 }
 
@@ -186,6 +279,7 @@ void jabber_roster_parse(JabberStream *js, const char *from,
                          JabberIqType type, const char *id, PurpleXmlNode *query)
 {
 	PurpleXmlNode *item, *group;
+	const char *ver;
 
 	if (!jabber_is_own_account(js, from)) {
 		purple_debug_warning("jabber", "Received bogon roster push from %s\n",
@@ -256,11 +350,19 @@ void jabber_roster_parse(JabberStream *js, const char *from,
 			}
 
 			add_purple_buddy_to_groups(js, jid, name, groups);
+			roster_cache_subscription(js, jid, jb);
 			if (jb == js->user_jb)
 				jabber_presence_fake_to_self(js, NULL);
 		}
 	}
 
+	/* Both the full roster and each push carry the version they bring us up
+	 * to, once everything above has been applied. */
+	ver = purple_xmlnode_get_attrib(query, "ver");
+	if (ver != NULL)
+		purple_account_set_string(purple_connection_get_account(js->gc),
+		                          JABBER_ROSTER_VERSION_SETTING, ver);
+
 	if (type == JABBER_IQ_SET) {
 		JabberIq *ack = jabber_iq_new(js, JABBER_IQ_RESULT);
 		jabber_iq_set_id(ack, id);
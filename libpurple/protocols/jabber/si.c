@@ -73,6 +73,7 @@ struct _JabberSIXfer {
 
 	JabberIBBSession *ibb_session;
 	guint ibb_timeout_handle;
+	guint ibb_pump_handle;
 	PurpleCircularBuffer *ibb_buffer;
 };
 
@@ -1176,6 +1177,36 @@ jabber_si_xfer_ibb_open_cb(JabberStream *js, const char *who, const char *id,
 	}
 }
 
+static gboolean
+jabber_si_xfer_ibb_pump_cb(gpointer data)
+{
+	PurpleXfer *xfer = data;
+	JabberSIXfer *jsx = JABBER_SI_XFER(xfer);
+
+	jsx->ibb_pump_handle = 0;
+
+	if (jsx->ibb_session &&
+			purple_xfer_get_status(xfer) == PURPLE_XFER_STATUS_STARTED &&
+			purple_xfer_get_bytes_remaining(xfer) > 0 &&
+			jabber_ibb_session_can_send(jsx->ibb_session)) {
+		purple_xfer_protocol_ready(xfer);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* keep the window full: ask for the next block from the main loop rather
+ than recursing into the transfer code from within its own write */
+static void
+jabber_si_xfer_ibb_pump(PurpleXfer *xfer)
+{
+	JabberSIXfer *jsx = JABBER_SI_XFER(xfer);
+
+	if (jsx->ibb_pump_handle == 0) {
+		jsx->ibb_pump_handle = g_idle_add(jabber_si_xfer_ibb_pump_cb, xfer);
+	}
+}
+
 static gssize
 jabber_si_xfer_ibb_write(PurpleXfer *xfer, const guchar *buffer, size_t len)
 {
@@ -1188,10 +1219,20 @@ jabber_si_xfer_ibb_write(PurpleXfer *xfer, const guchar *buffer, size_t len)
 		return PURPLE_XFER_CLASS(jabber_si_xfer_parent_class)->write(xfer, buffer, len);
 	}
 
+	/* the window is full, whatever we were handed is kept by the xfer
+	  until an ack makes room */
+	if (!jabber_ibb_session_can_send(sess)) {
+		return 0;
+	}
+
 	packet_size = MIN(len, jabber_ibb_session_get_max_data_size(sess));
 
 	jabber_ibb_session_send_data(sess, buffer, packet_size);
 
+	if (jabber_ibb_session_can_send(sess)) {
+		jabber_si_xfer_ibb_pump(xfer);
+	}
+
 	return packet_size;
 }
 
@@ -1202,13 +1243,18 @@ jabber_si_xfer_ibb_sent_cb(JabberIBBSession *sess)
 	goffset remaining = purple_xfer_get_bytes_remaining(xfer);
 
 	if (remaining == 0) {
+		if (jabber_ibb_session_get_pending(sess) > 0) {
+			/* wait until the rest of the window has been acknowledged */
+			return;
+		}
+
 		/* close the session */
 		jabber_ibb_session_close(sess);
 		purple_xfer_set_completed(xfer, TRUE);
 		purple_xfer_end(xfer);
 	} else {
 		/* send more... */
-		purple_xfer_protocol_ready(xfer);
+		jabber_si_xfer_ibb_pump(xfer);
 	}
 }
 
@@ -1235,6 +1281,10 @@ jabber_si_xfer_ibb_send_init(JabberStream *js, PurpleXfer *xfer)
 		purple_xfer_get_remote_user(xfer), xfer);
 
 	if (jsx->ibb_session) {
+		jabber_ibb_session_set_window(jsx->ibb_session,
+			purple_account_get_int(purple_connection_get_account(js->gc),
+				"ibb_window", JABBER_IBB_SESSION_DEFAULT_WINDOW));
+
 		/* should set callbacks here... */
 		jabber_ibb_session_set_opened_callback(jsx->ibb_session,
 			jabber_si_xfer_ibb_opened_cb);
@@ -1377,6 +1427,8 @@ static void jabber_si_xfer_send_request(PurpleXfer *xfer)
 	purple_xmlnode_insert_data(value, NS_IBB, -1);
 
 	jabber_iq_set_callback(iq, jabber_si_xfer_send_method_cb, xfer);
+	/* The reply waits on the other user accepting the transfer. */
+	jabber_iq_set_timeout(iq, 0);
 
 	/* Store the IQ id so that we can cancel the callback */
 	g_free(jsx->iq_id);
@@ -1850,6 +1902,10 @@ jabber_si_xfer_finalize(GObject *obj) {
 		g_source_remove(jsx->ibb_timeout_handle);
 	}
 
+	if (jsx->ibb_pump_handle > 0) {
+		g_source_remove(jsx->ibb_pump_handle);
+	}
+
 	g_list_free_full(jsx->streamhosts, (GDestroyNotify)jabber_bytestreams_streamhost_free);
 
 	if (jsx->ibb_session) {
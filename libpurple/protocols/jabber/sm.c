@@ -0,0 +1,485 @@
+/*
+ * purple - Jabber Protocol Plugin
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+
+#include <glib/gi18n-lib.h>
+
+#include <purple.h>
+
+#include "jabber.h"
+#include "sm.h"
+
+typedef enum {
+	JABBER_SM_DISABLED,
+	/* <enable/> was sent; outbound stanzas are counted from here on. */
+	JABBER_SM_ENABLING,
+	JABBER_SM_ENABLED,
+	/* The transport dropped and a new stream is being negotiated. */
+	JABBER_SM_RESUMING
+} JabberSmState;
+
+struct _JabberStreamManagement {
+	JabberSmState state;
+
+	/* Resumption id, or NULL if the server won't resume this session. */
+	gchar *id;
+	/* How long the server keeps the session around, 0 if unspecified. */
+	guint max;
+
+	/* Stanzas we've handled from the server. */
+	guint32 handled;
+	/* The server's last acknowledged count of our stanzas. */
+	guint32 acked;
+	GQueue unacked;
+
+	gboolean ack_requested;
+	guint request_timer;
+};
+
+JabberStreamManagement *
+jabber_sm_new(void)
+{
+	JabberStreamManagement *sm = g_new0(JabberStreamManagement, 1);
+
+	g_queue_init(&sm->unacked);
+
+	return sm;
+}
+
+void
+jabber_sm_free(JabberStreamManagement *sm)
+{
+	if (sm == NULL)
+		return;
+
+	if (sm->request_timer)
+		g_source_remove(sm->request_timer);
+
+	while (!g_queue_is_empty(&sm->unacked))
+		g_free(g_queue_pop_head(&sm->unacked));
+
+	g_free(sm->id);
+	g_free(sm);
+}
+
+void
+jabber_sm_push_unacked(JabberStreamManagement *sm, const char *stanza, int len)
+{
+	g_return_if_fail(sm != NULL);
+	g_return_if_fail(stanza != NULL);
+
+	if (len < 0)
+		len = strlen(stanza);
+
+	g_queue_push_tail(&sm->unacked, g_strndup(stanza, len));
+}
+
+guint
+jabber_sm_get_unacked_count(const JabberStreamManagement *sm)
+{
+	g_return_val_if_fail(sm != NULL, 0);
+
+	return g_queue_get_length((GQueue *)&sm->unacked);
+}
+
+GList *
+jabber_sm_get_unacked(const JabberStreamManagement *sm)
+{
+	g_return_val_if_fail(sm != NULL, NULL);
+
+	return sm->unacked.head;
+}
+
+gboolean
+jabber_sm_ack(JabberStreamManagement *sm, guint32 h)
+{
+	guint32 count;
+
+	g_return_val_if_fail(sm != NULL, FALSE);
+
+	/* Both counters wrap at 2^32, so unsigned subtraction does the right
+	 * thing across the wrap. */
+	count = h - sm->acked;
+
+	if (count > sm->unacked.length) {
+		purple_debug_warning("jabber", "Server acknowledged %u stanzas, but "
+		                     "only %u were outstanding\n",
+		                     count, sm->unacked.length);
+		while (!g_queue_is_empty(&sm->unacked))
+			g_free(g_queue_pop_head(&sm->unacked));
+		sm->acked = h;
+		return FALSE;
+	}
+
+	while (count-- > 0)
+		g_free(g_queue_pop_head(&sm->unacked));
+	sm->acked = h;
+
+	return TRUE;
+}
+
+void
+jabber_sm_handled(JabberStreamManagement *sm)
+{
+	g_return_if_fail(sm != NULL);
+
+	sm->handled++;
+}
+
+guint32
+jabber_sm_get_handled(const JabberStreamManagement *sm)
+{
+	g_return_val_if_fail(sm != NULL, 0);
+
+	return sm->handled;
+}
+
+gboolean
+jabber_sm_parse_h(PurpleXmlNode *packet, guint32 *h)
+{
+	const char *attr = purple_xmlnode_get_attrib(packet, "h");
+	gchar *end = NULL;
+	guint64 value;
+
+	if (attr == NULL || !g_ascii_isdigit(*attr))
+		return FALSE;
+
+	value = g_ascii_strtoull(attr, &end, 10);
+	if (*end != '\0' || value > G_MAXUINT32)
+		return FALSE;
+
+	*h = (guint32)value;
+	return TRUE;
+}
+
+static gboolean
+jabber_sm_is_stanza(PurpleXmlNode *packet)
+{
+	const char *name = packet->name;
+
+	return purple_strequal(name, "message") ||
+	       purple_strequal(name, "presence") ||
+	       purple_strequal(name, "iq");
+}
+
+static void
+jabber_sm_send_ack(JabberStream *js)
+{
+	char *a = g_strdup_printf("<a xmlns='" NS_STREAM_MANAGEMENT "' h='%u'/>",
+	                          js->sm->handled);
+
+	jabber_send_raw(NULL, js, a, -1);
+	g_free(a);
+}
+
+static gboolean
+jabber_sm_request_cb(gpointer data)
+{
+	JabberStream *js = data;
+	JabberStreamManagement *sm = js->sm;
+
+	sm->request_timer = 0;
+
+	if (sm->state == JABBER_SM_ENABLED && !sm->ack_requested &&
+	    !g_queue_is_empty(&sm->unacked)) {
+		jabber_send_raw(NULL, js, "<r xmlns='" NS_STREAM_MANAGEMENT "'/>", -1);
+		sm->ack_requested = TRUE;
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+jabber_sm_schedule_request(JabberStream *js)
+{
+	JabberStreamManagement *sm = js->sm;
+
+	if (sm->ack_requested || g_queue_is_empty(&sm->unacked))
+		return;
+
+	if (sm->unacked.length >= JABBER_SM_REQUEST_BATCH) {
+		/* Ask right after the stanza that got us here hits the wire. */
+		if (sm->request_timer)
+			g_source_remove(sm->request_timer);
+		sm->request_timer = g_idle_add(jabber_sm_request_cb, js);
+	} else if (sm->request_timer == 0) {
+		sm->request_timer = g_timeout_add_seconds(JABBER_SM_REQUEST_DELAY,
+		                                          jabber_sm_request_cb, js);
+	}
+}
+
+void
+jabber_sm_enable(JabberStream *js)
+{
+	PurpleXmlNode *enable;
+
+	if (!(js->server_caps & JABBER_CAP_STREAM_MANAGEMENT) || js->bosh ||
+	    js->websocket)
+		return;
+
+	jabber_sm_free(js->sm);
+	js->sm = jabber_sm_new();
+	js->sm->state = JABBER_SM_ENABLING;
+
+	enable = purple_xmlnode_new("enable");
+	purple_xmlnode_set_namespace(enable, NS_STREAM_MANAGEMENT);
+	purple_xmlnode_set_attrib(enable, "resume", "true");
+	jabber_send(js, enable);
+	purple_xmlnode_free(enable);
+}
+
+/* Tell the user about a message the server never acknowledged, in the
+ * conversation it was sent from. */
+static void
+jabber_sm_report_unacked(JabberStream *js, const char *stanza)
+{
+	PurpleAccount *account = purple_connection_get_account(js->gc);
+	PurpleConversation *conv;
+	PurpleXmlNode *packet, *body;
+	const char *to;
+	char *data, *escaped, *msg;
+
+	packet = purple_xmlnode_from_str(stanza, -1);
+	if (packet == NULL)
+		return;
+
+	to = purple_xmlnode_get_attrib(packet, "to");
+	body = purple_xmlnode_get_child(packet, "body");
+	if (!purple_strequal(packet->name, "message") || to == NULL ||
+	    body == NULL) {
+		purple_xmlnode_free(packet);
+		return;
+	}
+
+	conv = purple_conversations_find_with_account(to, account);
+	if (conv == NULL) {
+		char *bare = jabber_get_bare_jid(to);
+
+		conv = purple_conversations_find_with_account(bare, account);
+		g_free(bare);
+	}
+
+	if (conv != NULL) {
+		data = purple_xmlnode_get_data(body);
+		escaped = g_markup_escape_text(data ? data : "", -1);
+		msg = g_strdup_printf(_("This message may not have been delivered "
+		                        "because the connection was lost: %s"),
+		                      escaped);
+		purple_conversation_write_system_message(conv, msg,
+		                                         PURPLE_MESSAGE_ERROR);
+		g_free(msg);
+		g_free(escaped);
+		g_free(data);
+	}
+
+	purple_xmlnode_free(packet);
+}
+
+void
+jabber_sm_resume_failed(JabberStream *js)
+{
+	GList *l;
+
+	if (js->sm != NULL) {
+		for (l = js->sm->unacked.head; l != NULL; l = l->next)
+			jabber_sm_report_unacked(js, l->data);
+		jabber_sm_close(js);
+	}
+
+	purple_connection_error(js->gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+	                        _("Unable to resume the XMPP session"));
+}
+
+static void
+jabber_sm_resumed(JabberStream *js, PurpleXmlNode *packet)
+{
+	JabberStreamManagement *sm = js->sm;
+	guint32 h;
+	GList *l;
+
+	/* jabber_sm_ack() empties the queue on a bogus count, and then there
+	 * is nothing left to say what was lost, so check the count first. */
+	if (!jabber_sm_parse_h(packet, &h) ||
+	    h - sm->acked > sm->unacked.length) {
+		jabber_sm_resume_failed(js);
+		return;
+	}
+	jabber_sm_ack(sm, h);
+
+	purple_debug_info("jabber", "Session resumed, retransmitting %u "
+	                  "stanzas\n", sm->unacked.length);
+
+	sm->state = JABBER_SM_ENABLED;
+
+	/* The server kept our presence, roster and rooms, so skip everything
+	 * jabber_stream_set_state() would do on a fresh login. */
+	js->state = JABBER_STREAM_CONNECTED;
+	jabber_stream_restart_inactivity_timer(js);
+	/* Don't rely on the server carrying our client state across. */
+	jabber_csi_update(js, TRUE);
+
+	for (l = sm->unacked.head; l != NULL; l = l->next)
+		jabber_send_raw(NULL, js, l->data, -1);
+
+	jabber_sm_schedule_request(js);
+}
+
+void
+jabber_sm_process_packet(JabberStream *js, PurpleXmlNode *packet)
+{
+	JabberStreamManagement *sm = js->sm;
+	const char *name = packet->name;
+	guint32 h;
+
+	if (sm == NULL || sm->state == JABBER_SM_DISABLED) {
+		purple_debug_warning("jabber", "Ignoring stream management %s "
+		                     "without <enable/>\n", name);
+		return;
+	}
+
+	if (purple_strequal(name, "r")) {
+		if (sm->state == JABBER_SM_ENABLED)
+			jabber_sm_send_ack(js);
+	} else if (purple_strequal(name, "a")) {
+		if (!jabber_sm_parse_h(packet, &h)) {
+			purple_debug_warning("jabber", "Ignoring <a/> without a "
+			                     "valid count\n");
+			return;
+		}
+		jabber_sm_ack(sm, h);
+		sm->ack_requested = FALSE;
+		jabber_sm_schedule_request(js);
+	} else if (purple_strequal(name, "enabled")) {
+		const char *resume = purple_xmlnode_get_attrib(packet, "resume");
+		const char *max = purple_xmlnode_get_attrib(packet, "max");
+
+		sm->state = JABBER_SM_ENABLED;
+		if (purple_strequal(resume, "true") || purple_strequal(resume, "1")) {
+			g_free(sm->id);
+			sm->id = g_strdup(purple_xmlnode_get_attrib(packet, "id"));
+		}
+		sm->max = max ? (guint)g_ascii_strtoull(max, NULL, 10) : 0;
+
+		purple_debug_info("jabber", "Stream management enabled%s\n",
+		                  sm->id ? " with resumption" : "");
+		jabber_sm_schedule_request(js);
+	} else if (purple_strequal(name, "resumed")) {
+		if (sm->state != JABBER_SM_RESUMING) {
+			purple_debug_warning("jabber", "Ignoring spurious <resumed/>\n");
+			return;
+		}
+		jabber_sm_resumed(js, packet);
+	} else if (purple_strequal(name, "failed")) {
+		if (sm->state == JABBER_SM_RESUMING) {
+			/* The server has thrown our session away.  A regular
+			 * reconnect will rebuild it from scratch. */
+			jabber_sm_resume_failed(js);
+			return;
+		}
+
+		purple_debug_info("jabber", "Server refused to enable stream "
+		                  "management\n");
+		jabber_sm_close(js);
+	} else {
+		purple_debug_warning("jabber", "Unknown stream management "
+		                     "element: %s\n", name);
+	}
+}
+
+void
+jabber_sm_stanza_received(JabberStream *js, PurpleXmlNode *packet)
+{
+	/* Inbound counting starts once the server confirms with <enabled/>. */
+	if (js->sm && js->sm->state == JABBER_SM_ENABLED &&
+	    jabber_sm_is_stanza(packet))
+		jabber_sm_handled(js->sm);
+}
+
+gboolean
+jabber_sm_stanza_sent(JabberStream *js, PurpleXmlNode *packet,
+                      const char *text, int len)
+{
+	JabberStreamManagement *sm = js->sm;
+
+	if (sm == NULL || sm->state == JABBER_SM_DISABLED ||
+	    !jabber_sm_is_stanza(packet))
+		return TRUE;
+
+	jabber_sm_push_unacked(sm, text, len);
+
+	if (sm->state == JABBER_SM_RESUMING)
+		return FALSE;
+
+	if (sm->state == JABBER_SM_ENABLED)
+		jabber_sm_schedule_request(js);
+
+	return TRUE;
+}
+
+gboolean
+jabber_sm_start_resume(JabberStream *js)
+{
+	JabberStreamManagement *sm = js->sm;
+
+	if (sm == NULL || sm->state != JABBER_SM_ENABLED || sm->id == NULL)
+		return FALSE;
+
+	sm->state = JABBER_SM_RESUMING;
+	sm->ack_requested = FALSE;
+	if (sm->request_timer) {
+		g_source_remove(sm->request_timer);
+		sm->request_timer = 0;
+	}
+
+	return TRUE;
+}
+
+gboolean
+jabber_sm_is_resuming(JabberStream *js)
+{
+	return js->sm && js->sm->state == JABBER_SM_RESUMING;
+}
+
+void
+jabber_sm_resume(JabberStream *js)
+{
+	PurpleXmlNode *resume;
+	char *h;
+
+	g_return_if_fail(jabber_sm_is_resuming(js));
+
+	h = g_strdup_printf("%u", js->sm->handled);
+	resume = purple_xmlnode_new("resume");
+	purple_xmlnode_set_namespace(resume, NS_STREAM_MANAGEMENT);
+	purple_xmlnode_set_attrib(resume, "h", h);
+	purple_xmlnode_set_attrib(resume, "previd", js->sm->id);
+	jabber_send(js, resume);
+	purple_xmlnode_free(resume);
+	g_free(h);
+}
+
+void
+jabber_sm_close(JabberStream *js)
+{
+	jabber_sm_free(js->sm);
+	js->sm = NULL;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file sm.h Stream Management (XEP-0198)
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#ifndef PURPLE_JABBER_SM_H
+#define PURPLE_JABBER_SM_H
+
+typedef struct _JabberStreamManagement JabberStreamManagement;
+
+#include "jabber.h"
+
+/* Ask the server for an ack once this many stanzas are outstanding... */
+#define JABBER_SM_REQUEST_BATCH 10
+/* ...or this many seconds after the first unacknowledged one was sent. */
+#define JABBER_SM_REQUEST_DELAY 5
+
+/*
+ * Bookkeeping, independent of any connection.  The outbound queue holds the
+ * serialized form of every stanza the server has not acknowledged yet,
+ * oldest first.
+ */
+JabberStreamManagement *jabber_sm_new(void);
+void jabber_sm_free(JabberStreamManagement *sm);
+
+void jabber_sm_push_unacked(JabberStreamManagement *sm, const char *stanza,
+                            int len);
+guint jabber_sm_get_unacked_count(const JabberStreamManagement *sm);
+GList *jabber_sm_get_unacked(const JabberStreamManagement *sm);
+
+/**
+ * Drop every stanza covered by the server's handled count @a h.
+ *
+ * @return FALSE if @a h acknowledges stanzas that were never sent.  The
+ *         queue is emptied in that case.
+ */
+gboolean jabber_sm_ack(JabberStreamManagement *sm, guint32 h);
+
+void jabber_sm_handled(JabberStreamManagement *sm);
+guint32 jabber_sm_get_handled(const JabberStreamManagement *sm);
+
+/** Parse the 'h' attribute of an <a/>, <resume/> or <resumed/> element. */
+gboolean jabber_sm_parse_h(PurpleXmlNode *packet, guint32 *h);
+
+/*
+ * Glue between the bookkeeping above and a JabberStream.
+ */
+
+/** Send <enable/> after resource binding if the server offered it. */
+void jabber_sm_enable(JabberStream *js);
+
+/** Handle a top-level element in the stream management namespace. */
+void jabber_sm_process_packet(JabberStream *js, PurpleXmlNode *packet);
+
+/** Count an inbound stanza toward the handled count. */
+void jabber_sm_stanza_received(JabberStream *js, PurpleXmlNode *packet);
+
+/**
+ * Queue an outbound stanza until the server acknowledges it.
+ *
+ * @return TRUE if the stanza should be written now, FALSE if it is being
+ *         held for retransmission after the session is resumed.
+ */
+gboolean jabber_sm_stanza_sent(JabberStream *js, PurpleXmlNode *packet,
+                               const char *text, int len);
+
+/**
+ * Called when the transport drops.  If the server agreed to resumption,
+ * the stream enters the resuming state and TRUE is returned; the caller
+ * should reconnect rather than tear the account down.
+ */
+gboolean jabber_sm_start_resume(JabberStream *js);
+gboolean jabber_sm_is_resuming(JabberStream *js);
+
+/** Send <resume/> in place of resource binding on the new stream. */
+void jabber_sm_resume(JabberStream *js);
+
+/**
+ * Give up on resuming: report the messages the server never acknowledged
+ * as possibly undelivered and put the connection into an error state.
+ */
+void jabber_sm_resume_failed(JabberStream *js);
+
+void jabber_sm_close(JabberStream *js);
+
+#endif /* PURPLE_JABBER_SM_H */
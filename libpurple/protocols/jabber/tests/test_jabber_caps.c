@@ -33,6 +33,9 @@ _test_jabber_caps_match(GChecksumType hash_type, const gchar *in, const gchar *e
 
 	g_assert_cmpstr(expected, ==, got);
 	g_free(got);
+
+	jabber_caps_client_info_destroy(info);
+	purple_xmlnode_free(query);
 }
 
 static void
@@ -44,6 +47,29 @@ test_jabber_caps_calculate_from_xmlnode(void) {
 	);
 }
 
+static void
+test_jabber_caps_has_feature(void) {
+	PurpleXmlNode *query = purple_xmlnode_from_str(
+		"<query xmlns='http://jabber.org/protocol/disco#info'><identity category='client' type='pc' name='Test'/><feature var='http://jabber.org/protocol/chatstates'/><feature var='urn:xmpp:receipts'/><feature var='urn:xmpp:receipts'/></query>",
+		-1);
+	JabberCapsClientInfo *info = jabber_caps_parse_client_info(query);
+
+	g_assert_nonnull(info);
+	g_assert_true(jabber_caps_client_info_has_feature(info,
+		"http://jabber.org/protocol/chatstates"));
+	g_assert_true(jabber_caps_client_info_has_feature(info,
+		"urn:xmpp:receipts"));
+	g_assert_false(jabber_caps_client_info_has_feature(info,
+		"http://jabber.org/protocol/xhtml-im"));
+
+	/* the list keeps what was advertised, duplicates and all, as the hash
+	 * is calculated from it */
+	g_assert_cmpuint(3, ==, g_list_length(info->features));
+
+	jabber_caps_client_info_destroy(info);
+	purple_xmlnode_free(query);
+}
+
 gint
 main(gint argc, gchar **argv) {
 	g_test_init(&argc, &argv, NULL);
@@ -54,5 +80,8 @@ main(gint argc, gchar **argv) {
 	g_test_add_func("/jabber/caps/calulate from xmlnode",
 	                test_jabber_caps_calculate_from_xmlnode);
 
+	g_test_add_func("/jabber/caps/has feature",
+	                test_jabber_caps_has_feature);
+
 	return g_test_run();
 }
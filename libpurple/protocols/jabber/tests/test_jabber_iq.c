@@ -0,0 +1,300 @@
+#include <glib.h>
+
+#include <purple.h>
+
+#include "protocols/jabber/iq.h"
+#include "tests/test_ui.h"
+
+static void
+test_jabber_iq_id_round_trip(void) {
+	const guint32 serials[] = { 0, 1, 0xf, 0x10, 0xdeadbeef, G_MAXUINT32 };
+	JabberStream *js = g_new0(JabberStream, 1);
+	gsize i;
+
+	for (i = 0; i < G_N_ELEMENTS(serials); i++) {
+		char *id;
+		guint32 serial = 0;
+
+		js->next_id = serials[i];
+		id = jabber_get_next_id(js);
+
+		g_assert_true(jabber_iq_id_parse(id, &serial));
+		g_assert_cmpuint(serials[i], ==, serial);
+
+		g_free(id);
+	}
+
+	/* the counter wraps rather than overflowing */
+	g_assert_cmpuint(0, ==, js->next_id);
+
+	g_free(js);
+}
+
+static void
+test_jabber_iq_id_foreign(void) {
+	const gchar *invalid[] = {
+		"",
+		"purple",
+		"purple00",
+		"purple0a",
+		"purpleDEAD",
+		"purple123456789",
+		"purple12 ",
+		"purple-1",
+		"purple0x1",
+		"ab12",
+		"Purple12",
+	};
+	gsize i;
+
+	for (i = 0; i < G_N_ELEMENTS(invalid); i++)
+		g_assert_false(jabber_iq_id_parse(invalid[i], NULL));
+
+	g_assert_false(jabber_iq_id_parse(NULL, NULL));
+}
+
+/*
+ * Requests sent on a JabberStream that is not connected to anything.  The
+ * protocol below only carries the signals jabber_send() and jabber_iq_parse()
+ * emit, and what would have been sent is kept on the connection.
+ */
+typedef struct {
+	PurpleProtocol parent;
+} TestJabberProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestJabberProtocolClass;
+
+static GType test_jabber_protocol_get_type(void);
+
+G_DEFINE_TYPE(TestJabberProtocol, test_jabber_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_jabber_protocol_init(TestJabberProtocol *protocol) {
+	PURPLE_PROTOCOL(protocol)->id = "prpl-jabber-iq-test";
+}
+
+static void
+test_jabber_protocol_class_init(TestJabberProtocolClass *klass) {
+}
+
+static PurpleProtocol *test_protocol = NULL;
+
+static void
+test_sending_xmlnode_cb(PurpleConnection *gc, PurpleXmlNode **packet,
+                        gpointer data)
+{
+	GPtrArray *sent = g_object_get_data(G_OBJECT(gc), "test-sent");
+
+	g_ptr_array_add(sent, purple_xmlnode_to_str(*packet, NULL));
+}
+
+static void
+test_protocol_setup(void) {
+	test_protocol = g_object_new(test_jabber_protocol_get_type(), NULL);
+
+	purple_signal_register(test_protocol, "jabber-sending-xmlnode",
+			purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+	purple_signal_connect(test_protocol, "jabber-sending-xmlnode",
+			test_protocol, PURPLE_CALLBACK(test_sending_xmlnode_cb), NULL);
+	purple_signal_register(test_protocol, "jabber-receiving-iq",
+			purple_marshal_BOOLEAN__POINTER_POINTER_POINTER_POINTER_POINTER,
+			G_TYPE_BOOLEAN, 5, PURPLE_TYPE_CONNECTION, G_TYPE_STRING,
+			G_TYPE_STRING, G_TYPE_STRING, PURPLE_TYPE_XMLNODE);
+}
+
+typedef struct {
+	PurpleConnection *gc;
+	JabberStream *js;
+	/* everything sent, oldest first */
+	GPtrArray *sent;
+	/* what the callbacks got, as "type id from condition" */
+	GPtrArray *replies;
+} TestStream;
+
+static void
+test_stream_init(TestStream *ts) {
+	PurpleAccount *account = purple_account_new("iq@example.com/test",
+	                                            "prpl-jabber-iq-test");
+
+	ts->gc = g_object_new(PURPLE_TYPE_CONNECTION, "account", account,
+	                      "protocol", test_protocol, NULL);
+	ts->sent = g_ptr_array_new_with_free_func(g_free);
+	ts->replies = g_ptr_array_new_with_free_func(g_free);
+	g_object_set_data(G_OBJECT(ts->gc), "test-sent", ts->sent);
+
+	ts->js = g_new0(JabberStream, 1);
+	ts->js->gc = ts->gc;
+	ts->js->user = jabber_id_new("iq@example.com/test");
+	ts->js->iq_tracker = jabber_iq_tracker_new(ts->js);
+	purple_connection_set_protocol_data(ts->gc, ts->js);
+}
+
+static void
+test_stream_clear(TestStream *ts) {
+	jabber_iq_tracker_free(ts->js->iq_tracker);
+	jabber_id_free(ts->js->user);
+	g_free(ts->js);
+
+	purple_connection_set_protocol_data(ts->gc, NULL);
+	g_object_set_data(G_OBJECT(ts->gc), "test-sent", NULL);
+	g_ptr_array_free(ts->sent, TRUE);
+	g_ptr_array_free(ts->replies, TRUE);
+}
+
+static void
+test_reply_cb(JabberStream *js, const char *from, JabberIqType type,
+              const char *id, PurpleXmlNode *packet, gpointer data)
+{
+	TestStream *ts = data;
+	PurpleXmlNode *error = purple_xmlnode_get_child(packet, "error");
+	const gchar *condition = "-";
+
+	g_assert_true(js == ts->js);
+	g_assert_cmpstr(id, ==, purple_xmlnode_get_attrib(packet, "id"));
+	g_assert_cmpstr(from, ==, purple_xmlnode_get_attrib(packet, "from"));
+
+	if (error != NULL && error->child != NULL) {
+		g_assert_cmpstr(NS_XMPP_STANZAS, ==,
+		                purple_xmlnode_get_namespace(error->child));
+		condition = error->child->name;
+	}
+
+	g_ptr_array_add(ts->replies,
+	                g_strdup_printf("%s %s %s %s",
+	                                type == JABBER_IQ_ERROR ? "error" : "result",
+	                                id, from ? from : "-", condition));
+}
+
+/* Send a ping with a callback and return its id. */
+static gchar *
+test_stream_ping(TestStream *ts, const gchar *to, guint timeout) {
+	JabberIq *iq = jabber_iq_new(ts->js, JABBER_IQ_GET);
+	gchar *id = g_strdup(iq->id);
+
+	purple_xmlnode_set_namespace(purple_xmlnode_new_child(iq->node, "ping"),
+	                             NS_PING);
+	if (to)
+		purple_xmlnode_set_attrib(iq->node, "to", to);
+	jabber_iq_set_callback(iq, test_reply_cb, ts);
+	jabber_iq_set_timeout(iq, timeout);
+	jabber_iq_send(iq);
+
+	return id;
+}
+
+static void
+test_jabber_iq_timeout(void) {
+	TestStream ts;
+	PurpleXmlNode *reply;
+	gchar *server, *peer, *answered, *patient, *expected;
+	gint64 give_up;
+
+	test_stream_init(&ts);
+
+	server = test_stream_ping(&ts, NULL, 1);
+	peer = test_stream_ping(&ts, "a@example.com/r", 1);
+	answered = test_stream_ping(&ts, "a@example.com/r", 1);
+	patient = test_stream_ping(&ts, "b@example.com/r", 0);
+
+	g_assert_cmpuint(4, ==, ts.sent->len);
+	g_assert_cmpuint(4, ==, jabber_iq_get_outstanding_count(ts.js));
+	g_assert_cmpuint(0, ==, jabber_iq_get_timed_out_count(ts.js));
+
+	/* one of them is answered in time */
+	reply = purple_xmlnode_new("iq");
+	purple_xmlnode_set_attrib(reply, "type", "result");
+	purple_xmlnode_set_attrib(reply, "id", answered);
+	purple_xmlnode_set_attrib(reply, "from", "a@example.com/r");
+	jabber_iq_parse(ts.js, reply);
+	purple_xmlnode_free(reply);
+
+	g_assert_cmpuint(1, ==, ts.replies->len);
+	expected = g_strdup_printf("result %s a@example.com/r -", answered);
+	g_assert_cmpstr(expected, ==, g_ptr_array_index(ts.replies, 0));
+	g_free(expected);
+	g_assert_cmpuint(3, ==, jabber_iq_get_outstanding_count(ts.js));
+
+	/* the wheel turns once a second, so this takes one or two of them */
+	give_up = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+	while (ts.replies->len < 3) {
+		g_assert_cmpint(g_get_monotonic_time(), <, give_up);
+		g_main_context_iteration(NULL, TRUE);
+	}
+
+	/* in the order they were sent */
+	expected = g_strdup_printf("error %s - remote-server-timeout", server);
+	g_assert_cmpstr(expected, ==, g_ptr_array_index(ts.replies, 1));
+	g_free(expected);
+	expected = g_strdup_printf("error %s a@example.com/r "
+	                           "remote-server-timeout", peer);
+	g_assert_cmpstr(expected, ==, g_ptr_array_index(ts.replies, 2));
+	g_free(expected);
+
+	g_assert_cmpuint(1, ==, jabber_iq_get_outstanding_count(ts.js));
+	g_assert_cmpuint(2, ==, jabber_iq_get_timed_out_count(ts.js));
+
+	/* a late reply to a request given up on goes nowhere */
+	reply = purple_xmlnode_new("iq");
+	purple_xmlnode_set_attrib(reply, "type", "result");
+	purple_xmlnode_set_attrib(reply, "id", peer);
+	purple_xmlnode_set_attrib(reply, "from", "a@example.com/r");
+	jabber_iq_parse(ts.js, reply);
+	purple_xmlnode_free(reply);
+	g_assert_cmpuint(3, ==, ts.replies->len);
+
+	g_free(server);
+	g_free(peer);
+	g_free(answered);
+	g_free(patient);
+	test_stream_clear(&ts);
+}
+
+static void
+test_jabber_iq_foreign_id_callback(void) {
+	TestStream ts;
+	JabberIq *iq;
+
+	test_stream_init(&ts);
+
+	/* a request with a made up id can't be tracked, so it fails at once */
+	iq = jabber_iq_new(ts.js, JABBER_IQ_GET);
+	jabber_iq_set_id(iq, "not-ours");
+	purple_xmlnode_set_attrib(iq->node, "to", "a@example.com/r");
+	jabber_iq_set_callback(iq, test_reply_cb, &ts);
+	jabber_iq_send(iq);
+
+	g_assert_cmpuint(0, ==, ts.sent->len);
+	g_assert_cmpuint(1, ==, ts.replies->len);
+	g_assert_cmpstr("error not-ours a@example.com/r bad-request", ==,
+	                g_ptr_array_index(ts.replies, 0));
+	g_assert_cmpuint(0, ==, jabber_iq_get_outstanding_count(ts.js));
+
+	/* answers to someone else's request carry their id and go out */
+	iq = jabber_iq_new(ts.js, JABBER_IQ_RESULT);
+	jabber_iq_set_id(iq, "not-ours");
+	jabber_iq_send(iq);
+
+	g_assert_cmpuint(1, ==, ts.sent->len);
+	g_assert_cmpuint(1, ==, ts.replies->len);
+
+	test_stream_clear(&ts);
+}
+
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+	test_protocol_setup();
+
+	g_test_add_func("/jabber/iq/id/round trip", test_jabber_iq_id_round_trip);
+	g_test_add_func("/jabber/iq/id/foreign", test_jabber_iq_id_foreign);
+	g_test_add_func("/jabber/iq/timeout", test_jabber_iq_timeout);
+	g_test_add_func("/jabber/iq/foreign id callback",
+	                test_jabber_iq_foreign_id_callback);
+
+	return g_test_run();
+}
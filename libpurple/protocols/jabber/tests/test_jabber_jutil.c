@@ -197,6 +197,51 @@ test_jabber_util_jid_parts(void) {
 	assert_jid_parts("noone", "өexample.com", "noone@Өexample.com");
 }
 
+static void
+test_jabber_util_jid_ascii_parts(void) {
+	JabberID *jid;
+
+	/* Printable ASCII that stringprep leaves alone takes the quick path, and
+	 * must come out just as the slow path would have it. */
+	jid = jabber_id_new("No_One+x@Example.COM/Some Resource!");
+	g_assert_nonnull(jid);
+	g_assert_cmpstr("no_one+x", ==, jid->node);
+	g_assert_cmpstr("example.com", ==, jid->domain);
+	g_assert_cmpstr("Some Resource!", ==, jid->resource);
+	jabber_id_free(jid);
+
+	/* but these are prohibited by nodeprep */
+	g_assert_null(jabber_id_new("no one@example.com"));
+	g_assert_null(jabber_id_new("no:one@example.com"));
+	g_assert_null(jabber_id_new("no'one@example.com/res"));
+}
+
+static void
+test_jabber_util_jid_cache(void) {
+	JabberID *jid1, *jid2, *jid3;
+
+	jid1 = jabber_id_new("noone@example.com/cache");
+	jid2 = jabber_id_new("noone@example.com/cache");
+	g_assert_nonnull(jid1);
+	g_assert_true(jid1 == jid2);
+
+	/* private ones are never shared */
+	jid3 = jabber_id_new_private("noone@example.com/cache");
+	g_assert_nonnull(jid3);
+	g_assert_true(jid3 != jid1);
+	g_assert_true(jabber_id_equal(jid1, jid3));
+
+	jabber_id_free(jid1);
+	jabber_id_free(jid2);
+	jabber_id_free(jid3);
+
+	/* references handed out stay valid when the cache goes away */
+	jid1 = jabber_id_new("noone@example.com/cache");
+	jabber_id_cache_clear();
+	g_assert_cmpstr("cache", ==, jid1->resource);
+	jabber_id_free(jid1);
+}
+
 PurpleTestStringData test_jabber_util_jabber_normalize_data[] = {
         {"NoOnE@ExAMplE.com", "noone@example.com"},
         {"NoOnE@ExampLE.cOM/", "noone@example.com"},
@@ -269,6 +314,10 @@ main(gint argc, gchar **argv) {
 	}
 	g_test_add_func("/jabber/util/id_new/jid_parts",
 	                test_jabber_util_jid_parts);
+	g_test_add_func("/jabber/util/id_new/ascii_parts",
+	                test_jabber_util_jid_ascii_parts);
+	g_test_add_func("/jabber/util/id_new/cache",
+	                test_jabber_util_jid_cache);
 
 	for (i = 0; test_jabber_util_jabber_normalize_data[i].input; i++) {
 		test_name = g_strdup_printf("/jabber/util/normalize/%d", i);
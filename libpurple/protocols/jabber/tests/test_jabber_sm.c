@@ -0,0 +1,453 @@
+#include <glib.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "protocols/jabber/sm.h"
+#include "tests/test_ui.h"
+
+/*
+ * A scripted stand-in for the wire: each step is either a stanza we send,
+ * a stanza the server sends us, or a stream management element from the
+ * server.  The script is played against the bookkeeping the same way
+ * jabber.c and sm.c drive it on a live stream.
+ */
+typedef enum {
+	STEP_SEND,
+	STEP_RECV,
+	STEP_SERVER
+} StepDirection;
+
+typedef struct {
+	StepDirection direction;
+	const gchar *xml;
+	/* expected number of unacknowledged stanzas after this step */
+	guint unacked;
+} Step;
+
+static void
+play_script(JabberStreamManagement *sm, const Step *script, gsize n_steps)
+{
+	gsize i;
+
+	for (i = 0; i < n_steps; i++) {
+		const Step *step = &script[i];
+		PurpleXmlNode *node = purple_xmlnode_from_str(step->xml, -1);
+		guint32 h;
+
+		g_assert_nonnull(node);
+
+		switch (step->direction) {
+			case STEP_SEND:
+				jabber_sm_push_unacked(sm, step->xml, -1);
+				break;
+			case STEP_RECV:
+				jabber_sm_handled(sm);
+				break;
+			case STEP_SERVER:
+				g_assert_true(jabber_sm_parse_h(node, &h));
+				g_assert_true(jabber_sm_ack(sm, h));
+				break;
+		}
+
+		g_assert_cmpuint(step->unacked, ==, jabber_sm_get_unacked_count(sm));
+		purple_xmlnode_free(node);
+	}
+}
+
+static void
+test_jabber_sm_ack(void) {
+	const Step script[] = {
+		{ STEP_SEND, "<presence/>", 1 },
+		{ STEP_SEND, "<message to='a@example.com'><body>1</body></message>", 2 },
+		{ STEP_RECV, "<message from='a@example.com'><body>hi</body></message>", 2 },
+		{ STEP_SERVER, "<a xmlns='urn:xmpp:sm:3' h='1'/>", 1 },
+		{ STEP_SEND, "<message to='a@example.com'><body>2</body></message>", 2 },
+		{ STEP_SEND, "<iq type='get' id='p1'><ping xmlns='urn:xmpp:ping'/></iq>", 3 },
+		/* a repeated ack changes nothing */
+		{ STEP_SERVER, "<a xmlns='urn:xmpp:sm:3' h='1'/>", 3 },
+		{ STEP_SERVER, "<a xmlns='urn:xmpp:sm:3' h='4'/>", 0 },
+	};
+	JabberStreamManagement *sm = jabber_sm_new();
+
+	play_script(sm, script, G_N_ELEMENTS(script));
+	g_assert_cmpuint(1, ==, jabber_sm_get_handled(sm));
+
+	/* acknowledging more than was sent empties the queue and is reported */
+	jabber_sm_push_unacked(sm, "<presence/>", -1);
+	g_assert_false(jabber_sm_ack(sm, 7));
+	g_assert_cmpuint(0, ==, jabber_sm_get_unacked_count(sm));
+
+	jabber_sm_free(sm);
+}
+
+static void
+test_jabber_sm_resume(void) {
+	const Step script[] = {
+		{ STEP_SEND, "<message to='a@example.com'><body>1</body></message>", 1 },
+		{ STEP_SEND, "<message to='a@example.com'><body>2</body></message>", 2 },
+		{ STEP_RECV, "<presence from='a@example.com/x'/>", 2 },
+		{ STEP_RECV, "<message from='a@example.com'><body>hi</body></message>", 2 },
+		/* the connection drops here; this one is held while resuming */
+		{ STEP_SEND, "<message to='a@example.com'><body>3</body></message>", 3 },
+		/* the server only saw the first one before the drop */
+		{ STEP_SERVER, "<resumed xmlns='urn:xmpp:sm:3' previd='abc' h='1'/>", 2 },
+	};
+	JabberStreamManagement *sm = jabber_sm_new();
+	GList *l;
+
+	play_script(sm, script, G_N_ELEMENTS(script));
+
+	/* <resume/> reports what we handled, and the rest goes out again in
+	 * order. */
+	g_assert_cmpuint(2, ==, jabber_sm_get_handled(sm));
+
+	l = jabber_sm_get_unacked(sm);
+	g_assert_cmpstr("<message to='a@example.com'><body>2</body></message>",
+	                ==, l->data);
+	l = l->next;
+	g_assert_cmpstr("<message to='a@example.com'><body>3</body></message>",
+	                ==, l->data);
+	g_assert_null(l->next);
+
+	jabber_sm_free(sm);
+}
+
+static void
+test_jabber_sm_wrap(void) {
+	JabberStreamManagement *sm = jabber_sm_new();
+	guint i;
+
+	/* Queueing 2^32 stanzas isn't practical, so let a bogus ack move the
+	 * count up to the edge instead; that resyncs to the server's count. */
+	g_assert_false(jabber_sm_ack(sm, 4294967294u));
+
+	for (i = 0; i < 4; i++)
+		jabber_sm_push_unacked(sm, "<presence/>", -1);
+
+	/* 4294967294 + 2 wraps around to 0 */
+	g_assert_true(jabber_sm_ack(sm, 0));
+	g_assert_cmpuint(2, ==, jabber_sm_get_unacked_count(sm));
+	g_assert_true(jabber_sm_ack(sm, 2));
+	g_assert_cmpuint(0, ==, jabber_sm_get_unacked_count(sm));
+
+	jabber_sm_free(sm);
+}
+
+static void
+test_jabber_sm_parse_h(void) {
+	const gchar *invalid[] = {
+		"<a xmlns='urn:xmpp:sm:3'/>",
+		"<a xmlns='urn:xmpp:sm:3' h=''/>",
+		"<a xmlns='urn:xmpp:sm:3' h='-1'/>",
+		"<a xmlns='urn:xmpp:sm:3' h='12x'/>",
+		"<a xmlns='urn:xmpp:sm:3' h='4294967296'/>",
+	};
+	PurpleXmlNode *a;
+	guint32 h = 0;
+	gsize i;
+
+	for (i = 0; i < G_N_ELEMENTS(invalid); i++) {
+		a = purple_xmlnode_from_str(invalid[i], -1);
+		g_assert_false(jabber_sm_parse_h(a, &h));
+		purple_xmlnode_free(a);
+	}
+
+	a = purple_xmlnode_from_str("<a xmlns='urn:xmpp:sm:3' h='4294967295'/>", -1);
+	g_assert_true(jabber_sm_parse_h(a, &h));
+	g_assert_cmpuint(G_MAXUINT32, ==, h);
+	purple_xmlnode_free(a);
+}
+
+/*
+ * The same transcripts played against a JabberStream, so what sm.c puts on
+ * the wire gets checked too.  The protocol below only carries the signals
+ * jabber_send() goes through; jabber-sending-text is where the wire is
+ * tapped, and nothing is actually written.
+ */
+typedef struct {
+	PurpleProtocol parent;
+} TestJabberProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestJabberProtocolClass;
+
+static GType test_jabber_protocol_get_type(void);
+
+G_DEFINE_TYPE(TestJabberProtocol, test_jabber_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_jabber_protocol_init(TestJabberProtocol *protocol) {
+	PURPLE_PROTOCOL(protocol)->id = "prpl-jabber-sm-test";
+}
+
+static void
+test_jabber_protocol_class_init(TestJabberProtocolClass *klass) {
+}
+
+static PurpleProtocol *test_protocol = NULL;
+
+static void
+test_sending_text_cb(PurpleConnection *gc, const gchar **data,
+                     gpointer user_data)
+{
+	GPtrArray *wire = g_object_get_data(G_OBJECT(gc), "test-wire");
+
+	g_ptr_array_add(wire, g_strdup(*data));
+	*data = NULL;
+}
+
+static void
+test_protocol_setup(void) {
+	test_protocol = g_object_new(test_jabber_protocol_get_type(), NULL);
+
+	purple_signal_register(test_protocol, "jabber-sending-xmlnode",
+			purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+	purple_signal_connect_priority(test_protocol, "jabber-sending-xmlnode",
+			test_protocol, PURPLE_CALLBACK(jabber_send_signal_cb),
+			NULL, PURPLE_SIGNAL_PRIORITY_HIGHEST);
+	purple_signal_register(test_protocol, "jabber-sending-text",
+			purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+	purple_signal_connect(test_protocol, "jabber-sending-text",
+			test_protocol, PURPLE_CALLBACK(test_sending_text_cb), NULL);
+}
+
+typedef struct {
+	PurpleConnection *gc;
+	JabberStream *js;
+	/* everything written to the wire, oldest first */
+	GPtrArray *wire;
+} TestStream;
+
+static void
+test_stream_init(TestStream *ts, const gchar *username) {
+	PurpleAccount *account = purple_account_new(username, "prpl-jabber-sm-test");
+
+	ts->gc = g_object_new(PURPLE_TYPE_CONNECTION, "account", account,
+	                      "protocol", test_protocol, NULL);
+	ts->wire = g_ptr_array_new_with_free_func(g_free);
+	g_object_set_data(G_OBJECT(ts->gc), "test-wire", ts->wire);
+
+	ts->js = g_new0(JabberStream, 1);
+	ts->js->gc = ts->gc;
+	ts->js->state = JABBER_STREAM_CONNECTED;
+	ts->js->max_inactivity = 120;
+	ts->js->server_caps = JABBER_CAP_STREAM_MANAGEMENT;
+	purple_connection_set_protocol_data(ts->gc, ts->js);
+}
+
+static void
+test_stream_clear(TestStream *ts) {
+	JabberStream *js = ts->js;
+
+	jabber_sm_close(js);
+	if (js->inactivity_timer)
+		g_source_remove(js->inactivity_timer);
+	if (js->send_buffer)
+		g_string_free(js->send_buffer, TRUE);
+	g_free(js);
+
+	purple_connection_set_protocol_data(ts->gc, NULL);
+	g_object_set_data(G_OBJECT(ts->gc), "test-wire", NULL);
+	g_ptr_array_free(ts->wire, TRUE);
+}
+
+/* Take the oldest thing written to the wire. */
+static gchar *
+test_stream_pop(TestStream *ts) {
+	gchar *text;
+
+	g_assert_cmpuint(ts->wire->len, >, 0);
+
+	text = g_strdup(g_ptr_array_index(ts->wire, 0));
+	g_ptr_array_remove_index(ts->wire, 0);
+
+	return text;
+}
+
+static PurpleXmlNode *
+test_stream_pop_node(TestStream *ts, const gchar *name) {
+	gchar *text = test_stream_pop(ts);
+	PurpleXmlNode *node = purple_xmlnode_from_str(text, -1);
+
+	g_assert_nonnull(node);
+	g_assert_cmpstr(name, ==, node->name);
+	g_free(text);
+
+	return node;
+}
+
+static void
+test_stream_send(TestStream *ts, const gchar *xml) {
+	PurpleXmlNode *node = purple_xmlnode_from_str(xml, -1);
+
+	jabber_send(ts->js, node);
+	purple_xmlnode_free(node);
+}
+
+static void
+test_stream_receive(TestStream *ts, const gchar *xml) {
+	PurpleXmlNode *node = purple_xmlnode_from_str(xml, -1);
+
+	if (purple_strequal(purple_xmlnode_get_namespace(node),
+	                    "urn:xmpp:sm:3"))
+		jabber_sm_process_packet(ts->js, node);
+	else
+		jabber_sm_stanza_received(ts->js, node);
+	purple_xmlnode_free(node);
+}
+
+static void
+test_jabber_sm_stream_resume(void) {
+	TestStream ts;
+	PurpleXmlNode *node;
+	gchar *m2, *body;
+
+	test_stream_init(&ts, "resume@example.com/test");
+
+	jabber_sm_enable(ts.js);
+	node = test_stream_pop_node(&ts, "enable");
+	g_assert_cmpstr("true", ==, purple_xmlnode_get_attrib(node, "resume"));
+	purple_xmlnode_free(node);
+
+	test_stream_receive(&ts, "<enabled xmlns='urn:xmpp:sm:3' id='abc' resume='true'/>");
+	g_assert_cmpuint(0, ==, ts.wire->len);
+
+	test_stream_send(&ts, "<message to='a@example.com'><body>1</body></message>");
+	g_free(test_stream_pop(&ts));
+	test_stream_send(&ts, "<message to='a@example.com'><body>2</body></message>");
+	m2 = test_stream_pop(&ts);
+	g_assert_cmpuint(2, ==, jabber_sm_get_unacked_count(ts.js->sm));
+
+	/* the server asks what we've handled */
+	test_stream_receive(&ts, "<message from='a@example.com'><body>hi</body></message>");
+	test_stream_receive(&ts, "<r xmlns='urn:xmpp:sm:3'/>");
+	node = test_stream_pop_node(&ts, "a");
+	g_assert_cmpstr("1", ==, purple_xmlnode_get_attrib(node, "h"));
+	purple_xmlnode_free(node);
+
+	test_stream_receive(&ts, "<a xmlns='urn:xmpp:sm:3' h='1'/>");
+	g_assert_cmpuint(1, ==, jabber_sm_get_unacked_count(ts.js->sm));
+
+	/* the connection drops; what is sent meanwhile is held back */
+	g_assert_true(jabber_sm_start_resume(ts.js));
+	g_assert_true(jabber_sm_is_resuming(ts.js));
+	test_stream_send(&ts, "<message to='a@example.com'><body>3</body></message>");
+	g_assert_cmpuint(0, ==, ts.wire->len);
+	g_assert_cmpuint(2, ==, jabber_sm_get_unacked_count(ts.js->sm));
+
+	/* the new stream asks to carry on */
+	jabber_sm_resume(ts.js);
+	node = test_stream_pop_node(&ts, "resume");
+	g_assert_cmpstr("abc", ==, purple_xmlnode_get_attrib(node, "previd"));
+	g_assert_cmpstr("1", ==, purple_xmlnode_get_attrib(node, "h"));
+	purple_xmlnode_free(node);
+
+	/* the server lost the second message in the drop, so it goes out
+	 * again, followed by the one that was held */
+	test_stream_receive(&ts, "<resumed xmlns='urn:xmpp:sm:3' previd='abc' h='1'/>");
+	g_assert_false(jabber_sm_is_resuming(ts.js));
+	g_assert_null(purple_connection_get_error_info(ts.gc));
+
+	g_assert_cmpuint(2, ==, ts.wire->len);
+	g_assert_cmpstr(m2, ==, g_ptr_array_index(ts.wire, 0));
+	g_free(m2);
+	g_ptr_array_remove_index(ts.wire, 0);
+	node = test_stream_pop_node(&ts, "message");
+	body = purple_xmlnode_get_data(purple_xmlnode_get_child(node, "body"));
+	g_assert_cmpstr("3", ==, body);
+	g_free(body);
+	purple_xmlnode_free(node);
+
+	test_stream_clear(&ts);
+}
+
+static gboolean
+test_writing_im_msg_cb(PurpleConversation *conv, PurpleMessage *msg,
+                       gpointer data)
+{
+	GPtrArray *written = data;
+
+	g_assert_true(purple_message_get_flags(msg) & PURPLE_MESSAGE_ERROR);
+	g_ptr_array_add(written, g_strdup(purple_message_get_contents(msg)));
+
+	/* Nothing past the signal is of interest here. */
+	return TRUE;
+}
+
+static void
+test_jabber_sm_stream_failed(void) {
+	TestStream ts;
+	PurpleConnectionErrorInfo *info;
+	GPtrArray *written = g_ptr_array_new_with_free_func(g_free);
+
+	test_stream_init(&ts, "failed@example.com/test");
+
+	/* refusing <enable/> just turns stream management off */
+	jabber_sm_enable(ts.js);
+	g_free(test_stream_pop(&ts));
+	test_stream_receive(&ts, "<failed xmlns='urn:xmpp:sm:3'/>");
+	g_assert_null(ts.js->sm);
+
+	test_stream_send(&ts, "<presence/>");
+	g_free(test_stream_pop(&ts));
+	g_assert_null(ts.js->sm);
+	g_assert_null(purple_connection_get_error_info(ts.gc));
+
+	/* refusing <resume/> loses the session */
+	jabber_sm_enable(ts.js);
+	g_free(test_stream_pop(&ts));
+	test_stream_receive(&ts, "<enabled xmlns='urn:xmpp:sm:3' id='abc' resume='true'/>");
+
+	/* ... and with it whatever the server never acknowledged, which the
+	 * user is told about where it was sent from.  Closing the conversation
+	 * would call into the protocol, which this test one doesn't implement,
+	 * so it is left open. */
+	purple_im_conversation_new(purple_connection_get_account(ts.gc),
+	                                "a@example.com");
+	purple_signal_connect(purple_conversations_get_handle(), "writing-im-msg",
+	                      written, PURPLE_CALLBACK(test_writing_im_msg_cb),
+	                      written);
+	test_stream_send(&ts, "<message to='a@example.com/res'><body>a &lt;b&gt;</body></message>");
+	test_stream_send(&ts, "<presence/>");
+	g_ptr_array_set_size(ts.wire, 0);
+
+	g_assert_true(jabber_sm_start_resume(ts.js));
+	jabber_sm_resume(ts.js);
+	g_free(test_stream_pop(&ts));
+	test_stream_receive(&ts, "<failed xmlns='urn:xmpp:sm:3'/>");
+
+	info = purple_connection_get_error_info(ts.gc);
+	g_assert_nonnull(info);
+	g_assert_cmpint(PURPLE_CONNECTION_ERROR_NETWORK_ERROR, ==, info->type);
+	g_assert_cmpuint(0, ==, ts.wire->len);
+	g_assert_null(ts.js->sm);
+
+	g_assert_cmpuint(1, ==, written->len);
+	g_assert_nonnull(strstr(g_ptr_array_index(written, 0), "a &lt;b&gt;"));
+
+	purple_signals_disconnect_by_handle(written);
+	g_ptr_array_free(written, TRUE);
+
+	test_stream_clear(&ts);
+}
+
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+	test_protocol_setup();
+
+	g_test_add_func("/jabber/sm/ack", test_jabber_sm_ack);
+	g_test_add_func("/jabber/sm/resume", test_jabber_sm_resume);
+	g_test_add_func("/jabber/sm/wrap", test_jabber_sm_wrap);
+	g_test_add_func("/jabber/sm/parse h", test_jabber_sm_parse_h);
+	g_test_add_func("/jabber/sm/stream/resume", test_jabber_sm_stream_resume);
+	g_test_add_func("/jabber/sm/stream/failed", test_jabber_sm_stream_failed);
+
+	return g_test_run();
+}
@@ -0,0 +1,277 @@
+#include <glib.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include <libsoup/soup.h>
+
+#include "protocols/jabber/websocket.h"
+#include "tests/test_ui.h"
+
+static void
+test_jabber_websocket_is_url(void) {
+	g_assert_true(jabber_websocket_is_url("ws://example.com/xmpp-websocket"));
+	g_assert_true(jabber_websocket_is_url("WSS://example.com:5281/"));
+
+	g_assert_false(jabber_websocket_is_url(NULL));
+	g_assert_false(jabber_websocket_is_url(""));
+	g_assert_false(jabber_websocket_is_url("https://example.com/http-bind"));
+	g_assert_false(jabber_websocket_is_url("wss:example.com"));
+}
+
+static void
+test_jabber_websocket_parse_open(void) {
+	const gchar *invalid[] = {
+		"<open to='example.com' version='1.0'/>",
+		"<open xmlns='urn:ietf:params:xml:ns:xmpp-framing' to='example.com'/>",
+		"<open xmlns='urn:ietf:params:xml:ns:xmpp-framing' version='2.0'/>",
+		"<stream:stream xmlns:stream='http://etherx.jabber.org/streams' version='1.0'/>",
+	};
+	PurpleXmlNode *open;
+	gchar *id = NULL;
+	gint major = 0, minor = 0;
+	gsize i;
+
+	for (i = 0; i < G_N_ELEMENTS(invalid); i++) {
+		open = purple_xmlnode_from_str(invalid[i], -1);
+		g_assert_false(jabber_websocket_parse_open(open, &id, &major, &minor));
+		g_assert_null(id);
+		purple_xmlnode_free(open);
+	}
+
+	open = purple_xmlnode_from_str("<open xmlns='urn:ietf:params:xml:ns:xmpp-framing' "
+	                               "from='example.com' id='++TR84Sm6A3hnt3Q065SnAbbk3Y=' "
+	                               "version='1.0' xml:lang='en'/>", -1);
+	g_assert_true(jabber_websocket_parse_open(open, &id, &major, &minor));
+	g_assert_cmpstr("++TR84Sm6A3hnt3Q065SnAbbk3Y=", ==, id);
+	g_assert_cmpint(1, ==, major);
+	g_assert_cmpint(0, ==, minor);
+	g_free(id);
+	purple_xmlnode_free(open);
+}
+
+/*
+ * A stand-in server for the real transport.  It answers the client's
+ * <open/> with its own, follows up with a <close/>, and records everything
+ * the client sends, one element per message the way RFC 7395 asks.
+ */
+typedef struct {
+	GMainLoop *loop;
+	/* what the server sends after its <open/> */
+	const gchar *close;
+	GPtrArray *received;
+} StandIn;
+
+static void
+stand_in_server_message_cb(SoupWebsocketConnection *ws, gint type,
+                           GBytes *message, gpointer data)
+{
+	StandIn *standin = data;
+	PurpleXmlNode *packet;
+
+	packet = purple_xmlnode_from_str(g_bytes_get_data(message, NULL),
+	                                 g_bytes_get_size(message));
+	g_assert_nonnull(packet);
+	g_ptr_array_add(standin->received, packet);
+
+	if (purple_strequal("open", packet->name)) {
+		soup_websocket_connection_send_text(ws,
+			"<open xmlns='urn:ietf:params:xml:ns:xmpp-framing' "
+			"from='example.com' id='standin' version='1.0'/>");
+		soup_websocket_connection_send_text(ws, standin->close);
+	} else if (purple_strequal("close", packet->name)) {
+		g_main_loop_quit(standin->loop);
+	}
+}
+
+static void
+stand_in_server_cb(SoupServer *server, SoupWebsocketConnection *ws,
+                   const char *path, SoupClientContext *client, gpointer data)
+{
+	g_object_set_data_full(G_OBJECT(server), "ws", g_object_ref(ws),
+	                       g_object_unref);
+	g_signal_connect(ws, "message", G_CALLBACK(stand_in_server_message_cb),
+	                 data);
+}
+
+/*
+ * Just enough of a protocol and connection for the transport: jabber_send_raw()
+ * goes through the jabber-sending-text signal, and errors land on the
+ * connection.
+ */
+typedef struct {
+	PurpleProtocol parent;
+} TestJabberProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestJabberProtocolClass;
+
+static GType test_jabber_protocol_get_type(void);
+
+G_DEFINE_TYPE(TestJabberProtocol, test_jabber_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_jabber_protocol_init(TestJabberProtocol *protocol) {
+	PURPLE_PROTOCOL(protocol)->id = "prpl-jabber-websocket-test";
+}
+
+static void
+test_jabber_protocol_class_init(TestJabberProtocolClass *klass) {
+}
+
+static PurpleProtocol *test_protocol = NULL;
+
+static JabberStream *
+test_stream_new(const gchar *username) {
+	PurpleAccount *account;
+	PurpleProxyInfo *info;
+	PurpleConnection *gc;
+	JabberStream *js;
+
+	account = purple_account_new(username, "prpl-jabber-websocket-test");
+	info = purple_proxy_info_new();
+	purple_proxy_info_set_proxy_type(info, PURPLE_PROXY_NONE);
+	purple_account_set_proxy_info(account, info);
+
+	gc = g_object_new(PURPLE_TYPE_CONNECTION, "account", account,
+	                  "protocol", test_protocol, NULL);
+	/* A connection error disconnects the account from the main loop,
+	 * which would otherwise take the connection away mid-test. */
+	g_object_ref(gc);
+
+	js = g_new0(JabberStream, 1);
+	js->gc = gc;
+	js->user = jabber_id_new_private(username);
+	js->max_inactivity = 120;
+	purple_connection_set_protocol_data(gc, js);
+
+	return js;
+}
+
+static void
+test_stream_free(JabberStream *js) {
+	jabber_websocket_connection_destroy(js->websocket);
+	if (js->inactivity_timer)
+		g_source_remove(js->inactivity_timer);
+	jabber_id_free(js->user);
+	g_free(js->stream_id);
+
+	purple_connection_set_protocol_data(js->gc, NULL);
+	g_free(js);
+}
+
+static void
+stand_in_run(StandIn *standin, JabberStream *js) {
+	gchar *protocols[] = { "xmpp", NULL };
+	SoupServer *server;
+	GSList *uris;
+	GError *error = NULL;
+	gchar *url;
+
+	server = soup_server_new(NULL, NULL);
+	soup_server_add_websocket_handler(server, "/xmpp-websocket", NULL,
+	                                  protocols, stand_in_server_cb, standin,
+	                                  NULL);
+	soup_server_listen_local(server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error);
+	g_assert_no_error(error);
+
+	uris = soup_server_get_uris(server);
+	g_assert_nonnull(uris);
+	url = g_strdup_printf("ws://127.0.0.1:%u/xmpp-websocket",
+	                      soup_uri_get_port(uris->data));
+	g_slist_free_full(uris, (GDestroyNotify)soup_uri_free);
+
+	standin->loop = g_main_loop_new(NULL, FALSE);
+	standin->received = g_ptr_array_new_with_free_func(
+		(GDestroyNotify)purple_xmlnode_free);
+
+	js->websocket = jabber_websocket_connection_new(js, url);
+	g_assert_nonnull(js->websocket);
+	g_main_loop_run(standin->loop);
+
+	g_free(url);
+	g_main_loop_unref(standin->loop);
+	g_object_unref(server);
+}
+
+static void
+test_jabber_websocket_stand_in_check_framing(StandIn *standin) {
+	PurpleXmlNode *packet;
+	gchar *id = NULL;
+	gint major, minor;
+
+	g_assert_cmpuint(2, ==, standin->received->len);
+
+	/* the stream header goes first, as an <open/> of its own */
+	packet = g_ptr_array_index(standin->received, 0);
+	g_assert_true(jabber_websocket_parse_open(packet, &id, &major, &minor));
+	g_assert_cmpstr("example.com", ==, purple_xmlnode_get_attrib(packet, "to"));
+	g_free(id);
+
+	/* and the server's <close/> is answered with one */
+	packet = g_ptr_array_index(standin->received, 1);
+	g_assert_cmpstr("close", ==, packet->name);
+	g_assert_cmpstr("urn:ietf:params:xml:ns:xmpp-framing", ==,
+	                purple_xmlnode_get_namespace(packet));
+}
+
+static void
+test_jabber_websocket_stand_in(void) {
+	StandIn standin = { NULL, NULL, NULL };
+	JabberStream *js = test_stream_new("close@example.com/test");
+
+	standin.close = "<close xmlns='urn:ietf:params:xml:ns:xmpp-framing'/>";
+	stand_in_run(&standin, js);
+
+	test_jabber_websocket_stand_in_check_framing(&standin);
+	g_assert_cmpstr("standin", ==, js->stream_id);
+	g_assert_null(purple_connection_get_error_info(js->gc));
+
+	g_ptr_array_free(standin.received, TRUE);
+	test_stream_free(js);
+}
+
+static void
+test_jabber_websocket_stand_in_see_other_uri(void) {
+	StandIn standin = { NULL, NULL, NULL };
+	JabberStream *js = test_stream_new("moved@example.com/test");
+	PurpleConnectionErrorInfo *info;
+
+	standin.close = "<close xmlns='urn:ietf:params:xml:ns:xmpp-framing' "
+	                "see-other-uri='wss://other.example.com/xmpp'/>";
+	stand_in_run(&standin, js);
+
+	test_jabber_websocket_stand_in_check_framing(&standin);
+
+	/* the new location is passed on rather than dropped */
+	info = purple_connection_get_error_info(js->gc);
+	g_assert_nonnull(info);
+	g_assert_nonnull(strstr(info->description,
+	                        "wss://other.example.com/xmpp"));
+
+	g_ptr_array_free(standin.received, TRUE);
+	test_stream_free(js);
+}
+
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	test_protocol = g_object_new(test_jabber_protocol_get_type(), NULL);
+	purple_signal_register(test_protocol, "jabber-sending-text",
+			purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+
+	g_test_add_func("/jabber/websocket/is url", test_jabber_websocket_is_url);
+	g_test_add_func("/jabber/websocket/parse open",
+	                test_jabber_websocket_parse_open);
+	g_test_add_func("/jabber/websocket/stand-in",
+	                test_jabber_websocket_stand_in);
+	g_test_add_func("/jabber/websocket/stand-in/see-other-uri",
+	                test_jabber_websocket_stand_in_see_other_uri);
+
+	return g_test_run();
+}
@@ -0,0 +1,397 @@
+/*
+ * purple - Jabber Protocol Plugin
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ *
+ */
+#include <glib/gi18n-lib.h>
+
+#include <purple.h>
+
+#include <libsoup/soup.h>
+
+#include "websocket.h"
+
+/*
+ * Every WebSocket message carries exactly one complete element: <open/> and
+ * <close/> stand in for the stream header and footer, and everything else
+ * is a stanza or nonza that goes straight to jabber_process_packet().
+ */
+
+#define JABBER_WEBSOCKET_TIMEOUT 30
+/* Pings have to keep an idle connection inside the I/O timeout. */
+#define JABBER_WEBSOCKET_KEEPALIVE 20
+
+struct _PurpleJabberWebSocketConnection {
+	JabberStream *js;
+	SoupSession *session;
+	SoupWebsocketConnection *ws;
+	GCancellable *cancellable;
+
+	gboolean is_ssl;
+	gboolean is_terminating;
+};
+
+gboolean
+jabber_websocket_is_url(const gchar *url)
+{
+	return url != NULL && (g_ascii_strncasecmp(url, "ws://", 5) == 0 ||
+	                       g_ascii_strncasecmp(url, "wss://", 6) == 0);
+}
+
+gchar *
+jabber_websocket_open_new(const gchar *domain)
+{
+	gchar *escaped, *open;
+
+	escaped = g_markup_escape_text(domain, -1);
+	open = g_strdup_printf("<open xmlns='" NS_XMPP_FRAMING "' to='%s' "
+	                       "version='1.0'/>", escaped);
+	g_free(escaped);
+
+	return open;
+}
+
+gboolean
+jabber_websocket_parse_open(PurpleXmlNode *packet, gchar **id,
+	gint *major, gint *minor)
+{
+	const gchar *version, *dot;
+
+	g_return_val_if_fail(packet != NULL, FALSE);
+
+	if (!purple_strequal(packet->name, "open") ||
+	    !purple_strequal(purple_xmlnode_get_namespace(packet),
+	                     NS_XMPP_FRAMING))
+		return FALSE;
+
+	/* RFC 7395 only defines version 1.0. */
+	version = purple_xmlnode_get_attrib(packet, "version");
+	if (version == NULL)
+		return FALSE;
+
+	*major = atoi(version);
+	dot = strchr(version, '.');
+	*minor = dot ? atoi(dot + 1) : 0;
+	if (*major != 1)
+		return FALSE;
+
+	*id = g_strdup(purple_xmlnode_get_attrib(packet, "id"));
+	if (*id == NULL)
+		*id = g_strdup("");
+
+	return TRUE;
+}
+
+static void
+jabber_websocket_connection_message_cb(SoupWebsocketConnection *ws,
+                                       gint type, GBytes *message,
+                                       gpointer data)
+{
+	PurpleJabberWebSocketConnection *conn = data;
+	JabberStream *js = conn->js;
+	PurpleXmlNode *packet;
+	gconstpointer text;
+	gsize len;
+
+	text = g_bytes_get_data(message, &len);
+
+	if (purple_debug_is_verbose() && purple_debug_is_unsafe()) {
+		purple_debug_misc("jabber-websocket", "received: %.*s\n",
+		                  (int)len, (const gchar *)text);
+	}
+
+	purple_connection_update_last_received(js->gc);
+
+	if (type != SOUP_WEBSOCKET_DATA_TEXT) {
+		purple_debug_warning("jabber-websocket",
+		                     "Ignoring binary message\n");
+		return;
+	}
+
+	packet = purple_xmlnode_from_str(text, len);
+	if (packet == NULL) {
+		purple_connection_error(js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Invalid XMPP message from server"));
+		return;
+	}
+
+	if (js->stream_id == NULL) {
+		gchar *id = NULL;
+		gint major, minor;
+
+		if (!jabber_websocket_parse_open(packet, &id, &major, &minor)) {
+			purple_debug_error("jabber-websocket", "Expecting <open/>, "
+			                   "got %s\n", packet->name);
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_AUTHENTICATION_IMPOSSIBLE,
+				_("XMPP stream header missing"));
+			purple_xmlnode_free(packet);
+			return;
+		}
+
+		js->stream_id = id;
+		js->protocol_version.major = major;
+		js->protocol_version.minor = minor;
+	} else if (purple_strequal(packet->name, "close") &&
+	           purple_strequal(purple_xmlnode_get_namespace(packet),
+	                           NS_XMPP_FRAMING)) {
+		const gchar *uri = purple_xmlnode_get_attrib(packet,
+		                                             "see-other-uri");
+
+		purple_debug_info("jabber-websocket", "Server closed the stream%s%s\n",
+		                  uri ? ", redirecting to " : "", uri ? uri : "");
+		soup_websocket_connection_send_text(ws,
+			"<close xmlns='" NS_XMPP_FRAMING "'/>");
+
+		/* Following it would mean trusting the old server to pick our
+		 * new one, so leave that to the user. */
+		if (uri != NULL) {
+			gchar *tmp = g_strdup_printf(
+				_("The server moved the connection to %s"), uri);
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_INVALID_SETTINGS, tmp);
+			g_free(tmp);
+		}
+	} else {
+		jabber_process_packet(js, &packet);
+	}
+
+	if (packet != NULL)
+		purple_xmlnode_free(packet);
+
+	/* After SASL, the stream restarts with a fresh <open/>. */
+	if (js->reinit)
+		jabber_stream_init(js);
+}
+
+static void
+jabber_websocket_connection_closed_cb(SoupWebsocketConnection *ws,
+                                      gpointer data)
+{
+	PurpleJabberWebSocketConnection *conn = data;
+
+	if (conn->is_terminating)
+		return;
+
+	purple_connection_error(conn->js->gc,
+		PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+		_("Server closed the connection"));
+}
+
+static void
+jabber_websocket_connection_error_cb(SoupWebsocketConnection *ws,
+                                     GError *error, gpointer data)
+{
+	purple_debug_error("jabber-websocket", "WebSocket error: %s\n",
+	                   error->message);
+}
+
+static void
+jabber_websocket_connection_connected_cb(GObject *source, GAsyncResult *res,
+                                         gpointer data)
+{
+	PurpleJabberWebSocketConnection *conn = data;
+	SoupWebsocketConnection *ws;
+	GError *error = NULL;
+
+	ws = soup_session_websocket_connect_finish(SOUP_SESSION(source), res,
+	                                           &error);
+	if (ws == NULL) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_prefix_error(&error, "%s", _("Unable to connect: "));
+			purple_connection_take_error(conn->js->gc, error);
+		} else {
+			g_error_free(error);
+		}
+		return;
+	}
+
+	if (!purple_strequal(soup_websocket_connection_get_protocol(ws), "xmpp")) {
+		purple_connection_error(conn->js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Server does not support XMPP over WebSocket"));
+		g_object_unref(ws);
+		return;
+	}
+
+	purple_debug_misc("jabber-websocket", "Connected %p\n", conn);
+
+	conn->ws = ws;
+#if SOUP_CHECK_VERSION(2, 58, 0)
+	/* Whitespace keepalives aren't allowed over WebSocket; use pings. */
+	soup_websocket_connection_set_keepalive_interval(ws,
+		JABBER_WEBSOCKET_KEEPALIVE);
+#endif
+	g_signal_connect(ws, "message",
+		G_CALLBACK(jabber_websocket_connection_message_cb), conn);
+	g_signal_connect(ws, "closed",
+		G_CALLBACK(jabber_websocket_connection_closed_cb), conn);
+	g_signal_connect(ws, "error",
+		G_CALLBACK(jabber_websocket_connection_error_cb), conn);
+
+	jabber_stream_set_state(conn->js, JABBER_STREAM_INITIALIZING);
+}
+
+PurpleJabberWebSocketConnection *
+jabber_websocket_connection_new(JabberStream *js, const gchar *url)
+{
+	PurpleJabberWebSocketConnection *conn;
+	PurpleAccount *account;
+	GProxyResolver *resolver;
+	GError *error = NULL;
+	SoupURI *url_p;
+	SoupMessage *msg;
+	gboolean is_ssl;
+	gchar *protocols[] = { "xmpp", NULL };
+
+	if (!jabber_websocket_is_url(url)) {
+		purple_debug_error("jabber-websocket", "Not a WebSocket URL: %s\n",
+		                   url);
+		return NULL;
+	}
+
+	/* The handshake is a plain HTTP(S) request. */
+	is_ssl = g_ascii_strncasecmp(url, "wss://", 6) == 0;
+	url_p = soup_uri_new(url);
+	if (url_p != NULL) {
+		soup_uri_set_scheme(url_p, is_ssl ? SOUP_URI_SCHEME_HTTPS
+		                                  : SOUP_URI_SCHEME_HTTP);
+	}
+	if (!SOUP_URI_VALID_FOR_HTTP(url_p)) {
+		purple_debug_error("jabber-websocket",
+		                   "Unable to parse given WebSocket URL: %s\n", url);
+		if (url_p != NULL)
+			soup_uri_free(url_p);
+		return NULL;
+	}
+
+	account = purple_connection_get_account(js->gc);
+	resolver = purple_proxy_get_proxy_resolver(account, &error);
+	if (resolver == NULL) {
+		purple_debug_error("jabber-websocket",
+		                   "Unable to get account proxy resolver: %s\n",
+		                   error->message);
+		g_error_free(error);
+		soup_uri_free(url_p);
+		return NULL;
+	}
+
+	conn = g_new0(PurpleJabberWebSocketConnection, 1);
+	conn->js = js;
+	conn->is_ssl = is_ssl;
+	conn->cancellable = g_cancellable_new();
+	conn->session = soup_session_new_with_options(
+	        SOUP_SESSION_PROXY_RESOLVER, resolver,
+#if SOUP_CHECK_VERSION(2, 58, 0)
+	        /* The timeout carries over to the upgraded connection, and
+	         * only newer libsoup can ping to keep it busy. */
+	        SOUP_SESSION_TIMEOUT, JABBER_WEBSOCKET_TIMEOUT,
+#endif
+	        NULL);
+
+	msg = soup_message_new_from_uri("GET", url_p);
+	soup_session_websocket_connect_async(conn->session, msg, NULL, protocols,
+	                                     conn->cancellable,
+	                                     jabber_websocket_connection_connected_cb,
+	                                     conn);
+	g_object_unref(msg);
+
+	soup_uri_free(url_p);
+	g_object_unref(resolver);
+
+	return conn;
+}
+
+void
+jabber_websocket_connection_destroy(PurpleJabberWebSocketConnection *conn)
+{
+	if (conn == NULL || conn->is_terminating)
+		return;
+	conn->is_terminating = TRUE;
+
+	g_cancellable_cancel(conn->cancellable);
+	g_clear_object(&conn->cancellable);
+
+	if (conn->ws != NULL) {
+		g_signal_handlers_disconnect_by_data(conn->ws, conn);
+		if (soup_websocket_connection_get_state(conn->ws) ==
+		    SOUP_WEBSOCKET_STATE_OPEN) {
+			soup_websocket_connection_send_text(conn->ws,
+				"<close xmlns='" NS_XMPP_FRAMING "'/>");
+			soup_websocket_connection_close(conn->ws,
+				SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+		}
+		g_clear_object(&conn->ws);
+	}
+
+	soup_session_abort(conn->session);
+	g_clear_object(&conn->session);
+
+	g_free(conn);
+}
+
+gboolean
+jabber_websocket_connection_is_ssl(const PurpleJabberWebSocketConnection *conn)
+{
+	return conn->is_ssl;
+}
+
+void
+jabber_websocket_connection_open(PurpleJabberWebSocketConnection *conn)
+{
+	gchar *open;
+
+	g_return_if_fail(conn != NULL);
+
+	open = jabber_websocket_open_new(conn->js->user->domain);
+	jabber_send_raw(NULL, conn->js, open, -1);
+	g_free(open);
+}
+
+void
+jabber_websocket_connection_send(PurpleJabberWebSocketConnection *conn,
+	const gchar *data, gint len)
+{
+	g_return_if_fail(conn != NULL);
+	g_return_if_fail(data != NULL);
+
+	if (conn->ws == NULL ||
+	    soup_websocket_connection_get_state(conn->ws) !=
+	            SOUP_WEBSOCKET_STATE_OPEN) {
+		purple_debug_warning("jabber-websocket",
+		                     "Dropping data sent while not connected\n");
+		return;
+	}
+
+	if (len < 0)
+		len = strlen(data);
+
+	jabber_stream_restart_inactivity_timer(conn->js);
+
+	/* send_text() wants a terminated string of exactly one message */
+	if (data[len] == '\0') {
+		soup_websocket_connection_send_text(conn->ws, data);
+	} else {
+		gchar *text = g_strndup(data, len);
+		soup_websocket_connection_send_text(conn->ws, text);
+		g_free(text);
+	}
+}
@@ -0,0 +1,71 @@
+/**
+ * @file websocket.h XMPP over WebSocket (RFC 7395)
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#ifndef PURPLE_JABBER_WEBSOCKET_H
+#define PURPLE_JABBER_WEBSOCKET_H
+
+typedef struct _PurpleJabberWebSocketConnection PurpleJabberWebSocketConnection;
+
+#include "jabber.h"
+
+/** TRUE if @a url has a ws:// or wss:// scheme. */
+gboolean
+jabber_websocket_is_url(const gchar *url);
+
+PurpleJabberWebSocketConnection *
+jabber_websocket_connection_new(JabberStream *js, const gchar *url);
+
+void
+jabber_websocket_connection_destroy(PurpleJabberWebSocketConnection *conn);
+
+gboolean
+jabber_websocket_connection_is_ssl(const PurpleJabberWebSocketConnection *conn);
+
+/** Send the <open/> that stands in for the stream header. */
+void
+jabber_websocket_connection_open(PurpleJabberWebSocketConnection *conn);
+
+/** Send one complete top-level element as one WebSocket message. */
+void
+jabber_websocket_connection_send(PurpleJabberWebSocketConnection *conn,
+	const gchar *data, gint len);
+
+/*
+ * Framing, independent of any connection.
+ */
+
+/** The <open/> element for @a domain, serialized. */
+gchar *
+jabber_websocket_open_new(const gchar *domain);
+
+/**
+ * Check an <open/> from the server and pull out the stream id and version.
+ *
+ * @return FALSE if @a packet is not a usable <open/>.
+ */
+gboolean
+jabber_websocket_parse_open(PurpleXmlNode *packet, gchar **id,
+	gint *major, gint *minor);
+
+#endif /* PURPLE_JABBER_WEBSOCKET_H */
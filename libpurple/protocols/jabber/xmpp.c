@@ -25,6 +25,7 @@
 #include <purple.h>
 
 #include "xmpp.h"
+#include "ibb.h"
 
 static void
 xmpp_protocol_init(XMPPProtocol *self)
@@ -79,7 +80,12 @@ xmpp_protocol_init(XMPPProtocol *self)
 	protocol->account_options = g_list_append(protocol->account_options,
 						  option);
 
-	option = purple_account_option_string_new(_("BOSH URL"),
+	option = purple_account_option_int_new(_("In-band bytestream window"),
+						  "ibb_window", JABBER_IBB_SESSION_DEFAULT_WINDOW);
+	protocol->account_options = g_list_append(protocol->account_options,
+						  option);
+
+	option = purple_account_option_string_new(_("BOSH or WebSocket URL"),
 						  "bosh_url", NULL);
 	protocol->account_options = g_list_append(protocol->account_options,
 						  option);
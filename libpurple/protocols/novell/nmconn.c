@@ -23,7 +23,6 @@
 #include <unistd.h>
 #endif
 #include <string.h>
-#include <ctype.h>
 
 #include <purple.h>
 
@@ -156,6 +155,8 @@ nm_create_conn(const char *addr, int port)
 	NMConn *conn = 	g_new0(NMConn, 1);
 	conn->addr = g_strdup(addr);
 	conn->port = port;
+	conn->rx = g_byte_array_new();
+	conn->decoder = nm_field_decoder_new();
 	return conn;
 }
 
@@ -166,39 +167,37 @@ void nm_release_conn(NMConn *conn)
 	g_slist_free_full(conn->requests, (GDestroyNotify)nm_release_request);
 	conn->requests = NULL;
 
+	if (conn->inpa) {
+		g_source_remove(conn->inpa);
+		conn->inpa = 0;
+	}
+
 	if (conn->input) {
-		purple_gio_graceful_close(conn->stream, G_INPUT_STREAM(conn->input),
-		                          conn->output);
+		purple_gio_graceful_close(conn->stream, conn->input,
+		                          G_OUTPUT_STREAM(conn->output));
 	}
 	g_clear_object(&conn->input);
 	g_clear_object(&conn->output);
 	g_clear_object(&conn->stream);
 
+	g_clear_pointer(&conn->rx, g_byte_array_unref);
+	g_clear_pointer(&conn->decoder, nm_field_decoder_free);
 	g_clear_pointer(&conn->addr, g_free);
 	g_free(conn);
 }
 
-NMERR_T
-nm_write_fields(NMUser *user, NMField *fields)
+void
+nm_encode_fields(GString *str, NMField *fields)
 {
-	NMConn *conn;
-	NMERR_T rc = NM_OK;
 	NMField *field;
-	char *value = NULL;
-	char *method = NULL;
-	char buffer[4096];
-	int ret;
-	int bytes_to_send;
-	int val = 0;
-
-	g_return_val_if_fail(user != NULL, NMERR_BAD_PARM);
-	g_return_val_if_fail(user->conn != NULL, NMERR_BAD_PARM);
-	g_return_val_if_fail(fields != NULL, NMERR_BAD_PARM);
+	char *value;
+	guint32 count;
 
-	conn = user->conn;
+	g_return_if_fail(str != NULL);
+	g_return_if_fail(fields != NULL);
 
-	/* Format each field as valid "post" data and write it out */
-	for (field = fields; (rc == NM_OK) && (field->tag); field++) {
+	/* Format each field as valid "post" data */
+	for (field = fields; field->tag; field++) {
 
 		/* We don't currently handle binary types */
 		if (field->method == NMFIELD_METHOD_IGNORE ||
@@ -206,104 +205,103 @@ nm_write_fields(NMUser *user, NMField *fields)
 			continue;
 		}
 
-		/* Write the field tag */
-		bytes_to_send = g_snprintf(buffer, sizeof(buffer), "&tag=%s", field->tag);
-		ret = g_output_stream_write(conn->output, buffer, bytes_to_send,
-		                            user->cancellable, NULL);
-		if (ret < 0) {
-			rc = NMERR_TCP_WRITE;
-		}
+		/* The field tag and method */
+		g_string_append_printf(str, "&tag=%s&cmd=%s", field->tag,
+		                       encode_method(field->method));
 
-		/* Write the field method */
-		if (rc == NM_OK) {
-			method = encode_method(field->method);
-			bytes_to_send = g_snprintf(buffer, sizeof(buffer), "&cmd=%s", method);
-			ret = g_output_stream_write(conn->output, buffer, bytes_to_send,
-			                            user->cancellable, NULL);
-			if (ret < 0) {
-				rc = NMERR_TCP_WRITE;
-			}
-		}
+		/* The field value */
+		count = 0;
+		switch (field->type) {
+			case NMFIELD_TYPE_UTF8:
+			case NMFIELD_TYPE_DN:
 
-		/* Write the field value */
-		if (rc == NM_OK) {
-			switch (field->type) {
-				case NMFIELD_TYPE_UTF8:
-				case NMFIELD_TYPE_DN:
-
-					value = url_escape_string((char *) field->ptr_value);
-					bytes_to_send = g_snprintf(buffer, sizeof(buffer),
-											   "&val=%s", value);
-					if (bytes_to_send > (int)sizeof(buffer)) {
-						ret = g_output_stream_write(conn->output, buffer,
-						                            sizeof(buffer),
-						                            user->cancellable, NULL);
-					} else {
-						ret = g_output_stream_write(conn->output, buffer,
-						                            bytes_to_send,
-						                            user->cancellable, NULL);
-					}
-
-					if (ret < 0) {
-						rc = NMERR_TCP_WRITE;
-					}
-
-					g_free(value);
-
-					break;
-
-				case NMFIELD_TYPE_ARRAY:
-				case NMFIELD_TYPE_MV:
-
-					val = nm_count_fields((NMField *) field->ptr_value);
-					bytes_to_send = g_snprintf(buffer, sizeof(buffer),
-											   "&val=%u", val);
-					ret = g_output_stream_write(conn->output, buffer,
-					                            bytes_to_send,
-					                            user->cancellable, NULL);
-					if (ret < 0) {
-						rc = NMERR_TCP_WRITE;
-					}
-
-					break;
-
-				default:
-
-					bytes_to_send = g_snprintf(buffer, sizeof(buffer),
-											   "&val=%u", field->value);
-					ret = g_output_stream_write(conn->output, buffer,
-					                            bytes_to_send,
-					                            user->cancellable, NULL);
-					if (ret < 0) {
-						rc = NMERR_TCP_WRITE;
-					}
-
-					break;
-			}
-		}
+				value = url_escape_string((char *) field->ptr_value);
+				g_string_append_printf(str, "&val=%s", value);
+				g_free(value);
 
-		/* Write the field type */
-		if (rc == NM_OK) {
-			bytes_to_send = g_snprintf(buffer, sizeof(buffer),
-									   "&type=%u", field->type);
-			ret = g_output_stream_write(conn->output, buffer, bytes_to_send,
-			                            user->cancellable, NULL);
-			if (ret < 0) {
-				rc = NMERR_TCP_WRITE;
-			}
+				break;
+
+			case NMFIELD_TYPE_ARRAY:
+			case NMFIELD_TYPE_MV:
+
+				count = nm_count_fields((NMField *) field->ptr_value);
+				g_string_append_printf(str, "&val=%u", count);
+
+				break;
+
+			default:
+
+				g_string_append_printf(str, "&val=%u", field->value);
+
+				break;
 		}
 
-		/* If the field is a sub array then post its fields */
-		if (rc == NM_OK && val > 0) {
-			if (field->type == NMFIELD_TYPE_ARRAY ||
-				field->type == NMFIELD_TYPE_MV) {
+		/* The field type */
+		g_string_append_printf(str, "&type=%u", field->type);
 
-				rc = nm_write_fields(user, (NMField *)field->ptr_value);
-			}
+		/* If the field is a sub array then add its fields */
+		if (count > 0) {
+			nm_encode_fields(str, (NMField *)field->ptr_value);
 		}
 	}
+}
+
+GBytes *
+nm_encode_request(NMConn *conn, const char *cmd, NMField *fields)
+{
+	GString *str;
+	NMField *request_fields = NULL;
+
+	g_return_val_if_fail(conn != NULL, NULL);
+	g_return_val_if_fail(cmd != NULL, NULL);
+
+	str = g_string_sized_new(512);
+
+	/* The post and headers */
+	g_string_append_printf(str, "POST /%s HTTP/1.0\r\n", cmd);
+	if (purple_strequal("login", cmd)) {
+		g_string_append_printf(str, "Host: %s:%d\r\n\r\n", conn->addr,
+		                       conn->port);
+	} else {
+		g_string_append(str, "\r\n");
+	}
 
-	return rc;
+	/* Add the transaction id to the request fields */
+	if (fields)
+		request_fields = nm_copy_field_array(fields);
+
+	request_fields = nm_field_add_pointer(request_fields, NM_A_SZ_TRANSACTION_ID, 0,
+										  NMFIELD_METHOD_VALID, 0,
+										  g_strdup_printf("%d", ++(conn->trans_id)),
+										  NMFIELD_TYPE_UTF8);
+
+	nm_encode_fields(str, request_fields);
+	nm_free_fields(&request_fields);
+
+	/* The CRLF to terminate the data */
+	g_string_append(str, "\r\n");
+
+	return g_string_free_to_bytes(str);
+}
+
+static void
+nm_send_request_cb(GObject *source, GAsyncResult *res, gpointer data)
+{
+	PurpleQueuedOutputStream *stream = PURPLE_QUEUED_OUTPUT_STREAM(source);
+	NMUser *user = data;
+	GError *error = NULL;
+
+	if (!purple_queued_output_stream_push_bytes_finish(stream, res, &error)) {
+		purple_queued_output_stream_clear_queue(stream);
+
+		/* A cancelled write means the user is already gone. */
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			purple_connection_take_error(
+			        purple_account_get_connection(user->client_data), error);
+		} else {
+			g_error_free(error);
+		}
+	}
 }
 
 NMERR_T
@@ -311,12 +309,8 @@ nm_send_request(NMUser *user, char *cmd, NMField *fields, nm_response_cb cb,
                 gpointer data, NMRequest **request)
 {
 	NMConn *conn;
-	NMERR_T rc = NM_OK;
-	char buffer[512];
-	int bytes_to_send;
-	int ret;
-	NMField *request_fields = NULL;
-	char *str = NULL;
+	NMRequest *new_request;
+	GBytes *bytes;
 
 	g_return_val_if_fail(user != NULL, NMERR_BAD_PARM);
 	g_return_val_if_fail(user->conn != NULL, NMERR_BAD_PARM);
@@ -324,271 +318,414 @@ nm_send_request(NMUser *user, char *cmd, NMField *fields, nm_response_cb cb,
 
 	conn = user->conn;
 
-	/* Write the post */
-	bytes_to_send = g_snprintf(buffer, sizeof(buffer),
-							   "POST /%s HTTP/1.0\r\n", cmd);
-	ret = g_output_stream_write(conn->output, buffer, bytes_to_send,
-	                            user->cancellable, NULL);
-	if (ret < 0) {
-		rc = NMERR_TCP_WRITE;
+	if (conn->output == NULL) {
+		return NMERR_TCP_WRITE;
 	}
 
-	/* Write headers */
-	if (rc == NM_OK) {
-		if (purple_strequal("login", cmd)) {
-			bytes_to_send = g_snprintf(buffer, sizeof(buffer),
-									   "Host: %s:%d\r\n\r\n", conn->addr, conn->port);
-			ret = g_output_stream_write(conn->output, buffer, bytes_to_send,
-			                            user->cancellable, NULL);
-			if (ret < 0) {
-				rc = NMERR_TCP_WRITE;
-			}
-		} else {
-			bytes_to_send = g_snprintf(buffer, sizeof(buffer), "\r\n");
-			ret = g_output_stream_write(conn->output, buffer, bytes_to_send,
-			                            user->cancellable, NULL);
-			if (ret < 0) {
-				rc = NMERR_TCP_WRITE;
-			}
-		}
+	/* Send the request to the server.  It is queued behind anything not
+	 * yet written, and write errors are reported on the connection. */
+	bytes = nm_encode_request(conn, cmd, fields);
+	purple_queued_output_stream_push_bytes_async(conn->output, bytes,
+	                                             G_PRIORITY_DEFAULT,
+	                                             user->cancellable,
+	                                             nm_send_request_cb, user);
+	g_bytes_unref(bytes);
+
+	/* Create a request struct, add it to our queue, and return it */
+	new_request = nm_create_request(cmd, conn->trans_id, cb, NULL, data);
+	nm_conn_add_request_item(conn, new_request);
+
+	/* Set the out param if it was sent in, otherwise release the request */
+	if (request)
+		*request = new_request;
+	else
+		nm_release_request(new_request);
+
+	return NM_OK;
+}
+
+/* Field lists nest, but nothing the server sends comes close to this. */
+#define NM_DECODER_MAX_DEPTH	16
+
+/* Bigger arrays start out this size and grow as their fields arrive. */
+#define NM_DECODER_MAX_PREALLOC	256
+
+typedef enum
+{
+	NM_DECODE_TYPE = 0,
+	NM_DECODE_METHOD,
+	NM_DECODE_TAG_LEN,
+	NM_DECODE_TAG,
+	NM_DECODE_COUNT,
+	NM_DECODE_STR_LEN,
+	NM_DECODE_STR,
+	NM_DECODE_VALUE
+} NMDecodeState;
+
+/* A field array that is still being filled in. */
+typedef struct
+{
+	NMField *fields;
+	guint32 count;		/* Fields added so far */
+	guint32 size;		/* Room for fields, not counting the terminator */
+	gint64 remaining;	/* Fields still to come, or -1 if not known */
+} NMDecodeFrame;
+
+struct _NMFieldDecoder
+{
+	NMDecodeState state;
+	gboolean done;
+
+	/* The field being read */
+	guint8 type;
+	guint8 method;
+	char tag[65];
+	guint32 tag_len;
+	char *str;
+	guint32 str_len;
+
+	/* How much of the tag, string or number has been read */
+	guint32 got;
+	guchar num[4];
+	guint num_len;
+
+	/* frames[0] is the top level list */
+	NMDecodeFrame frames[NM_DECODER_MAX_DEPTH];
+	guint depth;
+};
+
+static void
+decoder_reset(NMFieldDecoder *decoder)
+{
+	memset(decoder, 0, sizeof(NMFieldDecoder));
+	decoder->depth = 1;
+	decoder->frames[0].remaining = -1;
+}
+
+static gboolean
+decoder_read_uint32(NMFieldDecoder *decoder, const guchar **data,
+                    const guchar *end, guint32 *val)
+{
+	while (decoder->num_len < 4 && *data < end) {
+		decoder->num[decoder->num_len++] = *(*data)++;
 	}
 
-	/* Add the transaction id to the request fields */
-	if (rc == NM_OK) {
-		if (fields)
-			request_fields = nm_copy_field_array(fields);
-
-		str = g_strdup_printf("%d", ++(conn->trans_id));
-		request_fields = nm_field_add_pointer(request_fields, NM_A_SZ_TRANSACTION_ID, 0,
-											  NMFIELD_METHOD_VALID, 0,
-											  str, NMFIELD_TYPE_UTF8);
+	if (decoder->num_len < 4) {
+		return FALSE;
 	}
 
-	/* Send the request to the server */
-	if (rc == NM_OK) {
-		rc = nm_write_fields(user, request_fields);
+	*val = decoder->num[0] | (decoder->num[1] << 8) |
+	       (decoder->num[2] << 16) | ((guint32)decoder->num[3] << 24);
+	decoder->num_len = 0;
+
+	return TRUE;
+}
+
+static gboolean
+decoder_read_bytes(NMFieldDecoder *decoder, char *buf, guint32 len,
+                   const guchar **data, const guchar *end)
+{
+	gsize n = MIN(len - decoder->got, (gsize)(end - *data));
+
+	memcpy(buf + decoder->got, *data, n);
+	*data += n;
+	decoder->got += n;
+
+	if (decoder->got < len) {
+		return FALSE;
 	}
 
-	/* Write the CRLF to terminate the data */
-	if (rc == NM_OK) {
-		ret = g_output_stream_write(conn->output, "\r\n", strlen("\r\n"),
-		                            user->cancellable, NULL);
-		if (ret < 0) {
-			rc = NMERR_TCP_WRITE;
+	decoder->got = 0;
+
+	return TRUE;
+}
+
+/* Claim the next slot in the innermost array for the field just read. */
+static NMField *
+decoder_add_field(NMFieldDecoder *decoder)
+{
+	NMDecodeFrame *frame = &decoder->frames[decoder->depth - 1];
+	NMField *field;
+
+	if (frame->count == frame->size) {
+		guint32 size = frame->size ? frame->size * 2 : 16;
+
+		frame->fields = g_renew(NMField, frame->fields, size + 1);
+		memset(&frame->fields[frame->count], 0,
+		       (size + 1 - frame->count) * sizeof(NMField));
+		frame->size = size;
+		frame->fields->len = size + 1;
+
+		/* The parent still points at the old array */
+		if (decoder->depth > 1) {
+			NMDecodeFrame *parent = &decoder->frames[decoder->depth - 2];
+
+			parent->fields[parent->count - 1].ptr_value = frame->fields;
 		}
 	}
 
-	/* Create a request struct, add it to our queue, and return it */
-	if (rc == NM_OK) {
-		NMRequest *new_request =
-		        nm_create_request(cmd, conn->trans_id, cb, NULL, data);
-		nm_conn_add_request_item(conn, new_request);
-
-		/* Set the out param if it was sent in, otherwise release the request */
-		if (request)
-			*request = new_request;
-		else
-			nm_release_request(new_request);
+	field = &frame->fields[frame->count++];
+	field->tag = g_strndup(decoder->tag, decoder->tag_len);
+	field->method = decoder->method;
+	field->type = decoder->type;
+
+	return field;
+}
+
+static void
+decoder_pop(NMFieldDecoder *decoder)
+{
+	NMDecodeFrame *frame = &decoder->frames[--decoder->depth];
+	NMDecodeFrame *parent = &decoder->frames[decoder->depth - 1];
+
+	/* An array with nothing in it is left as NULL, as it always was */
+	if (frame->count == 0) {
+		g_free(frame->fields);
+		parent->fields[parent->count - 1].ptr_value = NULL;
 	}
 
-	if (request_fields != NULL)
-		nm_free_fields(&request_fields);
+	memset(frame, 0, sizeof(NMDecodeFrame));
+}
+
+/* Close every array that has all of its fields. */
+static void
+decoder_unwind(NMFieldDecoder *decoder)
+{
+	while (decoder->depth > 1 &&
+	       decoder->frames[decoder->depth - 1].remaining == 0) {
+		decoder_pop(decoder);
+	}
 
-	return rc;
+	decoder->state = NM_DECODE_TYPE;
 }
 
-NMERR_T
-nm_read_header(NMUser *user)
+static void
+decoder_end_field(NMFieldDecoder *decoder)
 {
-	NMConn *conn;
-	NMERR_T rc = NM_OK;
-	gchar *buffer;
-	char *ptr = NULL;
-	int i;
-	char rtn_buf[8];
-	int rtn_code = 0;
-	GError *error = NULL;
+	NMDecodeFrame *frame = &decoder->frames[decoder->depth - 1];
 
-	g_return_val_if_fail(user != NULL, NMERR_BAD_PARM);
-	g_return_val_if_fail(user->conn != NULL, NMERR_BAD_PARM);
+	if (frame->remaining > 0) {
+		frame->remaining--;
+	}
 
-	conn = user->conn;
+	decoder_unwind(decoder);
+}
 
-	buffer = g_data_input_stream_read_line(conn->input, NULL, user->cancellable,
-	                                       &error);
-	if (error == NULL) {
-		/* Find the return code */
-		ptr = strchr(buffer, ' ');
-		if (ptr != NULL) {
-			ptr++;
-
-			i = 0;
-			while (isdigit(*ptr) && (i < 3)) {
-				rtn_buf[i] = *ptr;
-				i++;
-				ptr++;
-			}
-			rtn_buf[i] = '\0';
+static gboolean
+decoder_begin_array(NMFieldDecoder *decoder, guint32 count)
+{
+	NMDecodeFrame *frame;
+	NMField *field;
+	guint32 size;
 
-			if (i > 0)
-				rtn_code = atoi(rtn_buf);
-		}
+	field = decoder_add_field(decoder);
+	if (count == 0) {
+		decoder_end_field(decoder);
+		return TRUE;
 	}
 
-	/* Finish reading header, in the future we might want to do more processing here */
-	/* TODO: handle more general redirects in the future */
-	while ((error == NULL) && !purple_strequal(buffer, "\r")) {
-		g_free(buffer);
-		buffer = g_data_input_stream_read_line(conn->input, NULL,
-		                                       user->cancellable, &error);
+	if (decoder->depth == NM_DECODER_MAX_DEPTH) {
+		return FALSE;
 	}
-	g_free(buffer);
 
-	if (error != NULL) {
-		if (error->code != G_IO_ERROR_WOULD_BLOCK &&
-		    error->code != G_IO_ERROR_CANCELLED) {
-			rc = NMERR_TCP_READ;
-		}
-		g_error_free(error);
+	frame = &decoder->frames[decoder->depth - 1];
+	if (frame->remaining > 0) {
+		frame->remaining--;
 	}
 
-	if (rc == NM_OK && rtn_code == 301)
-		rc = NMERR_SERVER_REDIRECT;
+	/* The count is on the wire, so the whole array can be allocated up
+	 * front instead of being grown a field at a time. */
+	size = MIN(count, NM_DECODER_MAX_PREALLOC);
+
+	frame = &decoder->frames[decoder->depth++];
+	frame->fields = g_new0(NMField, size + 1);
+	frame->fields->len = size + 1;
+	frame->size = size;
+	frame->count = 0;
+	frame->remaining = count;
+
+	field->ptr_value = frame->fields;
+	decoder->state = NM_DECODE_TYPE;
 
-	return rc;
+	return TRUE;
 }
 
-NMERR_T
-nm_read_fields(NMUser *user, int count, NMField **fields)
+NMFieldDecoder *
+nm_field_decoder_new(void)
 {
-	NMConn *conn;
-	NMERR_T rc = NM_OK;
-	guint8 type;
-	guint8 method;
-	guint32 val;
-	char tag[64];
-	NMField *sub_fields = NULL;
-	char *str = NULL;
-	GError *error = NULL;
+	NMFieldDecoder *decoder = g_new(NMFieldDecoder, 1);
 
-	g_return_val_if_fail(user != NULL, NMERR_BAD_PARM);
-	g_return_val_if_fail(user->conn != NULL, NMERR_BAD_PARM);
-	g_return_val_if_fail(fields != NULL, NMERR_BAD_PARM);
+	decoder_reset(decoder);
 
-	conn = user->conn;
+	return decoder;
+}
 
-	do {
-		if (count > 0) {
-			count--;
-		}
+void
+nm_field_decoder_free(NMFieldDecoder *decoder)
+{
+	NMField *fields;
 
-		/* Read the field type, method, and tag */
-		type = g_data_input_stream_read_byte(conn->input, user->cancellable,
-		                                     &error);
-		if (error != NULL || type == 0) {
-			break;
-		}
+	if (decoder == NULL) {
+		return;
+	}
 
-		method = g_data_input_stream_read_byte(conn->input, user->cancellable,
-		                                       &error);
-		if (error != NULL) {
-			break;
-		}
+	fields = nm_field_decoder_finish(decoder);
+	nm_free_fields(&fields);
+	g_free(decoder);
+}
 
-		val = g_data_input_stream_read_uint32(conn->input, user->cancellable,
-		                                      &error);
-		if (error != NULL) {
-			break;
-		}
+gboolean
+nm_field_decoder_push(NMFieldDecoder *decoder, const guchar *data, gsize len,
+                      gsize *consumed, NMERR_T *rc)
+{
+	const guchar *p = data;
+	const guchar *end = data + len;
+	NMField *field;
+	guint32 val;
 
-		if (val > sizeof(tag)) {
-			rc = NMERR_PROTOCOL;
-			break;
-		}
+	g_return_val_if_fail(decoder != NULL, FALSE);
+	g_return_val_if_fail(consumed != NULL, FALSE);
+	g_return_val_if_fail(rc != NULL, FALSE);
 
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), tag, val, NULL,
-		                        user->cancellable, &error);
-		if (error != NULL) {
-			break;
-		}
+	*rc = NM_OK;
 
-		if (type == NMFIELD_TYPE_MV || type == NMFIELD_TYPE_ARRAY) {
+	while (!decoder->done) {
+		switch (decoder->state) {
+			case NM_DECODE_TYPE:
+				if (p == end) {
+					goto out;
+				}
 
-			/* Read the subarray (first read the number of items in the array) */
-			val = g_data_input_stream_read_uint32(conn->input,
-			                                      user->cancellable, &error);
-			if (error != NULL) {
+				decoder->type = *p++;
+				if (decoder->type != 0) {
+					decoder->state = NM_DECODE_METHOD;
+				} else if (decoder->depth == 1) {
+					decoder->done = TRUE;
+				} else {
+					/* A nested array can be cut short */
+					decoder_pop(decoder);
+					decoder_unwind(decoder);
+				}
 				break;
-			}
 
-			if (val > 0) {
-				rc = nm_read_fields(user, val, &sub_fields);
-				if (rc != NM_OK)
-					break;
-			}
+			case NM_DECODE_METHOD:
+				if (p == end) {
+					goto out;
+				}
 
-			*fields = nm_field_add_pointer(*fields, tag, 0, method,
-									   0, sub_fields, type);
+				decoder->method = *p++;
+				decoder->state = NM_DECODE_TAG_LEN;
+				break;
 
-			sub_fields = NULL;
+			case NM_DECODE_TAG_LEN:
+				if (!decoder_read_uint32(decoder, &p, end, &val)) {
+					goto out;
+				}
 
-		} else if (type == NMFIELD_TYPE_UTF8 || type == NMFIELD_TYPE_DN) {
+				if (val >= sizeof(decoder->tag)) {
+					*rc = NMERR_PROTOCOL;
+					goto out;
+				}
 
-			/* Read the string (first read the length) */
-			val = g_data_input_stream_read_uint32(conn->input,
-			                                      user->cancellable, &error);
-			if (error != NULL) {
+				decoder->tag_len = val;
+				decoder->state = NM_DECODE_TAG;
 				break;
-			}
 
-			if (val >= NMFIELD_MAX_STR_LENGTH) {
-				rc = NMERR_PROTOCOL;
+			case NM_DECODE_TAG:
+				if (!decoder_read_bytes(decoder, decoder->tag, decoder->tag_len,
+				                        &p, end)) {
+					goto out;
+				}
+
+				if (decoder->type == NMFIELD_TYPE_MV ||
+				    decoder->type == NMFIELD_TYPE_ARRAY) {
+					decoder->state = NM_DECODE_COUNT;
+				} else if (decoder->type == NMFIELD_TYPE_UTF8 ||
+				           decoder->type == NMFIELD_TYPE_DN) {
+					decoder->state = NM_DECODE_STR_LEN;
+				} else {
+					decoder->state = NM_DECODE_VALUE;
+				}
 				break;
-			}
 
-			if (val > 0) {
-				str = g_new0(char, val + 1);
+			case NM_DECODE_COUNT:
+				if (!decoder_read_uint32(decoder, &p, end, &val)) {
+					goto out;
+				}
 
-				g_input_stream_read_all(G_INPUT_STREAM(conn->input), str, val,
-				                        NULL, user->cancellable, &error);
-				if (error != NULL) {
-					break;
+				if (!decoder_begin_array(decoder, val)) {
+					*rc = NMERR_PROTOCOL;
+					goto out;
 				}
+				break;
 
-				*fields = nm_field_add_pointer(*fields, tag, 0, method,
-											   0, str, type);
-				str = NULL;
-			}
+			case NM_DECODE_STR_LEN:
+				if (!decoder_read_uint32(decoder, &p, end, &val)) {
+					goto out;
+				}
 
-		} else {
+				if (val >= NMFIELD_MAX_STR_LENGTH) {
+					*rc = NMERR_PROTOCOL;
+					goto out;
+				}
 
-			/* Read the numerical value */
-			val = g_data_input_stream_read_uint32(conn->input,
-			                                      user->cancellable, &error);
-			if (error != NULL) {
+				if (val == 0) {
+					/* Empty strings are dropped */
+					decoder_end_field(decoder);
+				} else {
+					decoder->str = g_new(char, val + 1);
+					decoder->str[val] = '\0';
+					decoder->str_len = val;
+					decoder->state = NM_DECODE_STR;
+				}
 				break;
-			}
 
-			*fields = nm_field_add_number(*fields, tag, 0, method,
-										  0, val, type);
-		}
+			case NM_DECODE_STR:
+				if (!decoder_read_bytes(decoder, decoder->str, decoder->str_len,
+				                        &p, end)) {
+					goto out;
+				}
 
-	} while (count != 0);
+				field = decoder_add_field(decoder);
+				field->ptr_value = decoder->str;
+				decoder->str = NULL;
+				decoder_end_field(decoder);
+				break;
 
-	g_free(str);
+			case NM_DECODE_VALUE:
+				if (!decoder_read_uint32(decoder, &p, end, &val)) {
+					goto out;
+				}
 
-	if (sub_fields != NULL) {
-		nm_free_fields(&sub_fields);
+				field = decoder_add_field(decoder);
+				field->value = val;
+				decoder_end_field(decoder);
+				break;
+		}
 	}
 
-	if (error != NULL) {
-		if (error->code != G_IO_ERROR_WOULD_BLOCK && error->code != G_IO_ERROR_CANCELLED) {
-			rc = NMERR_TCP_READ;
-		}
-		g_error_free(error);
+out:
+	*consumed = p - data;
+
+	return decoder->done;
+}
+
+NMField *
+nm_field_decoder_finish(NMFieldDecoder *decoder)
+{
+	NMField *fields;
+
+	g_return_val_if_fail(decoder != NULL, NULL);
+
+	fields = decoder->frames[0].fields;
+	if (!decoder->done || decoder->frames[0].count == 0) {
+		nm_free_fields(&fields);
 	}
 
-	return rc;
+	g_free(decoder->str);
+	decoder_reset(decoder);
+
+	return fields;
 }
 
 void
@@ -24,6 +24,7 @@
 #include <gio/gio.h>
 
 typedef struct _NMConn NMConn;
+typedef struct _NMFieldDecoder NMFieldDecoder;
 
 #include "nmfield.h"
 #include "nmuser.h"
@@ -31,6 +32,15 @@ typedef struct _NMConn NMConn;
 typedef int (*nm_ssl_read_cb) (gpointer ssl_data, void *buff, int len);
 typedef int (*nm_ssl_write_cb) (gpointer ssl_data, const void *buff, int len);
 
+/* What the start of the receive buffer holds. */
+typedef enum
+{
+	NM_READ_START = 0,		/* "HTTP" or an event type */
+	NM_READ_HEADER,			/* response header lines */
+	NM_READ_FIELDS,			/* response field list */
+	NM_READ_EVENT			/* event body */
+} NMReadState;
+
 struct _NMConn
 {
 
@@ -49,8 +59,18 @@ struct _NMConn
 	/* Connections to server. */
 	GSocketClient *client;
 	GIOStream *stream;
-	GDataInputStream *input;
-	GOutputStream *output;
+	GInputStream *input;
+	PurpleQueuedOutputStream *output;
+	guint inpa;
+
+	/* Received data that has not been parsed yet, and what it is. */
+	GByteArray *rx;
+	NMReadState rx_state;
+	guint32 rx_event;
+	int rx_code;
+
+	/* Decodes the field list of the response being received. */
+	NMFieldDecoder *decoder;
 };
 
 /**
@@ -89,36 +109,70 @@ nm_send_request(NMUser *user, char *cmd, NMField *fields, nm_response_cb cb,
                 gpointer data, NMRequest **request);
 
 /**
- * Write out the given field list.
+ * Append the "post" encoding of a field list, including any nested
+ * arrays, to a string.
  *
- * @param user		The logged-in user.
- * @param fields	The field list to write.
+ * @param str		The string to append to.
+ * @param fields	The field list to encode.
+ */
+void nm_encode_fields(GString *str, NMField *fields);
+
+/**
+ * Encode a complete request, headers and all, as it goes on the wire.
+ * The next transaction id is taken from the connection and added to the
+ * fields.
  *
- * @return			NM_OK on success.
+ * @param conn		The connection.
+ * @param cmd		The request.
+ * @param fields	The field list for the request, may be NULL.
+ *
+ * @return			The encoded request.
  */
-NMERR_T nm_write_fields(NMUser *user, NMField *fields);
+GBytes *nm_encode_request(NMConn *conn, const char *cmd, NMField *fields);
 
 /**
- * Read the headers for a response.
+ * Allocate a decoder for the binary field lists the server sends.
  *
- * @param user		The logged-in user.
+ * @return			The decoder, should be freed by calling
+ *					nm_field_decoder_free()
+ */
+NMFieldDecoder *nm_field_decoder_new(void);
+
+/**
+ * Release a decoder and any partly decoded field list.
  *
- * @return			NM_OK on success.
+ * @param decoder	The decoder.
  */
-NMERR_T nm_read_header(NMUser *user);
+void nm_field_decoder_free(NMFieldDecoder *decoder);
 
 /**
- * Read a field list from the connection.
+ * Feed received bytes to the decoder. The bytes do not need to line up
+ * with anything; whatever is left of a field is picked up by the next call.
+ * Nothing past the end of the field list is consumed.
+ *
+ * @param decoder	The decoder.
+ * @param data		The received bytes.
+ * @param len		The number of bytes in data.
+ * @param consumed	The number of bytes used. This is an out param.
+ * @param rc		NMERR_PROTOCOL if the data is malformed. This is an out
+ *					param.
+ *
+ * @return			TRUE once a whole field list has been decoded, it can
+ *					then be taken with nm_field_decoder_finish().
+ */
+gboolean nm_field_decoder_push(NMFieldDecoder *decoder, const guchar *data,
+                               gsize len, gsize *consumed, NMERR_T *rc);
+
+/**
+ * Take the decoded field list and make the decoder ready for the next one.
+ * If the list was not complete it is thrown away.
  *
- * @param user		The logged-in user.
- * @param count		The maximum number of fields to read (or -1 for no max).
- * @param fields	The field list. This is an out param. It
- *					should be freed by calling nm_free_fields
- *					when finished.
+ * @param decoder	The decoder.
  *
- * @return			NM_OK on success.
+ * @return			The field list, which should be freed by calling
+ *					nm_free_fields, or NULL if it was incomplete or empty.
  */
-NMERR_T nm_read_fields(NMUser *user, int count, NMField **fields);
+NMField *nm_field_decoder_finish(NMFieldDecoder *decoder);
 
 /**
  * Add a request to the connections request list.
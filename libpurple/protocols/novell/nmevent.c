@@ -29,6 +29,9 @@
 
 #define MAX_UINT32 0xFFFFFFFF
 
+/* Nothing in an event is allowed to be longer than this. */
+#define MAX_EVENT_STRING 1000000
+
 struct _NMEvent
 {
 
@@ -134,11 +137,11 @@ _got_user_for_conference(NMUser * user, NMERR_T ret_val,
  * get details for the event source if we don't have them yet.
  */
 static NMERR_T
-handle_receive_message(NMUser * user, NMEvent * event, gboolean autoreply)
+handle_receive_message(NMUser * user, NMEvent * event,
+                       GDataInputStream *input, gboolean autoreply)
 {
 	NMConference *conference;
 	NMUserRecord *user_record;
-	NMConn *conn;
 	NMERR_T rc = NM_OK;
 	guint32 size = 0, flags = 0;
 	char *msg = NULL;
@@ -146,10 +149,8 @@ handle_receive_message(NMUser * user, NMEvent * event, gboolean autoreply)
 	char *guid = NULL;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -158,19 +159,19 @@ handle_receive_message(NMUser * user, NMEvent * event, gboolean autoreply)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size, NULL,
+		g_input_stream_read_all(G_INPUT_STREAM(input), guid, size, NULL,
 		                        user->cancellable, &error);
 	}
 
 	/* Read the conference flags */
 	if (error == NULL) {
-		flags = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+		flags = g_data_input_stream_read_uint32(input, user->cancellable,
 		                                        &error);
 	}
 
 	/* Read the message text */
 	if (error == NULL) {
-		size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+		size = g_data_input_stream_read_uint32(input, user->cancellable,
 		                                       &error);
 		if (size > 100000) {
 			g_clear_error(&error);
@@ -179,7 +180,7 @@ handle_receive_message(NMUser * user, NMEvent * event, gboolean autoreply)
 
 		if (error == NULL) {
 			msg = g_new0(char, size + 1);
-			g_input_stream_read_all(G_INPUT_STREAM(conn->input), msg, size,
+			g_input_stream_read_all(G_INPUT_STREAM(input), msg, size,
 			                        NULL, user->cancellable, &error);
 
 			purple_debug_info("novell", "Message is %s", msg);
@@ -273,20 +274,18 @@ handle_receive_message(NMUser * user, NMEvent * event, gboolean autoreply)
  * get details for the event source if we don't have them yet.
  */
 static NMERR_T
-handle_conference_invite(NMUser * user, NMEvent * event)
+handle_conference_invite(NMUser * user, NMEvent * event,
+                         GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0;
 	char *guid = NULL;
 	char *msg = NULL;
-	NMConn *conn;
 	NMUserRecord *user_record;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -295,13 +294,13 @@ handle_conference_invite(NMUser * user, NMEvent * event)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size, NULL,
+		g_input_stream_read_all(G_INPUT_STREAM(input), guid, size, NULL,
 		                        user->cancellable, &error);
 	}
 
 	/* Read the the message */
 	if (error == NULL) {
-		size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+		size = g_data_input_stream_read_uint32(input, user->cancellable,
 		                                       &error);
 		if (size > 100000) {
 			g_clear_error(&error);
@@ -310,7 +309,7 @@ handle_conference_invite(NMUser * user, NMEvent * event)
 
 		if (error == NULL) {
 			msg = g_new0(char, size + 1);
-			g_input_stream_read_all(G_INPUT_STREAM(conn->input), msg, size,
+			g_input_stream_read_all(G_INPUT_STREAM(input), msg, size,
 			                        NULL, user->cancellable, &error);
 		}
 	}
@@ -365,20 +364,18 @@ handle_conference_invite(NMUser * user, NMEvent * event)
  * get details for the event source if we don't have them yet.
  */
 static NMERR_T
-handle_conference_invite_notify(NMUser * user, NMEvent * event)
+handle_conference_invite_notify(NMUser * user, NMEvent * event,
+                                GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0;
 	char *guid = NULL;
-	NMConn *conn;
 	NMConference *conference;
 	NMUserRecord *user_record;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -387,7 +384,7 @@ handle_conference_invite_notify(NMUser * user, NMEvent * event)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size, NULL,
+		g_input_stream_read_all(G_INPUT_STREAM(input), guid, size, NULL,
 		                        user->cancellable, &error);
 	}
 
@@ -433,19 +430,17 @@ handle_conference_invite_notify(NMUser * user, NMEvent * event)
 
 /* Read the conference reject event and set up the event object */
 static NMERR_T
-handle_conference_reject(NMUser * user, NMEvent * event)
+handle_conference_reject(NMUser * user, NMEvent * event,
+                         GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0;
 	char *guid = NULL;
-	NMConn *conn;
 	NMConference *conference;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -454,7 +449,7 @@ handle_conference_reject(NMUser * user, NMEvent * event)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size, NULL,
+		g_input_stream_read_all(G_INPUT_STREAM(input), guid, size, NULL,
 		                        user->cancellable, &error);
 	}
 
@@ -482,19 +477,16 @@ handle_conference_reject(NMUser * user, NMEvent * event)
  * participants
  */
 static NMERR_T
-handle_conference_left(NMUser * user, NMEvent * event)
+handle_conference_left(NMUser * user, NMEvent * event, GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0, flags = 0;
 	char *guid = NULL;
 	NMConference *conference;
-	NMConn *conn;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -503,13 +495,13 @@ handle_conference_left(NMUser * user, NMEvent * event)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size, NULL,
+		g_input_stream_read_all(G_INPUT_STREAM(input), guid, size, NULL,
 		                        user->cancellable, &error);
 	}
 
 	/* Read the conference flags */
 	if (error == NULL) {
-		flags = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+		flags = g_data_input_stream_read_uint32(input, user->cancellable,
 		                                        &error);
 	}
 
@@ -543,19 +535,17 @@ handle_conference_left(NMUser * user, NMEvent * event)
  * remove the conference from the list
  */
 static NMERR_T
-handle_conference_closed(NMUser * user, NMEvent * event)
+handle_conference_closed(NMUser * user, NMEvent * event,
+                         GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0;
 	char *guid = NULL;
 	NMConference *conference;
-	NMConn *conn;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -564,7 +554,7 @@ handle_conference_closed(NMUser * user, NMEvent * event)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size, NULL,
+		g_input_stream_read_all(G_INPUT_STREAM(input), guid, size, NULL,
 		                        user->cancellable, &error);
 	}
 
@@ -592,20 +582,18 @@ handle_conference_closed(NMUser * user, NMEvent * event)
  * get details for the event source if we don't have them yet.
  */
 static NMERR_T
-handle_conference_joined(NMUser * user, NMEvent * event)
+handle_conference_joined(NMUser * user, NMEvent * event,
+                         GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0, flags = 0;
 	char *guid = NULL;
-	NMConn *conn;
 	NMConference *conference;
 	NMUserRecord *user_record;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -614,13 +602,13 @@ handle_conference_joined(NMUser * user, NMEvent * event)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size, NULL,
+		g_input_stream_read_all(G_INPUT_STREAM(input), guid, size, NULL,
 		                        user->cancellable, &error);
 	}
 
 	/* Read the conference flags */
 	if (error == NULL) {
-		flags = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+		flags = g_data_input_stream_read_uint32(input, user->cancellable,
 		                                        &error);
 	}
 
@@ -663,19 +651,16 @@ handle_conference_joined(NMUser * user, NMEvent * event)
 
 /* Read the typing event and set up the event object */
 static NMERR_T
-handle_typing(NMUser * user, NMEvent * event)
+handle_typing(NMUser * user, NMEvent * event, GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0;
 	char *guid = NULL;
 	NMConference *conference;
-	NMConn *conn;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -684,7 +669,7 @@ handle_typing(NMUser * user, NMEvent * event)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size, NULL,
+		g_input_stream_read_all(G_INPUT_STREAM(input), guid, size, NULL,
 		                        user->cancellable, &error);
 	}
 
@@ -711,25 +696,22 @@ handle_typing(NMUser * user, NMEvent * event)
  * the status in the user record (for the event source)
  */
 static NMERR_T
-handle_status_change(NMUser * user, NMEvent * event)
+handle_status_change(NMUser * user, NMEvent * event, GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint16 status;
 	guint32 size;
 	char *text = NULL;
 	NMUserRecord *user_record;
-	NMConn *conn;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read new status */
-	status = g_data_input_stream_read_uint16(conn->input, user->cancellable,
+	status = g_data_input_stream_read_uint16(input, user->cancellable,
 	                                         &error);
 	if (error == NULL) {
 
 		/* Read the status text */
-		size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+		size = g_data_input_stream_read_uint32(input, user->cancellable,
 		                                       &error);
 		if (size > 10000) {
 			g_clear_error(&error);
@@ -738,7 +720,7 @@ handle_status_change(NMUser * user, NMEvent * event)
 
 		if (error == NULL) {
 			text = g_new0(char, size + 1);
-			g_input_stream_read_all(G_INPUT_STREAM(conn->input), text, size,
+			g_input_stream_read_all(G_INPUT_STREAM(input), text, size,
 			                        NULL, user->cancellable, &error);
 		}
 	}
@@ -766,18 +748,16 @@ handle_status_change(NMUser * user, NMEvent * event)
 
 /* Read the undeliverable event */
 static NMERR_T
-handle_undeliverable_status(NMUser * user, NMEvent * event)
+handle_undeliverable_status(NMUser * user, NMEvent * event,
+                            GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0;
 	char *guid = NULL;
-	NMConn *conn;
 	GError *error = NULL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the conference guid */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (size > 1000) {
 		g_clear_error(&error);
@@ -786,7 +766,7 @@ handle_undeliverable_status(NMUser * user, NMEvent * event)
 
 	if (error == NULL) {
 		guid = g_new0(char, size + 1);
-		rc = g_input_stream_read_all(G_INPUT_STREAM(conn->input), guid, size,
+		rc = g_input_stream_read_all(G_INPUT_STREAM(input), guid, size,
 		                             NULL, user->cancellable, &error);
 	} else {
 		if (error->code != G_IO_ERROR_CANCELLED) {
@@ -927,15 +907,91 @@ nm_event_get_gmt(NMEvent * event)
 		return (time_t)-1;
 }
 
+/*
+ * The layout of each event body: 's' is a string with a 32 bit length in
+ * front, 'd' is a 32 bit number and 'w' a 16 bit one. This has to match
+ * what the handlers above read.
+ */
+static const char *
+event_layout(int type)
+{
+	switch (type) {
+		case NMEVT_STATUS_CHANGE:
+			return "sws";
+
+		case NMEVT_RECEIVE_MESSAGE:
+		case NMEVT_RECEIVE_AUTOREPLY:
+			return "ssds";
+
+		case NMEVT_CONFERENCE_INVITE:
+			return "sss";
+
+		case NMEVT_CONFERENCE_LEFT:
+		case NMEVT_CONFERENCE_JOINED:
+			return "ssd";
+
+		case NMEVT_USER_TYPING:
+		case NMEVT_USER_NOT_TYPING:
+		case NMEVT_CONFERENCE_CLOSED:
+		case NMEVT_CONFERENCE_REJECT:
+		case NMEVT_CONFERENCE_INVITE_NOTIFY:
+		case NMEVT_UNDELIVERABLE_STATUS:
+			return "ss";
+
+		default:
+			/* Just the source */
+			return "s";
+	}
+}
+
+gssize
+nm_event_get_length(int type, const guchar *data, gsize len)
+{
+	const char *layout;
+	gsize pos = 0;
+	guint32 size;
+
+	if (type < NMEVT_START || type > NMEVT_STOP)
+		return -1;
+
+	for (layout = event_layout(type); *layout; layout++) {
+		switch (*layout) {
+			case 'w':
+				pos += 2;
+				break;
+
+			case 'd':
+				pos += 4;
+				break;
+
+			case 's':
+				if (pos + 4 > len)
+					return 0;
+
+				size = data[pos] | (data[pos + 1] << 8) |
+				       (data[pos + 2] << 16) | ((guint32)data[pos + 3] << 24);
+				if (size > MAX_EVENT_STRING)
+					return -1;
+
+				pos += 4 + size;
+				break;
+		}
+
+		if (pos > len)
+			return 0;
+	}
+
+	return pos;
+}
+
 NMERR_T
-nm_process_event(NMUser * user, int type)
+nm_process_event(NMUser * user, int type, GDataInputStream *input)
 {
 	NMERR_T rc = NM_OK;
 	guint32 size = 0;
 	NMEvent *event = NULL;
 	char *source = NULL;
 	nm_event_cb cb;
-	NMConn *conn;
 	GError *error = NULL;
 
 	if (user == NULL)
@@ -944,10 +1000,8 @@ nm_process_event(NMUser * user, int type)
 	if (type < NMEVT_START || type > NMEVT_STOP)
 		return NMERR_PROTOCOL;
 
-	conn = nm_user_get_conn(user);
-
 	/* Read the event source */
-	size = g_data_input_stream_read_uint32(conn->input, user->cancellable,
+	size = g_data_input_stream_read_uint32(input, user->cancellable,
 	                                       &error);
 	if (error == NULL) {
 		if (size > 1000000) {
@@ -956,7 +1010,7 @@ nm_process_event(NMUser * user, int type)
 		} else {
 			source = g_new0(char, size);
 
-			rc = g_input_stream_read_all(G_INPUT_STREAM(conn->input), source,
+			rc = g_input_stream_read_all(G_INPUT_STREAM(input), source,
 			                             size, NULL, user->cancellable, &error);
 		}
 	}
@@ -969,48 +1023,48 @@ nm_process_event(NMUser * user, int type)
 
 			switch (type) {
 			case NMEVT_STATUS_CHANGE:
-				rc = handle_status_change(user, event);
+				rc = handle_status_change(user, event, input);
 				break;
 
 			case NMEVT_RECEIVE_MESSAGE:
-				rc = handle_receive_message(user, event, FALSE);
+				rc = handle_receive_message(user, event, input, FALSE);
 				break;
 
 			case NMEVT_RECEIVE_AUTOREPLY:
-				rc = handle_receive_message(user, event, TRUE);
+				rc = handle_receive_message(user, event, input, TRUE);
 				break;
 
 			case NMEVT_USER_TYPING:
 			case NMEVT_USER_NOT_TYPING:
-				rc = handle_typing(user, event);
+				rc = handle_typing(user, event, input);
 				break;
 
 			case NMEVT_CONFERENCE_LEFT:
-				rc = handle_conference_left(user, event);
+				rc = handle_conference_left(user, event, input);
 				break;
 
 			case NMEVT_CONFERENCE_CLOSED:
-				rc = handle_conference_closed(user, event);
+				rc = handle_conference_closed(user, event, input);
 				break;
 
 			case NMEVT_CONFERENCE_JOINED:
-				rc = handle_conference_joined(user, event);
+				rc = handle_conference_joined(user, event, input);
 				break;
 
 			case NMEVT_CONFERENCE_INVITE:
-				rc = handle_conference_invite(user, event);
+				rc = handle_conference_invite(user, event, input);
 				break;
 
 			case NMEVT_CONFERENCE_REJECT:
-				rc = handle_conference_reject(user, event);
+				rc = handle_conference_reject(user, event, input);
 				break;
 
 			case NMEVT_CONFERENCE_INVITE_NOTIFY:
-				rc = handle_conference_invite_notify(user, event);
+				rc = handle_conference_invite_notify(user, event, input);
 				break;
 
 			case NMEVT_UNDELIVERABLE_STATUS:
-				rc = handle_undeliverable_status(user, event);
+				rc = handle_undeliverable_status(user, event, input);
 				break;
 
 			case NMEVT_INVALID_RECIPIENT:
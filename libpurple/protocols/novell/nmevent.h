@@ -50,16 +50,29 @@ typedef struct _NMEvent NMEvent;
 #define NMEVT_START						NMEVT_INVALID_RECIPIENT
 #define NMEVT_STOP						NMEVT_RECEIVE_AUTOREPLY
 
+/**
+ * Work out how long an event body is from what has been received of it.
+ *
+ * @param type		The type of the event.
+ * @param data		The body received so far, after the type.
+ * @param len		The number of bytes in data.
+ *
+ * @return			The length of the whole body, 0 if more data is needed
+ *					to tell, or -1 if the event is malformed.
+ */
+gssize nm_event_get_length(int type, const guchar *data, gsize len);
+
 /**
  * Process the event. The event will be read, an NMEvent will
  * be created, and the event callback will be called.
  *
  * @param user		The main user structure.
  * @param type		The type of the event to read.
+ * @param input		The event body, as measured by nm_event_get_length().
  *
  * @return			NM_OK on success
  */
-NMERR_T nm_process_event(NMUser * user, int type);
+NMERR_T nm_process_event(NMUser * user, int type, GDataInputStream *input);
 
 /**
  * Creates an NMEvent
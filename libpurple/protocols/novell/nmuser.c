@@ -37,7 +37,16 @@
 						"\\uc1\\cf1\\f0\\fs24 %s\\par\n}"
 #define NM_MAX_MESSAGE_SIZE 2048
 
-static NMERR_T nm_process_response(NMUser * user);
+/* Responses start with "HTTP", anything else is an event type */
+#define NM_RESPONSE_MAGIC ('H' + ('T' << 8) + ('T' << 16) + ('P' << 24))
+
+/* How much to read from the server at a time */
+#define NM_READ_SIZE 8192
+
+/* No header line from the server comes anywhere near this */
+#define NM_MAX_HEADER_LINE 8192
+
+static NMERR_T nm_process_response(NMUser * user, int rtn_code, NMField *fields);
 static void _update_contact_list(NMUser * user, NMField * fields);
 static void _handle_multiple_get_details_login_cb(NMUser * user, NMERR_T ret_code,
 												  gpointer resp_data, gpointer user_data);
@@ -993,39 +1002,172 @@ nm_send_keepalive(NMUser *user, nm_response_cb callback, gpointer data)
 	return rc;
 }
 
+/* Read the return code off the status line, eg. "/1.0 200 OK". */
+static int
+nm_parse_status_line(const guchar *line, gsize len)
+{
+	const guchar *ptr;
+	int rtn_code = 0;
+	int i;
+
+	ptr = memchr(line, ' ', len);
+	if (ptr == NULL)
+		return 0;
+
+	ptr++;
+	for (i = 0; i < 3 && ptr < line + len && g_ascii_isdigit(*ptr); i++, ptr++)
+		rtn_code = rtn_code * 10 + (*ptr - '0');
+
+	return rtn_code;
+}
+
+/*
+ * Handle every complete response and event at the front of the receive
+ * buffer. Whatever is left over is kept for when more data arrives; only
+ * the field decoder carries state in between.
+ */
+static NMERR_T
+nm_parse_data(NMUser * user)
+{
+	NMConn *conn = user->conn;
+	GByteArray *rx = conn->rx;
+	NMERR_T rc = NM_OK;
+	NMERR_T err = NM_OK;
+	NMERR_T ret;
+	gboolean more = FALSE;
+	gsize pos = 0;
+
+	while (err == NM_OK && !more && pos < rx->len) {
+		const guchar *data = rx->data + pos;
+		gsize len = rx->len - pos;
+		const guchar *eol;
+		gssize event_len;
+		gsize used;
+		guint32 val;
+
+		switch (conn->rx_state) {
+			case NM_READ_START:
+				if (len < 4) {
+					more = TRUE;
+					break;
+				}
+
+				val = data[0] | (data[1] << 8) | (data[2] << 16) |
+				      ((guint32)data[3] << 24);
+				pos += 4;
+
+				if (val == NM_RESPONSE_MAGIC) {
+					conn->rx_state = NM_READ_HEADER;
+					conn->rx_code = -1;
+				} else {
+					conn->rx_state = NM_READ_EVENT;
+					conn->rx_event = val;
+				}
+				break;
+
+			case NM_READ_HEADER:
+				eol = memchr(data, '\n', len);
+				if (eol == NULL) {
+					if (len > NM_MAX_HEADER_LINE)
+						err = NMERR_PROTOCOL;
+					more = TRUE;
+					break;
+				}
+
+				/* Everything but the return code is skipped for now */
+				/* TODO: handle more general redirects in the future */
+				if (conn->rx_code < 0) {
+					conn->rx_code = nm_parse_status_line(data, eol - data);
+				} else if (eol == data || (eol == data + 1 && *data == '\r')) {
+					conn->rx_state = NM_READ_FIELDS;
+				}
+				pos += eol - data + 1;
+				break;
+
+			case NM_READ_FIELDS:
+				if (nm_field_decoder_push(conn->decoder, data, len, &used, &err)) {
+					conn->rx_state = NM_READ_START;
+					ret = nm_process_response(user, conn->rx_code,
+					                          nm_field_decoder_finish(conn->decoder));
+					if (rc == NM_OK)
+						rc = ret;
+				}
+				pos += used;
+				break;
+
+			case NM_READ_EVENT:
+				event_len = nm_event_get_length(conn->rx_event, data, len);
+				if (event_len < 0) {
+					err = NMERR_PROTOCOL;
+				} else if (event_len == 0) {
+					more = TRUE;
+				} else {
+					GInputStream *mem;
+					GDataInputStream *input;
+
+					/* The event is all here, so reading it can't block */
+					mem = g_memory_input_stream_new_from_data(data, event_len,
+					                                          NULL);
+					input = g_data_input_stream_new(mem);
+					g_data_input_stream_set_byte_order(input,
+					        G_DATA_STREAM_BYTE_ORDER_LITTLE_ENDIAN);
+
+					conn->rx_state = NM_READ_START;
+					ret = nm_process_event(user, conn->rx_event, input);
+					if (rc == NM_OK)
+						rc = ret;
+
+					g_object_unref(input);
+					g_object_unref(mem);
+					pos += event_len;
+				}
+				break;
+		}
+	}
+
+	g_byte_array_remove_range(rx, 0, pos);
+
+	return (err != NM_OK) ? err : rc;
+}
+
 NMERR_T
 nm_process_new_data(NMUser * user)
 {
 	NMConn *conn;
-	NMERR_T rc = NM_OK;
-	guint32 val;
+	GByteArray *rx;
+	gssize len;
+	gsize old_len;
 	GError *error = NULL;
 
 	if (user == NULL)
 		return NMERR_BAD_PARM;
 
 	conn = user->conn;
-
-	/* Check to see if this is an event or a response */
-	val = g_data_input_stream_read_uint32(conn->input, user->cancellable,
-	                                      &error);
-	if (error == NULL) {
-		if (val == ('H' + ('T' << 8) + ('T' << 16) + ('P' << 24))) {
-			rc = nm_process_response(user);
-		} else {
-			rc = nm_process_event(user, val);
-		}
-	} else {
-		if (error->code == G_IO_ERROR_WOULD_BLOCK || error->code == G_IO_ERROR_CANCELLED) {
+	rx = conn->rx;
+
+	/* Read straight into the end of the receive buffer */
+	old_len = rx->len;
+	g_byte_array_set_size(rx, old_len + NM_READ_SIZE);
+	len = g_pollable_input_stream_read_nonblocking(
+	        G_POLLABLE_INPUT_STREAM(conn->input), rx->data + old_len,
+	        NM_READ_SIZE, user->cancellable, &error);
+	g_byte_array_set_size(rx, old_len + MAX(len, 0));
+
+	if (len == 0) {
+		/* The server closed the connection */
+		return NMERR_TCP_READ;
+	} else if (len < 0) {
+		if (error->code == G_IO_ERROR_WOULD_BLOCK ||
+		    error->code == G_IO_ERROR_CANCELLED) {
 			/* Try again later or ignore. */
-			rc = NM_OK;
-		} else {
-			rc = NMERR_PROTOCOL;
+			g_error_free(error);
+			return NM_OK;
 		}
 		g_error_free(error);
+		return NMERR_TCP_READ;
 	}
 
-	return rc;
+	return nm_parse_data(user);
 }
 
 NMConference *
@@ -1756,18 +1898,15 @@ nm_call_handler(NMUser * user, NMRequest * request, NMField * fields)
 }
 
 static NMERR_T
-nm_process_response(NMUser * user)
+nm_process_response(NMUser * user, int rtn_code, NMField *fields)
 {
 	NMERR_T rc = NM_OK;
-	NMField *fields = NULL;
 	NMField *field = NULL;
 	NMConn *conn = user->conn;
 	NMRequest *req = NULL;
 
-	rc = nm_read_header(user);
-	if (rc == NM_OK) {
-		rc = nm_read_fields(user, -1, &fields);
-	}
+	if (rtn_code == 301)
+		rc = NMERR_SERVER_REDIRECT;
 
 	if (rc == NM_OK) {
 		field = nm_locate_field(NM_A_SZ_TRANSACTION_ID, fields);
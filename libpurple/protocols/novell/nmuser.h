@@ -566,7 +566,8 @@ NMERR_T
 nm_send_keepalive(NMUser *user, nm_response_cb callback, gpointer data);
 
 /**
- *	Reads a response/event from the server and processes it.
+ *	Reads whatever the server has sent without blocking, and processes
+ *	every response and event that is now complete.
  *
  *  @param	user	The logged in User
  */
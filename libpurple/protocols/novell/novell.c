@@ -1666,7 +1666,7 @@ _show_privacy_locked_error(PurpleConnection *gc, NMUser *user)
  * Connect and recv callbacks
  ******************************************************************************/
 
-static void
+static gboolean
 novell_ssl_recv_cb(GObject *stream, gpointer data)
 {
 	PurpleConnection *gc = data;
@@ -1674,24 +1674,28 @@ novell_ssl_recv_cb(GObject *stream, gpointer data)
 	NMERR_T rc;
 
 	if (gc == NULL)
-		return;
+		return G_SOURCE_REMOVE;
 
 	user = purple_connection_get_protocol_data(gc);
 	if (user == NULL)
-		return;
+		return G_SOURCE_REMOVE;
 
 	rc = nm_process_new_data(user);
 	if (rc != NM_OK) {
 
 		if (_is_disconnect_error(rc)) {
 
+			user->conn->inpa = 0;
 			purple_connection_error(gc,
 				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
 				_("Error communicating with server. Closing connection."));
+			return G_SOURCE_REMOVE;
 		} else {
 			purple_debug_info("novell", "Error processing event or response (%d).", rc);
 		}
 	}
+
+	return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -1726,14 +1730,9 @@ novell_login_callback(GObject *source_object, GAsyncResult *res, gpointer data)
 									2, NOVELL_CONNECT_STEPS);
 
 	conn->stream = G_IO_STREAM(sockconn);
-	conn->input =
-	        g_data_input_stream_new(g_io_stream_get_input_stream(conn->stream));
-	conn->output = g_io_stream_get_output_stream(conn->stream);
-
-	g_data_input_stream_set_byte_order(conn->input,
-	                                   G_DATA_STREAM_BYTE_ORDER_LITTLE_ENDIAN);
-	g_data_input_stream_set_newline_type(conn->input,
-	                                     G_DATA_STREAM_NEWLINE_TYPE_LF);
+	conn->input = g_object_ref(g_io_stream_get_input_stream(conn->stream));
+	conn->output = purple_queued_output_stream_new(
+	        g_io_stream_get_output_stream(conn->stream));
 
 	my_addr = purple_network_get_my_ip_from_gio(sockconn);
 	pwd = purple_connection_get_password(gc);
@@ -1746,6 +1745,8 @@ novell_login_callback(GObject *source_object, GAsyncResult *res, gpointer data)
 		        G_POLLABLE_INPUT_STREAM(conn->input), user->cancellable);
 		g_source_set_callback(source, (GSourceFunc)novell_ssl_recv_cb, gc,
 		                      NULL);
+		conn->inpa = g_source_attach(source, NULL);
+		g_source_unref(source);
 	} else {
 		purple_connection_error(gc,
 			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
@@ -0,0 +1,347 @@
+#include <glib.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "protocols/novell/nmconn.h"
+
+/*
+ * The encodings below were captured from requests written by the old
+ * field-at-a-time writer, so any change to the wire format shows up here.
+ */
+#define LOGIN_REQUEST \
+	"POST /login HTTP/1.0\r\n" \
+	"Host: nm.example.com:8300\r\n\r\n" \
+	"&tag=NM_A_SZ_USERID&cmd=0&val=jsmith&type=10" \
+	"&tag=NM_A_SZ_CREDENTIALS&cmd=0&val=p%40ss+word&type=10" \
+	"&tag=NM_A_UD_BUILD&cmd=0&val=2&type=8" \
+	"&tag=NM_A_SZ_TRANSACTION_ID&cmd=0&val=1&type=10" \
+	"\r\n"
+
+#define CREATECONTACT_REQUEST \
+	"POST /createcontact HTTP/1.0\r\n" \
+	"\r\n" \
+	"&tag=NM_A_FA_CONTACT&cmd=1&val=2&type=9" \
+	"&tag=NM_A_SZ_DN&cmd=0&val=cn%3dbob%2co%3dacme&type=13" \
+	"&tag=NM_A_UD_OBJECT_ID&cmd=0&val=42&type=8" \
+	"&tag=NM_A_FA_FOLDER&cmd=G&val=0&type=9" \
+	"&tag=NM_A_SZ_TRANSACTION_ID&cmd=0&val=2&type=10" \
+	"\r\n"
+
+static NMField *
+build_contact_fields(void)
+{
+	NMField *contact = NULL;
+	NMField *fields = NULL;
+
+	contact = nm_field_add_pointer(contact, NM_A_SZ_DN, 0, NMFIELD_METHOD_VALID,
+	                               0, g_strdup("cn=bob,o=acme"),
+	                               NMFIELD_TYPE_DN);
+	contact = nm_field_add_number(contact, NM_A_UD_OBJECT_ID, 0,
+	                              NMFIELD_METHOD_VALID, 0, 42,
+	                              NMFIELD_TYPE_UDWORD);
+
+	fields = nm_field_add_pointer(fields, NM_A_FA_CONTACT, 0, NMFIELD_METHOD_ADD,
+	                              0, contact, NMFIELD_TYPE_ARRAY);
+	/* neither of these is ever put on the wire */
+	fields = nm_field_add_number(fields, NM_A_UD_COUNT, 0, NMFIELD_METHOD_IGNORE,
+	                             0, 7, NMFIELD_TYPE_UDWORD);
+	fields = nm_field_add_pointer(fields, NM_A_SZ_MESSAGE_BODY, 4,
+	                              NMFIELD_METHOD_VALID, 0, g_strdup("blob"),
+	                              NMFIELD_TYPE_BINARY);
+	fields = nm_field_add_pointer(fields, NM_A_FA_FOLDER, 0, NMFIELD_METHOD_EQUAL,
+	                              0, NULL, NMFIELD_TYPE_ARRAY);
+
+	return fields;
+}
+
+static void
+assert_bytes_cmpstr(GBytes *bytes, const gchar *expected)
+{
+	gsize len;
+	const gchar *data = g_bytes_get_data(bytes, &len);
+
+	g_assert_cmpmem(data, len, expected, strlen(expected));
+}
+
+static void
+test_novell_nmconn_encode_request(void) {
+	NMConn *conn = nm_create_conn("nm.example.com", 8300);
+	NMField *fields = NULL;
+	GBytes *bytes;
+
+	fields = nm_field_add_pointer(fields, NM_A_SZ_USERID, 0, NMFIELD_METHOD_VALID,
+	                              0, g_strdup("jsmith"), NMFIELD_TYPE_UTF8);
+	fields = nm_field_add_pointer(fields, NM_A_SZ_CREDENTIALS, 0,
+	                              NMFIELD_METHOD_VALID, 0, g_strdup("p@ss word"),
+	                              NMFIELD_TYPE_UTF8);
+	fields = nm_field_add_number(fields, NM_A_UD_BUILD, 0, NMFIELD_METHOD_VALID,
+	                             0, NM_PROTOCOL_VERSION, NMFIELD_TYPE_UDWORD);
+
+	bytes = nm_encode_request(conn, "login", fields);
+	assert_bytes_cmpstr(bytes, LOGIN_REQUEST);
+	g_bytes_unref(bytes);
+	nm_free_fields(&fields);
+
+	/* the transaction id moves on with every request */
+	fields = build_contact_fields();
+	bytes = nm_encode_request(conn, "createcontact", fields);
+	assert_bytes_cmpstr(bytes, CREATECONTACT_REQUEST);
+	g_bytes_unref(bytes);
+	nm_free_fields(&fields);
+
+	g_assert_cmpint(2, ==, conn->trans_id);
+
+	nm_release_conn(conn);
+}
+
+/*
+ * A minimal decoder for the "post" encoding, just enough to read back what
+ * nm_encode_fields() wrote.  Values come back unescaped as strings.
+ */
+static gchar *
+unescape_value(const gchar *value)
+{
+	GString *str = g_string_new(NULL);
+
+	for (; *value; value++) {
+		if (*value == '+') {
+			g_string_append_c(str, ' ');
+		} else if (*value == '%' && g_ascii_isxdigit(value[1]) &&
+		           g_ascii_isxdigit(value[2])) {
+			g_string_append_c(str, g_ascii_xdigit_value(value[1]) << 4 |
+			                       g_ascii_xdigit_value(value[2]));
+			value += 2;
+		} else {
+			g_string_append_c(str, *value);
+		}
+	}
+
+	return g_string_free(str, FALSE);
+}
+
+static void
+assert_fields_decode(NMField *fields, gchar ***pairs)
+{
+	NMField *field;
+
+	for (field = fields; field->tag; field++) {
+		gchar *value;
+		guint type;
+
+		if (field->method == NMFIELD_METHOD_IGNORE ||
+		    field->type == NMFIELD_TYPE_BINARY) {
+			continue;
+		}
+
+		g_assert_nonnull((*pairs)[3]);
+		g_assert_true(g_str_has_prefix((*pairs)[0], "tag="));
+		g_assert_cmpstr((*pairs)[0] + 4, ==, field->tag);
+		g_assert_true(g_str_has_prefix((*pairs)[1], "cmd="));
+		g_assert_true(g_str_has_prefix((*pairs)[2], "val="));
+		g_assert_true(g_str_has_prefix((*pairs)[3], "type="));
+
+		value = unescape_value((*pairs)[2] + 4);
+		type = g_ascii_strtoull((*pairs)[3] + 5, NULL, 10);
+		g_assert_cmpuint(type, ==, field->type);
+		*pairs += 4;
+
+		switch (field->type) {
+			case NMFIELD_TYPE_UTF8:
+			case NMFIELD_TYPE_DN:
+				g_assert_cmpstr(value, ==, field->ptr_value);
+				break;
+			case NMFIELD_TYPE_ARRAY:
+			case NMFIELD_TYPE_MV:
+				g_assert_cmpuint(g_ascii_strtoull(value, NULL, 10), ==,
+				                 nm_count_fields(field->ptr_value));
+				if (field->ptr_value) {
+					assert_fields_decode(field->ptr_value, pairs);
+				}
+				break;
+			default:
+				g_assert_cmpuint(g_ascii_strtoull(value, NULL, 10), ==,
+				                 field->value);
+				break;
+		}
+
+		g_free(value);
+	}
+}
+
+static void
+test_novell_nmconn_round_trip(void) {
+	NMField *fields = build_contact_fields();
+	GString *str = g_string_new(NULL);
+	gchar **split, **pairs;
+
+	fields = nm_field_add_pointer(fields, NM_A_SZ_MESSAGE_TEXT, 0,
+	                              NMFIELD_METHOD_VALID, 0,
+	                              g_strdup("50% off & \"free\" \xc3\xa9t\xc3\xa9"),
+	                              NMFIELD_TYPE_UTF8);
+
+	nm_encode_fields(str, fields);
+	g_assert_true(g_str_has_prefix(str->str, "&tag="));
+
+	/* This only splits cleanly if the '&' in the value was escaped. */
+	split = g_strsplit(str->str + 1, "&", -1);
+
+	pairs = split;
+	assert_fields_decode(fields, &pairs);
+	g_assert_null(*pairs);
+
+	g_strfreev(split);
+	g_string_free(str, TRUE);
+	nm_free_fields(&fields);
+}
+
+/*
+ * A response body as the server sends it: a transaction id, a contact list
+ * with a folder, an empty string that is dropped but still counted, and an
+ * empty array, then the terminator.  One extra byte follows that belongs to
+ * whatever comes next.
+ */
+static const guchar RESPONSE_FIELDS[] = {
+	NMFIELD_TYPE_UTF8, 0, 23, 0, 0, 0, 'N', 'M', '_', 'A', '_', 'S', 'Z',
+	'_', 'T', 'R', 'A', 'N', 'S', 'A', 'C', 'T', 'I', 'O', 'N', '_', 'I',
+	'D', 0, 1, 0, 0, 0, '7',
+	NMFIELD_TYPE_ARRAY, NMFIELD_METHOD_VALID, 15, 0, 0, 0, 'N', 'M', '_',
+	'A', '_', 'F', 'A', '_', 'F', 'O', 'L', 'D', 'E', 'R', 0, 3, 0, 0, 0,
+		NMFIELD_TYPE_UDWORD, 0, 18, 0, 0, 0, 'N', 'M', '_', 'A', '_', 'S',
+		'Z', '_', 'O', 'B', 'J', 'E', 'C', 'T', '_', 'I', 'D', 0, 42, 1, 0,
+		0,
+		NMFIELD_TYPE_DN, 0, 11, 0, 0, 0, 'N', 'M', '_', 'A', '_', 'S', 'Z',
+		'_', 'D', 'N', 0, 0, 0, 0, 0,
+		NMFIELD_TYPE_MV, 0, 15, 0, 0, 0, 'N', 'M', '_', 'A', '_', 'F', 'A',
+		'_', 'F', 'O', 'L', 'D', 'E', 'R', 0, 0, 0, 0, 0,
+	0,
+	0xff
+};
+
+static void
+assert_response_fields(NMField *fields)
+{
+	NMField *field, *folder;
+
+	g_assert_cmpuint(2, ==, nm_count_fields(fields));
+
+	field = nm_locate_field(NM_A_SZ_TRANSACTION_ID, fields);
+	g_assert_nonnull(field);
+	g_assert_cmpstr("7", ==, field->ptr_value);
+
+	field = nm_locate_field(NM_A_FA_FOLDER, fields);
+	g_assert_nonnull(field);
+	g_assert_cmpuint(NMFIELD_TYPE_ARRAY, ==, field->type);
+
+	folder = field->ptr_value;
+	g_assert_cmpuint(2, ==, nm_count_fields(folder));
+	g_assert_cmpstr(NM_A_SZ_OBJECT_ID, ==, folder[0].tag);
+	g_assert_cmpuint(298, ==, folder[0].value);
+	g_assert_cmpstr(NM_A_FA_FOLDER, ==, folder[1].tag);
+	g_assert_cmpuint(NMFIELD_TYPE_MV, ==, folder[1].type);
+	g_assert_null(folder[1].ptr_value);
+}
+
+static void
+test_novell_nmconn_decode_fields(void) {
+	NMFieldDecoder *decoder = nm_field_decoder_new();
+	NMField *fields;
+	NMERR_T rc;
+	gsize used;
+
+	/* all at once, leaving the last byte alone */
+	g_assert_true(nm_field_decoder_push(decoder, RESPONSE_FIELDS,
+	                                    sizeof(RESPONSE_FIELDS), &used, &rc));
+	g_assert_cmpint(NM_OK, ==, rc);
+	g_assert_cmpuint(sizeof(RESPONSE_FIELDS) - 1, ==, used);
+
+	fields = nm_field_decoder_finish(decoder);
+	assert_response_fields(fields);
+	nm_free_fields(&fields);
+
+	nm_field_decoder_free(decoder);
+}
+
+static void
+test_novell_nmconn_decode_fields_split(void) {
+	NMFieldDecoder *decoder = nm_field_decoder_new();
+	NMField *fields;
+	NMERR_T rc;
+	gsize used, i;
+
+	/* a byte at a time, as it might trickle in off the network */
+	for (i = 0; i < sizeof(RESPONSE_FIELDS) - 2; i++) {
+		g_assert_false(nm_field_decoder_push(decoder, &RESPONSE_FIELDS[i], 1,
+		                                     &used, &rc));
+		g_assert_cmpint(NM_OK, ==, rc);
+		g_assert_cmpuint(1, ==, used);
+	}
+	g_assert_true(nm_field_decoder_push(decoder, &RESPONSE_FIELDS[i], 2,
+	                                    &used, &rc));
+	g_assert_cmpuint(1, ==, used);
+
+	fields = nm_field_decoder_finish(decoder);
+	assert_response_fields(fields);
+	nm_free_fields(&fields);
+
+	/* the decoder is ready for the next one, and a partial list is
+	 * thrown away */
+	g_assert_false(nm_field_decoder_push(decoder, RESPONSE_FIELDS, 40, &used,
+	                                     &rc));
+	g_assert_null(nm_field_decoder_finish(decoder));
+
+	nm_field_decoder_free(decoder);
+}
+
+static void
+test_novell_nmconn_decode_fields_invalid(void) {
+	const guchar long_tag[] = { NMFIELD_TYPE_UDWORD, 0, 0, 1, 0, 0 };
+	const guchar long_str[] = {
+		NMFIELD_TYPE_UTF8, 0, 2, 0, 0, 0, 'x', 0, 0, 0, 1, 0
+	};
+	const guchar array[] = {
+		NMFIELD_TYPE_ARRAY, 0, 2, 0, 0, 0, 'x', 0, 1, 0, 0, 0
+	};
+	NMFieldDecoder *decoder = nm_field_decoder_new();
+	guchar deep[32 * sizeof(array)];
+	NMERR_T rc;
+	gsize used, i;
+
+	g_assert_false(nm_field_decoder_push(decoder, long_tag, sizeof(long_tag),
+	                                     &used, &rc));
+	g_assert_cmpint(NMERR_PROTOCOL, ==, rc);
+	g_assert_null(nm_field_decoder_finish(decoder));
+
+	g_assert_false(nm_field_decoder_push(decoder, long_str, sizeof(long_str),
+	                                     &used, &rc));
+	g_assert_cmpint(NMERR_PROTOCOL, ==, rc);
+	g_assert_null(nm_field_decoder_finish(decoder));
+
+	/* arrays nested far deeper than anything the server sends */
+	for (i = 0; i < sizeof(deep); i += sizeof(array)) {
+		memcpy(&deep[i], array, sizeof(array));
+	}
+	g_assert_false(nm_field_decoder_push(decoder, deep, sizeof(deep), &used,
+	                                     &rc));
+	g_assert_cmpint(NMERR_PROTOCOL, ==, rc);
+
+	nm_field_decoder_free(decoder);
+}
+
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/novell/nmconn/encode request",
+	                test_novell_nmconn_encode_request);
+	g_test_add_func("/novell/nmconn/round trip",
+	                test_novell_nmconn_round_trip);
+	g_test_add_func("/novell/nmconn/decode fields",
+	                test_novell_nmconn_decode_fields);
+	g_test_add_func("/novell/nmconn/decode fields split",
+	                test_novell_nmconn_decode_fields_split);
+	g_test_add_func("/novell/nmconn/decode fields invalid",
+	                test_novell_nmconn_decode_fields_invalid);
+
+	return g_test_run();
+}
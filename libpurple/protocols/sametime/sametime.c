@@ -2223,11 +2223,8 @@ static void ft_send(struct mwFileTransfer *ft) {
   rem = mwFileTransfer_getRemaining(ft);
   if(rem < MW_FT_LEN) o.len = rem;
 
+  /* reading the file also updates the progress */
   if(purple_xfer_read_file(xfer, buf, (size_t) o.len) == (gssize)o.len) {
-
-    /* calculate progress and display it */
-    purple_xfer_set_bytes_sent(xfer, purple_xfer_get_bytes_sent(xfer) + o.len);
-
     mwFileTransfer_send(ft, &o);
 
   } else {
@@ -2311,16 +2308,14 @@ static void mw_ft_recv(struct mwFileTransfer *ft,
   xfer = mwFileTransfer_getClientData(ft);
   g_return_if_fail(xfer != NULL);
 
-  /* we must collect and save our precious data */
+  /* we must collect and save our precious data, which also updates the
+     progress */
   if (!purple_xfer_write_file(xfer, data->data, data->len)) {
     DEBUG_ERROR("failed to write data\n");
     purple_xfer_cancel_local(xfer);
     return;
   }
 
-  /* update the progress */
-  purple_xfer_set_bytes_sent(xfer, purple_xfer_get_bytes_sent(xfer) + data->len);
-
   /* let the other side know we got it, and to send some more */
   mwFileTransfer_ack(ft);
 }
@@ -140,7 +140,7 @@ silcpurple_ftp_monitor(SilcClient client,
 		purple_xfer_set_size(xfer, filesize);
 	}
 	if (offset && filesize) {
-		purple_xfer_set_bytes_sent(xfer, offset);
+		purple_xfer_seek(xfer, offset);
 	}
 
 	if (status == SILC_CLIENT_FILE_MONITOR_SEND ||
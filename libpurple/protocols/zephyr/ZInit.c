@@ -53,8 +53,10 @@ ZInitialize(void)
 	/* Set up local loopback address for HostManager */
 	__HM_addr = g_inet_socket_address_new_from_string("127.0.0.1", port);
 
-	/* Initialize the input queue */
-	g_queue_init(&Z_input_queue);
+	/* Initialize the input queue, dropping anything left from before */
+	while (Z_input_queue.head) {
+		Z_RemQueue(Z_input_queue.head->data);
+	}
 
 	/* If there is no zhm, the code will fall back to something which might
 	 * not be "right", but this is is ok, since none of the servers call
@@ -26,6 +26,11 @@ guint32 __My_addr;
 int __Q_CompleteLength;
 int __Q_Size;
 GQueue Z_input_queue = G_QUEUE_INIT;
+/* Every queued notice by (multiuid, kind), so late fragments still find
+ * theirs, and the partial ones oldest fragment first so the stale ones can
+ * be dropped from the front. */
+static GHashTable *Z_input_index = NULL;
+static GQueue Z_pending_queue = G_QUEUE_INIT;
 GSocketAddress *__HM_addr;
 ZLocations_t *__locate_list;
 int __locate_num;
@@ -151,34 +156,90 @@ Z_ReadEnqueue(void)
 }
 
 
+/* The uid is hashed and compared field by field, as it may have padding
+ * between the address and the timeval that nobody initialized. */
+static guint
+Z_InputQ_hash(gconstpointer key)
+{
+	const Z_InputQ *qptr = key;
+	guint hash = qptr->kind;
+
+	hash = hash * 31 + qptr->uid.zuid_addr;
+	hash = hash * 31 + (guint)qptr->uid.tv.tv_sec;
+	hash = hash * 31 + (guint)qptr->uid.tv.tv_usec;
+	return hash;
+}
+
+static gboolean
+Z_InputQ_equal(gconstpointer a, gconstpointer b)
+{
+	const Z_InputQ *qa = a;
+	const Z_InputQ *qb = b;
+
+	return qa->kind == qb->kind &&
+	       qa->uid.zuid_addr == qb->uid.zuid_addr &&
+	       qa->uid.tv.tv_sec == qb->uid.tv.tv_sec &&
+	       qa->uid.tv.tv_usec == qb->uid.tv.tv_usec;
+}
+
+/* Take a notice out of expiry, either because it is complete or because it
+ * is being removed. */
+static void
+Z_ForgetPartial(Z_InputQ *qptr)
+{
+	if (qptr->pending_link == NULL) {
+		return;
+	}
+	g_queue_delete_link(&Z_pending_queue, qptr->pending_link);
+	qptr->pending_link = NULL;
+}
+
+/* Mark a partial notice as just touched, moving it to the young end. */
+static void
+Z_TouchPartial(Z_InputQ *qptr)
+{
+	qptr->time = g_get_monotonic_time();
+
+	if (qptr->pending_link == NULL) {
+		g_queue_push_tail(&Z_pending_queue, qptr);
+		qptr->pending_link = Z_pending_queue.tail;
+	} else if (qptr->pending_link != Z_pending_queue.tail) {
+		g_queue_unlink(&Z_pending_queue, qptr->pending_link);
+		g_queue_push_tail_link(&Z_pending_queue, qptr->pending_link);
+	}
+}
+
+/* Drop partial notices that haven't been touched in a while. */
+static void
+Z_ExpirePartials(void)
+{
+	gint64 limit = g_get_monotonic_time() - Z_NOTICETIMELIMIT * G_USEC_PER_SEC;
+
+	while (Z_pending_queue.head) {
+		Z_InputQ *qptr = Z_pending_queue.head->data;
+		if (qptr->time >= limit) {
+			break;
+		}
+		Z_RemQueue(qptr);
+	}
+}
+
 /*
- * Search the queue for a notice with the proper multiuid - remove any
- * notices that haven't been touched in a while
+ * Find the queued notice with the proper multiuid, complete or not
  */
 
 static Z_InputQ *
 Z_SearchQueue(ZUnique_Id_t *uid, ZNotice_Kind_t kind)
 {
-	register GList *list;
-	GList *next;
-	gint64 now;
-
-	now = g_get_monotonic_time();
+	Z_InputQ key;
 
-	list = Z_input_queue.head;
-
-	while (list) {
-		Z_InputQ *qptr = (Z_InputQ *)list->data;
-		if (ZCompareUID(uid, &qptr->uid) && qptr->kind == kind) {
-			return qptr;
-		}
-		next = list->next;
-		if (qptr->time && qptr->time + Z_NOTICETIMELIMIT < now) {
-			Z_RemQueue(qptr);
-		}
-		list = next;
+	if (Z_input_index == NULL) {
+		return NULL;
 	}
-	return NULL;
+
+	key.uid = *uid;
+	key.kind = kind;
+	return g_hash_table_lookup(Z_input_index, &key);
 }
 
 /*
@@ -304,6 +365,8 @@ Z_ReadWait(void)
 		return ZERR_NONE;
 	}
 
+	Z_ExpirePartials();
+
     /* If we can find a notice in the queue with the same multiuid field,
      * insert the current fragment as appropriate. */
     switch (notice.z_kind) {
@@ -353,6 +416,7 @@ Z_ReadWait(void)
 
 	/* Insert the entry at the end of the queue */
 	g_queue_push_tail(&Z_input_queue, qptr);
+	qptr->link = Z_input_queue.tail;
 
 	/* Copy the from field, multiuid, kind, and checked authentication. */
 	qptr->from = from;
@@ -360,6 +424,13 @@ Z_ReadWait(void)
 	qptr->kind = notice.z_kind;
 	qptr->auth = notice.z_checked_auth;
 
+	/* It stays findable until it is taken off the queue, so duplicates of
+	 * a notice that is already complete don't turn into a new one. */
+	if (Z_input_index == NULL) {
+		Z_input_index = g_hash_table_new(Z_InputQ_hash, Z_InputQ_equal);
+	}
+	g_hash_table_add(Z_input_index, qptr);
+
 	/* If this is the first part of the notice, we take the header from it.
 	 * We only take it if this is the first fragment so that the Unique
 	 * ID's will be predictable. */
@@ -435,6 +506,11 @@ Z_AddNoticeToEntry(Z_InputQ *qptr, ZNotice_t *notice, int part)
 	Z_Hole *hole;
 	gint last;
 
+	/* A retransmitted fragment of a notice we already have in full. */
+	if (qptr->complete) {
+		return ZERR_NONE;
+	}
+
 	/* Incorporate this notice's checked authentication. */
 	if (notice->z_checked_auth == ZAUTH_FAILED) {
 		qptr->auth = ZAUTH_FAILED;
@@ -442,7 +518,7 @@ Z_AddNoticeToEntry(Z_InputQ *qptr, ZNotice_t *notice, int part)
 		qptr->auth = ZAUTH_NO;
 	}
 
-	qptr->time = g_get_monotonic_time();
+	Z_TouchPartial(qptr);
 
 	last = part + notice->z_message_len - 1;
 
@@ -491,6 +567,7 @@ Z_AddNoticeToEntry(Z_InputQ *qptr, ZNotice_t *notice, int part)
 		}
 		qptr->complete = TRUE;
 		qptr->time = 0; /* don't time out anymore */
+		Z_ForgetPartial(qptr);
 		qptr->packet_len = qptr->header_len + qptr->msg_len;
 		qptr->packet = g_new(gchar, qptr->packet_len);
 		memcpy(qptr->packet, qptr->header, qptr->header_len);
@@ -718,12 +795,7 @@ Z_GetFirstComplete(void)
 Z_InputQ *
 Z_GetNextComplete(Z_InputQ *qptr)
 {
-	GList *list = g_queue_find(&Z_input_queue, qptr);
-
-	if (list) {
-		list = list->next;
-		list = g_list_find_custom(list, NULL, find_complete_input);
-	}
+	GList *list = g_list_find_custom(qptr->link->next, NULL, find_complete_input);
 
 	return list ? (Z_InputQ *)list->data : NULL;
 }
@@ -745,7 +817,9 @@ Z_RemQueue(Z_InputQ *qptr)
 
 	g_slist_free_full(qptr->holelist, g_free);
 
-	g_queue_remove(&Z_input_queue, qptr);
+	Z_ForgetPartial(qptr);
+	g_hash_table_remove(Z_input_index, qptr);
+	g_queue_delete_link(&Z_input_queue, qptr->link);
 	g_free(qptr);
 }
 
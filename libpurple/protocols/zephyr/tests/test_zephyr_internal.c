@@ -0,0 +1,213 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* Fragments are sent over loopback from a second socket to the one libzephyr
+ * reads from, and read back one at a time with Z_ReadWait(). */
+typedef struct {
+	GSocket *sender;
+	GSocketAddress *to;
+} TestZephyrFixture;
+
+static GSocket *
+test_zephyr_socket_new(void)
+{
+	GInetAddress *loopback;
+	GSocketAddress *addr;
+	GSocket *socket;
+	GError *error = NULL;
+
+	socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+	                      G_SOCKET_PROTOCOL_UDP, &error);
+	g_assert_no_error(error);
+
+	loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+	addr = g_inet_socket_address_new(loopback, 0);
+	g_socket_bind(socket, addr, FALSE, &error);
+	g_assert_no_error(error);
+	g_object_unref(addr);
+	g_object_unref(loopback);
+
+	return socket;
+}
+
+static void
+test_zephyr_setup(TestZephyrFixture *fixture, G_GNUC_UNUSED gconstpointer data)
+{
+	GError *error = NULL;
+
+	__Zephyr_socket = test_zephyr_socket_new();
+	fixture->sender = test_zephyr_socket_new();
+	fixture->to = g_socket_get_local_address(__Zephyr_socket, &error);
+	g_assert_no_error(error);
+}
+
+static void
+test_zephyr_teardown(TestZephyrFixture *fixture,
+                     G_GNUC_UNUSED gconstpointer data)
+{
+	while (Z_input_queue.head) {
+		Z_RemQueue(Z_input_queue.head->data);
+	}
+
+	g_clear_object(&fixture->to);
+	g_clear_object(&fixture->sender);
+	g_clear_object(&__Zephyr_socket);
+}
+
+/* Sends the part of body starting at offset as a fragment of the notice
+ * identified by multiuid, with its own uid taken from id, and reads it in. */
+static void
+test_zephyr_receive_fragment(TestZephyrFixture *fixture, guint32 multiuid,
+                             guint32 id, const gchar *body, gint offset,
+                             gint len)
+{
+	ZNotice_t notice;
+	gchar version[16];
+	gchar multi[32];
+	gchar *packet = NULL;
+	gint packet_len = 0;
+	GError *error = NULL;
+
+	g_snprintf(version, sizeof(version), "%s%d.%d", ZVERSIONHDR,
+	           ZVERSIONMAJOR, ZVERSIONMINOR);
+	g_snprintf(multi, sizeof(multi), "%d/%d", offset, (gint)strlen(body));
+
+	memset(&notice, 0, sizeof(notice));
+	notice.z_version = version;
+	notice.z_kind = UNACKED;
+	notice.z_uid.zuid_addr = 0x7f000001;
+	notice.z_uid.tv.tv_sec = 1000;
+	notice.z_uid.tv.tv_usec = id;
+	notice.z_multiuid = notice.z_uid;
+	notice.z_multiuid.tv.tv_usec = multiuid;
+	notice.z_multinotice = multi;
+	notice.z_ascii_authent = "";
+	notice.z_class = "MESSAGE";
+	notice.z_class_inst = "personal";
+	notice.z_opcode = "";
+	notice.z_sender = "alice@EXAMPLE.COM";
+	notice.z_recipient = "";
+	notice.z_default_format = "";
+	notice.z_message = (gchar *)body + offset;
+	notice.z_message_len = len;
+
+	g_assert_cmpint(ZFormatRawNotice(&notice, &packet, &packet_len), ==,
+	                ZERR_NONE);
+	g_socket_send_to(fixture->sender, fixture->to, packet, packet_len, NULL,
+	                 &error);
+	g_assert_no_error(error);
+	free(packet);
+
+	g_assert_cmpint(Z_ReadWait(), ==, ZERR_NONE);
+}
+
+static void
+test_zephyr_assert_complete(const gchar *body)
+{
+	Z_InputQ *qptr = Z_GetFirstComplete();
+
+	g_assert_nonnull(qptr);
+	g_assert_cmpint(qptr->msg_len, ==, strlen(body));
+	g_assert_cmpmem(qptr->msg, qptr->msg_len, body, strlen(body));
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_zephyr_internal_reassemble(TestZephyrFixture *fixture,
+                                G_GNUC_UNUSED gconstpointer data)
+{
+	const gchar *first = "hello world";
+	const gchar *second = "goodbye moon";
+
+	/* Two notices interleaved, with their fragments out of order. */
+	test_zephyr_receive_fragment(fixture, 100, 101, first, 6, 5);
+	test_zephyr_receive_fragment(fixture, 200, 201, second, 0, 8);
+	g_assert_cmpint(ZQLength(), ==, 0);
+	g_assert_cmpuint(g_queue_get_length(&Z_input_queue), ==, 2);
+
+	test_zephyr_receive_fragment(fixture, 100, 102, first, 0, 6);
+	g_assert_cmpint(ZQLength(), ==, 1);
+	test_zephyr_assert_complete(first);
+
+	test_zephyr_receive_fragment(fixture, 200, 202, second, 8, 4);
+	g_assert_cmpint(ZQLength(), ==, 2);
+	g_assert_cmpuint(g_queue_get_length(&Z_input_queue), ==, 2);
+
+	Z_RemQueue(Z_GetFirstComplete());
+	test_zephyr_assert_complete(second);
+}
+
+static void
+test_zephyr_internal_duplicate_after_complete(TestZephyrFixture *fixture,
+                                              G_GNUC_UNUSED gconstpointer data)
+{
+	const gchar *body = "hello world";
+
+	test_zephyr_receive_fragment(fixture, 300, 301, body, 0, 6);
+	test_zephyr_receive_fragment(fixture, 300, 302, body, 6, 5);
+	g_assert_cmpint(ZQLength(), ==, 1);
+
+	/* Retransmissions carry a new uid, so only the multiuid ties them to
+	 * the notice that is already complete and waiting to be read. */
+	test_zephyr_receive_fragment(fixture, 300, 303, body, 6, 5);
+	test_zephyr_receive_fragment(fixture, 300, 304, body, 0, 6);
+
+	g_assert_cmpint(ZQLength(), ==, 1);
+	g_assert_cmpuint(g_queue_get_length(&Z_input_queue), ==, 1);
+	test_zephyr_assert_complete(body);
+
+	/* Once it has been read, the notice is gone from the index as well. */
+	Z_RemQueue(Z_GetFirstComplete());
+	g_assert_cmpint(ZQLength(), ==, 0);
+
+	test_zephyr_receive_fragment(fixture, 300, 305, body, 0, 6);
+	g_assert_cmpint(ZQLength(), ==, 0);
+	g_assert_cmpuint(g_queue_get_length(&Z_input_queue), ==, 1);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add("/zephyr/internal/reassemble", TestZephyrFixture, NULL,
+	           test_zephyr_setup, test_zephyr_internal_reassemble,
+	           test_zephyr_teardown);
+	g_test_add("/zephyr/internal/duplicate-after-complete",
+	           TestZephyrFixture, NULL, test_zephyr_setup,
+	           test_zephyr_internal_duplicate_after_complete,
+	           test_zephyr_teardown);
+
+	return g_test_run();
+}
@@ -49,6 +49,14 @@
 #define ZEPHYR_TYPING_SEND_TIMEOUT 15
 #define ZEPHYR_TYPING_RECV_TIMEOUT 10
 
+/* Buddy location polling, in seconds.  Buddies start at the minimum and
+ * back off while nothing changes; open conversations poll faster. */
+#define ZEPHYR_LOC_INTERVAL_ACTIVE 10
+#define ZEPHYR_LOC_INTERVAL_MIN 20
+#define ZEPHYR_LOC_INTERVAL_MAX 300
+#define ZEPHYR_LOC_REPLY_TIMEOUT 10
+#define ZEPHYR_LOC_MAX_IN_FLIGHT 8
+
 static PurpleProtocol *my_protocol = NULL;
 static GSList *cmds = NULL;
 
@@ -57,14 +65,29 @@ extern char __Zephyr_realm[];
 #endif
 
 typedef struct _zephyr_triple zephyr_triple;
+typedef struct _zephyr_loc_buddy zephyr_loc_buddy;
 
 typedef gboolean (*ZephyrLoginFunc)(zephyr_account *zephyr);
+typedef GSource *(*ZephyrCreateSourceFunc)(zephyr_account *zephyr, PurpleConnection *gc);
 
 struct _zephyr_triple {
 	ZSubscription_t sub;
 	char *name;
 	gboolean open;
 	int id;
+	guint serial;
+};
+
+struct _zephyr_loc_buddy {
+	char *name;     /* as on the buddy list */
+	char *who;      /* what we ask the server for */
+	int ref;        /* buddy list entries with this name */
+	int online;     /* -1 until the first answer */
+	guint interval;
+	gint64 due;
+	gint64 sent;
+	GSequenceIter *iter;
+	GList *in_flight;
 };
 
 #ifdef WIN32
@@ -72,6 +95,8 @@ extern const char *username;
 #endif
 
 static void zephyr_chat_set_topic(PurpleConnection *gc, int id, const char *topic);
+static void zephyr_loc_answered(zephyr_account *zephyr, const char *name, gboolean online);
+static void zephyr_loc_poke(zephyr_account *zephyr, const char *name);
 
 static char *
 zephyr_strip_local_realm(const zephyr_account *zephyr, const char *user)
@@ -121,56 +146,86 @@ zephyr_triple_free(zephyr_triple *zt)
 	g_free(zt);
 }
 
-/* returns 0 if sub is a subset of zt.sub.  This function is used to
-   determine whether a zephyr sent to sub should be placed in the chat
-   with triple zt.sub
+/* Index key for a triple.  Every part is compared ignoring case, so the
+   key is folded to lower case. */
+static gchar *
+zephyr_triple_key(const char *zclass, const char *instance, const char *recipient)
+{
+	gchar *key = g_strjoin("\n", zclass, instance, recipient, NULL);
+	gchar *folded = g_ascii_strdown(key, -1);
+
+	g_free(key);
+	return folded;
+}
+
+/* Remember a subscription.  The list keeps the order for write_zsubs(); the
+   tables are what lookups go through.  Triples with a missing part never
+   match anything and are only kept in the list. */
+static void
+zephyr_triple_add(zephyr_account *zephyr, zephyr_triple *zt)
+{
+	zt->serial = g_queue_get_length(&zephyr->subscrips);
+	g_queue_push_tail(&zephyr->subscrips, zt);
+	g_hash_table_insert(zephyr->subscrips_by_id, GINT_TO_POINTER(zt->id), zt);
+
+	if (zt->sub.zsub_class && zt->sub.zsub_classinst && zt->sub.zsub_recipient) {
+		gchar *key = zephyr_triple_key(zt->sub.zsub_class,
+		                               zt->sub.zsub_classinst,
+		                               zt->sub.zsub_recipient);
+		/* The first subscription to a triple is the one that matches. */
+		if (g_hash_table_contains(zephyr->subscrips_by_triple, key)) {
+			g_free(key);
+		} else {
+			g_hash_table_insert(zephyr->subscrips_by_triple, key, zt);
+		}
+	}
+}
+
+/* Finds the chat a zephyr sent to sub should be placed in.
 
-   sub is a subset of zt.sub
+   sub belongs to a subscription zt.sub
    iff. the classnames are identical ignoring case
    AND. the instance names are identical (ignoring case), or zt.sub->instance is *.
    AND. the recipient names are identical
+
+   That leaves at most two candidates: the exact triple and the one with a
+   wildcard instance.  As with the list this replaced, the older one wins.
 */
-static gint
-zephyr_triple_subset(const zephyr_triple *zt, const ZSubscription_t *sub)
+static zephyr_triple *
+zephyr_triple_find(zephyr_account *zephyr, const ZSubscription_t *sub)
 {
-	if (!sub->zsub_class) {
-		purple_debug_error("zephyr", "sub1c doesn't exist\n");
-		return 1;
-	}
-	if (!sub->zsub_classinst) {
-		purple_debug_error("zephyr", "sub1i doesn't exist\n");
-		return 1;
-	}
-	if (!sub->zsub_recipient) {
-		purple_debug_error("zephyr", "sub1r doesn't exist\n");
-		return 1;
-	}
-	if (!zt->sub.zsub_class) {
-		purple_debug_error("zephyr", "sub2c doesn't exist\n");
-		return 1;
-	}
-	if (!zt->sub.zsub_classinst) {
-		purple_debug_error("zephyr", "sub2i doesn't exist\n");
-		return 1;
-	}
-	if (!zt->sub.zsub_recipient) {
-		purple_debug_error("zephyr", "sub2r doesn't exist\n");
-		return 1;
-	}
+	zephyr_triple *zt, *wild;
+	gchar *key;
 
-	if (g_ascii_strcasecmp(zt->sub.zsub_class, sub->zsub_class)) {
-		return 1;
+	if (!sub->zsub_class || !sub->zsub_classinst || !sub->zsub_recipient) {
+		purple_debug_error("zephyr", "incomplete triple\n");
+		return NULL;
 	}
-	if (g_ascii_strcasecmp(zt->sub.zsub_classinst, sub->zsub_classinst) && g_ascii_strcasecmp(zt->sub.zsub_classinst, "*")) {
-		return 1;
+
+	key = zephyr_triple_key(sub->zsub_class, sub->zsub_classinst, sub->zsub_recipient);
+	zt = g_hash_table_lookup(zephyr->subscrips_by_triple, key);
+	g_free(key);
+
+	key = zephyr_triple_key(sub->zsub_class, "*", sub->zsub_recipient);
+	wild = g_hash_table_lookup(zephyr->subscrips_by_triple, key);
+	g_free(key);
+
+	if (wild && (!zt || wild->serial < zt->serial)) {
+		zt = wild;
 	}
-	if (g_ascii_strcasecmp(zt->sub.zsub_recipient, sub->zsub_recipient)) {
-		return 1;
+
+	if (zt) {
+		purple_debug_info("zephyr", "<%s,%s,%s> is in <%s,%s,%s>\n",
+		                  sub->zsub_class, sub->zsub_classinst, sub->zsub_recipient,
+		                  zt->sub.zsub_class, zt->sub.zsub_classinst, zt->sub.zsub_recipient);
 	}
-	purple_debug_info("zephyr", "<%s,%s,%s> is in <%s,%s,%s>\n",
-	                  sub->zsub_class, sub->zsub_classinst, sub->zsub_recipient,
-	                  zt->sub.zsub_class, zt->sub.zsub_classinst, zt->sub.zsub_recipient);
-	return 0;
+	return zt;
+}
+
+static zephyr_triple *
+zephyr_triple_find_by_id(zephyr_account *zephyr, int id)
+{
+	return g_hash_table_lookup(zephyr->subscrips_by_id, GINT_TO_POINTER(id));
 }
 
 /*
@@ -241,7 +296,8 @@ handle_message(PurpleConnection *gc, ZNotice_t *notice)
 	zephyr_account* zephyr = purple_connection_get_protocol_data(gc);
 
 	if (!g_ascii_strcasecmp(notice->z_class, LOGIN_CLASS)) {
-		/* well, we'll be updating in 20 seconds anyway, might as well ignore this. */
+		/* Rather than parse this, have the next poll ask about them. */
+		zephyr_loc_poke(zephyr, notice->z_class_inst);
 	} else if (!g_ascii_strcasecmp(notice->z_class, LOCATE_CLASS)) {
 		if (!g_ascii_strcasecmp(notice->z_opcode, LOCATE_LOCATE)) {
 			int nlocs;
@@ -304,17 +360,14 @@ handle_message(PurpleConnection *gc, ZNotice_t *notice)
 			        .zsub_classinst = (gchar *)notice->z_class_inst,
 			        .zsub_recipient = (gchar *)notice->z_recipient
 			};
-			zephyr_triple *zt;
+			zephyr_triple *zt = zephyr_triple_find(zephyr, &sub);
 			gchar *send_inst_utf8;
-			GSList *l = g_slist_find_custom(zephyr->subscrips, &sub, (GCompareFunc)zephyr_triple_subset);
 			PurpleChatConversation *gcc;
 
-			if (!l) {
+			if (!zt) {
 				/* This is a server supplied subscription */
 				zt = zephyr_triple_new(zephyr, &sub);
-				zephyr->subscrips = g_slist_append(zephyr->subscrips, zt);
-			} else {
-				zt = l->data;
+				zephyr_triple_add(zephyr, zt);
 			}
 
 			if (!zt->open) {
@@ -403,47 +456,255 @@ handle_locations(PurpleConnection *gc, const gchar *user, int nlocs, const ZLoca
 		purple_notify_userinfo(gc, name, user_info, NULL, NULL);
 		purple_notify_user_info_destroy(user_info);
 	} else {
+		zephyr_loc_answered(zephyr, name, nlocs > 0);
 		purple_protocol_got_user_status(zephyr->account, name, (nlocs > 0) ? "available" : "offline", NULL);
 	}
 }
 
+/*
+ * Location polling.  Every buddy has its own next poll time, and
+ * loc_schedule keeps them sorted by it, so a poll only looks at the
+ * buddies that are due rather than the whole list.
+ */
+
+static gchar *
+zephyr_loc_key(const zephyr_account *zephyr, const char *name)
+{
+	gchar *who = zephyr_normalize_local_realm(zephyr, name);
+	gchar *key = g_ascii_strdown(who, -1);
+
+	g_free(who);
+	return key;
+}
+
+static gint
+zephyr_loc_cmp_due(gconstpointer a, gconstpointer b, G_GNUC_UNUSED gpointer data)
+{
+	const zephyr_loc_buddy *la = a;
+	const zephyr_loc_buddy *lb = b;
+
+	return (la->due > lb->due) - (la->due < lb->due);
+}
+
+static void
+zephyr_loc_buddy_free(zephyr_loc_buddy *lb)
+{
+	g_free(lb->name);
+	g_free(lb->who);
+	g_free(lb);
+}
+
+static void
+zephyr_loc_schedule(zephyr_account *zephyr, zephyr_loc_buddy *lb, gint64 due)
+{
+	if (lb->iter) {
+		g_sequence_remove(lb->iter);
+	}
+	lb->due = due;
+	lb->iter = g_sequence_insert_sorted(zephyr->loc_schedule, lb,
+	                                    zephyr_loc_cmp_due, NULL);
+}
+
+static void
+zephyr_loc_settle(zephyr_account *zephyr, zephyr_loc_buddy *lb)
+{
+	if (lb->in_flight) {
+		g_queue_delete_link(&zephyr->loc_in_flight, lb->in_flight);
+		lb->in_flight = NULL;
+	}
+}
+
+static void
+zephyr_loc_add(zephyr_account *zephyr, const char *name, gint64 due)
+{
+	gchar *key = zephyr_loc_key(zephyr, name);
+	zephyr_loc_buddy *lb = g_hash_table_lookup(zephyr->loc_buddies, key);
+
+	if (lb) {
+		lb->ref++;
+		g_free(key);
+		return;
+	}
+
+	lb = g_new0(zephyr_loc_buddy, 1);
+	lb->name = g_strdup(name);
+	lb->who = zephyr_normalize_local_realm(zephyr, name);
+	lb->ref = 1;
+	lb->online = -1;
+	lb->interval = ZEPHYR_LOC_INTERVAL_MIN;
+	g_hash_table_insert(zephyr->loc_buddies, key, lb);
+	zephyr_loc_schedule(zephyr, lb, due);
+}
+
 static void
-check_loc_buddy(PurpleBuddy *buddy, zephyr_account *zephyr)
+zephyr_loc_remove(zephyr_account *zephyr, const char *name)
 {
-	const char *bname = purple_buddy_get_name(buddy);
-	char *chk = zephyr_normalize_local_realm(zephyr, bname);
+	gchar *key = zephyr_loc_key(zephyr, name);
+	zephyr_loc_buddy *lb = g_hash_table_lookup(zephyr->loc_buddies, key);
+
+	if (lb && --lb->ref == 0) {
+		zephyr_loc_settle(zephyr, lb);
+		g_sequence_remove(lb->iter);
+		g_hash_table_remove(zephyr->loc_buddies, key);
+	}
+	g_free(key);
+}
+
+/* A poll was answered.  Buddies that keep giving the same answer are
+ * asked less often; a change puts them back to the minimum. */
+static void
+zephyr_loc_answered(zephyr_account *zephyr, const char *name, gboolean online)
+{
+	gchar *key = zephyr_loc_key(zephyr, name);
+	zephyr_loc_buddy *lb = g_hash_table_lookup(zephyr->loc_buddies, key);
+
+	g_free(key);
+	if (lb == NULL) {
+		return;
+	}
+
+	zephyr_loc_settle(zephyr, lb);
+	if (lb->online == online) {
+		lb->interval = MIN(lb->interval * 2, ZEPHYR_LOC_INTERVAL_MAX);
+	} else {
+		lb->interval = ZEPHYR_LOC_INTERVAL_MIN;
+	}
+	lb->online = online;
+}
+
+/* Something suggests the buddy's location changed; poll them soon. */
+static void
+zephyr_loc_poke(zephyr_account *zephyr, const char *name)
+{
+	gchar *key;
+	zephyr_loc_buddy *lb;
+
+	if (name == NULL) {
+		return;
+	}
+
+	key = zephyr_loc_key(zephyr, name);
+	lb = g_hash_table_lookup(zephyr->loc_buddies, key);
+	g_free(key);
+	if (lb == NULL) {
+		return;
+	}
+
+	lb->interval = ZEPHYR_LOC_INTERVAL_MIN;
+	if (lb->in_flight == NULL) {
+		zephyr_loc_schedule(zephyr, lb, g_get_monotonic_time());
+	}
+}
+
+static void
+check_loc_buddy(zephyr_account *zephyr, zephyr_loc_buddy *lb, gint64 now)
+{
+	guint interval = lb->interval;
 #ifdef WIN32
 	int numlocs;
 
-	ZLocateUser(chk, &numlocs, ZAUTH);
+	ZLocateUser(lb->who, &numlocs, ZAUTH);
 	for (int i = 0; i < numlocs; i++) {
 		ZLocations_t locations;
 		int one = 1;
 
 		ZGetLocations(&locations, &one);
-		serv_got_update(zgc, bname, 1, 0, 0, 0, 0);
+		serv_got_update(zgc, lb->name, 1, 0, 0, 0, 0);
 	}
 #else
 
-	purple_debug_info("zephyr", "chk: %s, bname: %s", chk, bname);
+	purple_debug_info("zephyr", "chk: %s, bname: %s", lb->who, lb->name);
 	/* XXX add real error reporting */
 	/* doesn't matter if this fails or not; we'll just move on to the next one */
-	zephyr->request_locations(zephyr, chk);
+	if (zephyr->request_locations(zephyr, lb->who)) {
+		lb->sent = now;
+		g_queue_push_tail(&zephyr->loc_in_flight, lb);
+		lb->in_flight = zephyr->loc_in_flight.tail;
+	}
 #endif /* WIN32 */
 
-	g_free(chk);
+	if (purple_conversations_find_im_with_account(lb->name, zephyr->account)) {
+		interval = MIN(interval, ZEPHYR_LOC_INTERVAL_ACTIVE);
+	}
+	zephyr_loc_schedule(zephyr, lb, now + interval * G_USEC_PER_SEC);
+}
+
+static gboolean check_loc(gpointer data);
+
+/* Sleep until the next buddy is due, rounded to whole seconds so the
+ * wakeups can be batched with other timers. */
+static void
+check_loc_arm(zephyr_account *zephyr, gint64 now)
+{
+	GSequenceIter *first = g_sequence_get_begin_iter(zephyr->loc_schedule);
+	guint delay = ZEPHYR_LOC_INTERVAL_MIN;
+
+	if (zephyr->loc_in_flight.length >= ZEPHYR_LOC_MAX_IN_FLIGHT) {
+		delay = 1;
+	} else if (!g_sequence_iter_is_end(first)) {
+		zephyr_loc_buddy *lb = g_sequence_get(first);
+		gint64 wait = (lb->due - now + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC;
+		delay = CLAMP(wait, 1, ZEPHYR_LOC_INTERVAL_MIN);
+	}
+
+	zephyr->loctimer = g_timeout_add_seconds(delay, check_loc, zephyr);
 }
 
 static gboolean
 check_loc(gpointer data)
 {
 	zephyr_account *zephyr = (zephyr_account *)data;
+	gint64 now = g_get_monotonic_time();
+
+	/* Requests that were never answered stop counting against the cap. */
+	while (zephyr->loc_in_flight.head) {
+		zephyr_loc_buddy *lb = zephyr->loc_in_flight.head->data;
+		if (lb->sent + ZEPHYR_LOC_REPLY_TIMEOUT * G_USEC_PER_SEC > now) {
+			break;
+		}
+		zephyr_loc_settle(zephyr, lb);
+	}
+
+	while (zephyr->loc_in_flight.length < ZEPHYR_LOC_MAX_IN_FLIGHT) {
+		GSequenceIter *first = g_sequence_get_begin_iter(zephyr->loc_schedule);
+		zephyr_loc_buddy *lb;
+
+		if (g_sequence_iter_is_end(first)) {
+			break;
+		}
+		lb = g_sequence_get(first);
+		if (lb->due > now) {
+			break;
+		}
+		/* Still waiting on the last answer; give it until it times out. */
+		if (lb->in_flight) {
+			zephyr_loc_schedule(zephyr, lb, lb->sent + ZEPHYR_LOC_REPLY_TIMEOUT * G_USEC_PER_SEC);
+			continue;
+		}
+		check_loc_buddy(zephyr, lb, now);
+	}
+
+	check_loc_arm(zephyr, now);
+	return G_SOURCE_REMOVE;
+}
+
+/* Spread the first round of polls over the minimum interval instead of
+ * sending them all at once. */
+static void
+check_loc_start(zephyr_account *zephyr)
+{
 	GSList *buddies = purple_blist_find_buddies(zephyr->account, NULL);
+	guint n = g_slist_length(buddies);
+	gint64 now = g_get_monotonic_time();
+	guint i = 0;
 
-	g_slist_foreach(buddies, (GFunc)check_loc_buddy, zephyr);
+	for (GSList *l = buddies; l; l = l->next, i++) {
+		gint64 offset = (gint64)ZEPHYR_LOC_INTERVAL_MIN * G_USEC_PER_SEC * i / n;
+		zephyr_loc_add(zephyr, purple_buddy_get_name(l->data), now + offset);
+	}
 	g_slist_free(buddies);
 
-	return G_SOURCE_CONTINUE;
+	check_loc_arm(zephyr, now);
 }
 
 static const gchar *
@@ -583,7 +844,7 @@ static void process_zsubs(zephyr_account *zephyr)
 						                   sub.zsub_class, sub.zsub_classinst, sub.zsub_recipient);
 					}
 
-					zephyr->subscrips = g_slist_append(zephyr->subscrips, zephyr_triple_new(zephyr, &sub));
+					zephyr_triple_add(zephyr, zephyr_triple_new(zephyr, &sub));
 					g_free(sub.zsub_class);
 					g_free(sub.zsub_classinst);
 					g_free(sub.zsub_recipient);
@@ -665,8 +926,9 @@ static void zephyr_login(PurpleAccount * account)
 	PurpleConnection *gc;
 	zephyr_account *zephyr;
 	ZephyrLoginFunc login;
-	GSourceFunc check_notify;
+	ZephyrCreateSourceFunc create_source;
 	ZSubscription_t sub;
+	GSource *source;
 
 	gc = purple_account_get_connection(account);
 
@@ -681,11 +943,19 @@ static void zephyr_login(PurpleAccount * account)
 
 	zephyr->account = account;
 	zephyr->exposure = get_zephyr_exposure(account);
+	g_queue_init(&zephyr->subscrips);
+	zephyr->subscrips_by_triple = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                                    g_free, NULL);
+	zephyr->subscrips_by_id = g_hash_table_new(g_direct_hash, g_direct_equal);
+	zephyr->loc_buddies = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                            (GDestroyNotify)zephyr_loc_buddy_free);
+	zephyr->loc_schedule = g_sequence_new(NULL);
+	g_queue_init(&zephyr->loc_in_flight);
 
 	if (purple_account_get_bool(account, "use_tzc", FALSE)) {
 		zephyr->connection_type = PURPLE_ZEPHYR_TZC;
 		login = tzc_login;
-		check_notify = tzc_check_notify;
+		create_source = tzc_create_source;
 		zephyr->subscribe_to = tzc_subscribe_to;
 		zephyr->request_locations = tzc_request_locations;
 		zephyr->send_message = tzc_send_message;
@@ -695,7 +965,7 @@ static void zephyr_login(PurpleAccount * account)
 	} else {
 		zephyr->connection_type = PURPLE_ZEPHYR_KRB4;
 		login = zeph02_login;
-		check_notify = zeph02_check_notify;
+		create_source = zeph02_create_source;
 		zephyr->subscribe_to = zeph02_subscribe_to;
 		zephyr->request_locations = zeph02_request_locations;
 		zephyr->send_message = zeph02_send_message;
@@ -740,8 +1010,11 @@ static void zephyr_login(PurpleAccount * account)
 		process_zsubs(zephyr);
 	}
 
-	zephyr->nottimer = g_timeout_add(100, check_notify, gc);
-	zephyr->loctimer = g_timeout_add_seconds(20, check_loc, zephyr);
+	/* Notices are handled as soon as the socket or tzc pipe is readable. */
+	source = create_source(zephyr, gc);
+	zephyr->notify_source = g_source_attach(source, NULL);
+	g_source_unref(source);
+	check_loc_start(zephyr);
 }
 
 static void write_zsubs(zephyr_account *zephyr)
@@ -751,7 +1024,7 @@ static void write_zsubs(zephyr_account *zephyr)
 	 * XXX deal with %host%, %canon%, unsubscriptions, and negative subscriptions (punts?)
 	 */
 
-	GSList *s = zephyr->subscrips;
+	GList *s = zephyr->subscrips.head;
 	zephyr_triple *zt;
 	FILE *fd;
 	char *fname;
@@ -851,14 +1124,20 @@ static void zephyr_close(PurpleConnection * gc)
 	if (purple_account_get_bool(purple_connection_get_account(gc), "write_zsubs", FALSE))
 		write_zsubs(zephyr);
 
-	g_slist_free_full(zephyr->subscrips, (GDestroyNotify)zephyr_triple_free);
+	g_clear_pointer(&zephyr->subscrips_by_triple, g_hash_table_destroy);
+	g_clear_pointer(&zephyr->subscrips_by_id, g_hash_table_destroy);
+	g_queue_foreach(&zephyr->subscrips, (GFunc)zephyr_triple_free, NULL);
+	g_queue_clear(&zephyr->subscrips);
 
-	if (zephyr->nottimer)
-		g_source_remove(zephyr->nottimer);
-	zephyr->nottimer = 0;
+	if (zephyr->notify_source)
+		g_source_remove(zephyr->notify_source);
+	zephyr->notify_source = 0;
 	if (zephyr->loctimer)
 		g_source_remove(zephyr->loctimer);
 	zephyr->loctimer = 0;
+	g_clear_pointer(&zephyr->loc_schedule, g_sequence_free);
+	g_clear_pointer(&zephyr->loc_buddies, g_hash_table_destroy);
+	g_queue_clear(&zephyr->loc_in_flight);
 	zephyr->close(zephyr);
 }
 
@@ -889,14 +1168,6 @@ zephyr_send_message(zephyr_account *zephyr, gchar *zclass, gchar *instance,
 	return result;
 }
 
-static gint
-zephyr_triple_cmp_id(gconstpointer data, gconstpointer user_data)
-{
-	const zephyr_triple *zt = data;
-	int id = GPOINTER_TO_INT(user_data);
-	return zt->id - id;
-}
-
 static const char * zephyr_get_signature(void)
 {
 	/* XXX add zephyr error reporting */
@@ -911,7 +1182,6 @@ static int
 zephyr_chat_send(PurpleProtocolChat *protocol_chat, PurpleConnection *gc,
                  int id, PurpleMessage *msg)
 {
-	GSList *l;
 	zephyr_triple *zt;
 	const char *sig;
 	PurpleChatConversation *gcc;
@@ -919,13 +1189,12 @@ zephyr_chat_send(PurpleProtocolChat *protocol_chat, PurpleConnection *gc,
 	char *recipient;
 	zephyr_account *zephyr = purple_connection_get_protocol_data(gc);
 
-	l = g_slist_find_custom(zephyr->subscrips, GINT_TO_POINTER(id), zephyr_triple_cmp_id);
-	if (!l) {
+	zt = zephyr_triple_find_by_id(zephyr, id);
+	if (!zt) {
 		/* this should never happen. */
 		return -EINVAL;
 	}
 
-	zt = l->data;
 	sig = zephyr_get_signature();
 
 	gcc = purple_conversations_find_chat_with_account(zt->name, purple_connection_get_account(gc));
@@ -1019,6 +1288,25 @@ zephyr_zloc(PurpleProtocolServer *protocol_server, PurpleConnection *gc,
 	}
 }
 
+static void
+zephyr_add_buddy(PurpleProtocolServer *protocol_server, PurpleConnection *gc,
+                 PurpleBuddy *buddy, PurpleGroup *group, const gchar *message)
+{
+	zephyr_account *zephyr = purple_connection_get_protocol_data(gc);
+
+	/* Ask about new buddies right away. */
+	zephyr_loc_add(zephyr, purple_buddy_get_name(buddy), g_get_monotonic_time());
+}
+
+static void
+zephyr_remove_buddy(PurpleProtocolServer *protocol_server, PurpleConnection *gc,
+                    PurpleBuddy *buddy, PurpleGroup *group)
+{
+	zephyr_account *zephyr = purple_connection_get_protocol_data(gc);
+
+	zephyr_loc_remove(zephyr, purple_buddy_get_name(buddy));
+}
+
 static void
 zephyr_set_status(PurpleProtocolServer *protocol_server,
                   PurpleAccount *account, PurpleStatus *status)
@@ -1132,7 +1420,6 @@ zephyr_triple_open_personal(zephyr_triple *zt, PurpleConnection *gc, char *insta
 static void
 zephyr_join_chat(PurpleConnection *gc, ZSubscription_t *sub)
 {
-	GSList *l;
 	zephyr_triple *zt;
 	zephyr_account *zephyr = purple_connection_get_protocol_data(gc);
 
@@ -1161,9 +1448,8 @@ zephyr_join_chat(PurpleConnection *gc, ZSubscription_t *sub)
 		sub->zsub_recipient = zephyr->username;
 	}
 
-	l = g_slist_find_custom(zephyr->subscrips, &sub, (GCompareFunc)zephyr_triple_subset);
-	if (l) {
-		zt = l->data;
+	zt = zephyr_triple_find(zephyr, sub);
+	if (zt) {
 		if (!zt->open) {
 			zephyr_triple_open_personal(zt, gc, sub->zsub_classinst);
 		}
@@ -1181,7 +1467,7 @@ zephyr_join_chat(PurpleConnection *gc, ZSubscription_t *sub)
 	}
 
 	zt = zephyr_triple_new(zephyr, sub);
-	zephyr->subscrips = g_slist_append(zephyr->subscrips, zt);
+	zephyr_triple_add(zephyr, zt);
 	zephyr_triple_open_personal(zt, gc, sub->zsub_classinst);
 }
 
@@ -1202,13 +1488,14 @@ zephyr_chat_leave(PurpleProtocolChat *protocol_chat, PurpleConnection * gc,
                   int id)
 {
 	zephyr_account *zephyr = purple_connection_get_protocol_data(gc);
-	GSList *l;
+	zephyr_triple *zt = zephyr_triple_find_by_id(zephyr, id);
 
-	l = g_slist_find_custom(zephyr->subscrips, GINT_TO_POINTER(id), zephyr_triple_cmp_id);
-	if (l) {
-		zephyr_triple *zt = l->data;
+	if (zt) {
+		/* Rejoining gets a fresh chat id. */
+		g_hash_table_remove(zephyr->subscrips_by_id, GINT_TO_POINTER(zt->id));
 		zt->open = FALSE;
 		zt->id = ++(zephyr->last_id);
+		g_hash_table_insert(zephyr->subscrips_by_id, GINT_TO_POINTER(zt->id), zt);
 	}
 }
 
@@ -1304,13 +1591,11 @@ static void zephyr_chat_set_topic(PurpleConnection * gc, int id, const char *top
 	PurpleChatConversation *gcc;
 	gchar *topic_utf8;
 	zephyr_account *zephyr = purple_connection_get_protocol_data(gc);
-	GSList *l;
 
-	l = g_slist_find_custom(zephyr->subscrips, GINT_TO_POINTER(id), zephyr_triple_cmp_id);
-	if (!l) {
+	zt = zephyr_triple_find_by_id(zephyr, id);
+	if (!zt) {
 		return;
 	}
-	zt = l->data;
 
 	gcc = purple_conversations_find_chat_with_account(zt->name, purple_connection_get_account(gc));
 
@@ -1540,7 +1825,7 @@ zephyr_action_resubscribe(PurpleProtocolAction *action)
 {
 	zephyr_account *zephyr = purple_connection_get_protocol_data(action->connection);
 
-	for (GSList *s = zephyr->subscrips; s; s = s->next) {
+	for (GList *s = zephyr->subscrips.head; s; s = s->next) {
 		zephyr_triple *zt = s->data;
 		/* XXX We really should care if this fails */
 		zephyr->subscribe_to(zephyr, &zt->sub);
@@ -1643,8 +1928,10 @@ zephyr_protocol_client_iface_init(PurpleProtocolClientInterface *client_iface)
 static void
 zephyr_protocol_server_iface_init(PurpleProtocolServerInterface *server_iface)
 {
-	server_iface->get_info   = zephyr_zloc;
-	server_iface->set_status = zephyr_set_status;
+	server_iface->get_info     = zephyr_zloc;
+	server_iface->set_status   = zephyr_set_status;
+	server_iface->add_buddy    = zephyr_add_buddy;
+	server_iface->remove_buddy = zephyr_remove_buddy;
 
 	server_iface->set_info       = NULL; /* XXX Location? */
 	server_iface->set_buddy_icon = NULL; /* XXX */
@@ -57,10 +57,15 @@ struct _zephyr_account {
 	char *encoding;
 	char* galaxy; /* not yet useful */
 	char* krbtkfile; /* not yet useful */
-	guint32 nottimer;
+	guint notify_source;
 	guint32 loctimer;
+	GHashTable *loc_buddies;
+	GSequence *loc_schedule;
+	GQueue loc_in_flight;
 	GList *pending_zloc_names;
-	GSList *subscrips;
+	GQueue subscrips;
+	GHashTable *subscrips_by_triple;
+	GHashTable *subscrips_by_id;
 	int last_id;
 	unsigned short port;
 	char ourhost[HOST_NAME_MAX + 1];
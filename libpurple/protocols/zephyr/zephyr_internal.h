@@ -160,6 +160,8 @@ typedef struct {
 	gchar *header;
 	gint msg_len;
 	gchar *msg;
+	GList *link;         /* in Z_input_queue */
+	GList *pending_link; /* in the expiry queue while incomplete */
 } Z_InputQ;
 
 int ZCompareUIDPred(ZNotice_t *, void *);
@@ -41,7 +41,15 @@ tzc_read(zephyr_account *zephyr, PollableInputStreamReadFunc read_func)
 
 	while (TRUE) {
 		GError *error = NULL;
-		if (read_func(stream, bufcur, &error) < 0) {
+		gssize ret = read_func(stream, bufcur, &error);
+		if (ret == 0) {
+			/* tzc went away; the pipe stays readable from now on. */
+			purple_debug_error("zephyr", "tzc closed its output");
+			purple_connection_error(purple_account_get_connection(zephyr->account), PURPLE_CONNECTION_ERROR_NETWORK_ERROR, "couldn't read");
+			g_free(buf);
+			return NULL;
+		}
+		if (ret < 0) {
 			if (error->code == G_IO_ERROR_WOULD_BLOCK ||
 			    error->code == G_IO_ERROR_TIMED_OUT) {
 				g_error_free(error);
@@ -485,8 +493,8 @@ tzc_login(zephyr_account *zephyr)
 	return TRUE;
 }
 
-gint
-tzc_check_notify(gpointer data)
+static gboolean
+tzc_check_notify(G_GNUC_UNUSED GObject *stream, gpointer data)
 {
 	PurpleConnection *gc = (PurpleConnection *)data;
 	zephyr_account* zephyr = purple_connection_get_protocol_data(gc);
@@ -496,6 +504,11 @@ tzc_check_notify(gpointer data)
 	if (buf != NULL) {
 		newparsetree = parse_buffer(buf, TRUE);
 		g_free(buf);
+	} else if (purple_connection_is_disconnecting(gc)) {
+		/* The read failed and the connection is going down; stop
+		 * watching rather than spin on a dead pipe until it does. */
+		zephyr->notify_source = 0;
+		return G_SOURCE_REMOVE;
 	}
 
 	if (newparsetree != NULL) {
@@ -550,7 +563,17 @@ tzc_check_notify(gpointer data)
 	}
 
 	g_node_destroy(newparsetree);
-	return TRUE;
+	return G_SOURCE_CONTINUE;
+}
+
+GSource *
+tzc_create_source(zephyr_account *zephyr, PurpleConnection *gc)
+{
+	GSource *source = g_pollable_input_stream_create_source(
+	        G_POLLABLE_INPUT_STREAM(zephyr->tzc_stdout), NULL);
+
+	g_source_set_callback(source, (GSourceFunc)tzc_check_notify, gc, NULL);
+	return source;
 }
 
 gboolean
@@ -26,7 +26,7 @@
 #include "zephyr_account.h"
 
 gboolean tzc_login(zephyr_account *zephyr);
-gint tzc_check_notify(gpointer data);
+GSource *tzc_create_source(zephyr_account *zephyr, PurpleConnection *gc);
 gboolean tzc_subscribe_to(zephyr_account *zephyr, ZSubscription_t *sub);
 gboolean tzc_request_locations(zephyr_account *zephyr, gchar *who);
 gboolean tzc_send_message(zephyr_account *zephyr, gchar *zclass, gchar *instance, gchar *recipient,
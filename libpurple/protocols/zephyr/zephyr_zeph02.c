@@ -89,17 +89,19 @@ handle_unknown(ZNotice_t *notice)
 	purple_debug_error("zephyr", "z_message_len: %d\n", notice->z_message_len);
 }
 
-gint
+static gboolean
 zeph02_check_notify(gpointer data)
 {
 	/* XXX add real error reporting */
 	PurpleConnection *gc = (PurpleConnection*) data;
-	while (ZPending()) {
+	/* ZPending() pulls in every datagram that is waiting and returns -1
+	 * on error, where ZReceiveNotice() would block. */
+	while (ZPending() > 0) {
 		ZNotice_t notice;
 		/* XXX add real error reporting */
 
 		if (ZReceiveNotice(&notice, NULL) != ZERR_NONE) {
-			return TRUE;
+			return G_SOURCE_CONTINUE;
 		}
 
 		switch (notice.z_kind) {
@@ -127,7 +129,62 @@ zeph02_check_notify(gpointer data)
 		ZFreeNotice(&notice);
 	}
 
-	return TRUE;
+	return G_SOURCE_CONTINUE;
+}
+
+/*
+ * libzephyr drains the socket into its own queue whenever it waits for an
+ * acknowledgement (sending, subscribing, locating), so notices can be
+ * sitting in that queue with nothing left to read on the socket.  This
+ * source is ready when either the socket is readable or the queue holds a
+ * complete notice.
+ */
+typedef struct {
+	GSource source;
+	gpointer fd_tag;
+} Zeph02Source;
+
+static gboolean
+zeph02_source_prepare(G_GNUC_UNUSED GSource *source, gint *timeout)
+{
+	*timeout = -1;
+	return ZQLength() > 0;
+}
+
+static gboolean
+zeph02_source_check(GSource *source)
+{
+	Zeph02Source *zsource = (Zeph02Source *)source;
+
+	return ZQLength() > 0 ||
+	       (g_source_query_unix_fd(source, zsource->fd_tag) & G_IO_IN);
+}
+
+static gboolean
+zeph02_source_dispatch(G_GNUC_UNUSED GSource *source, GSourceFunc callback,
+                       gpointer data)
+{
+	return callback(data);
+}
+
+static GSourceFuncs zeph02_source_funcs = {
+	zeph02_source_prepare,
+	zeph02_source_check,
+	zeph02_source_dispatch,
+	NULL
+};
+
+GSource *
+zeph02_create_source(G_GNUC_UNUSED zephyr_account *zephyr, PurpleConnection *gc)
+{
+	GSource *source = g_source_new(&zeph02_source_funcs, sizeof(Zeph02Source));
+	Zeph02Source *zsource = (Zeph02Source *)source;
+
+	zsource->fd_tag = g_source_add_unix_fd(source,
+	                                       g_socket_get_fd(ZGetSocket()),
+	                                       G_IO_IN);
+	g_source_set_callback(source, zeph02_check_notify, gc, NULL);
+	return source;
 }
 
 gboolean
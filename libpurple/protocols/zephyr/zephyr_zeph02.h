@@ -26,7 +26,7 @@
 #include "zephyr_account.h"
 
 gboolean zeph02_login(zephyr_account *zephyr);
-gint zeph02_check_notify(gpointer data);
+GSource *zeph02_create_source(zephyr_account *zephyr, PurpleConnection *gc);
 gboolean zeph02_subscribe_to(zephyr_account *zephyr, ZSubscription_t *sub);
 gboolean zeph02_request_locations(zephyr_account *zephyr, gchar *who);
 gboolean zeph02_send_message(zephyr_account *zephyr, gchar *zclass, gchar *instance, gchar *recipient,
@@ -70,6 +70,17 @@ PurpleXmlNode *_purple_account_to_xmlnode(PurpleAccount *account);
  */
 PurpleBlistNode *_purple_blist_get_last_child(PurpleBlistNode *node);
 
+/**
+ * _purple_blist_update_node_deferred:
+ * @node: The node to update.
+ *
+ * Updates @node in the UI like purple_blist_update_node(), except that while
+ * the UI is in the background the update is batched with others and
+ * delivered later.  Use this for changes the user won't miss for a few
+ * seconds, like presence.
+ */
+void _purple_blist_update_node_deferred(PurpleBlistNode *node);
+
 /* This is for the accounts code to notify the buddy icon code that
  * it's done loading.  We may want to replace this with a signal. */
 void
@@ -0,0 +1,226 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static guchar
+test_xfer_pattern(goffset offset) {
+	return (guchar)(offset % 251);
+}
+
+/* Creates a temporary file of size bytes filled with test_xfer_pattern. */
+static gchar *
+test_xfer_create_file(gsize size) {
+	GError *error = NULL;
+	gchar *path = NULL;
+	guchar *data;
+	gsize i;
+	gint fd;
+
+	fd = g_file_open_tmp("purple-xfer-XXXXXX", &path, &error);
+	g_assert_no_error(error);
+	g_close(fd, NULL);
+
+	data = g_malloc(size);
+	for (i = 0; i < size; i++) {
+		data[i] = test_xfer_pattern(i);
+	}
+
+	g_file_set_contents(path, (const gchar *)data, size, &error);
+	g_assert_no_error(error);
+	g_free(data);
+
+	return path;
+}
+
+static PurpleXfer *
+test_xfer_new(PurpleXferType type, const gchar *filename, goffset size) {
+	PurpleAccount *account = purple_account_new("test", "prpl-test");
+	PurpleXfer *xfer;
+
+	xfer = g_object_new(
+		PURPLE_TYPE_XFER,
+		"account", account,
+		"type", type,
+		"remote-user", "buddy",
+		NULL
+	);
+	purple_xfer_set_local_filename(xfer, filename);
+	purple_xfer_set_size(xfer, size);
+
+	return xfer;
+}
+
+static void
+test_xfer_assert_pattern(const guchar *data, gsize size, goffset offset) {
+	gsize i;
+
+	for (i = 0; i < size; i++) {
+		g_assert_cmpuint(data[i], ==, test_xfer_pattern(offset + i));
+	}
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+/* A protocol reading the file without an fd gets whole reads even while the
+ * read-ahead is warming up, and a file that turns out to be shorter than
+ * announced cancels the transfer instead of stalling it. */
+static void
+test_xfer_read_file_short(void) {
+	gchar *path = test_xfer_create_file(1000);
+	PurpleXfer *xfer = test_xfer_new(PURPLE_XFER_TYPE_SEND, path, 2000);
+	guchar buffer[1500];
+
+	purple_xfer_start(xfer, -1, NULL, 0);
+
+	g_assert_cmpint(purple_xfer_read_file(xfer, buffer, 500), ==, 500);
+	test_xfer_assert_pattern(buffer, 500, 0);
+
+	/* Only 500 bytes are left in the file. */
+	g_assert_cmpint(purple_xfer_read_file(xfer, buffer, 1000), ==, 500);
+	test_xfer_assert_pattern(buffer, 500, 500);
+	g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==, 1000);
+	g_assert_false(purple_xfer_is_cancelled(xfer));
+
+	/* Cancelling drops a reference, so keep ours around to check on it. */
+	g_object_ref(xfer);
+	g_assert_cmpint(purple_xfer_read_file(xfer, buffer, 1000), ==, -1);
+	g_assert_true(purple_xfer_is_cancelled(xfer));
+	g_object_unref(xfer);
+
+	g_remove(path);
+	g_free(path);
+}
+
+/* Seeking throws away what was read ahead from the old position. */
+static void
+test_xfer_read_file_seek(void) {
+	const gsize size = 1024 * 1024;
+	const goffset offset = 512 * 1024 + 7;
+	gchar *path = test_xfer_create_file(size);
+	PurpleXfer *xfer = test_xfer_new(PURPLE_XFER_TYPE_SEND, path, size);
+	guchar buffer[4096];
+
+	purple_xfer_start(xfer, -1, NULL, 0);
+
+	g_assert_cmpint(purple_xfer_read_file(xfer, buffer, sizeof(buffer)), ==,
+	                sizeof(buffer));
+	test_xfer_assert_pattern(buffer, sizeof(buffer), 0);
+
+	purple_xfer_seek(xfer, offset);
+	g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==, offset);
+
+	g_assert_cmpint(purple_xfer_read_file(xfer, buffer, sizeof(buffer)), ==,
+	                sizeof(buffer));
+	test_xfer_assert_pattern(buffer, sizeof(buffer), offset);
+	g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==,
+	                offset + sizeof(buffer));
+
+	/* Back to the start again, which has long left the read-ahead. */
+	purple_xfer_seek(xfer, 0);
+	g_assert_cmpint(purple_xfer_read_file(xfer, buffer, sizeof(buffer)), ==,
+	                sizeof(buffer));
+	test_xfer_assert_pattern(buffer, sizeof(buffer), 0);
+
+	purple_xfer_cancel_local(xfer);
+
+	g_remove(path);
+	g_free(path);
+}
+
+/* Reads from the network never take more than the rate limit allows, and
+ * nothing at all once it has been used up. */
+static void
+test_xfer_read_rate_limit(void) {
+	const gsize size = 32 * 1024;
+	gchar *source = test_xfer_create_file(size);
+	gchar *path = test_xfer_create_file(0);
+	PurpleXfer *xfer = test_xfer_new(PURPLE_XFER_TYPE_RECEIVE, path, size);
+	guchar *buffer = NULL;
+	gint fd;
+
+	/* A regular file stands in for the connection; it is always readable
+	 * and the main loop is never run, so only our reads touch it. */
+	fd = g_open(source, O_RDONLY, 0);
+	g_assert_cmpint(fd, >=, 0);
+
+	/* One byte a second still allows a first buffer of 4 KiB. */
+	purple_xfer_set_rate_limit(xfer, 1);
+	purple_xfer_start(xfer, fd, NULL, 0);
+
+	g_assert_cmpint(purple_xfer_read(xfer, &buffer), ==, 4096);
+	test_xfer_assert_pattern(buffer, 4096, 0);
+	g_free(buffer);
+
+	/* The full read grew the buffer, but the limit caps what we take. */
+	g_assert_cmpint(purple_xfer_read(xfer, &buffer), ==, 4096);
+	test_xfer_assert_pattern(buffer, 4096, 4096);
+
+	g_assert_true(purple_xfer_write_file(xfer, buffer, 4096));
+	g_free(buffer);
+
+	/* That used up the budget. */
+	buffer = NULL;
+	g_assert_cmpint(purple_xfer_read(xfer, &buffer), ==, 0);
+	g_assert_null(buffer);
+	g_assert_cmpint(purple_xfer_get_bytes_sent(xfer), ==, 4096);
+
+	purple_xfer_cancel_local(xfer);
+
+	g_remove(source);
+	g_free(source);
+	g_remove(path);
+	g_free(path);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	gint res = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_set_nonfatal_assertions();
+
+	test_ui_purple_init();
+
+	g_test_add_func("/xfer/read-file/short", test_xfer_read_file_short);
+	g_test_add_func("/xfer/read-file/seek", test_xfer_read_file_seek);
+	g_test_add_func("/xfer/read/rate-limit", test_xfer_read_rate_limit);
+
+	res = g_test_run();
+
+	return res;
+}
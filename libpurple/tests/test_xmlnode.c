@@ -133,6 +133,42 @@ test_strip_prefixes(void) {
 	purple_xmlnode_free(xml);
 }
 
+static void
+test_xmlnode_append_str(void) {
+	/* \xc2\x80 and \xc2\x85 are U+0080 and U+0085 */
+	const char *text = "1 < 2 && \"3\" > '4'\x01\t\xc2\x80\xc2\x85\xc3\xa9";
+	PurpleXmlNode *message, *body;
+	GString *str;
+	char *escaped, *expected, *xml;
+
+	message = purple_xmlnode_new("message");
+	purple_xmlnode_set_namespace(message, "jabber:client");
+	purple_xmlnode_set_attrib(message, "to", "a&b@example.com");
+	body = purple_xmlnode_new_child(message, "body");
+	purple_xmlnode_insert_data(body, text, -1);
+	purple_xmlnode_new_child(message, "active");
+
+	/* The escaping has to match what g_markup_escape_text() produces. */
+	escaped = g_markup_escape_text(text, -1);
+	expected = g_strdup_printf("prefix<message xmlns='jabber:client' "
+	                           "to='a&amp;b@example.com'><body>%s</body>"
+	                           "<active/></message>", escaped);
+
+	str = g_string_new("prefix");
+	purple_xmlnode_append_str(message, str);
+	g_assert_cmpstr(expected, ==, str->str);
+
+	/* and purple_xmlnode_to_str() is the same thing in a new string */
+	xml = purple_xmlnode_to_str(message, NULL);
+	g_assert_cmpstr(expected + sizeof("prefix") - 1, ==, xml);
+
+	g_string_free(str, TRUE);
+	g_free(xml);
+	g_free(expected);
+	g_free(escaped);
+	purple_xmlnode_free(message);
+}
+
 gint
 main(gint argc, gchar **argv) {
 	g_test_init(&argc, &argv, NULL);
@@ -143,6 +179,8 @@ main(gint argc, gchar **argv) {
 	                test_xmlnode_prefixes);
 	g_test_add_func("/xmlnode/strip_prefixes",
 	                test_strip_prefixes);
+	g_test_add_func("/xmlnode/append_str",
+	                test_xmlnode_append_str);
 
 	return g_test_run();
 }
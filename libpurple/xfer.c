@@ -43,10 +43,66 @@
 #define FT_INITIAL_BUFFER_SIZE 4096
 #define FT_MAX_BUFFER_SIZE     65535
 
+/* Local file I/O is done on a worker thread, with this many bytes of
+ * read-ahead or write-behind queued between it and the main loop. */
+#define FT_IO_CHUNK_SIZE       65536
+#define FT_IO_QUEUE_SIZE       (4 * 1024 * 1024)
+
+/* How often the throughput estimate is updated. */
+#define FT_RATE_SAMPLE_INTERVAL (G_USEC_PER_SEC / 2)
+
 typedef struct _PurpleXferPrivate  PurpleXferPrivate;
 
+/*
+ * A token bucket used to limit the transfer rate. The bucket holds at most
+ * one second worth of tokens, and may go into debt when more data than was
+ * allowed had to be accounted for.
+ */
+typedef struct {
+	gint64 rate;                 /* Bytes per second, 0 for unlimited.  */
+	gint64 tokens;               /* Bytes that may be transferred now.  */
+	gint64 updated;              /* Monotonic time of the last refill.  */
+} PurpleXferTokenBucket;
+
+/*
+ * The state shared between a transfer and the thread doing its local file
+ * I/O. Everything but the fields marked otherwise is protected by lock.
+ */
+typedef struct {
+	gint ref_count;              /* Atomic.                             */
+
+	GMutex lock;
+	GCond cond;
+
+	FILE *fp;                    /* Only used by the worker thread.     */
+	PurpleXferType type;
+	PurpleXfer *xfer;            /* Only used by the main thread.       */
+
+	GQueue chunks;               /* GBytes waiting to be written, or
+	                                read ahead and waiting to be sent.  */
+	gsize head_offset;           /* Bytes already taken from the first
+	                                read-ahead chunk.                   */
+	gsize queued;                /* Bytes in chunks.                    */
+
+	goffset seek_to;             /* Pending seek, or -1.                */
+	guint generation;            /* Bumped by every seek.               */
+
+	gboolean eof;
+	gint error;                  /* errno of the first failure.         */
+	gboolean waiting;            /* The main loop wants to be woken.    */
+	gboolean closing;
+	gboolean discard;            /* Drop whatever is still queued.      */
+} PurpleXferLocalIo;
+
+enum {
+	PURPLE_XFER_THROTTLE_NONE = 0x0,
+	PURPLE_XFER_THROTTLE_IO   = 0x1,
+	PURPLE_XFER_THROTTLE_RATE = 0x2,
+};
+
 static PurpleXferUiOps *xfer_ui_ops = NULL;
 static GList *xfers;
+static PurpleXferTokenBucket global_bucket = { 0, 0, 0 };
 
 /* Private data for a file transfer */
 struct _PurpleXferPrivate {
@@ -62,7 +118,7 @@ struct _PurpleXferPrivate {
 	char *local_filename;        /* The name on the local hard drive.   */
 	goffset size;                /* The size of the file.               */
 
-	FILE *dest_fp;               /* The destination file pointer.       */
+	PurpleXferLocalIo *local_io; /* The local file, when opened by us.  */
 
 	char *remote_ip;             /* The remote IP address.              */
 	guint16 local_port;          /* The local port.                     */
@@ -79,6 +135,16 @@ struct _PurpleXferPrivate {
 	size_t current_buffer_size;  /* This gradually increases for fast
 	                                 network connections.               */
 
+	PurpleXferTokenBucket bucket; /* The rate limit of this transfer.  */
+	gboolean rate_limit_set;     /* Whether the limit was set explicitly
+	                                or should come from the prefs.      */
+	guint throttled;             /* Why the watcher is paused.          */
+	guint throttle_timer;        /* Resumes a rate limited transfer.    */
+
+	gint64 throughput;           /* Bytes per second, smoothed.         */
+	gint64 rate_sample_time;     /* When throughput was last updated.   */
+	goffset rate_sample_bytes;   /* Bytes moved since that time.        */
+
 	PurpleXferStatus status;     /* File Transfer's status.             */
 
 	gboolean visible;            /* Hint the UI that the transfer should
@@ -126,6 +192,9 @@ enum
 	PROP_STATUS,
 	PROP_PROGRESS,
 	PROP_VISIBLE,
+	PROP_RATE_LIMIT,
+	PROP_THROUGHPUT,
+	PROP_ETA,
 	PROP_LAST
 };
 
@@ -147,6 +216,12 @@ static guint signals[SIG_LAST] = {0};
 G_DEFINE_TYPE_WITH_PRIVATE(PurpleXfer, purple_xfer, G_TYPE_OBJECT);
 
 static int purple_xfer_choose_file(PurpleXfer *xfer);
+static void purple_xfer_pause(PurpleXfer *xfer, guint reason);
+static void purple_xfer_unpause(PurpleXfer *xfer, guint reason);
+static void purple_xfer_finish(PurpleXfer *xfer);
+static void do_transfer(PurpleXfer *xfer);
+static void transfer_cb(gpointer data, gint source,
+                        PurpleInputCondition condition);
 
 static const gchar *
 purple_xfer_status_type_to_string(PurpleXferStatus type)
@@ -1084,15 +1159,721 @@ purple_xfer_set_local_port(PurpleXfer *xfer, guint16 local_port)
 	g_object_notify_by_pspec(G_OBJECT(xfer), properties[PROP_LOCAL_PORT]);
 }
 
-void
-purple_xfer_set_bytes_sent(PurpleXfer *xfer, goffset bytes_sent)
+/**************************************************************************
+ * Rate limiting
+ **************************************************************************/
+static gint64
+token_bucket_burst(const PurpleXferTokenBucket *bucket)
 {
-	PurpleXferPrivate *priv = NULL;
+	return MAX(bucket->rate, FT_INITIAL_BUFFER_SIZE);
+}
+
+static void
+token_bucket_set_rate(PurpleXferTokenBucket *bucket, gint64 rate)
+{
+	bucket->rate = MAX(rate, 0);
+	bucket->tokens = token_bucket_burst(bucket);
+	bucket->updated = g_get_monotonic_time();
+}
+
+/* Returns how many bytes may be moved right now. */
+static gint64
+token_bucket_available(PurpleXferTokenBucket *bucket, gint64 now)
+{
+	gint64 elapsed;
+
+	if (bucket->rate == 0) {
+		return G_MAXINT64;
+	}
+
+	/* The bucket never holds more than a second worth of tokens, so there
+	 * is no point in looking further back than that. */
+	elapsed = MIN(now - bucket->updated, 2 * G_USEC_PER_SEC);
+	if (elapsed > 0) {
+		gint64 refill = elapsed * bucket->rate / G_USEC_PER_SEC;
+
+		if (refill > 0) {
+			bucket->tokens = MIN(bucket->tokens + refill,
+			                     token_bucket_burst(bucket));
+			bucket->updated = now;
+		}
+	}
+
+	return MAX(bucket->tokens, 0);
+}
+
+static void
+token_bucket_consume(PurpleXferTokenBucket *bucket, gsize size)
+{
+	if (bucket->rate != 0) {
+		bucket->tokens -= (gint64)size;
+	}
+}
+
+/* Returns how long it takes until size bytes may be moved, in milliseconds. */
+static guint
+token_bucket_delay(const PurpleXferTokenBucket *bucket, gsize size)
+{
+	gint64 missing;
+
+	if (bucket->rate == 0) {
+		return 0;
+	}
+
+	missing = (gint64)size - bucket->tokens;
+	if (missing <= 0) {
+		return 0;
+	}
+
+	return (guint)MIN(missing * 1000 / bucket->rate + 1, G_MAXUINT);
+}
+
+/* Returns how many bytes this transfer may move right now, as allowed by its
+ * own and the global rate limit. */
+static gsize
+purple_xfer_rate_budget(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+	gint64 now = g_get_monotonic_time();
+	gint64 budget;
+
+	budget = MIN(token_bucket_available(&priv->bucket, now),
+	             token_bucket_available(&global_bucket, now));
+
+	return (gsize)MIN(budget, G_MAXSSIZE);
+}
+
+static gboolean
+purple_xfer_rate_resume_cb(gpointer data)
+{
+	PurpleXfer *xfer = PURPLE_XFER(data);
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+
+	priv->throttle_timer = 0;
+	purple_xfer_unpause(xfer, PURPLE_XFER_THROTTLE_RATE);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Pauses the transfer until another buffer fits into the rate limits. */
+static void
+purple_xfer_rate_wait(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+	guint delay;
+
+	purple_xfer_pause(xfer, PURPLE_XFER_THROTTLE_RATE);
+
+	if (priv->throttle_timer != 0) {
+		return;
+	}
+
+	delay = MAX(token_bucket_delay(&priv->bucket, FT_INITIAL_BUFFER_SIZE),
+	            token_bucket_delay(&global_bucket, FT_INITIAL_BUFFER_SIZE));
+
+	priv->throttle_timer = g_timeout_add(MAX(delay, 10),
+	                                     purple_xfer_rate_resume_cb, xfer);
+}
+
+/* Charges the rate limits for size bytes of file data, and updates the
+ * throughput estimate. */
+static void
+purple_xfer_account_bytes(PurpleXfer *xfer, gsize size)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+	gint64 now = g_get_monotonic_time();
+	gint64 elapsed, rate;
 	GObject *obj;
 
-	g_return_if_fail(PURPLE_IS_XFER(xfer));
+	token_bucket_consume(&priv->bucket, size);
+	token_bucket_consume(&global_bucket, size);
+
+	priv->rate_sample_bytes += size;
+
+	if (priv->rate_sample_time == 0) {
+		priv->rate_sample_time = now;
+		return;
+	}
+
+	elapsed = now - priv->rate_sample_time;
+	if (elapsed < FT_RATE_SAMPLE_INTERVAL) {
+		return;
+	}
+
+	rate = priv->rate_sample_bytes * G_USEC_PER_SEC / elapsed;
+
+	/* Smooth it out a bit so the ETA doesn't jump around. */
+	if (priv->throughput == 0) {
+		priv->throughput = rate;
+	} else {
+		priv->throughput = (3 * priv->throughput + rate) / 4;
+	}
+
+	priv->rate_sample_time = now;
+	priv->rate_sample_bytes = 0;
+
+	obj = G_OBJECT(xfer);
+	g_object_freeze_notify(obj);
+	g_object_notify_by_pspec(obj, properties[PROP_THROUGHPUT]);
+	g_object_notify_by_pspec(obj, properties[PROP_ETA]);
+	g_object_thaw_notify(obj);
+}
+
+static void
+rate_limit_pref_cb(const char *name, PurplePrefType type, gconstpointer value,
+                   gpointer data)
+{
+	token_bucket_set_rate(&global_bucket,
+	                      (gint64)GPOINTER_TO_INT(value) * 1024);
+}
+
+/**************************************************************************
+ * Local file I/O
+ *
+ * The file is read and written by a worker thread, so that a slow disk never
+ * holds up the main loop. When sending, the worker reads ahead into a queue
+ * of chunks; when receiving, it writes behind from one. Either way the queue
+ * is bounded for transfers we drive, which are paused instead of waiting on
+ * the disk. Protocols that push received data at us themselves can't be
+ * paused, so their writes just queue up; those that pull file data without
+ * an fd expect whole reads, so theirs wait for the worker.
+ **************************************************************************/
+static PurpleXferLocalIo *
+local_io_ref(PurpleXferLocalIo *io)
+{
+	g_atomic_int_inc(&io->ref_count);
+
+	return io;
+}
+
+/* Must be called with the lock held. */
+static void
+local_io_clear_chunks(PurpleXferLocalIo *io)
+{
+	GBytes *chunk;
+
+	while ((chunk = g_queue_pop_head(&io->chunks)) != NULL) {
+		g_bytes_unref(chunk);
+	}
+
+	io->head_offset = 0;
+	io->queued = 0;
+}
+
+static void
+local_io_unref(gpointer data)
+{
+	PurpleXferLocalIo *io = data;
+
+	if (!g_atomic_int_dec_and_test(&io->ref_count)) {
+		return;
+	}
+
+	local_io_clear_chunks(io);
+	g_mutex_clear(&io->lock);
+	g_cond_clear(&io->cond);
+	g_free(io);
+}
+
+static gboolean
+local_io_wakeup_cb(gpointer data)
+{
+	PurpleXferLocalIo *io = data;
+	PurpleXfer *xfer = io->xfer;
+	gint error;
+
+	g_mutex_lock(&io->lock);
+	error = io->error;
+	g_mutex_unlock(&io->lock);
+
+	if (xfer == NULL) {
+		/* The transfer is over already, but a write-behind may still have
+		 * failed after that. */
+		if (error != 0) {
+			purple_debug_error("xfer", "Writing the file failed after "
+			                   "the transfer ended: %s", g_strerror(error));
+		}
+
+		return G_SOURCE_REMOVE;
+	}
+
+	if (error != 0) {
+		purple_debug_error("xfer", "Local file I/O failed on ft %p: %s",
+		                   xfer, g_strerror(error));
+		purple_xfer_show_file_error(xfer,
+		                            purple_xfer_get_local_filename(xfer));
+		purple_xfer_cancel_local(xfer);
+
+		return G_SOURCE_REMOVE;
+	}
+
+	purple_xfer_unpause(xfer, PURPLE_XFER_THROTTLE_IO);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Must be called with the lock held. */
+static void
+local_io_wakeup(PurpleXferLocalIo *io)
+{
+	io->waiting = FALSE;
+
+	/* Idle priority keeps file transfers out of the way of everything
+	 * else going on in the main loop. */
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, local_io_wakeup_cb,
+	                local_io_ref(io), local_io_unref);
+}
+
+/* Must be called with the lock held. */
+static void
+local_io_fail(PurpleXferLocalIo *io, gint error)
+{
+	if (io->error == 0) {
+		io->error = (error != 0) ? error : EIO;
+		local_io_wakeup(io);
+	}
+
+	g_cond_broadcast(&io->cond);
+}
+
+/* Writes out the next queued chunk. Called with the lock held, and returns
+ * FALSE once everything has been written and the transfer is done with us. */
+static gboolean
+local_io_write_next(PurpleXferLocalIo *io)
+{
+	GBytes *chunk;
+	gconstpointer data;
+	gsize size, written;
+	gint error;
+
+	while (g_queue_is_empty(&io->chunks) && io->seek_to < 0 &&
+	       !io->closing && !io->discard)
+	{
+		g_cond_wait(&io->cond, &io->lock);
+	}
+
+	if (io->seek_to >= 0 || io->discard) {
+		return TRUE;
+	}
+
+	chunk = g_queue_pop_head(&io->chunks);
+	if (chunk == NULL) {
+		return FALSE;
+	}
+
+	g_mutex_unlock(&io->lock);
+
+	data = g_bytes_get_data(chunk, &size);
+	written = fwrite(data, 1, size, io->fp);
+	error = errno;
+
+	g_mutex_lock(&io->lock);
+
+	/* The chunk counts as queued until it is actually written, so that
+	 * seeking and completion can wait for it. */
+	io->queued -= size;
+	g_bytes_unref(chunk);
+
+	if (written != size) {
+		local_io_fail(io, error);
+	} else if (io->waiting && io->queued <= FT_IO_QUEUE_SIZE / 2) {
+		local_io_wakeup(io);
+	}
+
+	g_cond_broadcast(&io->cond);
+
+	return TRUE;
+}
+
+/* Reads the next chunk ahead. Called with the lock held, and returns FALSE
+ * once the transfer is done with us. */
+static gboolean
+local_io_read_next(PurpleXferLocalIo *io)
+{
+	guchar *buffer;
+	gsize got;
+	guint generation;
+	gboolean failed, eof;
+	gint error;
+
+	while ((io->eof || io->queued >= FT_IO_QUEUE_SIZE) && io->seek_to < 0 &&
+	       !io->closing && !io->discard)
+	{
+		g_cond_wait(&io->cond, &io->lock);
+	}
+
+	if (io->closing || io->discard) {
+		return FALSE;
+	}
+
+	if (io->seek_to >= 0) {
+		return TRUE;
+	}
+
+	generation = io->generation;
+	g_mutex_unlock(&io->lock);
+
+	buffer = g_malloc(FT_IO_CHUNK_SIZE);
+	got = fread(buffer, 1, FT_IO_CHUNK_SIZE, io->fp);
+	failed = (got < FT_IO_CHUNK_SIZE && ferror(io->fp));
+	error = errno;
+	eof = (got < FT_IO_CHUNK_SIZE && !failed);
+
+	g_mutex_lock(&io->lock);
+
+	if (generation != io->generation) {
+		/* The transfer seeked while we were reading, so this is stale. */
+		g_free(buffer);
+		return TRUE;
+	}
+
+	if (failed) {
+		g_free(buffer);
+		local_io_fail(io, error);
+		return TRUE;
+	}
+
+	if (got > 0) {
+		g_queue_push_tail(&io->chunks, g_bytes_new_take(buffer, got));
+		io->queued += got;
+	} else {
+		g_free(buffer);
+	}
+
+	io->eof = eof;
+	g_cond_broadcast(&io->cond);
+
+	if (io->waiting) {
+		local_io_wakeup(io);
+	}
+
+	return TRUE;
+}
+
+static gpointer
+local_io_thread(gpointer data)
+{
+	PurpleXferLocalIo *io = data;
+	gint error = 0;
+
+	g_mutex_lock(&io->lock);
+
+	while (io->error == 0 && !io->discard) {
+		gboolean more;
+
+		if (io->seek_to >= 0) {
+			goffset offset = io->seek_to;
+			gboolean failed;
+
+			io->seek_to = -1;
+			g_mutex_unlock(&io->lock);
+
+			failed = (fseek(io->fp, offset, SEEK_SET) != 0);
+			error = errno;
+
+			g_mutex_lock(&io->lock);
+
+			if (failed) {
+				local_io_fail(io, error);
+			}
+
+			continue;
+		}
+
+		if (io->type == PURPLE_XFER_TYPE_RECEIVE) {
+			more = local_io_write_next(io);
+		} else {
+			more = local_io_read_next(io);
+		}
+
+		if (!more) {
+			break;
+		}
+	}
+
+	/* Whatever is left is not wanted anymore; wait for the transfer to let
+	 * go of us before closing the file. */
+	local_io_clear_chunks(io);
+	g_cond_broadcast(&io->cond);
+
+	while (!io->closing) {
+		g_cond_wait(&io->cond, &io->lock);
+	}
+
+	g_mutex_unlock(&io->lock);
+
+	if (fclose(io->fp) != 0 && io->type == PURPLE_XFER_TYPE_RECEIVE) {
+		error = errno;
+
+		g_mutex_lock(&io->lock);
+		local_io_fail(io, error);
+		g_mutex_unlock(&io->lock);
+	}
+
+	local_io_unref(io);
+
+	return NULL;
+}
+
+static PurpleXferLocalIo *
+local_io_new(PurpleXfer *xfer, FILE *fp, PurpleXferType type)
+{
+	PurpleXferLocalIo *io = g_new0(PurpleXferLocalIo, 1);
+	GThread *thread;
+	GError *error = NULL;
+
+	io->ref_count = 1;
+	g_mutex_init(&io->lock);
+	g_cond_init(&io->cond);
+	g_queue_init(&io->chunks);
+	io->fp = fp;
+	io->type = type;
+	io->xfer = xfer;
+	io->seek_to = -1;
+
+	thread = g_thread_try_new("purple-xfer-io", local_io_thread,
+	                          local_io_ref(io), &error);
+	if (thread == NULL) {
+		purple_debug_error("xfer", "Unable to start the file I/O thread: %s",
+		                   error->message);
+		g_error_free(error);
+
+		/* Drop both the thread's reference and our own. */
+		local_io_unref(io);
+		local_io_unref(io);
+
+		return NULL;
+	}
+
+	g_thread_unref(thread);
+
+	return io;
+}
+
+/* Lets go of the file. Anything still queued for writing is written out
+ * unless discard is set; the file is closed by the worker when it's done. */
+static void
+local_io_close(PurpleXferLocalIo *io, gboolean discard)
+{
+	g_mutex_lock(&io->lock);
+	io->xfer = NULL;
+	io->closing = TRUE;
+	if (discard) {
+		io->discard = TRUE;
+	}
+	g_cond_broadcast(&io->cond);
+	g_mutex_unlock(&io->lock);
+
+	local_io_unref(io);
+}
+
+/* Returns TRUE if no more than limit bytes are waiting to be written or
+ * sent. Otherwise the worker will wake the transfer up once that changes. */
+static gboolean
+local_io_check_queued(PurpleXferLocalIo *io, gsize limit)
+{
+	gboolean ok;
+
+	g_mutex_lock(&io->lock);
+
+	if (io->error != 0) {
+		/* The worker has already scheduled a wakeup to report this. */
+		ok = FALSE;
+	} else if (io->queued <= limit) {
+		ok = TRUE;
+	} else {
+		io->waiting = TRUE;
+		ok = FALSE;
+	}
+
+	g_mutex_unlock(&io->lock);
+
+	return ok;
+}
+
+static gssize
+local_io_write(PurpleXferLocalIo *io, const guchar *buffer, gsize size)
+{
+	g_mutex_lock(&io->lock);
+
+	if (io->error != 0) {
+		g_mutex_unlock(&io->lock);
+		return -1;
+	}
+
+	g_queue_push_tail(&io->chunks, g_bytes_new(buffer, size));
+	io->queued += size;
+	g_cond_broadcast(&io->cond);
+
+	g_mutex_unlock(&io->lock);
+
+	return size;
+}
+
+/* Takes up to size bytes of read-ahead data. Returns 0 if there is none yet,
+ * in which case the worker will wake the transfer up once there is, and -1
+ * if the file failed to read or ended early. With wait set, it instead waits
+ * for the worker until size bytes or the end of the file have been read. */
+static gssize
+local_io_read(PurpleXferLocalIo *io, guchar *buffer, gsize size,
+              gboolean wait)
+{
+	gsize got = 0;
+	gboolean truncated = FALSE;
+
+	g_mutex_lock(&io->lock);
+
+	while (got < size && io->error == 0) {
+		GBytes *chunk = g_queue_peek_head(&io->chunks);
+		const guchar *data;
+		gsize len, n;
+
+		if (chunk == NULL) {
+			if (!wait || io->eof) {
+				break;
+			}
+
+			/* Let the worker know there's room again before waiting. */
+			g_cond_broadcast(&io->cond);
+			g_cond_wait(&io->cond, &io->lock);
+			continue;
+		}
+
+		data = g_bytes_get_data(chunk, &len);
+		n = MIN(len - io->head_offset, size - got);
+		memcpy(buffer + got, data + io->head_offset, n);
+
+		got += n;
+		io->head_offset += n;
+		io->queued -= n;
+
+		if (io->head_offset == len) {
+			g_bytes_unref(g_queue_pop_head(&io->chunks));
+			io->head_offset = 0;
+		}
+	}
+
+	if (io->error != 0) {
+		truncated = TRUE;
+	} else if (got == 0) {
+		if (io->eof) {
+			/* Reads only happen while bytes remain, so running out means
+			 * the file is shorter than the size we announced. */
+			truncated = TRUE;
+		} else {
+			io->waiting = TRUE;
+		}
+	}
+
+	g_cond_broadcast(&io->cond);
+	g_mutex_unlock(&io->lock);
+
+	return truncated ? -1 : (gssize)got;
+}
+
+static void
+local_io_seek(PurpleXferLocalIo *io, goffset offset)
+{
+	g_mutex_lock(&io->lock);
+
+	if (io->type == PURPLE_XFER_TYPE_RECEIVE) {
+		/* Everything queued so far belongs before the new position. */
+		while (io->error == 0 && io->queued > 0) {
+			g_cond_wait(&io->cond, &io->lock);
+		}
+	} else {
+		/* Everything read ahead so far is from the old position. */
+		local_io_clear_chunks(io);
+		io->eof = FALSE;
+		io->generation++;
+	}
+
+	io->seek_to = offset;
+	g_cond_broadcast(&io->cond);
+
+	g_mutex_unlock(&io->lock);
+}
+
+/**************************************************************************
+ * Flow control
+ **************************************************************************/
+static void
+purple_xfer_pause(PurpleXfer *xfer, guint reason)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+
+	priv->throttled |= reason;
+
+	if (priv->watcher != 0) {
+		purple_input_remove(priv->watcher);
+		purple_xfer_set_watcher(xfer, 0);
+	}
+}
+
+static void
+purple_xfer_unpause(PurpleXfer *xfer, guint reason)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+
+	if ((priv->throttled & reason) == 0) {
+		return;
+	}
+
+	priv->throttled &= ~reason;
+
+	if (priv->throttled != PURPLE_XFER_THROTTLE_NONE ||
+	    priv->status != PURPLE_XFER_STATUS_STARTED)
+	{
+		return;
+	}
+
+	if (priv->type == PURPLE_XFER_TYPE_RECEIVE && priv->size > 0 &&
+	    priv->bytes_sent >= priv->size)
+	{
+		/* Everything has arrived, we were only waiting for the disk. */
+		purple_xfer_finish(xfer);
+	} else if (priv->fd != -1) {
+		if (priv->watcher == 0) {
+			PurpleInputCondition cond;
+
+			cond = (priv->type == PURPLE_XFER_TYPE_SEND) ?
+			       PURPLE_INPUT_WRITE : PURPLE_INPUT_READ;
+			purple_xfer_set_watcher(
+				xfer,
+				purple_input_add(priv->fd, cond, transfer_cb, xfer)
+			);
+		}
+	} else {
+		/* The protocol said it was ready before we paused. */
+		do_transfer(xfer);
+	}
+}
+
+/* Stops all local I/O and any pending resumption of the transfer. */
+static void
+purple_xfer_stop_io(PurpleXfer *xfer, gboolean discard)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+
+	if (priv->throttle_timer != 0) {
+		g_source_remove(priv->throttle_timer);
+		priv->throttle_timer = 0;
+	}
+
+	priv->throttled = PURPLE_XFER_THROTTLE_NONE;
+
+	if (priv->local_io != NULL) {
+		local_io_close(priv->local_io, discard);
+		priv->local_io = NULL;
+	}
+}
+
+static void
+purple_xfer_update_bytes_sent(PurpleXfer *xfer, goffset bytes_sent)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+	GObject *obj;
 
-	priv = purple_xfer_get_instance_private(xfer);
 	priv->bytes_sent = bytes_sent;
 
 	obj = G_OBJECT(xfer);
@@ -1102,6 +1883,100 @@ purple_xfer_set_bytes_sent(PurpleXfer *xfer, goffset bytes_sent)
 	g_object_thaw_notify(obj);
 }
 
+void
+purple_xfer_set_bytes_sent(PurpleXfer *xfer, goffset bytes_sent)
+{
+	g_return_if_fail(PURPLE_IS_XFER(xfer));
+
+	purple_xfer_update_bytes_sent(xfer, bytes_sent);
+}
+
+void
+purple_xfer_seek(PurpleXfer *xfer, goffset offset)
+{
+	PurpleXferPrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_XFER(xfer));
+	g_return_if_fail(offset >= 0);
+
+	priv = purple_xfer_get_instance_private(xfer);
+
+	/* Jumping around in the file has to go through the worker. Before the
+	 * file is opened, do_open_local starts from bytes_sent anyway. */
+	if (priv->local_io != NULL && offset != priv->bytes_sent) {
+		local_io_seek(priv->local_io, offset);
+	}
+
+	purple_xfer_update_bytes_sent(xfer, offset);
+}
+
+void
+purple_xfer_set_rate_limit(PurpleXfer *xfer, gint64 rate)
+{
+	PurpleXferPrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_XFER(xfer));
+	g_return_if_fail(rate >= 0);
+
+	priv = purple_xfer_get_instance_private(xfer);
+
+	token_bucket_set_rate(&priv->bucket, rate);
+	priv->rate_limit_set = TRUE;
+
+	/* Re-evaluate a throttled transfer against the new limit right away. */
+	if (priv->throttle_timer != 0) {
+		g_source_remove(priv->throttle_timer);
+		priv->throttle_timer = g_timeout_add(0, purple_xfer_rate_resume_cb,
+		                                     xfer);
+	}
+
+	g_object_notify_by_pspec(G_OBJECT(xfer), properties[PROP_RATE_LIMIT]);
+}
+
+gint64
+purple_xfer_get_rate_limit(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_XFER(xfer), 0);
+
+	priv = purple_xfer_get_instance_private(xfer);
+	return priv->bucket.rate;
+}
+
+gint64
+purple_xfer_get_throughput(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_XFER(xfer), 0);
+
+	priv = purple_xfer_get_instance_private(xfer);
+	return priv->throughput;
+}
+
+gint64
+purple_xfer_get_eta(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = NULL;
+	goffset remaining;
+
+	g_return_val_if_fail(PURPLE_IS_XFER(xfer), -1);
+
+	priv = purple_xfer_get_instance_private(xfer);
+
+	if (purple_xfer_is_completed(xfer)) {
+		return 0;
+	}
+
+	remaining = purple_xfer_get_bytes_remaining(xfer);
+	if (priv->size <= 0 || remaining < 0 || priv->throughput <= 0) {
+		return -1;
+	}
+
+	return (remaining + priv->throughput - 1) / priv->throughput;
+}
+
 PurpleXferUiOps *
 purple_xfer_get_ui_ops(PurpleXfer *xfer)
 {
@@ -1152,7 +2027,7 @@ purple_xfer_read(PurpleXfer *xfer, guchar **buffer)
 {
 	PurpleXferPrivate *priv = NULL;
 	PurpleXferClass *klass = NULL;
-	gsize s;
+	gsize s, budget;
 	gssize r;
 
 	g_return_val_if_fail(PURPLE_IS_XFER(xfer), 0);
@@ -1169,6 +2044,15 @@ purple_xfer_read(PurpleXfer *xfer, guchar **buffer)
 		);
 	}
 
+	/* Nothing may be read until the rate limits allow it again. */
+	budget = purple_xfer_rate_budget(xfer);
+	if (budget == 0) {
+		*buffer = NULL;
+		purple_xfer_rate_wait(xfer);
+		return 0;
+	}
+	s = MIN(s, budget);
+
 	klass = PURPLE_XFER_GET_CLASS(xfer);
 	if(klass && klass->read) {
 		r = klass->read(xfer, buffer, s);
@@ -1233,12 +2117,12 @@ do_write_local(PurpleXfer *xfer, const guchar *buffer, gssize size)
 {
 	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
 
-	if (priv->dest_fp == NULL) {
+	if (priv->local_io == NULL) {
 		purple_debug_error("xfer", "File is not opened for writing");
 		return -1;
 	}
 
-	return fwrite(buffer, 1, size, priv->dest_fp);
+	return local_io_write(priv->local_io, buffer, size);
 }
 
 gboolean
@@ -1273,7 +2157,8 @@ purple_xfer_write_file(PurpleXfer *xfer, const guchar *buffer, gsize size)
 		return FALSE;
 	}
 
-	purple_xfer_set_bytes_sent(
+	purple_xfer_account_bytes(xfer, size);
+	purple_xfer_update_bytes_sent(
 		xfer,
 		purple_xfer_get_bytes_sent(xfer) + size
 	);
@@ -1287,13 +2172,15 @@ do_read_local(PurpleXfer *xfer, guchar *buffer, gssize size)
 	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
 	gssize got_len;
 
-	if (priv->dest_fp == NULL) {
+	if (priv->local_io == NULL) {
 		purple_debug_error("xfer", "File is not opened for reading");
 		return -1;
 	}
 
-	got_len = fread(buffer, 1, size, priv->dest_fp);
-	if ((got_len < 0 || got_len != size) && ferror(priv->dest_fp)) {
+	/* Protocols reading the file without an fd want whole reads, the same
+	 * as fread() would give them, and have no way to be woken up later. */
+	got_len = local_io_read(priv->local_io, buffer, size, priv->fd == -1);
+	if (got_len < 0) {
 		purple_debug_error("xfer", "Unable to read file.");
 		return -1;
 	}
@@ -1317,7 +2204,8 @@ purple_xfer_read_file(PurpleXfer *xfer, guchar *buffer, gsize size)
 	}
 
 	if (got_len > 0) {
-		purple_xfer_set_bytes_sent(xfer,
+		purple_xfer_account_bytes(xfer, got_len);
+		purple_xfer_update_bytes_sent(xfer,
 			purple_xfer_get_bytes_sent(xfer) + got_len);
 	}
 
@@ -1345,6 +2233,11 @@ do_transfer(PurpleXfer *xfer)
 	gssize r = 0;
 
 	if (priv->type == PURPLE_XFER_TYPE_RECEIVE) {
+		if (purple_xfer_rate_budget(xfer) < FT_INITIAL_BUFFER_SIZE) {
+			purple_xfer_rate_wait(xfer);
+			return;
+		}
+
 		r = purple_xfer_read(xfer, &buffer);
 		if (r > 0) {
 			if (!purple_xfer_write_file(xfer, buffer, r)) {
@@ -1352,6 +2245,13 @@ do_transfer(PurpleXfer *xfer)
 				return;
 			}
 
+			/* Stop reading from the network while the disk catches up. */
+			if (priv->local_io != NULL &&
+			    !local_io_check_queued(priv->local_io, FT_IO_QUEUE_SIZE))
+			{
+				purple_xfer_pause(xfer, PURPLE_XFER_THROTTLE_IO);
+			}
+
 		} else if(r < 0) {
 			purple_xfer_cancel_remote(xfer);
 			g_free(buffer);
@@ -1363,6 +2263,7 @@ do_transfer(PurpleXfer *xfer)
 			(gsize)purple_xfer_get_bytes_remaining(xfer),
 			(gsize)priv->current_buffer_size
 		);
+		gsize budget;
 		gboolean read_more = TRUE;
 		gboolean existing_buffer = FALSE;
 
@@ -1376,6 +2277,13 @@ do_transfer(PurpleXfer *xfer)
 			return;
 		}
 
+		budget = purple_xfer_rate_budget(xfer);
+		if (budget < FT_INITIAL_BUFFER_SIZE) {
+			purple_xfer_rate_wait(xfer);
+			return;
+		}
+		s = MIN(s, budget);
+
 		if (priv->buffer) {
 			existing_buffer = TRUE;
 			if (priv->buffer->len < s) {
@@ -1389,6 +2297,13 @@ do_transfer(PurpleXfer *xfer)
 		if (read_more) {
 			buffer = g_new(guchar, s);
 			result = purple_xfer_read_file(xfer, buffer, s);
+			if (result == 0 && priv->local_io != NULL) {
+				/* Nothing has been read ahead yet; the worker wakes us
+				 * up once there is. */
+				purple_xfer_pause(xfer, PURPLE_XFER_THROTTLE_IO);
+				g_free(buffer);
+				return;
+			}
 			if (result == 0) {
 				/*
 				 * The UI claimed it was ready, but didn't have any data for
@@ -1465,8 +2380,25 @@ do_transfer(PurpleXfer *xfer)
 
 	g_free(buffer);
 
+	purple_xfer_finish(xfer);
+}
+
+static void
+purple_xfer_finish(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+
 	if (purple_xfer_get_bytes_sent(xfer) >= purple_xfer_get_size(xfer) &&
 			!purple_xfer_is_completed(xfer)) {
+		/* Don't claim the file is complete while it's still being
+		 * written out. */
+		if (priv->type == PURPLE_XFER_TYPE_RECEIVE && priv->local_io != NULL &&
+		    !local_io_check_queued(priv->local_io, 0))
+		{
+			purple_xfer_pause(xfer, PURPLE_XFER_THROTTLE_IO);
+			return;
+		}
+
 		purple_xfer_set_completed(xfer, TRUE);
 	}
 
@@ -1484,7 +2416,7 @@ transfer_cb(gpointer data, gint source, PurpleInputCondition condition)
 	PurpleXfer *xfer = data;
 	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
 
-	if (priv->dest_fp == NULL) {
+	if (priv->local_io == NULL) {
 		/* The UI is moderating its side manually */
 		if (0 == (priv->ready & PURPLE_XFER_READY_UI)) {
 			priv->ready |= PURPLE_XFER_READY_PROTOCOL;
@@ -1506,19 +2438,35 @@ static gboolean
 do_open_local(PurpleXfer *xfer)
 {
 	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+	FILE *fp;
+
+	/* A receive picking up where an earlier one stopped keeps what is
+	 * already there; the seek below moves past it. */
+	if (priv->type != PURPLE_XFER_TYPE_RECEIVE) {
+		fp = g_fopen(purple_xfer_get_local_filename(xfer), "rb");
+	} else if (priv->bytes_sent > 0) {
+		fp = g_fopen(purple_xfer_get_local_filename(xfer), "r+b");
+	} else {
+		fp = g_fopen(purple_xfer_get_local_filename(xfer), "wb");
+	}
 
-	priv->dest_fp =
-	        g_fopen(purple_xfer_get_local_filename(xfer),
-	                priv->type == PURPLE_XFER_TYPE_RECEIVE ? "wb" : "rb");
-
-	if (priv->dest_fp == NULL) {
+	if (fp == NULL) {
 		purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
 		return FALSE;
 	}
 
-	if (fseek(priv->dest_fp, priv->bytes_sent, SEEK_SET) != 0) {
+	if (fseek(fp, priv->bytes_sent, SEEK_SET) != 0) {
 		purple_debug_error("xfer", "couldn't seek");
 		purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+		fclose(fp);
+		return FALSE;
+	}
+
+	/* From here on the file belongs to the worker thread. */
+	priv->local_io = local_io_new(xfer, fp, priv->type);
+	if (priv->local_io == NULL) {
+		purple_xfer_show_file_error(xfer, purple_xfer_get_local_filename(xfer));
+		fclose(fp);
 		return FALSE;
 	}
 
@@ -1537,6 +2485,12 @@ begin_transfer(PurpleXfer *xfer, PurpleInputCondition cond)
 		g_return_if_reached();
 	}
 
+	if (!priv->rate_limit_set) {
+		token_bucket_set_rate(&priv->bucket,
+			(gint64)purple_prefs_get_int(
+				"/purple/filetransfer/transfer_rate_limit") * 1024);
+	}
+
 	g_signal_emit(xfer, signals[SIG_OPEN_LOCAL], 0, &open_status);
 	if (!open_status) {
 		purple_xfer_cancel_local(xfer);
@@ -1550,6 +2504,7 @@ begin_transfer(PurpleXfer *xfer, PurpleInputCondition cond)
 	}
 
 	priv->start_time = g_get_monotonic_time();
+	priv->rate_sample_time = priv->start_time;
 
 	g_object_notify_by_pspec(G_OBJECT(xfer), properties[PROP_START_TIME]);
 
@@ -1629,8 +2584,9 @@ purple_xfer_protocol_ready(PurpleXfer *xfer)
 
 	priv->ready |= PURPLE_XFER_READY_PROTOCOL;
 
-	/* I don't think fwrite/fread are ever *not* ready */
-	if (priv->dest_fp == NULL && 0 == (priv->ready & PURPLE_XFER_READY_UI)) {
+	/* Our own local file I/O is always ready, any waiting for the disk is
+	 * handled by do_transfer */
+	if (priv->local_io == NULL && 0 == (priv->ready & PURPLE_XFER_READY_UI)) {
 		purple_debug_misc("xfer", "Protocol is ready on ft %p, waiting for UI\n", xfer);
 		return;
 	}
@@ -1738,13 +2694,9 @@ purple_xfer_end(PurpleXfer *xfer)
 		}
 	}
 
-	if (priv->dest_fp != NULL) {
-		if (fclose(priv->dest_fp)) {
-			purple_debug_error("xfer", "closing dest file in purple_xfer_end() failed: %s",
-					g_strerror(errno));
-		}
-		priv->dest_fp = NULL;
-	}
+	/* Anything still queued is written out, and any failure to do so is
+	 * logged, by the worker. */
+	purple_xfer_stop_io(xfer, FALSE);
 
 	g_object_unref(xfer);
 }
@@ -1812,10 +2764,7 @@ purple_xfer_cancel_local(PurpleXfer *xfer)
 		close(priv->fd);
 	}
 
-	if (priv->dest_fp != NULL) {
-		fclose(priv->dest_fp);
-		priv->dest_fp = NULL;
-	}
+	purple_xfer_stop_io(xfer, TRUE);
 
 	g_object_unref(xfer);
 }
@@ -1875,10 +2824,7 @@ purple_xfer_cancel_remote(PurpleXfer *xfer)
 	if (priv->fd != -1)
 		close(priv->fd);
 
-	if (priv->dest_fp != NULL) {
-		fclose(priv->dest_fp);
-		priv->dest_fp = NULL;
-	}
+	purple_xfer_stop_io(xfer, TRUE);
 
 	g_object_unref(xfer);
 }
@@ -2026,6 +2972,9 @@ purple_xfer_set_property(GObject *obj, guint param_id, const GValue *value,
 		case PROP_VISIBLE:
 			purple_xfer_set_visible(xfer, g_value_get_boolean(value));
 			break;
+		case PROP_RATE_LIMIT:
+			purple_xfer_set_rate_limit(xfer, g_value_get_int64(value));
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
 			break;
@@ -2093,6 +3042,15 @@ purple_xfer_get_property(GObject *obj, guint param_id, GValue *value,
 		case PROP_VISIBLE:
 			g_value_set_boolean(value, purple_xfer_get_visible(xfer));
 			break;
+		case PROP_RATE_LIMIT:
+			g_value_set_int64(value, purple_xfer_get_rate_limit(xfer));
+			break;
+		case PROP_THROUGHPUT:
+			g_value_set_int64(value, purple_xfer_get_throughput(xfer));
+			break;
+		case PROP_ETA:
+			g_value_set_int64(value, purple_xfer_get_eta(xfer));
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
 			break;
@@ -2142,6 +3100,8 @@ purple_xfer_finalize(GObject *object)
 
 	xfers = g_list_remove(xfers, xfer);
 
+	purple_xfer_stop_io(xfer, TRUE);
+
 	g_free(priv->who);
 	g_free(priv->filename);
 	g_free(priv->remote_ip);
@@ -2271,6 +3231,25 @@ purple_xfer_class_init(PurpleXferClass *klass)
 	        "Hint for UIs whether this transfer should be visible.", FALSE,
 	        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+	properties[PROP_RATE_LIMIT] = g_param_spec_int64(
+	        "rate-limit", "Rate limit",
+	        "The maximum transfer rate in bytes per second, or 0 for none.",
+	        0, G_MAXINT64, 0,
+	        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+	properties[PROP_THROUGHPUT] = g_param_spec_int64(
+	        "throughput", "Throughput",
+	        "The current transfer rate in bytes per second.",
+	        0, G_MAXINT64, 0,
+	        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+	properties[PROP_ETA] = g_param_spec_int64(
+	        "eta", "ETA",
+	        "The estimated number of seconds until the transfer completes, "
+	        "or -1 if unknown.",
+	        -1, G_MAXINT64, -1,
+	        G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
 	g_object_class_install_properties(obj_class, PROP_LAST, properties);
 
 	/* Signals */
@@ -2327,10 +3306,12 @@ purple_xfer_class_init(PurpleXferClass *klass)
 	 *
 	 * Read data locally to send to the protocol for a file transfer.
 	 *
-	 * The default class handler will read from a file using standard library
-	 * functions. If you connect to this signal, you must connect to
-	 * PurpleXfer::open-local, PurpleXfer::query-local, PurpleXfer::write-local
-	 * and PurpleXfer::data-not-sent as well.
+	 * The default class handler takes data a worker thread has read ahead
+	 * from the file. When the transfer has a file descriptor, it returns 0
+	 * until some is available and resumes the transfer once there is;
+	 * otherwise it waits for the worker. If you connect to this signal, you
+	 * must connect to PurpleXfer::open-local, PurpleXfer::query-local,
+	 * PurpleXfer::write-local and PurpleXfer::data-not-sent as well.
 	 *
 	 * Returns: The amount of data in the buffer, 0 if nothing is available,
 	 *          and a negative value if an error occurred and the transfer
@@ -2353,8 +3334,8 @@ purple_xfer_class_init(PurpleXferClass *klass)
 	 * deal with the entire buffer and return size, or it is treated as an
 	 * error.
 	 *
-	 * The default class handler will write to a file using standard library
-	 * functions. If you connect to this signal, you must connect to
+	 * The default class handler queues the data for a worker thread to write
+	 * to the file. If you connect to this signal, you must connect to
 	 * PurpleXfer::open-local, PurpleXfer::query-local, PurpleXfer::read-local
 	 * and PurpleXfer::data-not-sent as well.
 	 *
@@ -2462,6 +3443,16 @@ purple_xfers_init(void) {
 	purple_signal_register(handle, "file-recv-request",
 	                     purple_marshal_VOID__POINTER, G_TYPE_NONE, 1,
 	                     PURPLE_TYPE_XFER);
+
+	/* Rate limits in KiB/s, 0 for unlimited. */
+	purple_prefs_add_none("/purple/filetransfer");
+	purple_prefs_add_int("/purple/filetransfer/rate_limit", 0);
+	purple_prefs_add_int("/purple/filetransfer/transfer_rate_limit", 0);
+
+	token_bucket_set_rate(&global_bucket,
+		(gint64)purple_prefs_get_int("/purple/filetransfer/rate_limit") * 1024);
+	purple_prefs_connect_callback(handle, "/purple/filetransfer/rate_limit",
+	                              rate_limit_pref_cb, NULL);
 }
 
 void
@@ -2469,6 +3460,7 @@ purple_xfers_uninit(void)
 {
 	void *handle = purple_xfers_get_handle();
 
+	purple_prefs_disconnect_by_handle(handle);
 	purple_signals_disconnect_by_handle(handle);
 	purple_signals_unregister_by_instance(handle);
 }
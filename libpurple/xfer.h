@@ -540,19 +540,88 @@ void purple_xfer_set_local_port(PurpleXfer *xfer, guint16 local_port);
 /**
  * purple_xfer_set_bytes_sent:
  * @xfer:       The file transfer.
- * @bytes_sent: The new current position in the file.  If we're
- *                   sending a file then this is the next byte that we
- *                   will send.  If we're receiving a file, this is the
- *                   next byte that we expect to receive.
+ * @bytes_sent: The number of bytes sent or received so far.
  *
- * Sets the current working position in the active file transfer.  This
- * can be used to jump backward in the file if the protocol detects
- * that some bit of data needs to be resent or has been sent twice.
- *
- * It's used for pausing and resuming an oscar file transfer.
+ * Sets how far along the file transfer is.  This only updates the progress;
+ * purple_xfer_read_file() and purple_xfer_write_file() already count what
+ * they move.  To continue from another position in the local file, use
+ * purple_xfer_seek() instead.
  */
 void purple_xfer_set_bytes_sent(PurpleXfer *xfer, goffset bytes_sent);
 
+/**
+ * purple_xfer_seek:
+ * @xfer:   The file transfer.
+ * @offset: The new current position in the file.  If we're sending a file
+ *          then this is the next byte that we will send.  If we're receiving
+ *          a file, this is the next byte that we expect to receive.
+ *
+ * Sets the current working position in the file transfer, and moves the
+ * local file there if it is open already.  This can be used to resume a
+ * transfer, or to jump backward in the file if the protocol detects that
+ * some bit of data needs to be resent.
+ *
+ * Since: 3.0.0
+ */
+void purple_xfer_seek(PurpleXfer *xfer, goffset offset);
+
+/**
+ * purple_xfer_set_rate_limit:
+ * @xfer: The file transfer.
+ * @rate: The maximum rate in bytes per second, or 0 for no limit.
+ *
+ * Limits how fast the file transfer may send or receive.  The global limit
+ * from the <literal>/purple/filetransfer/rate_limit</literal> pref applies
+ * on top of this.  If this is never called, the limit is taken from the
+ * <literal>/purple/filetransfer/transfer_rate_limit</literal> pref when the
+ * transfer starts.
+ *
+ * Only transfers that libpurple drives, through a file descriptor or
+ * purple_xfer_protocol_ready(), are held back.  Data that a protocol reads
+ * or writes with purple_xfer_read_file() or purple_xfer_write_file() on its
+ * own still counts against the limits, but is never delayed.
+ *
+ * Since: 3.0.0
+ */
+void purple_xfer_set_rate_limit(PurpleXfer *xfer, gint64 rate);
+
+/**
+ * purple_xfer_get_rate_limit:
+ * @xfer: The file transfer.
+ *
+ * Returns the rate limit of the file transfer.
+ *
+ * Returns: The maximum rate in bytes per second, or 0 for no limit.
+ *
+ * Since: 3.0.0
+ */
+gint64 purple_xfer_get_rate_limit(PurpleXfer *xfer);
+
+/**
+ * purple_xfer_get_throughput:
+ * @xfer: The file transfer.
+ *
+ * Returns the current transfer rate, averaged over the last few seconds.
+ *
+ * Returns: The transfer rate in bytes per second.
+ *
+ * Since: 3.0.0
+ */
+gint64 purple_xfer_get_throughput(PurpleXfer *xfer);
+
+/**
+ * purple_xfer_get_eta:
+ * @xfer: The file transfer.
+ *
+ * Returns the estimated time until the file transfer completes, based on
+ * its current throughput.
+ *
+ * Returns: The number of seconds remaining, or -1 if unknown.
+ *
+ * Since: 3.0.0
+ */
+gint64 purple_xfer_get_eta(PurpleXfer *xfer);
+
 /**
  * purple_xfer_get_ui_ops:
  * @xfer: The file transfer.
@@ -568,9 +637,10 @@ PurpleXferUiOps *purple_xfer_get_ui_ops(PurpleXfer *xfer);
  * @xfer:   The file transfer.
  * @buffer: The buffer that will be created to contain the data.
  *
- * Reads in data from a file transfer stream.
+ * Reads in data from a file transfer stream, no more than the rate limits
+ * allow right now.
  *
- * Returns: The number of bytes read, or -1.
+ * Returns: The number of bytes read, 0 if nothing may be read yet, or -1.
  */
 gssize purple_xfer_read(PurpleXfer *xfer, guchar **buffer);
 
@@ -597,10 +597,167 @@ purple_xmlnode_to_str_helper(const PurpleXmlNode *node, int *len, gboolean forma
 	return g_string_free(text, FALSE);
 }
 
+/*
+ * Append text escaped the same way g_markup_escape_text() would, without
+ * the intermediate copy.  Runs of bytes that need no escaping are copied
+ * in one go.
+ */
+static void
+purple_xmlnode_append_escaped(GString *str, const char *text, gssize len)
+{
+	const guchar *p = (const guchar *)text, *run = p, *end;
+
+	if (len < 0)
+		len = strlen(text);
+	end = p + len;
+
+	while (p < end) {
+		const char *entity = NULL;
+		guint c = 0;
+		gsize skip = 1;
+
+		switch (*p) {
+			case '&':
+				entity = "&amp;";
+				break;
+			case '<':
+				entity = "&lt;";
+				break;
+			case '>':
+				entity = "&gt;";
+				break;
+			case '\'':
+				entity = "&apos;";
+				break;
+			case '"':
+				entity = "&quot;";
+				break;
+			default:
+				if ((*p >= 0x1 && *p <= 0x8) || *p == 0xb || *p == 0xc ||
+				    (*p >= 0xe && *p <= 0x1f) || *p == 0x7f) {
+					c = *p;
+				} else if (*p == 0xc2 && p + 1 < end &&
+				           p[1] >= 0x80 && p[1] <= 0x9f && p[1] != 0x85) {
+					/* C1 control characters, U+0080 to U+009F */
+					c = p[1];
+					skip = 2;
+				} else {
+					p++;
+					continue;
+				}
+				break;
+		}
+
+		g_string_append_len(str, (const char *)run, p - run);
+		if (entity)
+			g_string_append(str, entity);
+		else
+			g_string_append_printf(str, "&#x%x;", c);
+		p += skip;
+		run = p;
+	}
+
+	g_string_append_len(str, (const char *)run, p - run);
+}
+
+void
+purple_xmlnode_append_str(const PurpleXmlNode *node, GString *str)
+{
+	const char *prefix;
+	const PurpleXmlNode *c;
+	gboolean need_end = FALSE;
+
+	g_return_if_fail(node != NULL);
+	g_return_if_fail(str != NULL);
+
+	prefix = purple_xmlnode_get_prefix(node);
+
+	g_string_append_c(str, '<');
+	if (prefix) {
+		g_string_append(str, prefix);
+		g_string_append_c(str, ':');
+	}
+	purple_xmlnode_append_escaped(str, node->name, -1);
+
+	if (node->namespace_map) {
+		g_hash_table_foreach(node->namespace_map,
+			(GHFunc)purple_xmlnode_to_str_foreach_append_ns, str);
+	} else {
+		/* Figure out if this node has a different default namespace from parent */
+		const char *xmlns = NULL;
+		const char *parent_xmlns = NULL;
+		if (!prefix)
+			xmlns = node->xmlns;
+
+		if (!xmlns)
+			xmlns = purple_xmlnode_get_default_namespace(node);
+		if (node->parent)
+			parent_xmlns = purple_xmlnode_get_default_namespace(node->parent);
+		if (!purple_strequal(xmlns, parent_xmlns)) {
+			g_string_append(str, " xmlns='");
+			if (xmlns)
+				purple_xmlnode_append_escaped(str, xmlns, -1);
+			g_string_append_c(str, '\'');
+		}
+	}
+
+	for (c = node->child; c; c = c->next) {
+		if (c->type == PURPLE_XMLNODE_TYPE_ATTRIB) {
+			const char *aprefix = purple_xmlnode_get_prefix(c);
+
+			g_string_append_c(str, ' ');
+			if (aprefix) {
+				g_string_append(str, aprefix);
+				g_string_append_c(str, ':');
+			}
+			purple_xmlnode_append_escaped(str, c->name, -1);
+			g_string_append(str, "='");
+			purple_xmlnode_append_escaped(str, c->data, -1);
+			g_string_append_c(str, '\'');
+		} else if (c->type == PURPLE_XMLNODE_TYPE_TAG ||
+		           c->type == PURPLE_XMLNODE_TYPE_DATA) {
+			need_end = TRUE;
+		}
+	}
+
+	if (!need_end) {
+		g_string_append(str, "/>");
+		return;
+	}
+
+	g_string_append_c(str, '>');
+
+	for (c = node->child; c; c = c->next) {
+		if (c->type == PURPLE_XMLNODE_TYPE_TAG) {
+			purple_xmlnode_append_str(c, str);
+		} else if (c->type == PURPLE_XMLNODE_TYPE_DATA && c->data_sz > 0) {
+			purple_xmlnode_append_escaped(str, c->data, c->data_sz);
+		}
+	}
+
+	g_string_append(str, "</");
+	if (prefix) {
+		g_string_append(str, prefix);
+		g_string_append_c(str, ':');
+	}
+	purple_xmlnode_append_escaped(str, node->name, -1);
+	g_string_append_c(str, '>');
+}
+
 char *
 purple_xmlnode_to_str(const PurpleXmlNode *node, int *len)
 {
-	return purple_xmlnode_to_str_helper(node, len, FALSE, 0);
+	GString *text;
+
+	g_return_val_if_fail(node != NULL, NULL);
+
+	text = g_string_new(NULL);
+	purple_xmlnode_append_str(node, text);
+
+	if (len)
+		*len = text->len;
+
+	return g_string_free(text, FALSE);
 }
 
 char *
@@ -369,6 +369,19 @@ PurpleXmlNode *purple_xmlnode_get_parent(const PurpleXmlNode *child);
  */
 char *purple_xmlnode_to_str(const PurpleXmlNode *node, int *len);
 
+/**
+ * purple_xmlnode_append_str:
+ * @node: The starting node to output.
+ * @str:  The string to append to.
+ *
+ * Serializes the node the same way as purple_xmlnode_to_str(), but appends
+ * the xml to @str instead of allocating a new string.  This lets callers
+ * that send a lot of stanzas reuse one buffer.
+ *
+ * Since: 3.0.0
+ */
+void purple_xmlnode_append_str(const PurpleXmlNode *node, GString *str);
+
 /**
  * purple_xmlnode_to_formatted_str:
  * @node: The starting node to output.
@@ -2580,14 +2580,140 @@ do_alphashift(GdkPixbuf *pixbuf, int shift)
 	}
 }
 
+/*
+ * Decoded and scaled buddy icons, so that drawing the same icon again (for
+ * another row, a tooltip or after a status change) doesn't decode it again.
+ * Entries are keyed by the icon's content-addressed filename and the size it
+ * was scaled to, and the least recently used ones are dropped once the pixel
+ * data goes over BUDDY_ICON_CACHE_SIZE.
+ */
+#define BUDDY_ICON_CACHE_SIZE (24 * 1024 * 1024)
+
+typedef struct {
+	gchar *key;
+	GdkPixbuf *pixbuf;
+	gsize size;
+} BuddyIconCacheEntry;
+
+/* key -> link in buddy_icon_lru */
+static GHashTable *buddy_icon_cache = NULL;
+/* BuddyIconCacheEntry, most recently used first */
+static GQueue buddy_icon_lru = G_QUEUE_INIT;
+static gsize buddy_icon_cache_size = 0;
+
+static void
+buddy_icon_cache_entry_free(BuddyIconCacheEntry *entry)
+{
+	g_free(entry->key);
+	g_object_unref(entry->pixbuf);
+	g_free(entry);
+}
+
+static GdkPixbuf *
+buddy_icon_cache_lookup(const gchar *key)
+{
+	GList *link = g_hash_table_lookup(buddy_icon_cache, key);
+
+	if (link == NULL) {
+		return NULL;
+	}
+
+	g_queue_unlink(&buddy_icon_lru, link);
+	g_queue_push_head_link(&buddy_icon_lru, link);
+
+	return ((BuddyIconCacheEntry *)link->data)->pixbuf;
+}
+
+/* Takes ownership of key, but not of pixbuf. */
+static void
+buddy_icon_cache_insert(gchar *key, GdkPixbuf *pixbuf)
+{
+	BuddyIconCacheEntry *entry = g_new(BuddyIconCacheEntry, 1);
+
+	entry->key = key;
+	entry->pixbuf = g_object_ref(pixbuf);
+	entry->size = gdk_pixbuf_get_byte_length(pixbuf);
+
+	g_queue_push_head(&buddy_icon_lru, entry);
+	g_hash_table_insert(buddy_icon_cache, entry->key, buddy_icon_lru.head);
+	buddy_icon_cache_size += entry->size;
+
+	while (buddy_icon_cache_size > BUDDY_ICON_CACHE_SIZE &&
+			buddy_icon_lru.length > 1) {
+		BuddyIconCacheEntry *old = g_queue_pop_tail(&buddy_icon_lru);
+
+		g_hash_table_remove(buddy_icon_cache, old->key);
+		buddy_icon_cache_size -= old->size;
+		buddy_icon_cache_entry_free(old);
+	}
+}
+
+static void
+buddy_icon_cache_clear(void)
+{
+	g_hash_table_remove_all(buddy_icon_cache);
+
+	while (!g_queue_is_empty(&buddy_icon_lru)) {
+		buddy_icon_cache_entry_free(g_queue_pop_head(&buddy_icon_lru));
+	}
+	buddy_icon_cache_size = 0;
+}
+
+static GdkPixbuf *
+pidgin_blist_scale_buddy_icon(PurpleImage *img, gboolean scaled,
+                              PurpleBuddyIconSpec *icon_spec)
+{
+	GdkPixbuf *buf, *ret;
+	gint orig_width, orig_height, scale_width, scale_height;
+
+	buf = pidgin_pixbuf_from_image(img);
+	if (!buf) {
+		return NULL;
+	}
+
+	/* I'd use the pidgin_buddy_icon_get_scale_size() thing, but it won't
+	 * tell me the original size, which I need for scaling purposes. */
+	scale_width = orig_width = gdk_pixbuf_get_width(buf);
+	scale_height = orig_height = gdk_pixbuf_get_height(buf);
+
+	if (icon_spec && icon_spec->scale_rules & PURPLE_ICON_SCALE_DISPLAY)
+		purple_buddy_icon_spec_get_scaled_size(icon_spec, &scale_width, &scale_height);
+
+	if (scaled || scale_height > 200 || scale_width > 200) {
+		GdkPixbuf *tmpbuf;
+		float scale_size = scaled ? 32.0 : 200.0;
+		if(scale_height > scale_width) {
+			scale_width = scale_size * (double)scale_width / (double)scale_height;
+			scale_height = scale_size;
+		} else {
+			scale_height = scale_size * (double)scale_height / (double)scale_width;
+			scale_width = scale_size;
+		}
+		/* Scale & round before making square, so rectangular (but
+		 * non-square) images get rounded corners too. */
+		tmpbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, scale_width, scale_height);
+		gdk_pixbuf_fill(tmpbuf, 0x00000000);
+		gdk_pixbuf_scale(buf, tmpbuf, 0, 0, scale_width, scale_height, 0, 0, (double)scale_width/(double)orig_width, (double)scale_height/(double)orig_height, GDK_INTERP_BILINEAR);
+		if (pidgin_gdk_pixbuf_is_opaque(tmpbuf))
+			pidgin_gdk_pixbuf_make_round(tmpbuf);
+		ret = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, scale_size, scale_size);
+		gdk_pixbuf_fill(ret, 0x00000000);
+		gdk_pixbuf_copy_area(tmpbuf, 0, 0, scale_width, scale_height, ret, (scale_size-scale_width)/2, (scale_size-scale_height)/2);
+		g_object_unref(G_OBJECT(tmpbuf));
+	} else {
+		ret = gdk_pixbuf_scale_simple(buf,scale_width,scale_height, GDK_INTERP_BILINEAR);
+	}
+	g_object_unref(G_OBJECT(buf));
+
+	return ret;
+}
 
 static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
                                               gboolean scaled, gboolean greyed)
 {
-	gsize len;
 	PurpleBuddy *buddy = NULL;
 	PurpleGroup *group = NULL;
-	const guchar *data = NULL;
+	PurpleImage *img = NULL;
 	GdkPixbuf *buf, *ret = NULL;
 	PurpleBuddyIcon *icon = NULL;
 	PurpleAccount *account = NULL;
@@ -2595,7 +2721,7 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	PurpleImage *custom_img;
 	PurpleProtocol *protocol = NULL;
 	PurpleBuddyIconSpec *icon_spec = NULL;
-	gint orig_width, orig_height, scale_width, scale_height;
+	gchar *key;
 
 	if (PURPLE_IS_CONTACT(node)) {
 		buddy = purple_contact_get_priority_buddy((PurpleContact*)node);
@@ -2635,36 +2761,63 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 		custom_img = purple_buddy_icons_node_find_custom_icon(node);
 	}
 
-	if (custom_img) {
-		data = purple_image_get_data(custom_img);
-		len = purple_image_get_data_size(custom_img);
+	if (custom_img && purple_image_get_data(custom_img) != NULL) {
+		img = custom_img;
 	}
 
-	if (data == NULL) {
+	if (img == NULL) {
 		if (buddy) {
 			/* Not sure I like this...*/
-			if (!(icon = purple_buddy_icons_find(purple_buddy_get_account(buddy), purple_buddy_get_name(buddy))))
+			if (!(icon = purple_buddy_icons_find(purple_buddy_get_account(buddy), purple_buddy_get_name(buddy)))) {
+				if (custom_img)
+					g_object_unref(custom_img);
 				return NULL;
-			data = purple_buddy_icon_get_data(icon, &len);
+			}
+			img = purple_buddy_icon_get_image(icon);
+		}
+
+		if (img == NULL) {
+			purple_buddy_icon_unref(icon);
+			if (custom_img)
+				g_object_unref(custom_img);
+			return NULL;
 		}
+	}
 
-		if(data == NULL)
+	if (protocol)
+		icon_spec = purple_protocol_get_icon_spec(protocol);
+	if (icon_spec && !(icon_spec->scale_rules & PURPLE_ICON_SCALE_DISPLAY))
+		icon_spec = NULL;
+
+	/* The generated filename is the SHA-1 of the data, so identical icons
+	 * share an entry. */
+	key = g_strdup_printf("%s/%d/%s", purple_image_generate_filename(img),
+		scaled ? 32 : 200, icon_spec ? purple_protocol_get_id(protocol) : "");
+
+	buf = buddy_icon_cache_lookup(key);
+	if (buf == NULL) {
+		buf = pidgin_blist_scale_buddy_icon(img, scaled, icon_spec);
+		if (buf == NULL) {
+			purple_debug_warning("gtkblist", "Couldn't load buddy icon on "
+				"account %s (%s); buddyname=%s; custom_img_size=%" G_GSIZE_FORMAT,
+				account ? purple_account_get_username(account) : "(no account)",
+				account ? purple_account_get_protocol_id(account) : "(no account)",
+				buddy ? purple_buddy_get_name(buddy) : "(no buddy)",
+				custom_img ? purple_image_get_data_size(custom_img) : 0);
+			g_free(key);
+			purple_buddy_icon_unref(icon);
+			if (custom_img)
+				g_object_unref(custom_img);
 			return NULL;
+		}
+
+		buddy_icon_cache_insert(key, buf);
+		g_object_unref(buf);
+	} else {
+		g_free(key);
 	}
 
-	buf = pidgin_pixbuf_from_data(data, len);
 	purple_buddy_icon_unref(icon);
-	if (!buf) {
-		purple_debug_warning("gtkblist", "Couldn't load buddy icon on "
-			"account %s (%s); buddyname=%s; custom_img_size=%" G_GSIZE_FORMAT,
-			account ? purple_account_get_username(account) : "(no account)",
-			account ? purple_account_get_protocol_id(account) : "(no account)",
-			buddy ? purple_buddy_get_name(buddy) : "(no buddy)",
-			custom_img ? purple_image_get_data_size(custom_img) : 0);
-		if (custom_img)
-			g_object_unref(custom_img);
-		return NULL;
-	}
 	if (custom_img)
 		g_object_unref(custom_img);
 
@@ -2682,49 +2835,19 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 				offline = TRUE;
 		}
 
+		/* The cached copy is shared, so grey out one of our own. */
+		if (offline || idle)
+			ret = gdk_pixbuf_copy(buf);
+
 		if (offline)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.0, FALSE);
+			gdk_pixbuf_saturate_and_pixelate(ret, ret, 0.0, FALSE);
 
 		if (idle)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.25, FALSE);
+			gdk_pixbuf_saturate_and_pixelate(ret, ret, 0.25, FALSE);
 	}
 
-	/* I'd use the pidgin_buddy_icon_get_scale_size() thing, but it won't
-	 * tell me the original size, which I need for scaling purposes. */
-	scale_width = orig_width = gdk_pixbuf_get_width(buf);
-	scale_height = orig_height = gdk_pixbuf_get_height(buf);
-
-	if (protocol)
-		icon_spec = purple_protocol_get_icon_spec(protocol);
-
-	if (icon_spec && icon_spec->scale_rules & PURPLE_ICON_SCALE_DISPLAY)
-		purple_buddy_icon_spec_get_scaled_size(purple_protocol_get_icon_spec(protocol), &scale_width, &scale_height);
-
-	if (scaled || scale_height > 200 || scale_width > 200) {
-		GdkPixbuf *tmpbuf;
-		float scale_size = scaled ? 32.0 : 200.0;
-		if(scale_height > scale_width) {
-			scale_width = scale_size * (double)scale_width / (double)scale_height;
-			scale_height = scale_size;
-		} else {
-			scale_height = scale_size * (double)scale_height / (double)scale_width;
-			scale_width = scale_size;
-		}
-		/* Scale & round before making square, so rectangular (but
-		 * non-square) images get rounded corners too. */
-		tmpbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, scale_width, scale_height);
-		gdk_pixbuf_fill(tmpbuf, 0x00000000);
-		gdk_pixbuf_scale(buf, tmpbuf, 0, 0, scale_width, scale_height, 0, 0, (double)scale_width/(double)orig_width, (double)scale_height/(double)orig_height, GDK_INTERP_BILINEAR);
-		if (pidgin_gdk_pixbuf_is_opaque(tmpbuf))
-			pidgin_gdk_pixbuf_make_round(tmpbuf);
-		ret = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, scale_size, scale_size);
-		gdk_pixbuf_fill(ret, 0x00000000);
-		gdk_pixbuf_copy_area(tmpbuf, 0, 0, scale_width, scale_height, ret, (scale_size-scale_width)/2, (scale_size-scale_height)/2);
-		g_object_unref(G_OBJECT(tmpbuf));
-	} else {
-		ret = gdk_pixbuf_scale_simple(buf,scale_width,scale_height, GDK_INTERP_BILINEAR);
-	}
-	g_object_unref(G_OBJECT(buf));
+	if (ret == NULL)
+		ret = g_object_ref(buf);
 
 	return ret;
 }
@@ -6612,6 +6735,7 @@ void pidgin_blist_init(void)
 	void *gtk_blist_handle = pidgin_blist_get_handle();
 
 	cached_emblems = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	buddy_icon_cache = g_hash_table_new(g_str_hash, g_str_equal);
 
 	/* Initialize prefs */
 	purple_prefs_add_none(PIDGIN_PREFS_ROOT "/blist");
@@ -6665,6 +6789,8 @@ void pidgin_blist_init(void)
 void
 pidgin_blist_uninit(void) {
 	g_hash_table_destroy(cached_emblems);
+	buddy_icon_cache_clear();
+	g_hash_table_destroy(buddy_icon_cache);
 
 	purple_signals_unregister_by_instance(pidgin_blist_get_handle());
 	purple_signals_disconnect_by_handle(pidgin_blist_get_handle());
@@ -482,6 +482,80 @@ pidgin_application_signed_off_cb(PurpleAccount *account, gpointer data) {
 	}
 }
 
+/******************************************************************************
+ * Window Tracking
+ *****************************************************************************/
+/* We're in the foreground as long as any of our windows is shown and not
+ * minimized.  The core uses this to put off work the user can't see.
+ */
+static void
+pidgin_application_update_foreground(GtkApplication *application) {
+	GList *l = NULL;
+	gboolean foreground = FALSE;
+
+	for(l = gtk_application_get_windows(application); l != NULL; l = l->next) {
+		GtkWidget *widget = GTK_WIDGET(l->data);
+		GdkWindow *window = NULL;
+
+		if(!gtk_widget_get_visible(widget)) {
+			continue;
+		}
+
+		window = gtk_widget_get_window(widget);
+		if(window != NULL &&
+		   (gdk_window_get_state(window) & GDK_WINDOW_STATE_ICONIFIED))
+		{
+			continue;
+		}
+
+		foreground = TRUE;
+		break;
+	}
+
+	purple_core_set_foreground(foreground);
+}
+
+static gboolean
+pidgin_application_window_state_cb(GtkWidget *widget,
+                                   GdkEventWindowState *event, gpointer data)
+{
+	if(event->changed_mask & GDK_WINDOW_STATE_ICONIFIED) {
+		pidgin_application_update_foreground(GTK_APPLICATION(data));
+	}
+
+	return FALSE;
+}
+
+static void
+pidgin_application_window_visible_cb(GObject *obj, GParamSpec *pspec,
+                                     gpointer data)
+{
+	pidgin_application_update_foreground(GTK_APPLICATION(data));
+}
+
+static void
+pidgin_application_window_added_cb(GtkApplication *application,
+                                   GtkWindow *window, gpointer data)
+{
+	g_signal_connect_object(window, "window-state-event",
+	                        G_CALLBACK(pidgin_application_window_state_cb),
+	                        application, 0);
+	g_signal_connect_object(window, "notify::visible",
+	                        G_CALLBACK(pidgin_application_window_visible_cb),
+	                        application, 0);
+
+	pidgin_application_update_foreground(application);
+}
+
+static void
+pidgin_application_window_removed_cb(GtkApplication *application,
+                                     GtkWindow *window, gpointer data)
+{
+	g_signal_handlers_disconnect_by_data(window, application);
+
+	pidgin_application_update_foreground(application);
+}
+
 /******************************************************************************
  * GApplication Implementation
  *****************************************************************************/
@@ -541,6 +615,12 @@ pidgin_application_startup(GApplication *application) {
 		g_abort();
 	}
 
+	/* Let the core know when all of our windows are hidden or minimized. */
+	g_signal_connect(application, "window-added",
+	                 G_CALLBACK(pidgin_application_window_added_cb), NULL);
+	g_signal_connect(application, "window-removed",
+	                 G_CALLBACK(pidgin_application_window_removed_cb), NULL);
+
 	if(g_getenv("PURPLE_PLUGINS_SKIP")) {
 		purple_debug_info("gtk",
 				"PURPLE_PLUGINS_SKIP environment variable "